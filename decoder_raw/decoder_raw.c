@@ -16,8 +16,10 @@
 
 #include "access/genam.h"
 #include "access/sysattr.h"
+#include "access/transam.h"
 #include "catalog/pg_class.h"
 #include "catalog/pg_type.h"
+#include "libpq/pqformat.h"
 #include "nodes/parsenodes.h"
 #include "replication/output_plugin.h"
 #include "replication/logical.h"
@@ -43,6 +45,7 @@ typedef struct
 {
 	MemoryContext context;
 	bool		include_transaction;
+	bool		tuple_format;	/* binary change format instead of SQL */
 }			DecoderRawData;
 
 static void decoder_raw_startup(LogicalDecodingContext *ctx,
@@ -97,6 +100,7 @@ decoder_raw_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
 										  "Raw decoder context",
 										  ALLOCSET_DEFAULT_SIZES);
 	data->include_transaction = false;
+	data->tuple_format = false;
 
 	ctx->output_plugin_private = data;
 
@@ -142,6 +146,28 @@ decoder_raw_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
 						 errmsg("Incorrect value \"%s\" for parameter \"%s\"",
 								format, elem->defname)));
 		}
+		else if (strcmp(elem->defname, "change_format") == 0)
+		{
+			char	   *format = NULL;
+
+			if (elem->arg == NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("No value specified for parameter \"%s\"",
+								elem->defname)));
+
+			format = strVal(elem->arg);
+
+			if (strcmp(format, "sql") == 0)
+				data->tuple_format = false;
+			else if (strcmp(format, "tuple") == 0)
+				data->tuple_format = true;
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("Incorrect value \"%s\" for parameter \"%s\"",
+								format, elem->defname)));
+		}
 		else
 		{
 			ereport(ERROR,
@@ -151,6 +177,10 @@ decoder_raw_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
 							elem->arg ? strVal(elem->arg) : "(null)")));
 		}
 	}
+
+	/* Tuple format is made of binary data */
+	if (data->tuple_format)
+		opt->output_type = OUTPUT_PLUGIN_BINARY_OUTPUT;
 }
 
 /* cleanup this plugin's resources */
@@ -173,7 +203,10 @@ decoder_raw_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 	if (data->include_transaction)
 	{
 		OutputPluginPrepareWrite(ctx, true);
-		appendStringInfoString(ctx->out, "BEGIN;");
+		if (data->tuple_format)
+			pq_sendbyte(ctx->out, 'B');
+		else
+			appendStringInfoString(ctx->out, "BEGIN;");
 		OutputPluginWrite(ctx, true);
 	}
 }
@@ -189,7 +222,10 @@ decoder_raw_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	if (data->include_transaction)
 	{
 		OutputPluginPrepareWrite(ctx, true);
-		appendStringInfoString(ctx->out, "COMMIT;");
+		if (data->tuple_format)
+			pq_sendbyte(ctx->out, 'C');
+		else
+			appendStringInfoString(ctx->out, "COMMIT;");
 		OutputPluginWrite(ctx, true);
 	}
 }
@@ -563,6 +599,166 @@ decoder_raw_update(StringInfo s,
 	appendStringInfoString(s, ";");
 }
 
+/*
+ * Write in tuple format the relation name of a change.
+ */
+static void
+write_relname(StringInfo s, Relation relation)
+{
+	pq_sendstring(s, get_namespace_name(RelationGetNamespace(relation)));
+	pq_sendstring(s, RelationGetRelationName(relation));
+}
+
+/*
+ * Write in tuple format the types of the columns of a change's relation,
+ * for the receiver to check that they match its own.  This is made of an
+ * int16 for the number of columns, dropped columns excluded, then the OID
+ * of each column type.  The OID of a type not built in the server differs
+ * across clusters, so it is sent as InvalidOid.
+ */
+static void
+write_types(StringInfo s, Relation relation)
+{
+	TupleDesc	tupdesc = RelationGetDescr(relation);
+	int			natt;
+	uint16		nlive = 0;
+
+	for (natt = 0; natt < tupdesc->natts; natt++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, natt);
+
+		if (attr->attisdropped || attr->attnum < 0)
+			continue;
+		nlive++;
+	}
+
+	pq_sendint16(s, nlive);
+
+	for (natt = 0; natt < tupdesc->natts; natt++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, natt);
+
+		if (attr->attisdropped || attr->attnum < 0)
+			continue;
+
+		if (attr->atttypid < FirstNormalObjectId)
+			pq_sendint32(s, attr->atttypid);
+		else
+			pq_sendint32(s, InvalidOid);
+	}
+}
+
+/*
+ * Write in tuple format the values of a tuple. All the columns of the
+ * relation are written, except dropped and system columns, each one of
+ * them being:
+ * - 'n' for a NULL value.
+ * - 'u' for an unchanged toast value or a value not part of the given set
+ * of key attributes, if any.
+ * - 'b' followed by the length and the binary value generated by the send
+ * function of the column type.
+ */
+static void
+write_tuple(StringInfo s, Relation relation, HeapTuple tuple,
+			Bitmapset *keyattrs)
+{
+	TupleDesc	tupdesc = RelationGetDescr(relation);
+	int			natt;
+	uint16		nlive = 0;
+
+	for (natt = 0; natt < tupdesc->natts; natt++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, natt);
+
+		if (attr->attisdropped || attr->attnum < 0)
+			continue;
+		nlive++;
+	}
+
+	pq_sendint16(s, nlive);
+
+	for (natt = 0; natt < tupdesc->natts; natt++)
+	{
+		Form_pg_attribute attr;
+		Datum		origval;
+		bool		isnull;
+		Oid			typsend;
+		bool		typisvarlena;
+		bytea	   *outval;
+
+		attr = TupleDescAttr(tupdesc, natt);
+
+		/* Skip dropped columns and system columns */
+		if (attr->attisdropped || attr->attnum < 0)
+			continue;
+
+		/* Skip columns not part of the key, if any */
+		if (keyattrs != NULL &&
+			!bms_is_member(attr->attnum - FirstLowInvalidHeapAttributeNumber,
+						   keyattrs))
+		{
+			pq_sendbyte(s, 'u');
+			continue;
+		}
+
+		/* Get Datum from tuple */
+		origval = heap_getattr(tuple, natt + 1, tupdesc, &isnull);
+
+		if (isnull)
+		{
+			pq_sendbyte(s, 'n');
+			continue;
+		}
+
+		getTypeBinaryOutputInfo(attr->atttypid, &typsend, &typisvarlena);
+
+		/* Unchanged toast datum, let the receiver keep its value */
+		if (typisvarlena &&
+			VARATT_IS_EXTERNAL_ONDISK(DatumGetPointer(origval)))
+		{
+			pq_sendbyte(s, 'u');
+			continue;
+		}
+
+		/* Definitely detoasted Datum */
+		if (typisvarlena)
+			origval = PointerGetDatum(PG_DETOAST_DATUM(origval));
+
+		outval = OidSendFunctionCall(typsend, origval);
+		pq_sendbyte(s, 'b');
+		pq_sendint32(s, VARSIZE(outval) - VARHDRSZ);
+		pq_sendbytes(s, VARDATA(outval), VARSIZE(outval) - VARHDRSZ);
+	}
+}
+
+/*
+ * Write in tuple format a change, made of its action, the relation name,
+ * the column types, the values of the tuple used as key for UPDATE and
+ * DELETE and the new tuple values for INSERT and UPDATE.
+ */
+static void
+write_change(StringInfo s, Relation relation, char action,
+			 HeapTuple keytuple, HeapTuple newtuple)
+{
+	pq_sendbyte(s, action);
+	write_relname(s, relation);
+	write_types(s, relation);
+
+	if (keytuple != NULL)
+	{
+		Bitmapset  *keyattrs = NULL;
+
+		/* With FULL, all the values of the old tuple are available */
+		if (relation->rd_rel->relreplident != REPLICA_IDENTITY_FULL)
+			keyattrs = RelationGetIdentityKeyBitmap(relation);
+
+		write_tuple(s, relation, keytuple, keyattrs);
+	}
+
+	if (newtuple != NULL)
+		write_tuple(s, relation, newtuple, NULL);
+}
+
 /*
  * Callback for individual changed tuples
  */
@@ -598,9 +794,13 @@ decoder_raw_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 			if (change->data.tp.newtuple != NULL)
 			{
 				OutputPluginPrepareWrite(ctx, true);
-				decoder_raw_insert(ctx->out,
-								   relation,
-								   change->data.tp.newtuple);
+				if (data->tuple_format)
+					write_change(ctx->out, relation, 'I', NULL,
+								 change->data.tp.newtuple);
+				else
+					decoder_raw_insert(ctx->out,
+									   relation,
+									   change->data.tp.newtuple);
 				OutputPluginWrite(ctx, true);
 			}
 			break;
@@ -610,11 +810,20 @@ decoder_raw_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 				HeapTuple	oldtuple = change->data.tp.oldtuple;
 				HeapTuple	newtuple = change->data.tp.newtuple;
 
+				/* Nothing to do without new values, as in SQL format */
+				if (data->tuple_format && newtuple == NULL)
+					break;
+
 				OutputPluginPrepareWrite(ctx, true);
-				decoder_raw_update(ctx->out,
-								   relation,
-								   oldtuple,
-								   newtuple);
+				if (data->tuple_format)
+					write_change(ctx->out, relation, 'U',
+								 oldtuple ? oldtuple : newtuple,
+								 newtuple);
+				else
+					decoder_raw_update(ctx->out,
+									   relation,
+									   oldtuple,
+									   newtuple);
 				OutputPluginWrite(ctx, true);
 			}
 			break;
@@ -622,9 +831,13 @@ decoder_raw_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 			if (!is_rel_non_selective)
 			{
 				OutputPluginPrepareWrite(ctx, true);
-				decoder_raw_delete(ctx->out,
-								   relation,
-								   change->data.tp.oldtuple);
+				if (data->tuple_format)
+					write_change(ctx->out, relation, 'D',
+								 change->data.tp.oldtuple, NULL);
+				else
+					decoder_raw_delete(ctx->out,
+									   relation,
+									   change->data.tp.oldtuple);
 				OutputPluginWrite(ctx, true);
 			}
 			break;
@@ -661,6 +874,11 @@ decoder_raw_truncate(LogicalDecodingContext *ctx,
 	old = MemoryContextSwitchTo(data->context);
 
 	OutputPluginPrepareWrite(ctx, true);
+
+	/* Tuple format sends TRUNCATE as a query to execute as-is */
+	if (data->tuple_format)
+		pq_sendbyte(s, 'Q');
+
 	appendStringInfo(s, "TRUNCATE ");
 
 	for (int i = 0; i < nrelations; i++)
@@ -676,6 +894,8 @@ decoder_raw_truncate(LogicalDecodingContext *ctx,
 		appendStringInfo(s, " CASCADE");
 
 	appendStringInfo(s, ";");
+	if (data->tuple_format)
+		pq_sendbyte(s, '\0');
 	OutputPluginWrite(ctx, true);
 
 	MemoryContextSwitchTo(old);
@@ -137,5 +137,31 @@ SELECT substr(data, 1, 60) AS data
   FROM pg_logical_slot_get_changes('custom_slot', NULL, NULL, 'include_transaction', 'off');
 DROP TABLE tt1, tt2;
 
+-- Tuple format
+CREATE TABLE bb (a int primary key, b text);
+INSERT INTO bb VALUES (1, 'aa');
+UPDATE bb SET b = 'bb' WHERE a = 1;
+DELETE FROM bb WHERE a = 1;
+SELECT encode(data, 'hex') AS data
+  FROM pg_logical_slot_get_binary_changes('custom_slot', NULL, NULL, 'change_format', 'tuple');
+DROP TABLE bb;
+-- Tuple format, with all the old values sent for UPDATE and DELETE
+CREATE TABLE bb (a int primary key, b text);
+ALTER TABLE bb REPLICA IDENTITY FULL;
+INSERT INTO bb VALUES (1, 'aa');
+UPDATE bb SET b = 'bb' WHERE a = 1;
+DELETE FROM bb WHERE a = 1;
+SELECT encode(data, 'hex') AS data
+  FROM pg_logical_slot_get_binary_changes('custom_slot', NULL, NULL, 'change_format', 'tuple');
+DROP TABLE bb;
+-- Tuple format, with column types changing across changes
+CREATE TABLE bb (a int primary key, b text);
+INSERT INTO bb VALUES (1, 'aa');
+ALTER TABLE bb ALTER COLUMN a TYPE bigint;
+INSERT INTO bb VALUES (2, 'bb');
+SELECT encode(data, 'hex') AS data
+  FROM pg_logical_slot_get_binary_changes('custom_slot', NULL, NULL, 'change_format', 'tuple');
+DROP TABLE bb;
+
 -- Drop replication slot
 SELECT pg_drop_replication_slot('custom_slot');
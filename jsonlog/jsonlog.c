@@ -7,7 +7,7 @@
  * Copyright (c) 1996-2026, PostgreSQL Global Development Group
  *
  * IDENTIFICATION
- *		jsonlog.c/jsonlog.c
+ *		jsonlog/jsonlog.c
  *
  *-------------------------------------------------------------------------
  */
@@ -23,17 +23,25 @@
 #include "access/transam.h"
 #include "lib/stringinfo.h"
 #include "libpq/libpq.h"
+#if PG_VERSION_NUM >= 160000
+#include "port/simd.h"
+#endif
 #include "postmaster/bgworker.h"
 #include "postmaster/syslogger.h"
+#include "storage/ipc.h"
 #include "storage/proc.h"
+#include "storage/shmem.h"
 #include "tcop/tcopprot.h"
 #if PG_VERSION_NUM >= 140000
 #include "utils/backend_status.h"
 #endif
 #include "utils/elog.h"
 #include "utils/guc.h"
-#include "utils/json.h"
+#include "utils/memutils.h"
 #include "utils/ps_status.h"
+#include "utils/timestamp.h"
+
+#include "jsonlog.h"
 
 #if PG_VERSION_NUM < 90600
 #error Minimum version of PostgreSQL required is 9.6
@@ -48,9 +56,44 @@ void		_PG_fini(void);
 /* Hold previous logging hook */
 static emit_log_hook_type prev_log_hook = NULL;
 
+/* Hold previous shared memory hooks */
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
 /* GUC variables */
 static char *jsonlog_service_key = NULL;
 static char *jsonlog_service_value = NULL;
+int			jsonlog_destination = JSONLOG_DESTINATION_STDERR;
+int			jsonlog_async_buffer_size = 8192;
+int			jsonlog_async_overflow = JSONLOG_OVERFLOW_DROP;
+char	   *jsonlog_filename = NULL;
+int			jsonlog_rotation_age = 1440;
+int			jsonlog_rotation_size = 10240;
+int			jsonlog_rate_limit = 0;
+int			jsonlog_rate_limit_shared = 0;
+int			jsonlog_rate_limit_burst = 10;
+int			jsonlog_rate_limit_report_interval = 10;
+double		jsonlog_sample_rate_debug = 1.0;
+double		jsonlog_sample_rate_log = 1.0;
+double		jsonlog_sample_rate_info = 1.0;
+double		jsonlog_sample_rate_notice = 1.0;
+double		jsonlog_sample_rate_warning = 1.0;
+double		jsonlog_sample_rate_error = 1.0;
+
+static const struct config_enum_entry destination_options[] = {
+	{"stderr", JSONLOG_DESTINATION_STDERR, false},
+	{"async", JSONLOG_DESTINATION_ASYNC, false},
+	{"file", JSONLOG_DESTINATION_FILE, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry overflow_options[] = {
+	{"drop", JSONLOG_OVERFLOW_DROP, false},
+	{"sync", JSONLOG_OVERFLOW_SYNC, false},
+	{NULL, 0, false}
+};
 
 /*
  * Track if redirection to syslogger can happen. This uses the same method
@@ -59,9 +102,35 @@ static char *jsonlog_service_value = NULL;
  */
 extern bool redirection_done;
 
+/*
+ * Fields of the JSON object that are constant in a session, escaped once.
+ * The prefix covers the fields from the service identifier to the session
+ * id.  The pointers of the session fields used to build it are saved, so
+ * as it is rebuilt once they are set at authentication, or in a child
+ * process of the postmaster.  The service identifier invalidates it when
+ * reloaded.  The application name is compared with the value escaped, as
+ * it can change at any time.
+ */
+typedef struct JsonlogSession
+{
+	bool		valid;
+	int			pid;
+	Port	   *port;
+	const char *user_name;
+	const char *database_name;
+	const char *remote_host;
+	StringInfoData prefix;		/* service identifier to session id */
+	StringInfoData start;		/* session_start */
+	char	   *appname;		/* application_name escaped */
+	StringInfoData appname_json;	/* application_name field */
+} JsonlogSession;
+
+static JsonlogSession jsonlog_session;
+
 /* Log timestamp */
 #define FORMATTED_TS_LEN 128
 static char formatted_log_time[FORMATTED_TS_LEN];
+static pg_time_t formatted_log_sec = 0;	/* second of formatted_log_time */
 static char formatted_start_time[FORMATTED_TS_LEN];
 static pg_tz *utc_tz = NULL;
 
@@ -186,7 +255,7 @@ setup_formatted_log_time(void)
 {
 	struct timeval tv;
 	pg_time_t	stamp_time;
-	char		msbuf[8];
+	int			msec;
 
 	gettimeofday(&tv, NULL);
 	stamp_time = (pg_time_t) tv.tv_sec;
@@ -202,20 +271,49 @@ setup_formatted_log_time(void)
 	 * is done in Date's toJSON. The main reasons to do so are that this is
 	 * conform to ISO 8601 and that this is rather established.
 	 *
-	 * Take care to leave room for milliseconds which we paste in.
+	 * Take care to leave room for milliseconds which we paste in.  The part
+	 * up to the seconds is formatted only when the second changes, as UTC
+	 * has no transitions that could change it within a second.
 	 */
+	if (stamp_time != formatted_log_sec || formatted_log_time[0] == '\0')
+	{
+		/* Load timezone only once */
+		if (!utc_tz)
+			utc_tz = pg_tzset("UTC");
+
+		pg_strftime(formatted_log_time, FORMATTED_TS_LEN,
+					"%Y-%m-%dT%H:%M:%S.000Z",
+					pg_localtime(&stamp_time, utc_tz));
+		formatted_log_sec = stamp_time;
+	}
 
-	/* Load timezone only once */
-	if (!utc_tz)
-		utc_tz = pg_tzset("UTC");
+	/* 'paste' milliseconds into place... */
+	msec = (int) (tv.tv_usec / 1000);
+	formatted_log_time[20] = '0' + msec / 100;
+	formatted_log_time[21] = '0' + (msec / 10) % 10;
+	formatted_log_time[22] = '0' + msec % 10;
+}
 
-	pg_strftime(formatted_log_time, FORMATTED_TS_LEN,
-				"%Y-%m-%dT%H:%M:%S.000Z",
-				pg_localtime(&stamp_time, utc_tz));
+/*
+ * jsonlog_log_time
+ * Current time, formatted as the "timestamp" field.
+ */
+const char *
+jsonlog_log_time(void)
+{
+	setup_formatted_log_time();
+	return formatted_log_time;
+}
 
-	/* 'paste' milliseconds into place... */
-	sprintf(msbuf, ".%03d", (int) (tv.tv_usec / 1000));
-	memcpy(formatted_log_time + 19, msbuf, 4);
+/*
+ * jsonlog_log_sec
+ * Second of the last timestamp formatted, the one of the line being
+ * written, saving a system call per line to the writes checking the time.
+ */
+pg_time_t
+jsonlog_log_sec(void)
+{
+	return formatted_log_sec;
 }
 
 /*
@@ -226,12 +324,6 @@ setup_formatted_start_time(void)
 {
 	pg_time_t	stamp_time = (pg_time_t) MyStartTime;
 
-	/*
-	 * No need to do this one twice, its value being fixed for each session.
-	 */
-	if (formatted_start_time[0] != '\0')
-		return;
-
 	/*
 	 * Load timezone only once.  This should not be necessary here as
 	 * setup_formatted_log_time() would have done that already, but just play
@@ -245,6 +337,129 @@ setup_formatted_start_time(void)
 				pg_localtime(&stamp_time, utc_tz));
 }
 
+/*
+ * jsonlog_scan_plain
+ * Find the first byte needing an escape in a JSON string, returning end if
+ * there is none.  Chunks of bytes are checked at once with vector
+ * instructions where available.
+ */
+static inline const char *
+jsonlog_scan_plain(const char *str, const char *end)
+{
+#if PG_VERSION_NUM >= 160000
+	while (end - str >= (ptrdiff_t) sizeof(Vector8))
+	{
+		Vector8		chunk;
+
+		vector8_load(&chunk, (const uint8 *) str);
+		if (vector8_has_le(chunk, 0x1F) ||
+			vector8_has(chunk, '"') ||
+			vector8_has(chunk, '\\'))
+			break;
+		str += sizeof(Vector8);
+	}
+#endif
+
+	while (str < end)
+	{
+		unsigned char c = (unsigned char) *str;
+
+		if (c <= 0x1F || c == '"' || c == '\\')
+			break;
+		str++;
+	}
+
+	return str;
+}
+
+/*
+ * appendJSONEscaped
+ * Append to given StringInfo len bytes of a string, escaped for JSON but
+ * without quotes.  The runs of bytes not needing escapes are copied at
+ * once, with the same escapes as escape_json().
+ */
+static void
+appendJSONEscaped(StringInfo buf, const char *str, int len)
+{
+	const char *end = str + len;
+
+	/* Enough room for the string if nothing needs escaping */
+	enlargeStringInfo(buf, len);
+
+	while (str < end)
+	{
+		const char *plain = str;
+
+		str = jsonlog_scan_plain(str, end);
+		if (str > plain)
+			appendBinaryStringInfo(buf, plain, str - plain);
+		if (str == end)
+			break;
+
+		switch (*str)
+		{
+			case '\b':
+				appendStringInfoString(buf, "\\b");
+				break;
+			case '\f':
+				appendStringInfoString(buf, "\\f");
+				break;
+			case '\n':
+				appendStringInfoString(buf, "\\n");
+				break;
+			case '\r':
+				appendStringInfoString(buf, "\\r");
+				break;
+			case '\t':
+				appendStringInfoString(buf, "\\t");
+				break;
+			case '"':
+				appendStringInfoString(buf, "\\\"");
+				break;
+			case '\\':
+				appendStringInfoString(buf, "\\\\");
+				break;
+			default:
+				appendStringInfo(buf, "\\u%04x", (unsigned char) *str);
+				break;
+		}
+		str++;
+	}
+}
+
+/*
+ * appendJSONKey
+ * Append to given StringInfo a key of a JSON object, with its colon.
+ */
+static void
+appendJSONKey(StringInfo buf, const char *key)
+{
+	appendStringInfoCharMacro(buf, '"');
+	appendJSONEscaped(buf, key, strlen(key));
+	appendBinaryStringInfo(buf, "\":", 2);
+}
+
+/*
+ * appendJSONLiteralLen
+ * Append to given StringInfo a JSON with a given key and a value of len
+ * bytes not yet made literal, escaping it directly in the StringInfo.
+ */
+static void
+appendJSONLiteralLen(StringInfo buf, const char *key, const char *value,
+					 int len, bool is_comma)
+{
+	Assert(key && value);
+
+	appendJSONKey(buf, key);
+	appendStringInfoCharMacro(buf, '"');
+	appendJSONEscaped(buf, value, len);
+	appendStringInfoCharMacro(buf, '"');
+
+	/* Add comma if necessary */
+	if (is_comma)
+		appendStringInfoCharMacro(buf, ',');
+}
+
 /*
  * appendJSONLiteral
  * Append to given StringInfo a JSON with a given key and a value
@@ -254,26 +469,191 @@ static void
 appendJSONLiteral(StringInfo buf, const char *key, const char *value,
 				  bool is_comma)
 {
-	StringInfoData literal_json;
+	Assert(value);
+	appendJSONLiteralLen(buf, key, value, strlen(value), is_comma);
+}
 
-	initStringInfo(&literal_json);
-	Assert(key && value);
+/*
+ * jsonlog_estimate_len
+ * Estimate the length of the JSON object of a message, so as its buffer
+ * is allocated once in most cases.  This counts the variable fields with
+ * some margin for their escapes, plus room for the other fields.
+ */
+static int
+jsonlog_estimate_len(ErrorData *edata)
+{
+	Size		len = 0;
 
-	/*
-	 * Call in-core function able to generate wanted strings, there is no need
-	 * to reinvent the wheel.
-	 */
-	escape_json(&literal_json, value);
+	if (edata->message)
+		len += strlen(edata->message);
+	if (edata->detail_log)
+		len += strlen(edata->detail_log);
+	else if (edata->detail)
+		len += strlen(edata->detail);
+	if (edata->hint)
+		len += strlen(edata->hint);
+	if (edata->internalquery)
+		len += strlen(edata->internalquery);
+	if (edata->context)
+		len += strlen(edata->context);
+	if (debug_query_string)
+		len += strlen(debug_query_string);
 
-	/* Now append the field */
-	appendStringInfo(buf, "\"%s\":%s", key, literal_json.data);
+	len += len / 8 + jsonlog_session.prefix.len + 1024;
 
-	/* Add comma if necessary */
-	if (is_comma)
-		appendStringInfoChar(buf, ',');
+	return (int) Min(len, MaxAllocSize / 2);
+}
+
+/*
+ * jsonlog_session_prefix
+ * Append the fields constant in the session, from the service identifier
+ * to the session id, building them first if necessary.
+ */
+static void
+jsonlog_session_prefix(StringInfo buf)
+{
+	JsonlogSession *session = &jsonlog_session;
+	Port	   *port = MyProcPort;
+
+	if (!session->valid ||
+		session->pid != MyProcPid ||
+		session->port != port ||
+		(port &&
+		 (session->user_name != port->user_name ||
+		  session->database_name != port->database_name ||
+		  session->remote_host != port->remote_host)))
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+		if (session->prefix.data == NULL)
+		{
+			initStringInfo(&session->prefix);
+			initStringInfo(&session->start);
+		}
+		resetStringInfo(&session->prefix);
+		resetStringInfo(&session->start);
+
+		/* Service identifier, if service key is set */
+		if (jsonlog_service_key && jsonlog_service_key[0] != '\0')
+			appendJSONLiteral(&session->prefix, jsonlog_service_key,
+							  jsonlog_service_value, true);
+
+		/* Username */
+		if (port && port->user_name)
+			appendJSONLiteral(&session->prefix, "user", port->user_name, true);
+
+		/* Database name */
+		if (port && port->database_name)
+			appendJSONLiteral(&session->prefix, "dbname",
+							  port->database_name, true);
+
+		/* Process ID */
+		if (MyProcPid != 0)
+			appendStringInfo(&session->prefix, "\"pid\":%d,", MyProcPid);
+
+		/* Remote host and port */
+		if (port && port->remote_host)
+		{
+			appendJSONLiteral(&session->prefix, "remote_host",
+							  port->remote_host, true);
+			if (port->remote_port && port->remote_port[0] != '\0')
+				appendJSONLiteral(&session->prefix, "remote_port",
+								  port->remote_port, true);
+		}
+
+		/* Session id */
+		if (MyProcPid != 0)
+			appendStringInfo(&session->prefix, "\"session_id\":\"%lx.%x\",",
+							 (long) MyStartTime, MyProcPid);
+
+		/* session start timestamp */
+		setup_formatted_start_time();
+		appendJSONLiteral(&session->start, "session_start",
+						  formatted_start_time, true);
+
+		session->pid = MyProcPid;
+		session->port = port;
+		session->user_name = port ? port->user_name : NULL;
+		session->database_name = port ? port->database_name : NULL;
+		session->remote_host = port ? port->remote_host : NULL;
+		session->valid = true;
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	appendBinaryStringInfo(buf, session->prefix.data, session->prefix.len);
+}
+
+/*
+ * jsonlog_session_start
+ * Append the session start timestamp, built with the session prefix.
+ */
+static void
+jsonlog_session_start(StringInfo buf)
+{
+	Assert(jsonlog_session.valid);
+	appendBinaryStringInfo(buf, jsonlog_session.start.data,
+						   jsonlog_session.start.len);
+}
+
+/*
+ * jsonlog_application_name
+ * Append the application name, escaped again only when it changes.
+ */
+static void
+jsonlog_application_name(StringInfo buf)
+{
+	JsonlogSession *session = &jsonlog_session;
+
+	if (application_name == NULL || application_name[0] == '\0')
+		return;
+
+	if (session->appname == NULL ||
+		strcmp(session->appname, application_name) != 0)
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+		if (session->appname != NULL)
+			pfree(session->appname);
+		session->appname = pstrdup(application_name);
+
+		if (session->appname_json.data == NULL)
+			initStringInfo(&session->appname_json);
+		resetStringInfo(&session->appname_json);
+		appendJSONLiteral(&session->appname_json, "application_name",
+						  application_name, true);
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	appendBinaryStringInfo(buf, session->appname_json.data,
+						   session->appname_json.len);
+}
+
+/*
+ * jsonlog_service_assign
+ * Invalidate the session prefix when the service identifier changes.
+ */
+static void
+jsonlog_service_assign(const char *newval, void *extra)
+{
+	jsonlog_session.valid = false;
+}
 
-	/* Clean up */
-	pfree(literal_json.data);
+/*
+ * jsonlog_filename_assign, jsonlog_rotation_age_assign
+ * Make the log files check their settings at the next write.
+ */
+static void
+jsonlog_filename_assign(const char *newval, void *extra)
+{
+	jsonlog_file_assign();
+}
+
+static void
+jsonlog_rotation_age_assign(int newval, void *extra)
+{
+	jsonlog_file_assign();
 }
 
 /*
@@ -305,6 +685,114 @@ is_log_level_output(int elevel, int log_min_level)
 	return false;
 }
 
+/*
+ * jsonlog_use_shmem
+ * Check if this process can use the shared memory of jsonlog.  The
+ * postmaster does not touch shared memory, and the syslogger is not
+ * attached to it.
+ */
+static bool
+jsonlog_use_shmem(void)
+{
+#if PG_VERSION_NUM >= 130000
+	return IsUnderPostmaster && MyBackendType != B_LOGGER;
+#else
+	return IsUnderPostmaster && !am_syslogger;
+#endif
+}
+
+/*
+ * jsonlog_write_line
+ * Write complete lines to the destination of the JSON logs.
+ */
+static void
+jsonlog_write_line(char *data, int len)
+{
+	/*
+	 * Hand the lines to the writer of the shared ring, or write them to the
+	 * log file directly, if enabled.
+	 */
+	if (jsonlog_destination != JSONLOG_DESTINATION_STDERR &&
+		jsonlog_use_shmem() &&
+		(jsonlog_destination == JSONLOG_DESTINATION_ASYNC ?
+		 jsonlog_ring_insert(data, len) :
+		 jsonlog_file_write(data, len, formatted_log_sec)))
+	{
+		/* Nothing else to do */
+	}
+	/* Write to stderr, if enabled */
+	else if ((Log_destination & LOG_DESTINATION_STDERR) != 0)
+	{
+#if PG_VERSION_NUM >= 130000
+		if (redirection_done && MyBackendType != B_LOGGER)
+#else
+		if (redirection_done && !am_syslogger)
+#endif
+			jsonlog_write_pipe_chunks(data, len);
+		else
+			jsonlog_write_console(data, len);
+	}
+
+	/* If in the syslogger process, try to write messages direct to file */
+#if PG_VERSION_NUM >= 130000
+	if (MyBackendType == B_LOGGER)
+#else
+	if (am_syslogger)
+#endif
+		write_syslogger_file(data, len, LOG_DESTINATION_STDERR);
+}
+
+/*
+ * jsonlog_append_suppressed
+ * Append one line per group of similar messages suppressed since the last
+ * report.
+ */
+static void
+jsonlog_append_suppressed(StringInfo buf)
+{
+	JsonlogSuppressed report;
+
+	jsonlog_limit_report_start();
+	while (jsonlog_limit_report_next(&report))
+	{
+		appendStringInfoChar(buf, '{');
+
+		setup_formatted_log_time();
+		appendBinaryStringInfo(buf, "\"timestamp\":\"", 13);
+		appendStringInfoString(buf, formatted_log_time);
+		appendBinaryStringInfo(buf, "\",", 2);
+
+		jsonlog_session_prefix(buf);
+
+		appendJSONLiteral(buf, "error_severity",
+						  (char *) jsonlog_error_severity(report.elevel), true);
+		if (report.sqlerrcode != ERRCODE_SUCCESSFUL_COMPLETION)
+			appendJSONLiteral(buf, "state_code",
+							  unpack_sql_state(report.sqlerrcode), true);
+		appendJSONLiteral(buf, "message_template", report.template, true);
+		appendStringInfo(buf, "\"suppressed\":" UINT64_FORMAT ",",
+						 report.count);
+		appendStringInfo(buf, "\"message\":\"suppressed " UINT64_FORMAT
+						 " similar messages\"}\n", report.count);
+	}
+}
+
+/*
+ * jsonlog_report_suppressed
+ * Log the messages suppressed not reported yet, at process exit.
+ */
+void
+jsonlog_report_suppressed(void)
+{
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+	jsonlog_append_suppressed(&buf);
+	if (buf.len > 0)
+		jsonlog_write_line(buf.data, buf.len);
+	pfree(buf.data);
+}
+
 /*
  * jsonlog_write_json
  * Write logs in json format.
@@ -329,66 +817,52 @@ jsonlog_write_json(ErrorData *edata)
 		return;
 #endif
 
-	initStringInfo(&buf);
+	/*
+	 * Drop repetitive messages, reporting them later, by themselves if due,
+	 * so as they are reported even if nothing else is logged.
+	 */
+	if (!jsonlog_limit_check(edata, jsonlog_use_shmem()))
+	{
+		if (jsonlog_limit_report_due())
+			jsonlog_report_suppressed();
+		if (prev_log_hook)
+			(*prev_log_hook) (edata);
+		return;
+	}
+
+	/* Allocate the buffer once, sized for the message */
+	buf.maxlen = jsonlog_estimate_len(edata);
+	buf.data = palloc(buf.maxlen);
+	resetStringInfo(&buf);
+
+	/* Messages suppressed since the last report, if due, come first */
+	if (jsonlog_limit_report_due())
+		jsonlog_append_suppressed(&buf);
 
 	/* Initialize string */
 	appendStringInfoChar(&buf, '{');
 
-	/* Timestamp */
+	/* Timestamp, with nothing to escape */
 	setup_formatted_log_time();
-	appendJSONLiteral(&buf, "timestamp", formatted_log_time, true);
-
-	/* Service identifier, if service key is set */
-	if (jsonlog_service_key && jsonlog_service_key[0] != '\0')
-		appendJSONLiteral(&buf, jsonlog_service_key, jsonlog_service_value,
-						  true);
-
-	/* Username */
-	if (MyProcPort && MyProcPort->user_name)
-		appendJSONLiteral(&buf, "user", MyProcPort->user_name, true);
+	appendBinaryStringInfo(&buf, "\"timestamp\":\"", 13);
+	appendStringInfoString(&buf, formatted_log_time);
+	appendBinaryStringInfo(&buf, "\",", 2);
 
-	/* Database name */
-	if (MyProcPort && MyProcPort->database_name)
-		appendJSONLiteral(&buf, "dbname", MyProcPort->database_name, true);
-
-	/* Process ID */
-	if (MyProcPid != 0)
-		appendStringInfo(&buf, "\"pid\":%d,", MyProcPid);
-
-	/* Remote host and port */
-	if (MyProcPort && MyProcPort->remote_host)
-	{
-		appendJSONLiteral(&buf, "remote_host",
-						  MyProcPort->remote_host, true);
-		if (MyProcPort->remote_port && MyProcPort->remote_port[0] != '\0')
-			appendJSONLiteral(&buf, "remote_port",
-							  MyProcPort->remote_port, true);
-	}
-
-	/* Session id */
-	if (MyProcPid != 0)
-		appendStringInfo(&buf, "\"session_id\":\"%lx.%x\",",
-						 (long) MyStartTime, MyProcPid);
+	/* Fields constant in the session, up to the session id */
+	jsonlog_session_prefix(&buf);
 
 	/* PS display */
 	if (MyProcPort)
 	{
-		StringInfoData msgbuf;
 		const char *psdisp;
 		int			displen;
 
-		initStringInfo(&msgbuf);
-
 		psdisp = get_ps_display(&displen);
-		appendBinaryStringInfo(&msgbuf, psdisp, displen);
-		appendJSONLiteral(&buf, "ps_display",
-						  msgbuf.data, true);
-		pfree(msgbuf.data);
+		appendJSONLiteralLen(&buf, "ps_display", psdisp, displen, true);
 	}
 
 	/* session start timestamp */
-	setup_formatted_start_time();
-	appendJSONLiteral(&buf, "session_start", formatted_start_time, true);
+	jsonlog_session_start(&buf);
 
 	/* Virtual transaction id */
 	/* keep VXID format in sync with lockfuncs.c */
@@ -458,25 +932,23 @@ jsonlog_write_json(ErrorData *edata)
 	/* File error location */
 	if (Log_error_verbosity >= PGERROR_VERBOSE)
 	{
-		StringInfoData msgbuf;
-
-		initStringInfo(&msgbuf);
-
+		appendJSONKey(&buf, "file_location");
+		appendStringInfoCharMacro(&buf, '"');
 		if (edata->funcname && edata->filename)
-			appendStringInfo(&msgbuf, "%s, %s:%d",
-							 edata->funcname, edata->filename,
-							 edata->lineno);
-		else if (edata->filename)
-			appendStringInfo(&msgbuf, "%s:%d",
-							 edata->filename, edata->lineno);
-		appendJSONLiteral(&buf, "file_location", msgbuf.data, true);
-		pfree(msgbuf.data);
+		{
+			appendJSONEscaped(&buf, edata->funcname, strlen(edata->funcname));
+			appendBinaryStringInfo(&buf, ", ", 2);
+		}
+		if (edata->filename)
+		{
+			appendJSONEscaped(&buf, edata->filename, strlen(edata->filename));
+			appendStringInfo(&buf, ":%d", edata->lineno);
+		}
+		appendBinaryStringInfo(&buf, "\",", 2);
 	}
 
 	/* Application name */
-	if (application_name && application_name[0] != '\0')
-		appendJSONLiteral(&buf, "application_name",
-						  application_name, true);
+	jsonlog_application_name(&buf);
 
 #if PG_VERSION_NUM >= 130000
 	/* backend type */
@@ -513,26 +985,7 @@ jsonlog_write_json(ErrorData *edata)
 	appendStringInfoChar(&buf, '}');
 	appendStringInfoChar(&buf, '\n');
 
-	/* Write to stderr, if enabled */
-	if ((Log_destination & LOG_DESTINATION_STDERR) != 0)
-	{
-#if PG_VERSION_NUM >= 130000
-		if (redirection_done && MyBackendType != B_LOGGER)
-#else
-		if (redirection_done && !am_syslogger)
-#endif
-			jsonlog_write_pipe_chunks(buf.data, buf.len);
-		else
-			jsonlog_write_console(buf.data, buf.len);
-	}
-
-	/* If in the syslogger process, try to write messages direct to file */
-#if PG_VERSION_NUM >= 130000
-	if (MyBackendType == B_LOGGER)
-#else
-	if (am_syslogger)
-#endif
-		write_syslogger_file(buf.data, buf.len, LOG_DESTINATION_STDERR);
+	jsonlog_write_line(buf.data, buf.len);
 
 	/* Cleanup */
 	pfree(buf.data);
@@ -542,6 +995,57 @@ jsonlog_write_json(ErrorData *edata)
 		(*prev_log_hook) (edata);
 }
 
+/*
+ * jsonlog_shmem_size
+ * Size of the shared memory used by the rate limits, the log files and
+ * the ring
+ */
+static Size
+jsonlog_shmem_size(void)
+{
+	Size		size = jsonlog_limit_shmem_size();
+
+	if (jsonlog_destination != JSONLOG_DESTINATION_STDERR)
+		size = add_size(size, jsonlog_file_shmem_size());
+	if (jsonlog_destination == JSONLOG_DESTINATION_ASYNC)
+		size = add_size(size, jsonlog_ring_shmem_size());
+	return size;
+}
+
+#if PG_VERSION_NUM >= 150000
+/*
+ * jsonlog_shmem_request
+ * Request shared memory for the rate limits, the log files and the ring
+ * of asynchronous logging
+ */
+static void
+jsonlog_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(jsonlog_shmem_size());
+}
+#endif
+
+/*
+ * jsonlog_shmem_startup
+ * Initialize the rate limits, the log files and the ring of asynchronous
+ * logging
+ */
+static void
+jsonlog_shmem_startup(void)
+{
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	jsonlog_limit_startup();
+	if (jsonlog_destination != JSONLOG_DESTINATION_STDERR)
+		jsonlog_file_startup();
+	if (jsonlog_destination == JSONLOG_DESTINATION_ASYNC)
+		jsonlog_ring_startup();
+}
+
 /*
  * _PG_init
  * Entry point loading hooks
@@ -555,14 +1059,162 @@ _PG_init(void)
 							   &jsonlog_service_key,
 							   "",
 							   PGC_SIGHUP,
-							   0, NULL, NULL, NULL);
+							   0, NULL, jsonlog_service_assign, NULL);
 	DefineCustomStringVariable("jsonlog.service_value",
 							   "Service identifier value.",
 							   "Default is the empty string.",
 							   &jsonlog_service_value,
 							   "",
 							   PGC_SIGHUP,
-							   0, NULL, NULL, NULL);
+							   0, NULL, jsonlog_service_assign, NULL);
+	DefineCustomEnumVariable("jsonlog.destination",
+							 "Destination of the JSON logs.",
+							 "\"async\" and \"file\" require jsonlog in shared_preload_libraries.",
+							 &jsonlog_destination,
+							 JSONLOG_DESTINATION_STDERR,
+							 destination_options,
+							 PGC_POSTMASTER,
+							 0, NULL, NULL, NULL);
+	DefineCustomIntVariable("jsonlog.async_buffer_size",
+							"Size of the shared buffer of asynchronous logging.",
+							NULL,
+							&jsonlog_async_buffer_size,
+							8192, 64, MAX_KILOBYTES / 2,
+							PGC_POSTMASTER,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+	DefineCustomEnumVariable("jsonlog.async_overflow",
+							 "Behavior of asynchronous logging when the shared buffer is full.",
+							 NULL,
+							 &jsonlog_async_overflow,
+							 JSONLOG_OVERFLOW_DROP,
+							 overflow_options,
+							 PGC_SIGHUP,
+							 0, NULL, NULL, NULL);
+	DefineCustomStringVariable("jsonlog.filename",
+							   "File name pattern of the JSON log files.",
+							   "Files are created in log_directory.",
+							   &jsonlog_filename,
+							   "jsonlog-%Y-%m-%d_%H%M%S.json",
+							   PGC_SIGHUP,
+							   0, NULL, jsonlog_filename_assign, NULL);
+	DefineCustomIntVariable("jsonlog.rotation_age",
+							"Automatic rotation of the JSON log files after N minutes.",
+							"Zero disables rotations based on age.",
+							&jsonlog_rotation_age,
+							1440, 0, INT_MAX / SECS_PER_MINUTE,
+							PGC_SIGHUP,
+							GUC_UNIT_MIN,
+							NULL, jsonlog_rotation_age_assign, NULL);
+	DefineCustomIntVariable("jsonlog.rotation_size",
+							"Automatic rotation of the JSON log files after N kilobytes.",
+							"Zero disables rotations based on size.",
+							&jsonlog_rotation_size,
+							10240, 0, INT_MAX / 1024,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+	DefineCustomIntVariable("jsonlog.rate_limit",
+							"Messages logged per second by a process for similar messages.",
+							"Zero disables this limit.",
+							&jsonlog_rate_limit,
+							0, 0, INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL, NULL, NULL);
+	DefineCustomIntVariable("jsonlog.rate_limit_shared",
+							"Messages logged per second by all processes for similar messages.",
+							"Zero disables this limit.  This requires jsonlog in shared_preload_libraries.",
+							&jsonlog_rate_limit_shared,
+							0, 0, INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+	DefineCustomIntVariable("jsonlog.rate_limit_burst",
+							"Similar messages logged in a burst before the rate limits apply.",
+							NULL,
+							&jsonlog_rate_limit_burst,
+							10, 1, INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+	DefineCustomIntVariable("jsonlog.rate_limit_report_interval",
+							"Minimum time between two reports of the messages suppressed.",
+							NULL,
+							&jsonlog_rate_limit_report_interval,
+							10, 1, INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+	DefineCustomRealVariable("jsonlog.sample_rate_debug",
+							 "Fraction of the DEBUG messages logged.",
+							 NULL,
+							 &jsonlog_sample_rate_debug,
+							 1.0, 0.0, 1.0,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+	DefineCustomRealVariable("jsonlog.sample_rate_log",
+							 "Fraction of the LOG messages logged.",
+							 NULL,
+							 &jsonlog_sample_rate_log,
+							 1.0, 0.0, 1.0,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+	DefineCustomRealVariable("jsonlog.sample_rate_info",
+							 "Fraction of the INFO messages logged.",
+							 NULL,
+							 &jsonlog_sample_rate_info,
+							 1.0, 0.0, 1.0,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+	DefineCustomRealVariable("jsonlog.sample_rate_notice",
+							 "Fraction of the NOTICE messages logged.",
+							 NULL,
+							 &jsonlog_sample_rate_notice,
+							 1.0, 0.0, 1.0,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+	DefineCustomRealVariable("jsonlog.sample_rate_warning",
+							 "Fraction of the WARNING messages logged.",
+							 NULL,
+							 &jsonlog_sample_rate_warning,
+							 1.0, 0.0, 1.0,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+	DefineCustomRealVariable("jsonlog.sample_rate_error",
+							 "Fraction of the ERROR messages logged.",
+							 NULL,
+							 &jsonlog_sample_rate_error,
+							 1.0, 0.0, 1.0,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	/*
+	 * Shared buckets of the rate limits, and log files with the shared ring
+	 * and its writer for asynchronous logging.
+	 */
+	if (process_shared_preload_libraries_in_progress)
+	{
+#if PG_VERSION_NUM >= 150000
+		prev_shmem_request_hook = shmem_request_hook;
+		shmem_request_hook = jsonlog_shmem_request;
+#else
+		RequestAddinShmemSpace(jsonlog_shmem_size());
+#endif
+		prev_shmem_startup_hook = shmem_startup_hook;
+		shmem_startup_hook = jsonlog_shmem_startup;
+		if (jsonlog_destination == JSONLOG_DESTINATION_ASYNC)
+			jsonlog_ring_register_worker();
+	}
+
+	/* Groups of the rate limits, allocated before logging anything */
+	jsonlog_limit_init();
 
 	prev_log_hook = emit_log_hook;
 	emit_log_hook = jsonlog_write_json;
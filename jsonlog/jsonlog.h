@@ -0,0 +1,89 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonlog.h
+ *		Declarations shared across the files of jsonlog
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		jsonlog/jsonlog.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef JSONLOG_H
+#define JSONLOG_H
+
+#include "pgtime.h"
+
+/* Destinations of the JSON logs */
+typedef enum JsonlogDestination
+{
+	JSONLOG_DESTINATION_STDERR,	/* stderr or syslogger, synchronously */
+	JSONLOG_DESTINATION_ASYNC,	/* shared ring, drained by a worker */
+	JSONLOG_DESTINATION_FILE,	/* log files, written by each process */
+} JsonlogDestination;
+
+/* Policies when the shared ring is full */
+typedef enum JsonlogOverflow
+{
+	JSONLOG_OVERFLOW_DROP,		/* drop the message, counting it */
+	JSONLOG_OVERFLOW_SYNC,		/* write the message to the file directly */
+} JsonlogOverflow;
+
+/* GUC variables, in jsonlog.c */
+extern int	jsonlog_destination;
+extern int	jsonlog_async_buffer_size;
+extern int	jsonlog_async_overflow;
+extern char *jsonlog_filename;
+extern int	jsonlog_rotation_age;
+extern int	jsonlog_rotation_size;
+extern int	jsonlog_rate_limit;
+extern int	jsonlog_rate_limit_shared;
+extern int	jsonlog_rate_limit_burst;
+extern int	jsonlog_rate_limit_report_interval;
+extern double jsonlog_sample_rate_debug;
+extern double jsonlog_sample_rate_log;
+extern double jsonlog_sample_rate_info;
+extern double jsonlog_sample_rate_notice;
+extern double jsonlog_sample_rate_warning;
+extern double jsonlog_sample_rate_error;
+
+/* Group of similar messages suppressed, to report */
+typedef struct JsonlogSuppressed
+{
+	int			elevel;			/* severity of the last message */
+	int			sqlerrcode;
+	const char *template;		/* format string, possibly truncated */
+	uint64		count;			/* messages suppressed */
+} JsonlogSuppressed;
+
+/* Current time formatted for the "timestamp" field, in jsonlog.c */
+extern const char *jsonlog_log_time(void);
+extern pg_time_t jsonlog_log_sec(void);
+
+/* Log the messages suppressed not reported yet, in jsonlog.c */
+extern void jsonlog_report_suppressed(void);
+
+/* Rate limiting and sampling, in jsonlog_limit.c */
+extern Size jsonlog_limit_shmem_size(void);
+extern void jsonlog_limit_startup(void);
+extern void jsonlog_limit_init(void);
+extern bool jsonlog_limit_check(ErrorData *edata, bool use_shared);
+extern bool jsonlog_limit_report_due(void);
+extern void jsonlog_limit_report_start(void);
+extern bool jsonlog_limit_report_next(JsonlogSuppressed *report);
+
+/* Log files written directly, with rotation, in jsonlog_file.c */
+extern Size jsonlog_file_shmem_size(void);
+extern void jsonlog_file_startup(void);
+extern void jsonlog_file_assign(void);
+extern bool jsonlog_file_write(const char *data, int len, pg_time_t now);
+
+/* Asynchronous ring and its writer, in jsonlog_ring.c */
+extern Size jsonlog_ring_shmem_size(void);
+extern void jsonlog_ring_startup(void);
+extern void jsonlog_ring_register_worker(void);
+extern bool jsonlog_ring_insert(const char *data, int len);
+
+#endif							/* JSONLOG_H */
@@ -0,0 +1,37 @@
+-- Microbenchmark of the lines logged per second by jsonlog.
+--
+-- jsonlog_bench() logs num_lines messages of msg_len bytes with RAISE LOG,
+-- each one written by jsonlog, and returns the number of lines logged per
+-- second.  A "typical" message is short with a few characters to escape,
+-- a "large" one is a few kilobytes long with quotes and newlines spread
+-- in it, as a long query or a detail would be:
+-- SELECT jsonlog_bench(100000, 100);	-- typical
+-- SELECT jsonlog_bench(100000, 8192);	-- large
+--
+-- The messages go to the server logs and not to the client, with the
+-- default values of log_min_messages and client_min_messages.  To test
+-- concurrency, the following script can be used with pgbench:
+-- SELECT jsonlog_bench(1000, 100);
+--
+-- This can then be invoked with a command like that, the lines logged per
+-- second being the tps reported multiplied by 1000:
+-- pgbench -n -c 24 -j 24 -f bench_script.sql -T 60
+
+CREATE OR REPLACE FUNCTION jsonlog_bench(num_lines int, msg_len int)
+RETURNS float8 AS
+$func$
+DECLARE
+  msg text;
+  start_time timestamptz;
+  elapsed float8;
+BEGIN
+  -- Some characters to escape every 64 bytes
+  msg = rpad('', msg_len, repeat('x', 60) || E'"\\\n\t');
+  start_time = clock_timestamp();
+  FOR i IN 1..num_lines LOOP
+    RAISE LOG '%', msg;
+  END LOOP;
+  elapsed = extract(epoch FROM clock_timestamp() - start_time);
+  RETURN num_lines / greatest(elapsed, 0.000001);
+END
+$func$ LANGUAGE plpgsql;
@@ -0,0 +1,330 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonlog_file.c
+ *		Log files written directly by jsonlog, with rotation
+ *
+ * The log file in use is tracked in shared memory with a generation number
+ * bumped at each rotation.  Each process keeps the file open, writing its
+ * lines with O_APPEND so as lines written concurrently are not interleaved,
+ * and opens the new file once it sees that the generation has changed.
+ * The amount of data written to the file and the time of its next rotation
+ * are shared, the first process noticing that the file needs a rotation
+ * doing it, without blocking the others that keep on writing to the
+ * previous file in the meantime.
+ *
+ * When a file cannot be created, the creation is retried with a delay
+ * doubling at each failure, whatever jsonlog.rotation_age.
+ *
+ * This is used by all the processes with jsonlog.destination = 'file', and
+ * by the writer of the ring with jsonlog.destination = 'async'.  Nothing
+ * here can use ereport(), as this runs in the hook emitting logs.  Instead,
+ * failures are reported to the caller that falls back to stderr.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		jsonlog/jsonlog_file.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "miscadmin.h"
+#include "pgtime.h"
+#include "port/atomics.h"
+#include "postmaster/syslogger.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/timestamp.h"
+
+#include "jsonlog.h"
+
+/* Delays between two attempts to create a file, in seconds */
+#define JSONLOG_FILE_RETRY_MIN		1
+#define JSONLOG_FILE_RETRY_MAX		60
+
+/* Shared state of the log file */
+typedef struct JsonlogFile
+{
+	slock_t		mutex;			/* protects path and pattern */
+	char		path[MAXPGPATH];	/* path of the file in use */
+	char		pattern[MAXPGPATH]; /* jsonlog.filename of the file */
+	pg_atomic_uint64 generation;	/* bumped at each rotation, 0 if none */
+	pg_atomic_uint64 size;		/* bytes in the file */
+	pg_atomic_uint64 next_rotation; /* time of the next rotation, or 0 */
+	pg_atomic_flag rotating;	/* is a rotation in progress? */
+	int			retry_delay;	/* delay after the last failure to create a
+								 * file, 0 if none, set while rotating */
+} JsonlogFile;
+
+static JsonlogFile *jsonlog_file = NULL;
+
+/* File open in this process */
+static int	file_fd = -1;
+static uint64 file_generation = 0;
+
+/* Has jsonlog.filename or jsonlog.rotation_age been reloaded? */
+static bool file_reload = false;
+
+Size
+jsonlog_file_shmem_size(void)
+{
+	return sizeof(JsonlogFile);
+}
+
+/*
+ * Compute the next time of rotation based on its age, aligned on local
+ * time as done by the syslogger.
+ */
+static pg_time_t
+jsonlog_file_next_rotation(pg_time_t now)
+{
+	pg_time_t	rotinterval;
+	struct pg_tm *tm;
+
+	if (jsonlog_rotation_age <= 0)
+		return 0;
+
+	rotinterval = jsonlog_rotation_age * SECS_PER_MINUTE;
+	tm = pg_localtime(&now, log_timezone);
+	now += tm->tm_gmtoff;
+	now -= now % rotinterval;
+	now += rotinterval;
+	now -= tm->tm_gmtoff;
+	return now;
+}
+
+/*
+ * Create a new log file named after jsonlog.filename, and make it the one
+ * in use.  If it cannot be created, the current file stays in use.
+ * Returns false if a rotation is already in progress or has failed.
+ */
+static bool
+jsonlog_file_rotate(void)
+{
+	char		fname[MAXPGPATH];
+	char		path[MAXPGPATH];
+	pg_time_t	now = (pg_time_t) time(NULL);
+	struct stat st;
+	int			fd;
+
+	if (!pg_atomic_test_set_flag(&jsonlog_file->rotating))
+		return false;
+
+	pg_strftime(fname, sizeof(fname), jsonlog_filename,
+				pg_localtime(&now, log_timezone));
+	snprintf(path, sizeof(path), "%s/%s", Log_directory, fname);
+
+	/*
+	 * With a name that has not changed, the same file stays in use.  The
+	 * size is reset so as the next check happens after as much data.
+	 */
+	SpinLockAcquire(&jsonlog_file->mutex);
+	if (strcmp(jsonlog_file->path, path) == 0 &&
+		strcmp(jsonlog_file->pattern, jsonlog_filename) == 0)
+	{
+		SpinLockRelease(&jsonlog_file->mutex);
+		pg_atomic_write_u64(&jsonlog_file->size, 0);
+		pg_atomic_write_u64(&jsonlog_file->next_rotation,
+							jsonlog_file_next_rotation(now));
+		pg_atomic_clear_flag(&jsonlog_file->rotating);
+		return true;
+	}
+	SpinLockRelease(&jsonlog_file->mutex);
+
+	(void) mkdir(Log_directory, S_IRWXU);
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT | PG_BINARY, Log_file_mode);
+	if (fd < 0)
+	{
+		/* Retry after a delay, not at each line */
+		jsonlog_file->retry_delay = jsonlog_file->retry_delay == 0 ?
+			JSONLOG_FILE_RETRY_MIN :
+			Min(jsonlog_file->retry_delay * 2, JSONLOG_FILE_RETRY_MAX);
+		pg_atomic_write_u64(&jsonlog_file->next_rotation,
+							now + jsonlog_file->retry_delay);
+		pg_atomic_clear_flag(&jsonlog_file->rotating);
+		return false;
+	}
+	jsonlog_file->retry_delay = 0;
+
+	SpinLockAcquire(&jsonlog_file->mutex);
+	strlcpy(jsonlog_file->path, path, MAXPGPATH);
+	strlcpy(jsonlog_file->pattern, jsonlog_filename, MAXPGPATH);
+	SpinLockRelease(&jsonlog_file->mutex);
+
+	pg_atomic_write_u64(&jsonlog_file->size,
+						fstat(fd, &st) == 0 ? st.st_size : 0);
+	pg_atomic_write_u64(&jsonlog_file->next_rotation,
+						jsonlog_file_next_rotation(now));
+	pg_write_barrier();
+	pg_atomic_fetch_add_u64(&jsonlog_file->generation, 1);
+
+	/* Switch to the new file directly */
+	if (file_fd >= 0)
+		close(file_fd);
+	file_fd = fd;
+	file_generation = pg_atomic_read_u64(&jsonlog_file->generation);
+
+	pg_atomic_clear_flag(&jsonlog_file->rotating);
+	return true;
+}
+
+/*
+ * Initialize the shared state of the log file, or attach to it.  The
+ * first file is created here by the postmaster, so as it exists once
+ * processes begin to log.
+ */
+void
+jsonlog_file_startup(void)
+{
+	bool		found;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	jsonlog_file = ShmemInitStruct("jsonlog file", jsonlog_file_shmem_size(),
+								   &found);
+	if (!found)
+	{
+		SpinLockInit(&jsonlog_file->mutex);
+		jsonlog_file->path[0] = '\0';
+		jsonlog_file->pattern[0] = '\0';
+		pg_atomic_init_u64(&jsonlog_file->generation, 0);
+		pg_atomic_init_u64(&jsonlog_file->size, 0);
+		pg_atomic_init_u64(&jsonlog_file->next_rotation, 0);
+		pg_atomic_init_flag(&jsonlog_file->rotating);
+		jsonlog_file->retry_delay = 0;
+
+		(void) jsonlog_file_rotate();
+
+		/* Children open the file by themselves */
+		if (file_fd >= 0)
+			close(file_fd);
+		file_fd = -1;
+		file_generation = 0;
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Note that jsonlog.filename or jsonlog.rotation_age have changed, to be
+ * checked at the next write.
+ */
+void
+jsonlog_file_assign(void)
+{
+	file_reload = true;
+}
+
+/*
+ * Open the file in use, if it has changed since the last write.  Returns
+ * false if there is no file to write to.
+ */
+static bool
+jsonlog_file_open(void)
+{
+	char		path[MAXPGPATH];
+	uint64		generation;
+	int			fd;
+
+	generation = pg_atomic_read_u64(&jsonlog_file->generation);
+	if (generation == file_generation && file_fd >= 0)
+		return true;
+	if (generation == 0)
+		return false;
+	pg_read_barrier();
+
+	SpinLockAcquire(&jsonlog_file->mutex);
+	strlcpy(path, jsonlog_file->path, MAXPGPATH);
+	SpinLockRelease(&jsonlog_file->mutex);
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT | PG_BINARY, Log_file_mode);
+	if (fd < 0)
+		return file_fd >= 0;
+
+	if (file_fd >= 0)
+		close(file_fd);
+	file_fd = fd;
+	file_generation = generation;
+	return true;
+}
+
+/*
+ * Check if the settings of the file have been reloaded, rotating it if
+ * its name pattern has changed.
+ */
+static void
+jsonlog_file_check_reload(void)
+{
+	bool		changed;
+
+	file_reload = false;
+
+	SpinLockAcquire(&jsonlog_file->mutex);
+	changed = strcmp(jsonlog_file->pattern, jsonlog_filename) != 0;
+	SpinLockRelease(&jsonlog_file->mutex);
+
+	if (changed)
+		(void) jsonlog_file_rotate();
+	else if (jsonlog_file->retry_delay == 0)
+		pg_atomic_write_u64(&jsonlog_file->next_rotation,
+							jsonlog_file_next_rotation((pg_time_t) time(NULL)));
+}
+
+/*
+ * Append data to the log file in use, made of complete lines.  Lines up to
+ * PIPE_BUF bytes are written with a single write(), and longer lines as
+ * well unless interrupted, O_APPEND making concurrent writes land one
+ * after the other.  "now" is the current time, checked against the next
+ * rotation.  Returns false if nothing could be written, for the caller to
+ * write the data somewhere else.
+ */
+bool
+jsonlog_file_write(const char *data, int len, pg_time_t now)
+{
+	uint64		size = 0;
+	uint64		next_rotation;
+	bool		written = false;
+
+	if (jsonlog_file == NULL)
+		return false;
+
+	if (file_reload)
+		jsonlog_file_check_reload();
+
+	/* Rotate first if the time has come */
+	next_rotation = pg_atomic_read_u64(&jsonlog_file->next_rotation);
+	if (next_rotation != 0 && (uint64) now >= next_rotation)
+		(void) jsonlog_file_rotate();
+
+	if (!jsonlog_file_open())
+		return false;
+
+	while (len > 0)
+	{
+		ssize_t		rc;
+
+		rc = write(file_fd, data, len);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		data += rc;
+		len -= rc;
+		written = true;
+		size = pg_atomic_add_fetch_u64(&jsonlog_file->size, rc);
+	}
+
+	/* Rotate once the file is large enough, after complete lines */
+	if (written && jsonlog_rotation_size > 0 &&
+		size >= (uint64) jsonlog_rotation_size * 1024)
+		(void) jsonlog_file_rotate();
+
+	return written;
+}
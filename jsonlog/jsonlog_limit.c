@@ -0,0 +1,446 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonlog_limit.c
+ *		Rate limiting and sampling of repetitive messages
+ *
+ * Messages are grouped by their SQLSTATE and the hash of their untranslated
+ * format string, so as messages only differing by their parameters count
+ * as similar.  Each group is first sampled depending on the severity of the
+ * messages, then has to take a token from a bucket local to the process and
+ * from a bucket shared by all processes, refilled at the rates given by
+ * jsonlog.rate_limit and jsonlog.rate_limit_shared.
+ *
+ * The messages suppressed are counted by each process, and reported with
+ * one line per group once per jsonlog.rate_limit_report_interval, when the
+ * process logs or suppresses a message again, or when it exits.
+ *
+ * The groups of a process are kept in a hash table allocated when the
+ * module is loaded, so as no memory is allocated for them while logging.
+ * Once the table is full, the messages of new groups share one catch-all
+ * group, keeping them limited.
+ *
+ * The shared buckets are a fixed array in shared memory, with each group
+ * mapped to a slot by its hash.  When two groups are mapped to the same
+ * slot, the last one seen takes it over, so the shared limit is only
+ * approximate for many groups.  Nothing here can use ereport(), as this
+ * runs in the hook emitting logs.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		jsonlog/jsonlog_limit.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#endif
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include "jsonlog.h"
+
+/* Number of slots of the shared buckets */
+#define JSONLOG_LIMIT_SHARED_SLOTS	1024
+
+/* Maximum number of groups tracked by a process */
+#define JSONLOG_LIMIT_LOCAL_GROUPS	1024
+
+/* Maximum length of the format string kept for the reports */
+#define JSONLOG_LIMIT_TEMPLATE_LEN	128
+
+/* Format string reported for the catch-all group */
+#define JSONLOG_LIMIT_OTHER_TEMPLATE	"(other messages)"
+
+/* Group of similar messages */
+typedef struct JsonlogLimitKey
+{
+	int			sqlerrcode;
+	uint32		hash;			/* hash of the format string */
+} JsonlogLimitKey;
+
+/* Shared bucket of a group */
+typedef struct JsonlogLimitSlot
+{
+	slock_t		mutex;			/* protects all the fields below */
+	JsonlogLimitKey key;
+	double		tokens;
+	TimestampTz last_refill;
+} JsonlogLimitSlot;
+
+/* Bucket and suppressed messages of a group, in a process */
+typedef struct JsonlogLimitEntry
+{
+	JsonlogLimitKey key;		/* hash key, must be first */
+	double		tokens;
+	TimestampTz last_refill;
+	double		sample;			/* accumulated sampling ratio */
+	int			elevel;			/* severity of the last message */
+	uint64		suppressed;		/* messages suppressed, not reported yet */
+	char		template[JSONLOG_LIMIT_TEMPLATE_LEN];
+} JsonlogLimitEntry;
+
+static JsonlogLimitSlot *jsonlog_limit_slots = NULL;
+static HTAB *jsonlog_limit_groups = NULL;
+
+/* Group of the messages not fitting in jsonlog_limit_groups */
+static JsonlogLimitEntry limit_other;
+
+/* Time of the last check and of the last report of this process */
+static TimestampTz limit_now = 0;
+static TimestampTz limit_last_report = 0;
+
+/* Are there suppressed messages not reported yet? */
+static bool limit_pending = false;
+static bool limit_exit_registered = false;
+
+/* Sequential scan of the reports in progress */
+static HASH_SEQ_STATUS limit_report_status;
+static bool limit_report_scan = false;
+
+Size
+jsonlog_limit_shmem_size(void)
+{
+	return mul_size(JSONLOG_LIMIT_SHARED_SLOTS, sizeof(JsonlogLimitSlot));
+}
+
+/*
+ * Initialize the shared buckets, or attach to them.
+ */
+void
+jsonlog_limit_startup(void)
+{
+	bool		found;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	jsonlog_limit_slots = ShmemInitStruct("jsonlog limit",
+										  jsonlog_limit_shmem_size(),
+										  &found);
+	if (!found)
+	{
+		int			i;
+
+		for (i = 0; i < JSONLOG_LIMIT_SHARED_SLOTS; i++)
+		{
+			JsonlogLimitSlot *slot = &jsonlog_limit_slots[i];
+
+			SpinLockInit(&slot->mutex);
+			slot->key.sqlerrcode = 0;
+			slot->key.hash = 0;
+			slot->tokens = 0;
+			slot->last_refill = 0;
+		}
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Initialize a group, with a full bucket.
+ */
+static void
+jsonlog_limit_init_entry(JsonlogLimitEntry *entry, const char *template)
+{
+	int			len;
+
+	entry->tokens = 0;
+	entry->last_refill = 0;
+	entry->sample = 1.0;
+	entry->elevel = LOG;
+	entry->suppressed = 0;
+	len = pg_mbcliplen(template, strlen(template),
+					   JSONLOG_LIMIT_TEMPLATE_LEN - 1);
+	memcpy(entry->template, template, len);
+	entry->template[len] = '\0';
+}
+
+/*
+ * Create the table of the groups of this process, when the module is
+ * loaded.  Its entries are all allocated here, by filling the table once,
+ * so as the hook emitting logs never allocates any.
+ */
+void
+jsonlog_limit_init(void)
+{
+	HASHCTL		ctl;
+	JsonlogLimitKey key;
+
+	if (jsonlog_limit_groups != NULL)
+		return;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(JsonlogLimitKey);
+	ctl.entrysize = sizeof(JsonlogLimitEntry);
+	ctl.hcxt = TopMemoryContext;
+	jsonlog_limit_groups = hash_create("jsonlog limit groups",
+									   JSONLOG_LIMIT_LOCAL_GROUPS, &ctl,
+									   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	memset(&key, 0, sizeof(key));
+	for (int i = 0; i < JSONLOG_LIMIT_LOCAL_GROUPS; i++)
+	{
+		key.hash = i;
+		(void) hash_search(jsonlog_limit_groups, &key, HASH_ENTER, NULL);
+	}
+	for (int i = 0; i < JSONLOG_LIMIT_LOCAL_GROUPS; i++)
+	{
+		key.hash = i;
+		(void) hash_search(jsonlog_limit_groups, &key, HASH_REMOVE, NULL);
+	}
+
+	memset(&limit_other, 0, sizeof(limit_other));
+	jsonlog_limit_init_entry(&limit_other, JSONLOG_LIMIT_OTHER_TEMPLATE);
+}
+
+/*
+ * Sampling ratio of a severity.  FATAL and PANIC are never sampled.
+ */
+static double
+jsonlog_limit_sample_rate(int elevel)
+{
+	switch (elevel)
+	{
+		case DEBUG1:
+		case DEBUG2:
+		case DEBUG3:
+		case DEBUG4:
+		case DEBUG5:
+			return jsonlog_sample_rate_debug;
+		case LOG:
+		case COMMERROR:
+			return jsonlog_sample_rate_log;
+		case INFO:
+			return jsonlog_sample_rate_info;
+		case NOTICE:
+			return jsonlog_sample_rate_notice;
+		case WARNING:
+			return jsonlog_sample_rate_warning;
+		case ERROR:
+			return jsonlog_sample_rate_error;
+		default:
+			return 1.0;
+	}
+}
+
+/*
+ * Take a token from a bucket refilled at "rate" tokens per second, holding
+ * up to jsonlog.rate_limit_burst tokens.  Returns false if it is empty.
+ */
+static bool
+jsonlog_limit_take(double *tokens, TimestampTz *last_refill, int rate)
+{
+	double		burst = Max(jsonlog_rate_limit_burst, 1);
+
+	if (*last_refill == 0)
+		*tokens = burst;
+	else if (limit_now > *last_refill)
+		*tokens = Min(burst, *tokens +
+					  (double) (limit_now - *last_refill) * rate / USECS_PER_SEC);
+	*last_refill = limit_now;
+
+	if (*tokens < 1.0)
+		return false;
+	*tokens -= 1.0;
+	return true;
+}
+
+/*
+ * Take a token from the shared bucket of a group.
+ */
+static bool
+jsonlog_limit_take_shared(const JsonlogLimitKey *key)
+{
+	JsonlogLimitSlot *slot;
+	uint32		index;
+	bool		result;
+
+	index = (key->hash ^ ((uint32) key->sqlerrcode * 0x9E3779B1)) %
+		JSONLOG_LIMIT_SHARED_SLOTS;
+	slot = &jsonlog_limit_slots[index];
+
+	SpinLockAcquire(&slot->mutex);
+	if (slot->key.sqlerrcode != key->sqlerrcode ||
+		slot->key.hash != key->hash)
+	{
+		/* Take over the slot, with a full bucket */
+		slot->key = *key;
+		slot->last_refill = 0;
+	}
+	result = jsonlog_limit_take(&slot->tokens, &slot->last_refill,
+								jsonlog_rate_limit_shared);
+	SpinLockRelease(&slot->mutex);
+
+	return result;
+}
+
+/*
+ * Report the messages suppressed when the process exits.
+ */
+static void
+jsonlog_limit_exit(int code, Datum arg)
+{
+	if (limit_pending)
+		jsonlog_report_suppressed();
+}
+
+/*
+ * Check if a message can be logged, counting it as suppressed if not.
+ * The shared buckets are only used in the processes attached to shared
+ * memory.
+ */
+bool
+jsonlog_limit_check(ErrorData *edata, bool use_shared)
+{
+	JsonlogLimitKey key;
+	JsonlogLimitEntry *entry;
+	const char *template;
+	double		sample_rate;
+	bool		found;
+
+	if (edata->elevel >= FATAL)
+		return true;
+
+	sample_rate = jsonlog_limit_sample_rate(edata->elevel);
+	if (sample_rate >= 1.0 && jsonlog_rate_limit == 0 &&
+		jsonlog_rate_limit_shared == 0)
+		return true;
+
+	limit_now = GetCurrentTimestamp();
+
+	template = edata->message_id ? edata->message_id :
+		(edata->message ? edata->message : "");
+
+	memset(&key, 0, sizeof(key));
+	key.sqlerrcode = edata->sqlerrcode;
+	key.hash = DatumGetUInt32(hash_any((const unsigned char *) template,
+									   strlen(template)));
+
+	/* Past the maximum number of groups, new groups use the catch-all one */
+	entry = hash_search(jsonlog_limit_groups, &key, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		if (hash_get_num_entries(jsonlog_limit_groups) < JSONLOG_LIMIT_LOCAL_GROUPS)
+			entry = hash_search(jsonlog_limit_groups, &key, HASH_ENTER_NULL,
+								&found);
+		if (entry != NULL)
+			jsonlog_limit_init_entry(entry, template);
+		else
+			entry = &limit_other;
+	}
+	entry->elevel = edata->elevel;
+
+	/* Sample first, then take a token from the local and shared buckets */
+	if (sample_rate < 1.0)
+	{
+		entry->sample += sample_rate;
+		if (entry->sample < 1.0)
+			goto suppressed;
+		entry->sample -= 1.0;
+	}
+	if (jsonlog_rate_limit > 0 &&
+		!jsonlog_limit_take(&entry->tokens, &entry->last_refill,
+							jsonlog_rate_limit))
+		goto suppressed;
+	if (jsonlog_rate_limit_shared > 0 && use_shared &&
+		jsonlog_limit_slots != NULL &&
+		!jsonlog_limit_take_shared(&key))
+		goto suppressed;
+
+	return true;
+
+suppressed:
+	entry->suppressed++;
+	if (!limit_pending)
+	{
+		limit_pending = true;
+		if (limit_last_report == 0)
+			limit_last_report = limit_now;
+	}
+	if (!limit_exit_registered && IsUnderPostmaster)
+	{
+		before_shmem_exit(jsonlog_limit_exit, (Datum) 0);
+		limit_exit_registered = true;
+	}
+	return false;
+}
+
+/*
+ * Check if the messages suppressed are due for a report.
+ */
+bool
+jsonlog_limit_report_due(void)
+{
+	return limit_pending &&
+		limit_now - limit_last_report >=
+		(TimestampTz) jsonlog_rate_limit_report_interval * USECS_PER_SEC;
+}
+
+/*
+ * Begin the reports of the messages suppressed.  The caller then fetches
+ * the groups to report with jsonlog_limit_report_next() until it returns
+ * false.
+ */
+void
+jsonlog_limit_report_start(void)
+{
+	limit_pending = false;
+	limit_last_report = limit_now;
+	hash_seq_init(&limit_report_status, jsonlog_limit_groups);
+	limit_report_scan = true;
+}
+
+/*
+ * Fill a report with the messages suppressed of a group, resetting its
+ * count.
+ */
+static void
+jsonlog_limit_report_entry(JsonlogLimitEntry *entry,
+						   JsonlogSuppressed *report)
+{
+	report->elevel = entry->elevel;
+	report->sqlerrcode = entry->key.sqlerrcode;
+	report->template = entry->template;
+	report->count = entry->suppressed;
+	entry->suppressed = 0;
+}
+
+/*
+ * Get the next group with messages suppressed, the catch-all group being
+ * the last one.
+ */
+bool
+jsonlog_limit_report_next(JsonlogSuppressed *report)
+{
+	JsonlogLimitEntry *entry;
+
+	while (limit_report_scan &&
+		   (entry = hash_seq_search(&limit_report_status)) != NULL)
+	{
+		if (entry->suppressed == 0)
+			continue;
+
+		jsonlog_limit_report_entry(entry, report);
+		return true;
+	}
+	limit_report_scan = false;
+
+	if (limit_other.suppressed > 0)
+	{
+		jsonlog_limit_report_entry(&limit_other, report);
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,481 @@
+/*-------------------------------------------------------------------------
+ *
+ * jsonlog_ring.c
+ *		Asynchronous logging through a ring in shared memory, drained by
+ *		a background worker
+ *
+ * Backends reserve space in the ring with a compare-and-swap on the
+ * position of the next entry, copy their line in it, then mark the entry
+ * as committed by setting its length.  No lock is taken, so the backends
+ * logging do not wait on each other, nor on any system call writing the
+ * logs.  The writer consumes the committed entries in the order of the
+ * ring, batching them in large writes to the log files of jsonlog_file.c.
+ *
+ * When the ring is full, a message is either dropped and counted, the
+ * writer reporting the number of messages dropped, or written to the log
+ * file by the backend itself, depending on jsonlog.async_overflow, so as
+ * a backend never waits for the writer.
+ * Messages are written synchronously to stderr when the writer is not
+ * running, or when they are larger than half of the ring.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		jsonlog/jsonlog_ring.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#if PG_VERSION_NUM >= 140000
+#include "utils/wait_event.h"
+#endif
+
+#include "jsonlog.h"
+
+/* Size of the buffer of the writer, batching the entries written */
+#define JSONLOG_WRITE_BUFFER_SIZE	(1024 * 1024)
+
+/* Maximum time the writer sleeps */
+#define JSONLOG_WRITER_NAPTIME		1000L
+
+/* Maximum time the writer waits for the last entries when exiting, in ms */
+#define JSONLOG_WRITER_SHUTDOWN_TIMEOUT	100
+
+/*
+ * Header of an entry in the ring, followed by the line logged.  The length
+ * is zero until the line has been entirely copied in the ring.  Entries
+ * are aligned on the size of their header, so as a header never wraps.
+ */
+typedef struct JsonlogRingEntry
+{
+	pg_atomic_uint32 len;		/* length of the line, 0 if not committed */
+	uint32		padding;
+} JsonlogRingEntry;
+
+#define JSONLOG_ENTRY_SIZE(len) \
+	(sizeof(JsonlogRingEntry) + TYPEALIGN(sizeof(JsonlogRingEntry), (len)))
+
+/*
+ * Shared state of the ring.  Positions increase forever, their modulo
+ * with the size of the ring giving their offset in the data.
+ */
+typedef struct JsonlogRing
+{
+	pg_atomic_uint64 reserve_pos;	/* end of the space reserved */
+	pg_atomic_uint64 read_pos;	/* start of the entries not consumed */
+	pg_atomic_uint64 dropped;	/* messages dropped when full */
+	pg_atomic_uint32 writer_pid;	/* PID of the writer, 0 if not running */
+	Latch	   *writer_latch;	/* latch of the writer */
+	uint64		size;			/* size of the data */
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} JsonlogRing;
+
+static JsonlogRing *jsonlog_ring = NULL;
+
+/* Is this process the writer? */
+static bool am_jsonlog_writer = false;
+
+/* Signal handling of the writer */
+static volatile sig_atomic_t got_sigterm = false;
+static volatile sig_atomic_t got_sighup = false;
+
+/* State of the writer */
+static char *write_buf = NULL;
+static int	write_len = 0;
+static uint64 dropped_reported = 0;
+
+pg_noreturn PGDLLEXPORT void jsonlog_writer_main(Datum main_arg);
+
+Size
+jsonlog_ring_shmem_size(void)
+{
+	return add_size(offsetof(JsonlogRing, data),
+					mul_size(jsonlog_async_buffer_size, 1024));
+}
+
+/*
+ * Initialize the ring, or attach to it.
+ */
+void
+jsonlog_ring_startup(void)
+{
+	bool		found;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	jsonlog_ring = ShmemInitStruct("jsonlog ring", jsonlog_ring_shmem_size(),
+								   &found);
+	if (!found)
+	{
+		pg_atomic_init_u64(&jsonlog_ring->reserve_pos, 0);
+		pg_atomic_init_u64(&jsonlog_ring->read_pos, 0);
+		pg_atomic_init_u64(&jsonlog_ring->dropped, 0);
+		pg_atomic_init_u32(&jsonlog_ring->writer_pid, 0);
+		jsonlog_ring->writer_latch = NULL;
+		jsonlog_ring->size = (uint64) jsonlog_async_buffer_size * 1024;
+		memset(jsonlog_ring->data, 0, jsonlog_ring->size);
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Register the writer draining the ring.
+ */
+void
+jsonlog_ring_register_worker(void)
+{
+	BackgroundWorker worker;
+
+	MemSet(&worker, 0, sizeof(BackgroundWorker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "jsonlog");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "jsonlog_writer_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "jsonlog writer");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "jsonlog writer");
+#endif
+	worker.bgw_restart_time = 1;
+	worker.bgw_main_arg = (Datum) 0;
+	worker.bgw_notify_pid = 0;
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Copy len bytes to or from the ring at the given position, wrapping
+ * around its end.
+ */
+static void
+jsonlog_ring_copy_in(uint64 pos, const char *data, int len)
+{
+	uint64		offset = pos % jsonlog_ring->size;
+	uint64		first = Min((uint64) len, jsonlog_ring->size - offset);
+
+	memcpy(jsonlog_ring->data + offset, data, first);
+	if (first < len)
+		memcpy(jsonlog_ring->data, data + first, len - first);
+}
+
+static void
+jsonlog_ring_copy_out(uint64 pos, char *data, int len)
+{
+	uint64		offset = pos % jsonlog_ring->size;
+	uint64		first = Min((uint64) len, jsonlog_ring->size - offset);
+
+	memcpy(data, jsonlog_ring->data + offset, first);
+	if (first < len)
+		memcpy(data + first, jsonlog_ring->data, len - first);
+}
+
+/*
+ * Insert a line in the ring.  Returns false if it could not be handled,
+ * the caller writing it by itself.  Returns true if the line has been
+ * inserted, or dropped or written to the log file because the ring was
+ * full.
+ */
+bool
+jsonlog_ring_insert(const char *data, int len)
+{
+	uint64		size = JSONLOG_ENTRY_SIZE(len);
+	uint64		reserve_pos;
+	JsonlogRingEntry *entry;
+
+	if (jsonlog_ring == NULL || am_jsonlog_writer ||
+		size > jsonlog_ring->size / 2 ||
+		pg_atomic_read_u32(&jsonlog_ring->writer_pid) == 0)
+		return false;
+
+	for (;;)
+	{
+		/*
+		 * The read position is fetched first, so as it is never ahead of
+		 * the reserve position read.
+		 */
+		uint64		read_pos = pg_atomic_read_u64(&jsonlog_ring->read_pos);
+
+		pg_read_barrier();
+		reserve_pos = pg_atomic_read_u64(&jsonlog_ring->reserve_pos);
+
+		if (reserve_pos + size - read_pos > jsonlog_ring->size)
+		{
+			SetLatch(jsonlog_ring->writer_latch);
+
+			if (jsonlog_async_overflow == JSONLOG_OVERFLOW_DROP)
+			{
+				pg_atomic_fetch_add_u64(&jsonlog_ring->dropped, 1);
+				return true;
+			}
+
+			/* Write synchronously, the caller using stderr on failure */
+			return jsonlog_file_write(data, len, jsonlog_log_sec());
+		}
+
+		if (pg_atomic_compare_exchange_u64(&jsonlog_ring->reserve_pos,
+										   &reserve_pos, reserve_pos + size))
+			break;
+	}
+
+	jsonlog_ring_copy_in(reserve_pos + sizeof(JsonlogRingEntry), data, len);
+
+	/* Commit the entry once its data is in place */
+	pg_write_barrier();
+	entry = (JsonlogRingEntry *)
+		(jsonlog_ring->data + reserve_pos % jsonlog_ring->size);
+	pg_atomic_write_u32(&entry->len, len);
+
+	if (pg_atomic_read_u32(&jsonlog_ring->writer_pid) != 0)
+		SetLatch(jsonlog_ring->writer_latch);
+
+	return true;
+}
+
+/*
+ * Write the lines batched to the log file, giving up on failures as there
+ * is no way to retry without blocking the ring.
+ */
+static void
+jsonlog_writer_flush(void)
+{
+	if (write_len > 0 &&
+		!jsonlog_file_write(write_buf, write_len, (pg_time_t) time(NULL)))
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not write %d bytes to JSON log file: %m",
+						write_len)));
+	write_len = 0;
+}
+
+/*
+ * Report the messages dropped since the last report, as a line of the
+ * log file.
+ */
+static void
+jsonlog_writer_report_dropped(void)
+{
+	uint64		dropped = pg_atomic_read_u64(&jsonlog_ring->dropped);
+	char		line[512];
+	int			len;
+
+	if (dropped == dropped_reported)
+		return;
+
+	len = snprintf(line, sizeof(line),
+				   "{\"timestamp\":\"%s\",\"pid\":%d,"
+				   "\"backend_type\":\"jsonlog writer\","
+				   "\"error_severity\":\"WARNING\","
+				   "\"message\":\"" UINT64_FORMAT " messages dropped as the jsonlog buffer was full\"}\n",
+				   jsonlog_log_time(), MyProcPid,
+				   dropped - dropped_reported);
+	dropped_reported = dropped;
+
+	if (write_len + len > JSONLOG_WRITE_BUFFER_SIZE)
+		jsonlog_writer_flush();
+	memcpy(write_buf + write_len, line, len);
+	write_len += len;
+	jsonlog_writer_flush();
+}
+
+/*
+ * Consume the entries committed in the ring, in order, writing them to the
+ * log file.  Returns false if an entry is not committed yet.
+ */
+static bool
+jsonlog_writer_drain(void)
+{
+	uint64		read_pos = pg_atomic_read_u64(&jsonlog_ring->read_pos);
+	uint64		reserve_pos = pg_atomic_read_u64(&jsonlog_ring->reserve_pos);
+	bool		complete = true;
+
+	while (read_pos < reserve_pos)
+	{
+		JsonlogRingEntry *entry;
+		uint32		len;
+		uint64		size;
+		uint64		offset;
+		uint64		first;
+
+		entry = (JsonlogRingEntry *)
+			(jsonlog_ring->data + read_pos % jsonlog_ring->size);
+		len = pg_atomic_read_u32(&entry->len);
+		if (len == 0)
+		{
+			/* Still being copied */
+			complete = false;
+			break;
+		}
+		pg_read_barrier();
+
+		if (write_len + len > JSONLOG_WRITE_BUFFER_SIZE)
+			jsonlog_writer_flush();
+		if (len > JSONLOG_WRITE_BUFFER_SIZE)
+		{
+			char	   *line = palloc(len);
+
+			jsonlog_ring_copy_out(read_pos + sizeof(JsonlogRingEntry),
+								  line, len);
+			if (!jsonlog_file_write(line, len, (pg_time_t) time(NULL)))
+				ereport(LOG,
+						(errcode_for_file_access(),
+						 errmsg("could not write %d bytes to JSON log file: %m",
+								len)));
+			pfree(line);
+		}
+		else
+		{
+			jsonlog_ring_copy_out(read_pos + sizeof(JsonlogRingEntry),
+								  write_buf + write_len, len);
+			write_len += len;
+		}
+
+		/*
+		 * Zero the space of the entry, as the header of a future entry may
+		 * be located anywhere in it.
+		 */
+		size = JSONLOG_ENTRY_SIZE(len);
+		offset = read_pos % jsonlog_ring->size;
+		first = Min(size, jsonlog_ring->size - offset);
+		memset(jsonlog_ring->data + offset, 0, first);
+		if (first < size)
+			memset(jsonlog_ring->data, 0, size - first);
+
+		read_pos += size;
+	}
+
+	/* Release the space consumed once zeroed */
+	pg_write_barrier();
+	pg_atomic_write_u64(&jsonlog_ring->read_pos, read_pos);
+
+	jsonlog_writer_flush();
+	return complete;
+}
+
+/*
+ * Stop accepting entries and write the ones remaining when the writer
+ * exits.  Backends that saw the writer running just before may still be
+ * reserving or copying their entries, so the ring is drained until it
+ * stays empty for a millisecond, for a short time at most.  What is left
+ * after that is reported as lost.
+ */
+static void
+jsonlog_writer_shutdown(int code, Datum arg)
+{
+	uint64		reserve_pos;
+	uint64		read_pos;
+	bool		empty = false;
+
+	pg_atomic_write_u32(&jsonlog_ring->writer_pid, 0);
+	pg_memory_barrier();
+
+	for (int i = 0; i < JSONLOG_WRITER_SHUTDOWN_TIMEOUT; i++)
+	{
+		bool		complete = jsonlog_writer_drain();
+
+		reserve_pos = pg_atomic_read_u64(&jsonlog_ring->reserve_pos);
+		read_pos = pg_atomic_read_u64(&jsonlog_ring->read_pos);
+		if (complete && read_pos == reserve_pos)
+		{
+			if (empty)
+				break;
+			empty = true;
+		}
+		else
+			empty = false;
+		pg_usleep(1000L);
+	}
+	jsonlog_writer_report_dropped();
+
+	reserve_pos = pg_atomic_read_u64(&jsonlog_ring->reserve_pos);
+	read_pos = pg_atomic_read_u64(&jsonlog_ring->read_pos);
+	if (read_pos != reserve_pos)
+		ereport(LOG,
+				(errmsg("jsonlog writer exiting with " UINT64_FORMAT " bytes of messages not written",
+						reserve_pos - read_pos)));
+}
+
+static void
+jsonlog_writer_sigterm(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sigterm = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+static void
+jsonlog_writer_sighup(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+/*
+ * jsonlog_writer_main
+ *
+ * Main loop of the worker draining the ring.
+ */
+void
+jsonlog_writer_main(Datum main_arg)
+{
+	am_jsonlog_writer = true;
+
+	pqsignal(SIGHUP, jsonlog_writer_sighup);
+	pqsignal(SIGTERM, jsonlog_writer_sigterm);
+	BackgroundWorkerUnblockSignals();
+
+	write_buf = palloc(JSONLOG_WRITE_BUFFER_SIZE);
+
+	/* Past messages dropped have been reported by the previous writer */
+	dropped_reported = pg_atomic_read_u64(&jsonlog_ring->dropped);
+
+	jsonlog_ring->writer_latch = MyLatch;
+	pg_write_barrier();
+	pg_atomic_write_u32(&jsonlog_ring->writer_pid, MyProcPid);
+	before_shmem_exit(jsonlog_writer_shutdown, (Datum) 0);
+
+	while (!got_sigterm)
+	{
+		ResetLatch(MyLatch);
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		(void) jsonlog_writer_drain();
+		jsonlog_writer_report_dropped();
+
+#if PG_VERSION_NUM >= 120000
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 JSONLOG_WRITER_NAPTIME,
+						 PG_WAIT_EXTENSION);
+#elif PG_VERSION_NUM >= 100000
+		if (WaitLatch(MyLatch,
+					  WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					  JSONLOG_WRITER_NAPTIME,
+					  PG_WAIT_EXTENSION) & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+#else
+		if (WaitLatch(MyLatch,
+					  WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					  JSONLOG_WRITER_NAPTIME) & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+#endif
+	}
+
+	proc_exit(0);
+}
@@ -0,0 +1,195 @@
+# Copyright (c) 2023-2026, PostgreSQL Global Development Group
+
+# Check the logs written with each destination of jsonlog: the lines are
+# valid JSON, the messages dropped when the ring of asynchronous logging
+# is full are reported, the log files are rotated once large enough, and
+# the messages suppressed by jsonlog.rate_limit are reported.
+
+use strict;
+use warnings;
+
+use JSON::PP;
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+use Time::HiRes qw(usleep);
+
+# Get the lines logged by a node, from its server log for "stderr" and
+# from the files of log_directory for the other destinations.
+sub jsonlog_lines
+{
+	my ($node, $destination, $offset) = @_;
+	my $contents = '';
+
+	if ($destination eq 'stderr')
+	{
+		$contents = slurp_file($node->logfile, $offset);
+	}
+	else
+	{
+		$contents .= slurp_file($_) foreach (jsonlog_files($node));
+	}
+
+	return split(/\n/, $contents);
+}
+
+# Get the log files of a node written by jsonlog, in creation order
+sub jsonlog_files
+{
+	my ($node) = @_;
+	my $logdir = $node->data_dir . '/log';
+
+	opendir(my $dh, $logdir) or die "could not open $logdir: $!";
+	my @files = sort grep { /^jsonlog-.*\.json$/ } readdir($dh);
+	closedir($dh);
+
+	return map { "$logdir/$_" } @files;
+}
+
+# Wait for a line logged whose decoded contents match a condition,
+# returning it.
+sub wait_for_jsonlog
+{
+	my ($node, $destination, $offset, $condition) = @_;
+	my $max_attempts = 10 * $PostgreSQL::Test::Utils::timeout_default;
+
+	for (my $attempt = 0; $attempt < $max_attempts; $attempt++)
+	{
+		foreach my $line (jsonlog_lines($node, $destination, $offset))
+		{
+			my $json = eval { decode_json($line) };
+
+			return $json if defined($json) && $condition->($json);
+		}
+		usleep(100_000);
+	}
+	return undef;
+}
+
+foreach my $destination ('stderr', 'async', 'file')
+{
+	my $node = PostgreSQL::Test::Cluster->new("node_$destination");
+	$node->init;
+	$node->append_conf(
+		'postgresql.conf', qq{
+shared_preload_libraries = 'jsonlog'
+cluster_name = 'jsonlog_$destination'
+jsonlog.destination = '$destination'
+jsonlog.async_buffer_size = '64kB'
+jsonlog.rotation_size = '16kB'
+});
+	$node->start;
+	my $offset = -s $node->logfile;
+
+	# A message with characters to escape reaches the log
+	$node->safe_psql('postgres',
+		q{DO $$BEGIN RAISE LOG 'jsonlog marker "quoted" \ and%tab', E'\t'; END$$});
+	my $marker = wait_for_jsonlog(
+		$node, $destination, $offset,
+		sub {
+			my $json = shift;
+			return ($json->{message} // '') =~ /^jsonlog marker/;
+		});
+	is( $marker->{message},
+		"jsonlog marker \"quoted\" \\ and\ttab",
+		"$destination: message logged");
+	is($marker->{error_severity}, 'LOG', "$destination: severity logged");
+	like($marker->{timestamp}, qr/^\d{4}-\d\d-\d\dT\d\d:\d\d:\d\d\.\d{3}Z$/,
+		"$destination: timestamp logged");
+
+	# Messages dropped while the writer is stopped are reported once it
+	# runs again.
+  SKIP:
+	{
+		skip 'messages dropped only with async', 2
+		  if $destination ne 'async';
+		skip 'writer cannot be stopped on Windows', 2 if $windows_os;
+
+		my ($ps) = run_command([ 'ps', '-eo', 'pid=,args=' ]);
+		my ($writer) = $ps =~ /^\s*(\d+)\s.*jsonlog_async: jsonlog writer/m;
+		ok(defined($writer), "$destination: writer running");
+
+		kill('STOP', $writer);
+		$node->safe_psql('postgres',
+			q{DO $$BEGIN FOR i IN 1..500 LOOP RAISE LOG 'flood %', repeat('x', 1000); END LOOP; END$$}
+		);
+		kill('CONT', $writer);
+
+		my $dropped = wait_for_jsonlog(
+			$node, $destination, $offset,
+			sub {
+				my $json = shift;
+				return ($json->{message} // '') =~
+				  /^\d+ messages dropped as the jsonlog buffer was full$/;
+			});
+		ok( defined($dropped)
+			  && $dropped->{message} =~ /^([1-9]\d*) messages dropped/,
+			"$destination: messages dropped reported");
+	}
+
+	# Similar messages past the burst of jsonlog.rate_limit are suppressed,
+	# the session reporting how many at exit.
+	$node->safe_psql(
+		'postgres', q{
+SET jsonlog.rate_limit = 1;
+DO $$BEGIN FOR i IN 1..100 LOOP RAISE LOG 'rate limited %', i; END LOOP; END$$;
+});
+	my $suppressed = wait_for_jsonlog(
+		$node, $destination, $offset,
+		sub {
+			my $json = shift;
+			return defined($json->{suppressed});
+		});
+	ok( defined($suppressed)
+		  && $suppressed->{suppressed} > 0
+		  && $suppressed->{message} eq
+		  "suppressed $suppressed->{suppressed} similar messages"
+		  && defined($suppressed->{message_template}),
+		"$destination: messages suppressed reported");
+
+	my ($limited, $total_suppressed) = (0, 0);
+	foreach my $line (jsonlog_lines($node, $destination, $offset))
+	{
+		my $json = eval { decode_json($line) };
+
+		next unless defined($json);
+		$limited++ if ($json->{message} // '') =~ /^rate limited \d+$/;
+		$total_suppressed += $json->{suppressed} // 0;
+	}
+	is($limited + $total_suppressed,
+		100, "$destination: messages logged or suppressed");
+
+	# A file is rotated once larger than jsonlog.rotation_size.  The new
+	# file is created at least one second after the first one, so as its
+	# name differs.
+  SKIP:
+	{
+		skip 'no log files with stderr', 2 if $destination eq 'stderr';
+
+		sleep(1);
+		$node->safe_psql('postgres',
+			q{DO $$BEGIN FOR i IN 1..30 LOOP RAISE LOG 'rotation %', repeat('x', 1000); END LOOP; END$$}
+		);
+
+		my $max_attempts = 10 * $PostgreSQL::Test::Utils::timeout_default;
+		my @files = jsonlog_files($node);
+		for (my $attempt = 0; $attempt < $max_attempts; $attempt++)
+		{
+			last if scalar(@files) >= 2;
+			usleep(100_000);
+			@files = jsonlog_files($node);
+		}
+		cmp_ok(scalar(@files), '>=', 2, "$destination: log file rotated");
+		cmp_ok(-s $files[0], '>=', 16 * 1024,
+			"$destination: size of the log file rotated");
+	}
+
+	# All the lines written are valid JSON
+	$node->stop;
+	my @lines = jsonlog_lines($node, $destination, $offset);
+	my @invalid = grep { !defined(eval { decode_json($_) }) } @lines;
+	cmp_ok(scalar(@lines), '>', 0, "$destination: lines logged");
+	is_deeply(\@invalid, [], "$destination: all lines are valid JSON");
+}
+
+done_testing();
@@ -12,28 +12,119 @@
  */
 
 #include "postgres_fe.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
 #include "getopt_long.h"
 
+#include "access/rmgr.h"
+#include "access/xact.h"
 #include "access/xlogdefs.h"
 #include "access/xlog_internal.h"
+#include "catalog/dbcommands_xlog.h"
+#include "catalog/storage_xlog.h"
+#include "portability/instr_time.h"
+
+#include "pg_wal_blocks.h"
 
 #define PG_WAL_BLOCKS_VERSION "0.1"
 
+/* Maximum time to wait for new WAL in follow mode, in milliseconds */
+#define FOLLOW_WAIT_TIMEOUT		1000
+
 static const char *progname;
 
 /* Global parameters */
 static bool verbose = false;
-static char *full_path = NULL;
+static char *wal_directory = NULL;
+static char *summary_path = NULL;
+static bool merge = false;
+static int	jobs = 1;
+static ReadMode read_mode = READ_MODE_CHUNK;
+static bool follow = false;
+static char *checkpoint_path = NULL;
+static bool print_blocks = true;
+static bool fpi_stats_csv = false;
+static char *prewarm_path = NULL;
+static int	prewarm_blocks = 0;
+static uint64 prewarm_half_life = UINT64CONST(1024) * 1024 * 1024;
+static uint64 workset_window = 0;
 static uint32 WalSegSz = DEFAULT_XLOG_SEG_SIZE; /* should be settable */
 
 /* Data regarding input WAL to parse */
-static XLogSegNo segno = 0;
+static TimeLineID timeline = 1;
+
+/*
+ * Range of records parsed by a thread, the ones beginning in a segment
+ * between start_lsn and end_lsn.  The block references found are kept in
+ * order, to be consumed once all the ranges before it are done.
+ */
+typedef struct SegmentRange
+{
+	XLogSegNo	segno;			/* segment of the range */
+	XLogRecPtr	start_lsn;		/* start of the range */
+	XLogRecPtr	end_lsn;		/* end of the range */
+	XLogRecPtr	read_lsn;		/* end of the records read */
+	bool		failed;			/* no record could be read? */
+	bool		done;			/* parsing complete? */
+	uint64		bytes_read;		/* bytes of WAL read */
+	BlockRef   *refs;			/* block references found */
+	int			nrefs;
+	int			maxrefs;
+	WorkingSet *workset;		/* sketches of the range, or NULL */
+} SegmentRange;
+
+/*
+ * Analysis data gathered by a thread over all the ranges it parses, merged
+ * into the global data once the thread is done.  The working set is
+ * gathered per range instead, for its windows to be completed as the
+ * ranges are consumed.
+ */
+typedef struct ParseContext
+{
+	FpiStats   *fpi_stats;
+	PrewarmList *prewarm;
+} ParseContext;
+
+/* Global analysis data, NULL if not requested */
+static FpiStats *fpi_stats = NULL;
+static PrewarmList *prewarm = NULL;
+static WorkingSet *workset = NULL;
+static XLogRecPtr prewarm_end_lsn = InvalidXLogRecPtr;
+
+/*
+ * Ranges to parse, grabbed by the threads in order.  A thread does not grab
+ * a range more than RANGE_WINDOW_PER_JOB * jobs ranges past the oldest one
+ * not yet consumed, so as the block references kept in memory stay bounded
+ * when one range is slow to parse.
+ */
+#define RANGE_WINDOW_PER_JOB	2
+
+static SegmentRange *ranges = NULL;
+static int	nranges = 0;
+static int	next_range = 0;
+static int	consumed_ranges = 0;
+static pthread_mutex_t range_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t range_done = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t range_consumed = PTHREAD_COND_INITIALIZER;
+
+/* State of follow mode */
+static volatile sig_atomic_t follow_stop = false;
+static int	follow_inotify_fd = -1;
 
 /* Structures for XLOG reader callback */
 typedef struct XLogReadBlockPrivate
 {
-	const char *full_path;
 	TimeLineID	timeline;
+	XLogSegNo	segno;			/* segment of the range parsed */
+	SegmentReader reader;		/* reads of segments, except in page mode */
 } XLogReadBlockPrivate;
 static int	XLogReadPageBlock(XLogReaderState *xlogreader,
 							  XLogRecPtr targetPagePtr,
@@ -44,11 +135,31 @@ static void
 usage(const char *progname)
 {
 	printf("%s tracks relation blocks touched by WAL records.\n\n", progname);
-	printf("Usage:\n %s [OPTION] [WAL_SEGMENT]...\n\n", progname);
+	printf("Usage:\n %s [OPTION] [STARTSEG [ENDSEG]]\n", progname);
+	printf(" %s --merge --summary=FILE [SUMMARY]...\n\n", progname);
 	printf("Options:\n");
-	printf("  -v             write some progress messages as well\n");
-	printf("  -V, --version  output version information, then exit\n");
-	printf("  -?, --help     show this help, then exit\n");
+	printf("  -c, --checkpoint=FILE in follow mode, resume from and save position to FILE\n");
+	printf("  -E, --end=RECPTR      stop parsing at records beginning at RECPTR\n");
+	printf("  -f, --follow          keep parsing new WAL as it is written\n");
+	printf("  -F, --fpi-stats=FORMAT report full-page image statistics per relation,\n"
+		   "                        as \"table\" or \"csv\"\n");
+	printf("  -H, --prewarm-half-life=MB\n"
+		   "                        WAL halving the weight of a block reference\n"
+		   "                        in the prewarm list (default 1024)\n");
+	printf("  -j, --jobs=NUM        use this many threads to parse segments\n");
+	printf("  -m, --merge           merge the block summaries of consecutive ranges\n");
+	printf("  -n, --prewarm-blocks=NUM\n"
+		   "                        number of blocks in the prewarm list (default all)\n");
+	printf("  -p, --path=PATH       directory of the segments, if no STARTSEG\n");
+	printf("  -r, --read-mode=MODE  read WAL by page, chunk (default) or mmap\n");
+	printf("  -S, --start=RECPTR    start parsing at records beginning at RECPTR\n");
+	printf("  -s, --summary=FILE    write a block summary of the records to FILE\n");
+	printf("  -t, --timeline=TLI    timeline of the records, if no STARTSEG\n");
+	printf("  -v                    write some progress messages as well\n");
+	printf("  -w, --prewarm=FILE    write a prewarm list for autoprewarm to FILE\n");
+	printf("  -W, --working-set=MB  estimate the blocks modified per window of MB of WAL\n");
+	printf("  -V, --version         output version information, then exit\n");
+	printf("  -?, --help            show this help, then exit\n");
 	printf("\n");
 	printf("Report bugs to https://github.com/michaelpq/pg_plugins.\n");
 }
@@ -83,18 +194,30 @@ split_path(const char *path, char **dir, char **fname)
 	}
 }
 
+/*
+ * Build the path of a segment, located in the directory given in input.
+ */
+void
+segment_path(char *path, XLogSegNo seg, TimeLineID tli)
+{
+	char		fname[MAXFNAMELEN];
+
+	XLogFileName(fname, tli, seg, WalSegSz);
+	snprintf(path, MAXPGPATH, "%s%s",
+			 wal_directory != NULL ? wal_directory : "", fname);
+}
+
 static void
 XLogOpenSegment(XLogReaderState *state, XLogSegNo nextSegNo,
 				TimeLineID *tli_p)
 {
-	XLogReadBlockPrivate *private =
-		(XLogReadBlockPrivate *) state->private_data;
+	char		path[MAXPGPATH];
 
-	state->seg.ws_file = open(private->full_path, O_RDONLY | PG_BINARY, 0);
+	segment_path(path, nextSegNo, *tli_p);
+	state->seg.ws_file = open(path, O_RDONLY | PG_BINARY, 0);
 	if (state->seg.ws_file < 0)
 	{
-		fprintf(stderr, "could not open file \"%s\": %m\n",
-				private->full_path);
+		fprintf(stderr, "could not open file \"%s\": %m\n", path);
 		exit(EXIT_FAILURE);
 	}
 }
@@ -117,6 +240,35 @@ XLogReadPageBlock(XLogReaderState *state, XLogRecPtr targetPagePtr,
 	XLogReadBlockPrivate *private =
 		(XLogReadBlockPrivate *) state->private_data;
 	WALReadError errinfo;
+	XLogSegNo	target_segno;
+
+	/*
+	 * Records at the end of the segment can continue in the next one, which
+	 * is read if present.  If not, this is the end of the WAL available.
+	 */
+	XLByteToSeg(targetPagePtr, target_segno, WalSegSz);
+	if (target_segno != private->segno)
+	{
+		if (!segment_file_exists(target_segno, private->timeline))
+			return -1;
+
+		/* In follow mode, the reader moves on to this segment */
+		if (follow)
+			private->segno = target_segno;
+	}
+
+	/*
+	 * Large reads, pages being served from memory.  Compressed segments are
+	 * always decompressed in memory.
+	 */
+	if (read_mode != READ_MODE_PAGE ||
+		segment_reader_compressed(&private->reader, target_segno))
+	{
+		segment_reader_read(&private->reader, target_segno,
+							XLogSegmentOffset(targetPagePtr, WalSegSz),
+							readBuf, XLOG_BLCKSZ);
+		return XLOG_BLCKSZ;
+	}
 
 	/*
 	 * Note that WalRead() is in charge of opening the segment to read and it
@@ -145,18 +297,178 @@ XLogReadPageBlock(XLogReaderState *state, XLogRecPtr targetPagePtr,
 		exit(EXIT_FAILURE);
 	}
 
+	private->reader.bytes_read += XLOG_BLCKSZ;
 	return XLOG_BLCKSZ;
 }
 
+/*
+ * Add a block reference to a range.
+ */
+static void
+add_block_ref(SegmentRange *range, const RelFileLocator *rlocator,
+			  ForkNumber forknum, BlockNumber blkno, bool limit)
+{
+	BlockRef   *ref;
+
+	if (range->nrefs >= range->maxrefs)
+	{
+		range->maxrefs = Max(range->maxrefs * 2, 1024);
+		range->refs = pg_realloc(range->refs,
+								 sizeof(BlockRef) * range->maxrefs);
+	}
+
+	ref = &range->refs[range->nrefs++];
+	ref->rlocator = *rlocator;
+	ref->forknum = forknum;
+	ref->blkno = blkno;
+	ref->limit = limit;
+}
+
+/*
+ * Add limit blocks for the relations dropped by a transaction commit or
+ * abort record.  The record is parsed as ParseCommitRecord() and
+ * ParseAbortRecord() do, up to the list of relations, which comes at the
+ * same place for both.
+ */
+static void
+extract_xact_dropped_rels(XLogReaderState *record, SegmentRange *range)
+{
+	uint8		info = XLogRecGetInfo(record);
+	char	   *data = XLogRecGetData(record);
+	xl_xact_xinfo *xl_xinfo;
+	xl_xact_relfilelocators *xl_rels;
+
+	/* xl_xact_commit and xl_xact_abort both hold only the xact time */
+	data += MinSizeOfXactCommit;
+
+	if ((info & XLOG_XACT_HAS_INFO) == 0)
+		return;
+
+	xl_xinfo = (xl_xact_xinfo *) data;
+	data += sizeof(xl_xact_xinfo);
+
+	if ((xl_xinfo->xinfo & XACT_XINFO_HAS_RELFILELOCATORS) == 0)
+		return;
+
+	if ((xl_xinfo->xinfo & XACT_XINFO_HAS_DBINFO) != 0)
+		data += sizeof(xl_xact_dbinfo);
+
+	if ((xl_xinfo->xinfo & XACT_XINFO_HAS_SUBXACTS) != 0)
+	{
+		xl_xact_subxacts *xl_subxacts = (xl_xact_subxacts *) data;
+
+		data += MinSizeOfXactSubxacts +
+			xl_subxacts->nsubxacts * sizeof(TransactionId);
+	}
+
+	/*
+	 * The free space map is not WAL-logged, so it does not matter for
+	 * summaries, as for the WAL summarizer.
+	 */
+	xl_rels = (xl_xact_relfilelocators *) data;
+	for (int i = 0; i < xl_rels->nrels; i++)
+	{
+		for (ForkNumber forknum = 0; forknum <= MAX_FORKNUM; forknum++)
+		{
+			if (forknum != FSM_FORKNUM)
+				add_block_ref(range, &xl_rels->xlocators[i], forknum, 0, true);
+		}
+	}
+}
+
 /*
  * extract_block_info
- * Extract block information for given record.
+ * Extract block information for given record, adding it to the range
+ * being parsed.
  */
 static void
-extract_block_info(XLogReaderState *record)
+extract_block_info(XLogReaderState *record, SegmentRange *range)
 {
+	uint8		info = XLogRecGetInfo(record) & ~XLR_INFO_MASK;
 	int			block_id;
 
+	/*
+	 * Relation forks created or truncated get a limit block, as the blocks
+	 * past it are not the ones of the relation fork before the range.
+	 */
+	if (XLogRecGetRmid(record) == RM_SMGR_ID)
+	{
+		if (info == XLOG_SMGR_CREATE)
+		{
+			xl_smgr_create *xlrec = (xl_smgr_create *) XLogRecGetData(record);
+
+			add_block_ref(range, &xlrec->rlocator, xlrec->forkNum, 0, true);
+		}
+		else if (info == XLOG_SMGR_TRUNCATE)
+		{
+			xl_smgr_truncate *xlrec = (xl_smgr_truncate *) XLogRecGetData(record);
+
+			if ((xlrec->flags & SMGR_TRUNCATE_HEAP) != 0)
+				add_block_ref(range, &xlrec->rlocator, MAIN_FORKNUM,
+							  xlrec->blkno, true);
+			if ((xlrec->flags & SMGR_TRUNCATE_FSM) != 0)
+				add_block_ref(range, &xlrec->rlocator, FSM_FORKNUM, 0, true);
+			if ((xlrec->flags & SMGR_TRUNCATE_VM) != 0)
+				add_block_ref(range, &xlrec->rlocator, VISIBILITYMAP_FORKNUM,
+							  0, true);
+		}
+	}
+
+	/*
+	 * Databases created or dropped get a limit block on a relation number
+	 * of 0 in each tablespace involved, meaning all their relations, as
+	 * done by the WAL summarizer.
+	 */
+	if (XLogRecGetRmid(record) == RM_DBASE_ID)
+	{
+		RelFileLocator rlocator;
+
+		rlocator.relNumber = 0;
+
+		if (info == XLOG_DBASE_CREATE_FILE_COPY)
+		{
+			xl_dbase_create_file_copy_rec *xlrec =
+				(xl_dbase_create_file_copy_rec *) XLogRecGetData(record);
+
+			rlocator.spcOid = xlrec->tablespace_id;
+			rlocator.dbOid = xlrec->db_id;
+			add_block_ref(range, &rlocator, MAIN_FORKNUM, 0, true);
+		}
+		else if (info == XLOG_DBASE_CREATE_WAL_LOG)
+		{
+			xl_dbase_create_wal_log_rec *xlrec =
+				(xl_dbase_create_wal_log_rec *) XLogRecGetData(record);
+
+			rlocator.spcOid = xlrec->tablespace_id;
+			rlocator.dbOid = xlrec->db_id;
+			add_block_ref(range, &rlocator, MAIN_FORKNUM, 0, true);
+		}
+		else if (info == XLOG_DBASE_DROP)
+		{
+			xl_dbase_drop_rec *xlrec =
+				(xl_dbase_drop_rec *) XLogRecGetData(record);
+
+			rlocator.dbOid = xlrec->db_id;
+			for (int i = 0; i < xlrec->ntablespaces; i++)
+			{
+				rlocator.spcOid = xlrec->tablespace_ids[i];
+				add_block_ref(range, &rlocator, MAIN_FORKNUM, 0, true);
+			}
+		}
+	}
+
+	/* Relations dropped by a transaction get a limit block for each fork */
+	if (XLogRecGetRmid(record) == RM_XACT_ID)
+	{
+		uint8		xact_info = XLogRecGetInfo(record) & XLOG_XACT_OPMASK;
+
+		if (xact_info == XLOG_XACT_COMMIT ||
+			xact_info == XLOG_XACT_COMMIT_PREPARED ||
+			xact_info == XLOG_XACT_ABORT ||
+			xact_info == XLOG_XACT_ABORT_PREPARED)
+			extract_xact_dropped_rels(record, range);
+	}
+
 	for (block_id = 0; block_id <= XLogRecMaxBlockId(record); block_id++)
 	{
 		RelFileLocator rlocator;
@@ -167,78 +479,639 @@ extract_block_info(XLogReaderState *record)
 										&forknum, &blkno, NULL))
 			continue;
 
+		add_block_ref(range, &rlocator, forknum, blkno, false);
+	}
+}
+
+/*
+ * print_block_refs
+ * Print the blocks of the main fork referenced in a range.
+ */
+static void
+print_block_refs(SegmentRange *range)
+{
+	for (int i = 0; i < range->nrefs; i++)
+	{
+		BlockRef   *ref = &range->refs[i];
+
 		/* We only care about the main fork */
-		if (forknum != MAIN_FORKNUM)
+		if (ref->limit || ref->forknum != MAIN_FORKNUM)
 			continue;
 
-		/*
-		 * Print information of block touched. TODO: more advanced logic
-		 * (really needed?)
-		 */
 		fprintf(stderr, "Block touched: dboid = %u, relid = %u, block = %u\n",
-				rlocator.dbOid, rlocator.relNumber, blkno);
+				ref->rlocator.dbOid, ref->rlocator.relNumber, ref->blkno);
 	}
 }
 
 /*
- * do_wal_parsing
- * Central part where the actual parsing work happens.
+ * parse_segment
+ * Parse the records beginning in a range, which is part of a single
+ * segment.  Records continuing in the next segment are read from it.
  */
 static void
-do_wal_parsing(TimeLineID timeline)
+parse_segment(SegmentRange *range, ParseContext *context)
 {
 	XLogReadBlockPrivate private;
 	XLogRecord *record;
 	XLogReaderState *state;
 	char	   *errormsg;
-	XLogRecPtr	first_record;
 	XLogRecPtr	next_record;
 
-	private.full_path = full_path;
 	private.timeline = timeline;
+	private.segno = range->segno;
+	segment_reader_init(&private.reader, read_mode, timeline, WalSegSz);
 
-	/* Set the first record to look at */
-	XLogSegNoOffsetToRecPtr(segno, 0, WalSegSz, first_record);
 	state = XLogReaderAllocate(WalSegSz, NULL,
 							   XL_ROUTINE(.page_read = &XLogReadPageBlock,
 										  .segment_open = &XLogOpenSegment,
 										  .segment_close = &XLogCloseSegment),
 							   &private);
+	if (state == NULL)
+	{
+		fprintf(stderr, "out of memory while allocating a WAL reading processor\n");
+		exit(EXIT_FAILURE);
+	}
+
+	range->read_lsn = range->start_lsn;
 
 	/* first find a valid recptr to start from */
-	next_record = XLogFindNextRecord(state, first_record, &errormsg);
+	next_record = XLogFindNextRecord(state, range->start_lsn, &errormsg);
 
 	if (XLogRecPtrIsInvalid(next_record))
 	{
 		if (errormsg)
 			fprintf(stderr, "could not find valid first record after %X/%X: %s\n",
-					(uint32) (first_record >> 32), (uint32) first_record,
-					errormsg);
+					(uint32) (range->start_lsn >> 32),
+					(uint32) range->start_lsn, errormsg);
 		else
 			fprintf(stderr, "could not find valid first record after %X/%X\n",
-					(uint32) (first_record >> 32), (uint32) first_record);
-		exit(EXIT_FAILURE);
+					(uint32) (range->start_lsn >> 32),
+					(uint32) range->start_lsn);
+		range->failed = true;
+		XLogReaderFree(state);
+		range->bytes_read = private.reader.bytes_read;
+		segment_reader_free(&private.reader);
+		return;
 	}
 
 	XLogBeginRead(state, next_record);
 
 	/* Loop through all the records */
-	do
+	for (;;)
 	{
 		/* Move on to next record */
 		record = XLogReadRecord(state, &errormsg);
 
 		if (record == NULL)
+		{
+			if (errormsg)
+				fprintf(stderr, "error reading xlog record: %s\n", errormsg);
 			break;
+		}
 
-		if (errormsg)
-			fprintf(stderr, "error reading xlog record: %s\n", errormsg);
+		/* Records beginning past the range are for the next one */
+		if (state->ReadRecPtr >= range->end_lsn)
+		{
+			range->read_lsn = range->end_lsn;
+			break;
+		}
+		range->read_lsn = state->EndRecPtr;
 
 		/* extract block information for this record */
-		extract_block_info(state);
-	} while (record != NULL);
+		if (summary_path != NULL || print_blocks)
+			extract_block_info(state, range);
+		if (context->fpi_stats != NULL)
+			fpi_stats_add_record(context->fpi_stats, state);
+		if (context->prewarm != NULL)
+			prewarm_add_record(context->prewarm, state);
+		if (range->workset != NULL)
+			workset_add_record(range->workset, state);
+	}
 
 	XLogReaderFree(state);
+	range->bytes_read = private.reader.bytes_read;
+	segment_reader_free(&private.reader);
+}
+
+/*
+ * parse_thread
+ * Thread parsing ranges until there are none left to grab.  Ranges are
+ * grabbed in LSN order, so as they complete roughly in this order, waiting
+ * for the oldest ones to be consumed when too far ahead of them.
+ */
+static void *
+parse_thread(void *arg)
+{
+	ParseContext context;
+
+	memset(&context, 0, sizeof(ParseContext));
+	if (fpi_stats != NULL)
+		context.fpi_stats = fpi_stats_create();
+	if (prewarm != NULL)
+		context.prewarm = prewarm_create(prewarm_end_lsn, prewarm_half_life);
+
+	for (;;)
+	{
+		SegmentRange *range;
+
+		pthread_mutex_lock(&range_mutex);
+		while (next_range < nranges &&
+			   next_range >= consumed_ranges + RANGE_WINDOW_PER_JOB * jobs)
+			pthread_cond_wait(&range_consumed, &range_mutex);
+		if (next_range >= nranges)
+		{
+			pthread_mutex_unlock(&range_mutex);
+			break;
+		}
+		range = &ranges[next_range++];
+		pthread_mutex_unlock(&range_mutex);
+
+		if (workset != NULL)
+			range->workset = workset_create(workset_window);
+		parse_segment(range, &context);
+
+		pthread_mutex_lock(&range_mutex);
+		range->done = true;
+		pthread_cond_broadcast(&range_done);
+		pthread_mutex_unlock(&range_mutex);
+	}
+
+	if (context.fpi_stats != NULL)
+	{
+		pthread_mutex_lock(&range_mutex);
+		fpi_stats_merge(fpi_stats, context.fpi_stats);
+		pthread_mutex_unlock(&range_mutex);
+		fpi_stats_free(context.fpi_stats);
+	}
+	if (context.prewarm != NULL)
+	{
+		pthread_mutex_lock(&range_mutex);
+		prewarm_merge(prewarm, context.prewarm);
+		pthread_mutex_unlock(&range_mutex);
+		prewarm_free(context.prewarm);
+	}
+
+	return NULL;
+}
+
+/*
+ * do_wal_parsing
+ * Central part where the actual parsing work happens.  The ranges of
+ * records are parsed by a pool of threads, and their block references
+ * are consumed in LSN order as each range completes.
+ */
+static void
+do_wal_parsing(void)
+{
+	pthread_t  *threads;
+	int			nthreads = Min(jobs, nranges);
+	BlockRefTable *brtab = NULL;
+	XLogRecPtr	end_lsn = InvalidXLogRecPtr;
+	bool		failed = false;
+	uint64		bytes_read = 0;
+	instr_time	start_time;
+	instr_time	duration;
+
+	if (summary_path != NULL)
+		brtab = CreateEmptyBlockRefTable();
+
+	INSTR_TIME_SET_CURRENT(start_time);
+
+	threads = pg_malloc(sizeof(pthread_t) * nthreads);
+	for (int i = 0; i < nthreads; i++)
+	{
+		int			rc = pthread_create(&threads[i], NULL, parse_thread, NULL);
+
+		if (rc != 0)
+		{
+			fprintf(stderr, "could not create thread: %s\n", strerror(rc));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (int i = 0; i < nranges; i++)
+	{
+		SegmentRange *range = &ranges[i];
+
+		pthread_mutex_lock(&range_mutex);
+		while (!range->done)
+			pthread_cond_wait(&range_done, &range_mutex);
+		pthread_mutex_unlock(&range_mutex);
+
+		if (range->failed)
+			failed = true;
+		bytes_read += range->bytes_read;
+
+		if (brtab != NULL)
+		{
+			/* The summary stops at the first range not read entirely */
+			if (XLogRecPtrIsInvalid(end_lsn))
+				summary_add_refs(brtab, range->refs, range->nrefs);
+		}
+		else if (print_blocks)
+			print_block_refs(range);
+
+		if (verbose)
+		{
+			char		fname[MAXFNAMELEN];
+
+			XLogFileName(fname, timeline, range->segno, WalSegSz);
+			fprintf(stderr, "segment %s: %d block references in records up to %X/%X\n",
+					fname, range->nrefs,
+					(uint32) (range->read_lsn >> 32), (uint32) range->read_lsn);
+		}
+
+		if (XLogRecPtrIsInvalid(end_lsn) && range->read_lsn < range->end_lsn)
+		{
+			end_lsn = range->read_lsn;
+			if (i < nranges - 1)
+				fprintf(stderr, "records missing after %X/%X\n",
+						(uint32) (end_lsn >> 32), (uint32) end_lsn);
+		}
+
+		pg_free(range->refs);
+		range->refs = NULL;
+
+		/* The windows before the end of this range are complete */
+		if (range->workset != NULL)
+		{
+			workset_merge(workset, range->workset);
+			workset_free(range->workset);
+			range->workset = NULL;
+			workset_complete(workset, range->end_lsn);
+		}
+
+		pthread_mutex_lock(&range_mutex);
+		consumed_ranges = i + 1;
+		pthread_cond_broadcast(&range_consumed);
+		pthread_mutex_unlock(&range_mutex);
+	}
+
+	for (int i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pg_free(threads);
+
+	/* Throughput of the reads, to compare read modes */
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start_time);
+	if (verbose)
+	{
+		double		secs = INSTR_TIME_GET_DOUBLE(duration);
+
+		fprintf(stderr, "read %.1f MB of WAL in %.3f s (%.1f MB/s) in %s mode with %d jobs\n",
+				bytes_read / (1024.0 * 1024.0), secs,
+				secs > 0 ? bytes_read / (1024.0 * 1024.0) / secs : 0.0,
+				read_mode_name(read_mode), nthreads);
+	}
+
+	if (XLogRecPtrIsInvalid(end_lsn))
+		end_lsn = ranges[nranges - 1].end_lsn;
+
+	if (brtab != NULL)
+	{
+		summary_write(summary_path, brtab, timeline, ranges[0].start_lsn,
+					  end_lsn);
+		if (verbose)
+			fprintf(stderr, "block summary \"%s\" written for %X/%X to %X/%X\n",
+					summary_path,
+					(uint32) (ranges[0].start_lsn >> 32),
+					(uint32) ranges[0].start_lsn,
+					(uint32) (end_lsn >> 32), (uint32) end_lsn);
+	}
+
+	if (fpi_stats != NULL)
+		fpi_stats_report(fpi_stats, fpi_stats_csv);
+	if (workset != NULL)
+		workset_report(workset);
+	if (prewarm != NULL)
+	{
+		prewarm_write(prewarm, prewarm_path, prewarm_blocks);
+		if (verbose)
+			fprintf(stderr, "prewarm list \"%s\" written\n", prewarm_path);
+	}
+
+	if (failed)
+		exit(EXIT_FAILURE);
+}
+
+/*
+ * Read the position saved in a checkpoint file, or InvalidXLogRecPtr if
+ * there is none.
+ */
+static XLogRecPtr
+read_checkpoint(const char *path)
+{
+	FILE	   *file;
+	uint32		hi;
+	uint32		lo;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+	{
+		if (errno == ENOENT)
+			return InvalidXLogRecPtr;
+		fprintf(stderr, "could not open file \"%s\": %m\n", path);
+		exit(EXIT_FAILURE);
+	}
+	if (fscanf(file, "%X/%X", &hi, &lo) != 2)
+	{
+		fprintf(stderr, "invalid contents in checkpoint file \"%s\"\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(file);
+
+	return ((uint64) hi) << 32 | lo;
+}
+
+/*
+ * Save a position in a checkpoint file, all the block references of the
+ * records before it having been emitted.  The file is replaced durably,
+ * its directory being flushed after the rename.
+ */
+static void
+write_checkpoint(const char *path, XLogRecPtr lsn)
+{
+	char		tmp_path[MAXPGPATH];
+	FILE	   *file;
+	char	   *dir;
+	char	   *fname;
+	int			fd;
+
+	snprintf(tmp_path, MAXPGPATH, "%s.tmp", path);
+	file = fopen(tmp_path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "could not create file \"%s\": %m\n", tmp_path);
+		exit(EXIT_FAILURE);
+	}
+	if (fprintf(file, "%X/%X\n", (uint32) (lsn >> 32), (uint32) lsn) < 0 ||
+		fflush(file) != 0 || fsync(fileno(file)) != 0)
+	{
+		fprintf(stderr, "could not write file \"%s\": %m\n", tmp_path);
+		exit(EXIT_FAILURE);
+	}
+	if (fclose(file) != 0)
+	{
+		fprintf(stderr, "could not close file \"%s\": %m\n", tmp_path);
+		exit(EXIT_FAILURE);
+	}
+	if (rename(tmp_path, path) != 0)
+	{
+		fprintf(stderr, "could not rename file \"%s\" to \"%s\": %m\n",
+				tmp_path, path);
+		exit(EXIT_FAILURE);
+	}
+
+	split_path(path, &dir, &fname);
+	fd = open(dir != NULL ? dir : ".", O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "could not open directory \"%s\": %m\n",
+				dir != NULL ? dir : ".");
+		exit(EXIT_FAILURE);
+	}
+	/* Some platforms do not allow to flush directories */
+	if (fsync(fd) != 0 && errno != EBADF && errno != EINVAL)
+	{
+		fprintf(stderr, "could not fsync directory \"%s\": %m\n",
+				dir != NULL ? dir : ".");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	pg_free(dir);
+	pg_free(fname);
+}
+
+static void
+follow_signal(SIGNAL_ARGS)
+{
+	follow_stop = true;
+}
+
+/*
+ * Wait for new WAL to be written.  On Linux, changes in the directory of
+ * the segments are watched with inotify, and the wait is cut short when
+ * a segment is created or written.  Elsewhere, this is a simple poll.
+ */
+static void
+follow_wait(void)
+{
+#ifdef __linux__
+	if (follow_inotify_fd >= 0)
+	{
+		struct pollfd pfd;
+
+		pfd.fd = follow_inotify_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, FOLLOW_WAIT_TIMEOUT) > 0)
+		{
+			char		buf[4096];
+
+			/* Consume the events, only the wakeup matters */
+			while (read(follow_inotify_fd, buf, sizeof(buf)) > 0)
+				;
+		}
+		return;
+	}
+#endif
+
+	pg_usleep(FOLLOW_WAIT_TIMEOUT * 1000L);
+}
+
+/*
+ * do_wal_follow
+ * Parse records continuously from start_lsn, waiting for new WAL once
+ * the end of the WAL written is reached, until interrupted.  The block
+ * references are emitted record by record, and the position reached is
+ * saved in the checkpoint file each time the end of WAL is reached, at
+ * each segment switch and when stopping, if it moved since last saved.
+ */
+static void
+do_wal_follow(XLogRecPtr start_lsn)
+{
+	XLogReadBlockPrivate private;
+	XLogReaderState *state;
+	XLogRecord *record;
+	char	   *errormsg;
+	XLogRecPtr	next_record;
+	XLogRecPtr	next_lsn = start_lsn;
+	XLogRecPtr	checkpoint_lsn = InvalidXLogRecPtr;
+	XLogSegNo	checkpoint_segno;
+	SegmentRange range;
+
+	pqsignal(SIGINT, follow_signal);
+	pqsignal(SIGTERM, follow_signal);
+
+#ifdef __linux__
+	follow_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (follow_inotify_fd >= 0 &&
+		inotify_add_watch(follow_inotify_fd,
+						  wal_directory != NULL ? wal_directory : ".",
+						  IN_CREATE | IN_MODIFY | IN_MOVED_TO) < 0)
+	{
+		close(follow_inotify_fd);
+		follow_inotify_fd = -1;
+	}
+#endif
+
+	private.timeline = timeline;
+	XLByteToSeg(start_lsn, private.segno, WalSegSz);
+	segment_reader_init(&private.reader, read_mode, timeline, WalSegSz);
+	memset(&range, 0, sizeof(SegmentRange));
+
+	state = XLogReaderAllocate(WalSegSz, NULL,
+							   XL_ROUTINE(.page_read = &XLogReadPageBlock,
+										  .segment_open = &XLogOpenSegment,
+										  .segment_close = &XLogCloseSegment),
+							   &private);
+	if (state == NULL)
+	{
+		fprintf(stderr, "out of memory while allocating a WAL reading processor\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* The first record may not have been written yet */
+	for (;;)
+	{
+		next_record = XLogFindNextRecord(state, start_lsn, &errormsg);
+		if (!XLogRecPtrIsInvalid(next_record) || follow_stop)
+			break;
+		segment_reader_close(&private.reader);
+		follow_wait();
+	}
+
+	if (!XLogRecPtrIsInvalid(next_record))
+	{
+		XLogBeginRead(state, next_record);
+		XLByteToSeg(next_record, checkpoint_segno, WalSegSz);
+
+		while (!follow_stop)
+		{
+			record = XLogReadRecord(state, &errormsg);
+
+			/*
+			 * End of the WAL written, or a page still being written.  Save the
+			 * position, and retry once new WAL is there.
+			 */
+			if (record == NULL)
+			{
+				if (verbose && errormsg)
+					fprintf(stderr, "waiting for WAL after %X/%X: %s\n",
+							(uint32) (next_lsn >> 32), (uint32) next_lsn,
+							errormsg);
+				fflush(stderr);
+				if (checkpoint_path != NULL && next_lsn != checkpoint_lsn)
+				{
+					write_checkpoint(checkpoint_path, next_lsn);
+					checkpoint_lsn = next_lsn;
+				}
+
+				/* Data in memory may be stale */
+				segment_reader_close(&private.reader);
+				follow_wait();
+				continue;
+			}
+
+			extract_block_info(state, &range);
+			print_block_refs(&range);
+			range.nrefs = 0;
+			next_lsn = state->EndRecPtr;
+
+			if (checkpoint_path != NULL &&
+				!XLByteInSeg(state->ReadRecPtr, checkpoint_segno, WalSegSz))
+			{
+				fflush(stderr);
+				write_checkpoint(checkpoint_path, next_lsn);
+				checkpoint_lsn = next_lsn;
+				XLByteToSeg(state->ReadRecPtr, checkpoint_segno, WalSegSz);
+			}
+		}
+	}
+
+	fflush(stderr);
+	if (checkpoint_path != NULL && next_lsn != checkpoint_lsn)
+		write_checkpoint(checkpoint_path, next_lsn);
+	if (verbose)
+		fprintf(stderr, "stopped following WAL at %X/%X\n",
+				(uint32) (next_lsn >> 32), (uint32) next_lsn);
+
+	XLogReaderFree(state);
+	segment_reader_free(&private.reader);
+	pg_free(range.refs);
+#ifdef __linux__
+	if (follow_inotify_fd >= 0)
+		close(follow_inotify_fd);
+#endif
+}
+
+/*
+ * Parse a LSN given as option.
+ */
+static XLogRecPtr
+parse_lsn(const char *value, const char *option)
+{
+	uint32		hi;
+	uint32		lo;
+
+	if (sscanf(value, "%X/%X", &hi, &lo) != 2)
+	{
+		fprintf(stderr, "%s: invalid value \"%s\" for option %s\n",
+				progname, value, option);
+		exit(1);
+	}
+
+	return ((uint64) hi) << 32 | lo;
+}
+
+/*
+ * Parse a segment file given in input, getting its timeline and segment
+ * number.  The directory of the first segment is the one where all the
+ * segments are looked for.
+ */
+static XLogSegNo
+parse_segment_file(const char *path, bool first)
+{
+	char	   *directory = NULL;
+	char	   *fname = NULL;
+	char		full_path[MAXPGPATH];
+	TimeLineID	tli;
+	XLogSegNo	seg;
+
+	split_path(path, &directory, &fname);
+	segment_strip_suffix(fname);
+
+	if (!IsXLogFileName(fname))
+	{
+		fprintf(stderr, "%s: \"%s\" is not a valid WAL segment name\n",
+				progname, fname);
+		exit(1);
+	}
+
+	/* parse timeline and segment number from file name */
+	XLogFromFileName(fname, &tli, &seg, WalSegSz);
+
+	if (first)
+	{
+		if (directory != NULL)
+			wal_directory = directory;
+		timeline = tli;
+	}
+	else if (tli != timeline)
+	{
+		fprintf(stderr, "%s: segment \"%s\" is on timeline %u, expected %u\n",
+				progname, fname, tli, timeline);
+		exit(1);
+	}
+
+	if (!segment_file_exists(seg, timeline))
+	{
+		segment_path(full_path, seg, timeline);
+		fprintf(stderr, "could not open file \"%s\": %m\n", full_path);
+		exit(1);
+	}
+
+	return seg;
 }
 
 int
@@ -247,12 +1120,30 @@ main(int argc, char **argv)
 	static struct option long_options[] = {
 		{"help", no_argument, NULL, '?'},
 		{"version", no_argument, NULL, 'V'},
+		{"checkpoint", required_argument, NULL, 'c'},
+		{"end", required_argument, NULL, 'E'},
+		{"follow", no_argument, NULL, 'f'},
+		{"fpi-stats", required_argument, NULL, 'F'},
+		{"prewarm", required_argument, NULL, 'w'},
+		{"prewarm-blocks", required_argument, NULL, 'n'},
+		{"prewarm-half-life", required_argument, NULL, 'H'},
+		{"working-set", required_argument, NULL, 'W'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"merge", no_argument, NULL, 'm'},
+		{"path", required_argument, NULL, 'p'},
+		{"read-mode", required_argument, NULL, 'r'},
+		{"start", required_argument, NULL, 'S'},
+		{"summary", required_argument, NULL, 's'},
+		{"timeline", required_argument, NULL, 't'},
 		{"verbose", no_argument, NULL, 'v'},
 		{NULL, 0, NULL, 0}
 	};
 	int			c;
 	int			option_index;
-	TimeLineID	timeline;
+	XLogRecPtr	start_lsn = InvalidXLogRecPtr;
+	XLogRecPtr	end_lsn = InvalidXLogRecPtr;
+	XLogSegNo	start_segno;
+	XLogSegNo	end_segno;
 
 	progname = get_progname(argv[0]);
 
@@ -277,20 +1168,123 @@ main(int argc, char **argv)
 		}
 	}
 
-	while ((c = getopt_long(argc, argv, "v", long_options, &option_index)) != -1)
+	while ((c = getopt_long(argc, argv, "c:E:fF:H:j:mn:p:r:S:s:t:vw:W:", long_options, &option_index)) != -1)
 	{
 		switch (c)
 		{
 			case '?':
 				fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
 				exit(1);
+			case 'c':
+				checkpoint_path = pg_strdup(optarg);
+				break;
+			case 'E':
+				end_lsn = parse_lsn(optarg, "--end");
+				break;
+			case 'f':
+				follow = true;
+				break;
+			case 'F':
+				if (strcmp(optarg, "csv") == 0)
+					fpi_stats_csv = true;
+				else if (strcmp(optarg, "table") != 0)
+				{
+					fprintf(stderr, "%s: invalid statistics format \"%s\"\n",
+							progname, optarg);
+					exit(1);
+				}
+				fpi_stats = fpi_stats_create();
+				break;
+			case 'H':
+				prewarm_half_life = strtoul(optarg, NULL, 10);
+				if (prewarm_half_life == 0)
+				{
+					fprintf(stderr, "%s: prewarm half-life must be at least 1MB\n",
+							progname);
+					exit(1);
+				}
+				prewarm_half_life *= 1024 * 1024;
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs < 1)
+				{
+					fprintf(stderr, "%s: number of jobs must be at least 1\n",
+							progname);
+					exit(1);
+				}
+				break;
+			case 'm':
+				merge = true;
+				break;
+			case 'n':
+				prewarm_blocks = atoi(optarg);
+				if (prewarm_blocks < 0)
+				{
+					fprintf(stderr, "%s: number of prewarm blocks cannot be negative\n",
+							progname);
+					exit(1);
+				}
+				break;
+			case 'p':
+				wal_directory = psprintf("%s/", optarg);
+				break;
+			case 'r':
+				if (!read_mode_parse(optarg, &read_mode))
+				{
+					fprintf(stderr, "%s: invalid read mode \"%s\"\n",
+							progname, optarg);
+					exit(1);
+				}
+				break;
+			case 'S':
+				start_lsn = parse_lsn(optarg, "--start");
+				break;
+			case 's':
+				summary_path = pg_strdup(optarg);
+				break;
+			case 't':
+				timeline = atoi(optarg);
+				break;
 			case 'v':
 				verbose = true;
 				break;
+			case 'w':
+				prewarm_path = pg_strdup(optarg);
+				break;
+			case 'W':
+				workset_window = strtoul(optarg, NULL, 10);
+				if (workset_window == 0)
+				{
+					fprintf(stderr, "%s: working set window must be at least 1MB\n",
+							progname);
+					exit(1);
+				}
+				workset_window *= 1024 * 1024;
+				workset = workset_create(workset_window);
+				break;
+		}
+	}
+
+	/* Merge of summaries, taking all the remaining arguments */
+	if (merge)
+	{
+		if (summary_path == NULL)
+		{
+			fprintf(stderr, "%s: no output summary defined with --summary.\n",
+					progname);
+			exit(1);
 		}
+		if (optind >= argc)
+		{
+			fprintf(stderr, "%s: no input summary defined.\n", progname);
+			exit(1);
+		}
+		summary_merge(summary_path, argv + optind, argc - optind);
+		exit(0);
 	}
 
-	if ((optind + 1) < argc)
+	if ((optind + 2) < argc)
 	{
 		fprintf(stderr,
 				"%s: too many command-line arguments (first is \"%s\")\n",
@@ -298,36 +1292,137 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
-	/* parse files as start/end boundaries, extract path if not specified */
-	if (optind < argc)
+	/* Block references are printed only if nothing else is reported */
+	if (summary_path != NULL || fpi_stats != NULL || prewarm_path != NULL ||
+		workset != NULL)
+		print_blocks = false;
+
+	if (checkpoint_path != NULL && !follow)
 	{
-		char	   *directory = NULL;
-		char	   *fname = NULL;
-		int			fd;
+		fprintf(stderr, "%s: --checkpoint requires --follow\n", progname);
+		exit(1);
+	}
 
-		full_path = pg_strdup(argv[optind]);
+	/* Follow mode, parsing from a start position without end */
+	if (follow)
+	{
+		if (summary_path != NULL || fpi_stats != NULL || prewarm_path != NULL ||
+			workset != NULL || !XLogRecPtrIsInvalid(end_lsn) || jobs > 1 ||
+			optind + 1 < argc)
+		{
+			fprintf(stderr, "%s: --follow cannot be used with --summary, --fpi-stats, --prewarm, --working-set, --end, --jobs or an end segment\n",
+					progname);
+			exit(1);
+		}
 
-		split_path(full_path, &directory, &fname);
+		/*
+		 * A mapping of the segment being written would not see the data
+		 * appended to it, and accessing a segment truncated or recycled
+		 * under it would raise SIGBUS.
+		 */
+		if (read_mode == READ_MODE_MMAP)
+		{
+			fprintf(stderr, "%s: --follow cannot be used with --read-mode=mmap\n",
+					progname);
+			exit(1);
+		}
+
+		if (optind < argc)
+		{
+			start_segno = parse_segment_file(argv[optind], true);
+			if (XLogRecPtrIsInvalid(start_lsn))
+				XLogSegNoOffsetToRecPtr(start_segno, 0, WalSegSz, start_lsn);
+		}
+
+		/* A saved position takes priority, to resume after a restart */
+		if (checkpoint_path != NULL)
+		{
+			XLogRecPtr	checkpoint_lsn = read_checkpoint(checkpoint_path);
+
+			if (!XLogRecPtrIsInvalid(checkpoint_lsn))
+				start_lsn = checkpoint_lsn;
+		}
 
-		fd = open(full_path, O_RDONLY | PG_BINARY, 0);
-		if (fd < 0)
+		if (XLogRecPtrIsInvalid(start_lsn))
 		{
-			fprintf(stderr, "could not open file \"%s\"", fname);
+			fprintf(stderr, "%s: no input file, start LSN or checkpoint defined.\n",
+					progname);
 			exit(1);
 		}
-		close(fd);
 
-		/* parse timeline and segment number from file name */
-		XLogFromFileName(fname, &timeline, &segno, WalSegSz);
+		do_wal_follow(start_lsn);
+		exit(0);
 	}
 
-	if (full_path == NULL)
+	/*
+	 * Parse files as start/end boundaries, the LSNs given in input
+	 * restricting the range further.
+	 */
+	if (optind < argc)
+	{
+		start_segno = parse_segment_file(argv[optind], true);
+		end_segno = start_segno;
+		if (optind + 1 < argc)
+			end_segno = parse_segment_file(argv[optind + 1], false);
+
+		if (end_segno < start_segno)
+		{
+			fprintf(stderr, "%s: end segment is before start segment\n",
+					progname);
+			exit(1);
+		}
+
+		if (XLogRecPtrIsInvalid(start_lsn))
+			XLogSegNoOffsetToRecPtr(start_segno, 0, WalSegSz, start_lsn);
+		if (XLogRecPtrIsInvalid(end_lsn))
+			XLogSegNoOffsetToRecPtr(end_segno + 1, 0, WalSegSz, end_lsn);
+	}
+	else if (XLogRecPtrIsInvalid(start_lsn))
+	{
+		fprintf(stderr, "%s: no input file or start LSN defined.\n", progname);
+		exit(1);
+	}
+	else if (XLogRecPtrIsInvalid(end_lsn))
+	{
+		fprintf(stderr, "%s: no end LSN defined.\n", progname);
+		exit(1);
+	}
+
+	if (end_lsn <= start_lsn)
 	{
-		fprintf(stderr, "%s: no input file defined.\n", progname);
+		fprintf(stderr, "%s: end LSN %X/%X is not after start LSN %X/%X\n",
+				progname,
+				(uint32) (end_lsn >> 32), (uint32) end_lsn,
+				(uint32) (start_lsn >> 32), (uint32) start_lsn);
 		exit(1);
 	}
 
-	/* File to parse is here, so begin */
-	do_wal_parsing(timeline);
+	/* Block references are weighted by their distance to the end */
+	if (prewarm_path != NULL)
+	{
+		prewarm_end_lsn = end_lsn;
+		prewarm = prewarm_create(prewarm_end_lsn, prewarm_half_life);
+	}
+
+	/* Split the range of records to parse at segment boundaries */
+	XLByteToSeg(start_lsn, start_segno, WalSegSz);
+	XLByteToPrevSeg(end_lsn, end_segno, WalSegSz);
+	nranges = end_segno - start_segno + 1;
+	ranges = pg_malloc0(sizeof(SegmentRange) * nranges);
+	for (int i = 0; i < nranges; i++)
+	{
+		SegmentRange *range = &ranges[i];
+		XLogRecPtr	seg_start;
+		XLogRecPtr	seg_end;
+
+		range->segno = start_segno + i;
+		XLogSegNoOffsetToRecPtr(range->segno, 0, WalSegSz, seg_start);
+		XLogSegNoOffsetToRecPtr(range->segno + 1, 0, WalSegSz, seg_end);
+		range->start_lsn = Max(seg_start, start_lsn);
+		range->end_lsn = Min(seg_end, end_lsn);
+	}
+
+	/* Files to parse are here, so begin */
+	do_wal_parsing();
 	exit(0);
 }
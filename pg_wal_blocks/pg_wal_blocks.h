@@ -0,0 +1,136 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_wal_blocks.h
+ *		Declarations shared across the files of pg_wal_blocks.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pg_wal_blocks/pg_wal_blocks.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PG_WAL_BLOCKS_H
+#define PG_WAL_BLOCKS_H
+
+#include "access/xlogdefs.h"
+#include "access/xlogreader.h"
+#include "common/blkreftable.h"
+
+/*
+ * Block reference found in a WAL record.  A limit block is the size of a
+ * relation fork created or truncated, blocks past it being discarded.
+ */
+typedef struct BlockRef
+{
+	RelFileLocator rlocator;
+	ForkNumber	forknum;
+	BlockNumber blkno;			/* block modified, or limit block */
+	bool		limit;			/* is blkno a limit block? */
+} BlockRef;
+
+/*
+ * Reads of WAL pages, in read.c.  Pages are read one at a time from the
+ * segment files with WALRead(), or served from memory filled with large
+ * chunks of a segment or with a mapping of the whole segment.
+ */
+typedef enum ReadMode
+{
+	READ_MODE_PAGE,
+	READ_MODE_CHUNK,
+	READ_MODE_MMAP,
+} ReadMode;
+
+typedef struct SegmentInflater SegmentInflater;
+
+typedef struct SegmentReader
+{
+	ReadMode	mode;
+	TimeLineID	tli;			/* timeline of the segments */
+	int			segsize;		/* size of the segments */
+	bool		is_open;		/* is a segment open? */
+	XLogSegNo	segno;			/* segment open */
+	int			fd;				/* file of the segment open, or -1 */
+	char	   *data;			/* chunk read or segment mapped */
+	uint32		data_start;		/* offset of data in the segment */
+	uint32		data_len;		/* number of bytes in data */
+	uint64		bytes_read;		/* total number of bytes read */
+	SegmentInflater *inflater;	/* decompression of a compressed segment */
+} SegmentReader;
+
+extern bool read_mode_parse(const char *name, ReadMode *mode);
+extern const char *read_mode_name(ReadMode mode);
+extern void segment_reader_init(SegmentReader *reader, ReadMode mode,
+								TimeLineID tli, int segsize);
+extern bool segment_reader_compressed(SegmentReader *reader, XLogSegNo segno);
+extern void segment_reader_read(SegmentReader *reader, XLogSegNo segno,
+								uint32 offset, char *buf, int len);
+extern void segment_reader_close(SegmentReader *reader);
+extern void segment_reader_free(SegmentReader *reader);
+extern bool segment_file_exists(XLogSegNo segno, TimeLineID tli);
+extern void segment_strip_suffix(char *fname);
+
+/* Full-page image statistics per relation fork, in stats.c */
+typedef struct FpiStats FpiStats;
+
+extern FpiStats *fpi_stats_create(void);
+extern void fpi_stats_free(FpiStats *stats);
+extern void fpi_stats_add_record(FpiStats *stats, XLogReaderState *record);
+extern void fpi_stats_merge(FpiStats *dst, FpiStats *src);
+extern void fpi_stats_report(FpiStats *stats, bool csv);
+
+/* Prewarm list of the blocks referenced, in prewarm.c */
+typedef struct PrewarmList PrewarmList;
+
+extern PrewarmList *prewarm_create(XLogRecPtr end_lsn, uint64 half_life);
+extern void prewarm_free(PrewarmList *list);
+extern void prewarm_add_record(PrewarmList *list, XLogReaderState *record);
+extern void prewarm_merge(PrewarmList *dst, PrewarmList *src);
+extern void prewarm_write(PrewarmList *list, const char *path,
+						  int max_blocks);
+
+/* Write working set estimated with HyperLogLog, in workset.c */
+typedef struct WorkingSet WorkingSet;
+
+extern WorkingSet *workset_create(uint64 window_size);
+extern void workset_free(WorkingSet *workset);
+extern void workset_add_record(WorkingSet *workset, XLogReaderState *record);
+extern void workset_merge(WorkingSet *dst, WorkingSet *src);
+extern void workset_complete(WorkingSet *workset, XLogRecPtr lsn);
+extern void workset_report(WorkingSet *workset);
+
+/* Path of a segment in the directory parsed, in pg_wal_blocks.c */
+extern void segment_path(char *path, XLogSegNo seg, TimeLineID tli);
+
+/*
+ * Block reference summaries, in summary.c.
+ *
+ * A summary file is made of a BlockSummaryHeader, followed by the contents
+ * of a BlockRefTable, which stores for each relation fork a sorted set of
+ * modified blocks as bitmaps or arrays, and the block from which the
+ * relation fork has been truncated, if any.  A summary covers the records
+ * of a timeline whose start LSN is between start_lsn, included, and
+ * end_lsn, excluded.
+ */
+#define BLOCK_SUMMARY_MAGIC		0x53424750	/* "PGBS" */
+#define BLOCK_SUMMARY_VERSION	1
+
+typedef struct BlockSummaryHeader
+{
+	uint32		magic;			/* BLOCK_SUMMARY_MAGIC */
+	uint32		version;		/* BLOCK_SUMMARY_VERSION */
+	XLogRecPtr	start_lsn;		/* start of the range covered */
+	XLogRecPtr	end_lsn;		/* end of the range covered */
+	TimeLineID	tli;			/* timeline of the range */
+	uint32		reserved;		/* unused, zero */
+} BlockSummaryHeader;
+
+extern void summary_add_refs(BlockRefTable *brtab, BlockRef *refs,
+							 int nrefs);
+extern void summary_write(const char *path, BlockRefTable *brtab,
+						  TimeLineID tli, XLogRecPtr start_lsn,
+						  XLogRecPtr end_lsn);
+extern void summary_merge(const char *path, char **inputs, int ninputs);
+
+#endif							/* PG_WAL_BLOCKS_H */
@@ -0,0 +1,235 @@
+/*-------------------------------------------------------------------------
+ *
+ * prewarm.c
+ *		Prewarm list of the blocks referenced by WAL records
+ *
+ * Each block referenced gets a score, sum of the weights of the records
+ * referencing it, the weight of a record decaying exponentially with the
+ * amount of WAL between the record and the end of the range parsed.  The
+ * blocks with the highest scores, frequently and recently modified, are
+ * written in the format of the autoprewarm.blocks file of pg_prewarm.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pg_wal_blocks/prewarm.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include <math.h>
+#include <unistd.h>
+
+#include "common/hashfn.h"
+
+#include "pg_wal_blocks.h"
+
+/* Block tracked, fields ordered as in autoprewarm.blocks */
+typedef struct PrewarmKey
+{
+	Oid			database;
+	Oid			tablespace;
+	RelFileNumber filenumber;
+	ForkNumber	forknum;
+	BlockNumber blocknum;
+} PrewarmKey;
+
+typedef struct PrewarmEntry
+{
+	PrewarmKey	key;
+	char		status;			/* for simplehash */
+	double		score;			/* sum of the weights of the records */
+} PrewarmEntry;
+
+#define SH_PREFIX				pwblocks
+#define SH_ELEMENT_TYPE			PrewarmEntry
+#define SH_KEY_TYPE				PrewarmKey
+#define SH_KEY					key
+#define SH_HASH_KEY(tb, key) \
+	hash_bytes((const unsigned char *) &(key), sizeof(PrewarmKey))
+#define SH_EQUAL(tb, a, b)		(memcmp(&(a), &(b), sizeof(PrewarmKey)) == 0)
+#define SH_SCOPE				static inline
+#define SH_RAW_ALLOCATOR		pg_malloc0
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+struct PrewarmList
+{
+	pwblocks_hash *hash;
+	XLogRecPtr	end_lsn;		/* end of the range parsed */
+	double		half_life;		/* bytes of WAL halving a weight */
+};
+
+PrewarmList *
+prewarm_create(XLogRecPtr end_lsn, uint64 half_life)
+{
+	PrewarmList *list = pg_malloc(sizeof(PrewarmList));
+
+	list->hash = pwblocks_create(4096, NULL);
+	list->end_lsn = end_lsn;
+	list->half_life = (double) half_life;
+	return list;
+}
+
+void
+prewarm_free(PrewarmList *list)
+{
+	pwblocks_destroy(list->hash);
+	pg_free(list);
+}
+
+static void
+prewarm_add(PrewarmList *list, const PrewarmKey *key, double weight)
+{
+	PrewarmEntry *entry;
+	bool		found;
+
+	entry = pwblocks_insert(list->hash, *key, &found);
+	if (!found)
+		entry->score = 0;
+	entry->score += weight;
+}
+
+/*
+ * Add the blocks referenced by a record to the list.
+ */
+void
+prewarm_add_record(PrewarmList *list, XLogReaderState *record)
+{
+	double		weight;
+	XLogRecPtr	distance = 0;
+
+	if (record->ReadRecPtr < list->end_lsn)
+		distance = list->end_lsn - record->ReadRecPtr;
+	weight = pow(2.0, -(double) distance / list->half_life);
+
+	for (int block_id = 0; block_id <= XLogRecMaxBlockId(record); block_id++)
+	{
+		RelFileLocator rlocator;
+		PrewarmKey	key;
+
+		/* Zero the key, as it is hashed and compared as bytes */
+		memset(&key, 0, sizeof(PrewarmKey));
+		if (!XLogRecGetBlockTagExtended(record, block_id, &rlocator,
+										&key.forknum, &key.blocknum, NULL))
+			continue;
+		key.database = rlocator.dbOid;
+		key.tablespace = rlocator.spcOid;
+		key.filenumber = rlocator.relNumber;
+
+		prewarm_add(list, &key, weight);
+	}
+}
+
+/*
+ * Add the scores of src to the ones of dst.
+ */
+void
+prewarm_merge(PrewarmList *dst, PrewarmList *src)
+{
+	pwblocks_iterator iter;
+	PrewarmEntry *entry;
+
+	pwblocks_start_iterate(src->hash, &iter);
+	while ((entry = pwblocks_iterate(src->hash, &iter)) != NULL)
+		prewarm_add(dst, &entry->key, entry->score);
+}
+
+/* Sort by score, the highest first */
+static int
+prewarm_score_cmp(const void *a, const void *b)
+{
+	const PrewarmEntry *ea = *(PrewarmEntry *const *) a;
+	const PrewarmEntry *eb = *(PrewarmEntry *const *) b;
+
+	if (ea->score != eb->score)
+		return ea->score > eb->score ? -1 : 1;
+	return memcmp(&ea->key, &eb->key, sizeof(PrewarmKey));
+}
+
+/* Sort in the order of autoprewarm, grouping blocks by relation */
+static int
+prewarm_block_cmp(const void *a, const void *b)
+{
+	const PrewarmKey *ka = &(*(PrewarmEntry *const *) a)->key;
+	const PrewarmKey *kb = &(*(PrewarmEntry *const *) b)->key;
+
+	if (ka->database != kb->database)
+		return ka->database < kb->database ? -1 : 1;
+	if (ka->tablespace != kb->tablespace)
+		return ka->tablespace < kb->tablespace ? -1 : 1;
+	if (ka->filenumber != kb->filenumber)
+		return ka->filenumber < kb->filenumber ? -1 : 1;
+	if (ka->forknum != kb->forknum)
+		return ka->forknum < kb->forknum ? -1 : 1;
+	if (ka->blocknum != kb->blocknum)
+		return ka->blocknum < kb->blocknum ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Write the max_blocks blocks with the highest scores, or all of them if
+ * max_blocks is 0, in the format of autoprewarm.blocks.  The file is
+ * written under a temporary name, then renamed.
+ */
+void
+prewarm_write(PrewarmList *list, const char *path, int max_blocks)
+{
+	pwblocks_iterator iter;
+	PrewarmEntry *entry;
+	PrewarmEntry **entries;
+	int			nentries = 0;
+	char		tmp_path[MAXPGPATH];
+	FILE	   *file;
+
+	entries = pg_malloc(sizeof(PrewarmEntry *) * Max(list->hash->members, 1));
+	pwblocks_start_iterate(list->hash, &iter);
+	while ((entry = pwblocks_iterate(list->hash, &iter)) != NULL)
+		entries[nentries++] = entry;
+
+	if (max_blocks > 0 && nentries > max_blocks)
+	{
+		qsort(entries, nentries, sizeof(PrewarmEntry *), prewarm_score_cmp);
+		nentries = max_blocks;
+	}
+	qsort(entries, nentries, sizeof(PrewarmEntry *), prewarm_block_cmp);
+
+	snprintf(tmp_path, MAXPGPATH, "%s.tmp", path);
+	file = fopen(tmp_path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "could not create file \"%s\": %m\n", tmp_path);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(file, "<<%d>>\n", nentries);
+	for (int i = 0; i < nentries; i++)
+	{
+		PrewarmKey *key = &entries[i]->key;
+
+		fprintf(file, "%u,%u,%u,%u,%u\n", key->database, key->tablespace,
+				key->filenumber, (uint32) key->forknum, key->blocknum);
+	}
+
+	if (fflush(file) != 0 || ferror(file) || fsync(fileno(file)) != 0)
+	{
+		fprintf(stderr, "could not write file \"%s\": %m\n", tmp_path);
+		exit(EXIT_FAILURE);
+	}
+	if (fclose(file) != 0)
+	{
+		fprintf(stderr, "could not close file \"%s\": %m\n", tmp_path);
+		exit(EXIT_FAILURE);
+	}
+	if (rename(tmp_path, path) != 0)
+	{
+		fprintf(stderr, "could not rename file \"%s\" to \"%s\": %m\n",
+				tmp_path, path);
+		exit(EXIT_FAILURE);
+	}
+
+	pg_free(entries);
+}
@@ -0,0 +1,668 @@
+/*-------------------------------------------------------------------------
+ *
+ * read.c
+ *		Reads of WAL pages from segment files
+ *
+ * Pages are served from memory, filled with reads of large chunks of a
+ * segment or with a mapping of the whole segment, so as the number of
+ * system calls does not depend on the number of pages read.
+ *
+ * If a segment does not exist, a compressed variant of it is looked for,
+ * with the suffix ".gz", ".lz4" or ".zst", as found in WAL archives.  It
+ * is decompressed progressively in memory as pages are requested, in any
+ * read mode, so as no decompressed copy of it is written anywhere.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pg_wal_blocks/read.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "access/xlog_internal.h"
+
+#include "pg_wal_blocks.h"
+
+/* Size of the chunks read at once */
+#define READ_CHUNK_SIZE		(4 * 1024 * 1024)
+
+/* Size of the reads of compressed data */
+#define READ_COMPRESSED_SIZE	(128 * 1024)
+
+typedef enum SegmentCompression
+{
+	SEGMENT_COMPRESSION_NONE,
+	SEGMENT_COMPRESSION_GZIP,
+	SEGMENT_COMPRESSION_LZ4,
+	SEGMENT_COMPRESSION_ZSTD,
+} SegmentCompression;
+
+static const struct
+{
+	const char *suffix;
+	SegmentCompression compression;
+}			segment_suffixes[] =
+{
+	{".gz", SEGMENT_COMPRESSION_GZIP},
+	{".lz4", SEGMENT_COMPRESSION_LZ4},
+	{".zst", SEGMENT_COMPRESSION_ZSTD},
+};
+
+/*
+ * Decompression of the segment open.  The data decompressed is kept until
+ * the next segment is opened, so as pages can be read again at no cost.
+ */
+struct SegmentInflater
+{
+	SegmentCompression compression; /* compression of the segment open */
+	char		path[MAXPGPATH];	/* path of the compressed file */
+	char	   *in_buf;			/* compressed data read */
+	size_t		in_len;			/* bytes in in_buf */
+	size_t		in_pos;			/* bytes of in_buf consumed */
+	char	   *out_buf;		/* data decompressed, up to a segment */
+	uint32		out_len;		/* bytes in out_buf */
+	bool		frame_done;		/* at the end of a frame? */
+	bool		eof;			/* end of the data reached? */
+
+#ifdef HAVE_LIBZ
+	z_stream	zs;
+	bool		zs_init;
+#endif
+#ifdef USE_LZ4
+	LZ4F_dctx  *lz4_dctx;
+#endif
+#ifdef USE_ZSTD
+	ZSTD_DCtx  *zstd_dctx;
+#endif
+};
+
+/*
+ * Find the file of a segment, uncompressed or compressed, appending the
+ * suffix of the compressed variant found to path.  If nothing is found,
+ * path is left as-is, so as the error reported is about it.
+ */
+static SegmentCompression
+segment_find_file(char *path)
+{
+	struct stat st;
+	size_t		len = strlen(path);
+
+	if (stat(path, &st) == 0)
+		return SEGMENT_COMPRESSION_NONE;
+
+	for (int i = 0; i < lengthof(segment_suffixes); i++)
+	{
+		snprintf(path + len, MAXPGPATH - len, "%s",
+				 segment_suffixes[i].suffix);
+		if (stat(path, &st) == 0)
+			return segment_suffixes[i].compression;
+	}
+
+	path[len] = '\0';
+	return SEGMENT_COMPRESSION_NONE;
+}
+
+/*
+ * Check if a segment exists, uncompressed or compressed.
+ */
+bool
+segment_file_exists(XLogSegNo segno, TimeLineID tli)
+{
+	char		path[MAXPGPATH];
+	struct stat st;
+
+	segment_path(path, segno, tli);
+	(void) segment_find_file(path);
+	return stat(path, &st) == 0;
+}
+
+/*
+ * Remove the suffix of a compressed segment from a file name, if any.
+ */
+void
+segment_strip_suffix(char *fname)
+{
+	size_t		len = strlen(fname);
+
+	for (int i = 0; i < lengthof(segment_suffixes); i++)
+	{
+		size_t		suffix_len = strlen(segment_suffixes[i].suffix);
+
+		if (len > suffix_len &&
+			strcmp(fname + len - suffix_len, segment_suffixes[i].suffix) == 0)
+		{
+			fname[len - suffix_len] = '\0';
+			return;
+		}
+	}
+}
+
+/*
+ * Parse the name of a read mode, returning false if unknown.
+ */
+bool
+read_mode_parse(const char *name, ReadMode *mode)
+{
+	if (strcmp(name, "page") == 0)
+		*mode = READ_MODE_PAGE;
+	else if (strcmp(name, "chunk") == 0)
+		*mode = READ_MODE_CHUNK;
+#ifndef WIN32
+	else if (strcmp(name, "mmap") == 0)
+		*mode = READ_MODE_MMAP;
+#endif
+	else
+		return false;
+
+	return true;
+}
+
+const char *
+read_mode_name(ReadMode mode)
+{
+	switch (mode)
+	{
+		case READ_MODE_PAGE:
+			return "page";
+		case READ_MODE_CHUNK:
+			return "chunk";
+		case READ_MODE_MMAP:
+			return "mmap";
+	}
+	return "unknown";			/* keep compiler quiet */
+}
+
+void
+segment_reader_init(SegmentReader *reader, ReadMode mode, TimeLineID tli,
+					int segsize)
+{
+	memset(reader, 0, sizeof(SegmentReader));
+	reader->mode = mode;
+	reader->tli = tli;
+	reader->segsize = segsize;
+	reader->fd = -1;
+}
+
+static inline bool
+segment_reader_is_compressed(SegmentReader *reader)
+{
+	return reader->inflater != NULL &&
+		reader->inflater->compression != SEGMENT_COMPRESSION_NONE;
+}
+
+/*
+ * Release the segment currently open, if any.
+ */
+void
+segment_reader_close(SegmentReader *reader)
+{
+#ifndef WIN32
+	if (reader->mode == READ_MODE_MMAP && reader->data != NULL)
+	{
+		munmap(reader->data, reader->data_len);
+		reader->data = NULL;
+	}
+#endif
+	if (reader->fd >= 0)
+	{
+		close(reader->fd);
+		reader->fd = -1;
+	}
+	if (reader->inflater != NULL)
+		reader->inflater->compression = SEGMENT_COMPRESSION_NONE;
+	reader->data_start = 0;
+	reader->data_len = 0;
+	reader->is_open = false;
+}
+
+/*
+ * Prepare the decompression of a compressed segment from its beginning.
+ */
+static void
+segment_reader_start_inflate(SegmentReader *reader,
+							 SegmentCompression compression, const char *path)
+{
+	SegmentInflater *inflater = reader->inflater;
+
+	if (inflater == NULL)
+	{
+		inflater = reader->inflater = pg_malloc0(sizeof(SegmentInflater));
+		inflater->in_buf = pg_malloc(READ_COMPRESSED_SIZE);
+		inflater->out_buf = pg_malloc(reader->segsize);
+	}
+
+	inflater->compression = compression;
+	strlcpy(inflater->path, path, MAXPGPATH);
+	inflater->in_len = 0;
+	inflater->in_pos = 0;
+	inflater->out_len = 0;
+	inflater->frame_done = false;
+	inflater->eof = false;
+
+	switch (compression)
+	{
+		case SEGMENT_COMPRESSION_NONE:
+			Assert(false);
+			break;
+		case SEGMENT_COMPRESSION_GZIP:
+#ifdef HAVE_LIBZ
+			if (inflater->zs_init)
+				inflateEnd(&inflater->zs);
+			inflater->zs_init = false;
+			memset(&inflater->zs, 0, sizeof(z_stream));
+			/* Detect gzip or zlib headers */
+			if (inflateInit2(&inflater->zs, 15 + 32) != Z_OK)
+			{
+				fprintf(stderr, "could not initialize decompression of file \"%s\"\n",
+						path);
+				exit(EXIT_FAILURE);
+			}
+			inflater->zs_init = true;
+			return;
+#endif
+			break;
+		case SEGMENT_COMPRESSION_LZ4:
+#ifdef USE_LZ4
+			if (inflater->lz4_dctx == NULL)
+			{
+				if (LZ4F_isError(LZ4F_createDecompressionContext(&inflater->lz4_dctx,
+																 LZ4F_VERSION)))
+				{
+					fprintf(stderr, "could not initialize decompression of file \"%s\"\n",
+							path);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else
+				LZ4F_resetDecompressionContext(inflater->lz4_dctx);
+			return;
+#endif
+			break;
+		case SEGMENT_COMPRESSION_ZSTD:
+#ifdef USE_ZSTD
+			if (inflater->zstd_dctx == NULL)
+			{
+				inflater->zstd_dctx = ZSTD_createDCtx();
+				if (inflater->zstd_dctx == NULL)
+				{
+					fprintf(stderr, "could not initialize decompression of file \"%s\"\n",
+							path);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else
+				ZSTD_DCtx_reset(inflater->zstd_dctx, ZSTD_reset_session_only);
+			return;
+#endif
+			break;
+	}
+
+	fprintf(stderr, "could not read file \"%s\": compression not supported by this build\n",
+			path);
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Decompress the segment open until at least upto bytes of it are in
+ * memory, or its end is reached.
+ */
+static void
+segment_reader_inflate(SegmentReader *reader, uint32 upto)
+{
+	SegmentInflater *inflater = reader->inflater;
+
+	upto = Min(upto, (uint32) reader->segsize);
+
+	while (inflater->out_len < upto && !inflater->eof)
+	{
+		bool		input_end = false;
+		uint32		before = inflater->out_len;
+
+		if (inflater->in_pos == inflater->in_len)
+		{
+			ssize_t		rc;
+
+			rc = read(reader->fd, inflater->in_buf, READ_COMPRESSED_SIZE);
+			if (rc < 0)
+			{
+				fprintf(stderr, "could not read file \"%s\": %m\n",
+						inflater->path);
+				exit(EXIT_FAILURE);
+			}
+			inflater->in_len = rc;
+			inflater->in_pos = 0;
+			reader->bytes_read += rc;
+			input_end = (rc == 0);
+		}
+
+		switch (inflater->compression)
+		{
+			case SEGMENT_COMPRESSION_NONE:
+				Assert(false);
+				break;
+			case SEGMENT_COMPRESSION_GZIP:
+#ifdef HAVE_LIBZ
+				{
+					int			ret;
+					size_t		avail_in = inflater->in_len - inflater->in_pos;
+
+					inflater->zs.next_in = (Bytef *) inflater->in_buf + inflater->in_pos;
+					inflater->zs.avail_in = avail_in;
+					inflater->zs.next_out = (Bytef *) inflater->out_buf + inflater->out_len;
+					inflater->zs.avail_out = reader->segsize - inflater->out_len;
+
+					ret = inflate(&inflater->zs, Z_NO_FLUSH);
+					if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+					{
+						fprintf(stderr, "could not decompress file \"%s\": %s\n",
+								inflater->path,
+								inflater->zs.msg ? inflater->zs.msg : "unknown error");
+						exit(EXIT_FAILURE);
+					}
+
+					inflater->in_pos += avail_in - inflater->zs.avail_in;
+					inflater->out_len = reader->segsize - inflater->zs.avail_out;
+
+					/* Members of a gzip file can be concatenated */
+					if (ret == Z_STREAM_END)
+					{
+						inflater->frame_done = true;
+						inflateReset(&inflater->zs);
+					}
+					else if (avail_in != inflater->zs.avail_in)
+						inflater->frame_done = false;
+				}
+#endif
+				break;
+			case SEGMENT_COMPRESSION_LZ4:
+#ifdef USE_LZ4
+				{
+					size_t		dst_size = reader->segsize - inflater->out_len;
+					size_t		src_size = inflater->in_len - inflater->in_pos;
+					size_t		ret;
+
+					ret = LZ4F_decompress(inflater->lz4_dctx,
+										  inflater->out_buf + inflater->out_len,
+										  &dst_size,
+										  inflater->in_buf + inflater->in_pos,
+										  &src_size, NULL);
+					if (LZ4F_isError(ret))
+					{
+						fprintf(stderr, "could not decompress file \"%s\": %s\n",
+								inflater->path, LZ4F_getErrorName(ret));
+						exit(EXIT_FAILURE);
+					}
+
+					inflater->in_pos += src_size;
+					inflater->out_len += dst_size;
+					inflater->frame_done = (ret == 0);
+				}
+#endif
+				break;
+			case SEGMENT_COMPRESSION_ZSTD:
+#ifdef USE_ZSTD
+				{
+					ZSTD_inBuffer in = {inflater->in_buf, inflater->in_len, inflater->in_pos};
+					ZSTD_outBuffer out = {inflater->out_buf, reader->segsize, inflater->out_len};
+					size_t		ret;
+
+					ret = ZSTD_decompressStream(inflater->zstd_dctx, &out, &in);
+					if (ZSTD_isError(ret))
+					{
+						fprintf(stderr, "could not decompress file \"%s\": %s\n",
+								inflater->path, ZSTD_getErrorName(ret));
+						exit(EXIT_FAILURE);
+					}
+
+					inflater->in_pos = in.pos;
+					inflater->out_len = out.pos;
+					inflater->frame_done = (ret == 0);
+				}
+#endif
+				break;
+		}
+
+		/* A full segment is decompressed, ignore anything past it */
+		if (inflater->out_len == reader->segsize)
+			inflater->eof = true;
+
+		/* All the input is consumed, and nothing more is produced */
+		if (input_end && inflater->out_len == before)
+		{
+			if (!inflater->frame_done)
+			{
+				fprintf(stderr, "could not decompress file \"%s\": unexpected end of file\n",
+						inflater->path);
+				exit(EXIT_FAILURE);
+			}
+			inflater->eof = true;
+		}
+	}
+}
+
+/*
+ * Open a segment, mapping it entirely in mmap mode.  A compressed segment
+ * is decompressed as its pages are read, in any mode.
+ */
+static void
+segment_reader_open(SegmentReader *reader, XLogSegNo segno)
+{
+	char		path[MAXPGPATH];
+	SegmentCompression compression;
+
+	segment_reader_close(reader);
+
+	segment_path(path, segno, reader->tli);
+	compression = segment_find_file(path);
+	reader->fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (reader->fd < 0)
+	{
+		fprintf(stderr, "could not open file \"%s\": %m\n", path);
+		exit(EXIT_FAILURE);
+	}
+	reader->segno = segno;
+	reader->is_open = true;
+
+	if (compression != SEGMENT_COMPRESSION_NONE)
+	{
+		segment_reader_start_inflate(reader, compression, path);
+		return;
+	}
+
+	/* In page mode, WALRead() reads uncompressed segments by itself */
+	if (reader->mode == READ_MODE_PAGE)
+	{
+		close(reader->fd);
+		reader->fd = -1;
+		return;
+	}
+
+#ifndef WIN32
+	if (reader->mode == READ_MODE_MMAP)
+	{
+		struct stat st;
+
+		if (fstat(reader->fd, &st) != 0)
+		{
+			fprintf(stderr, "could not stat file \"%s\": %m\n", path);
+			exit(EXIT_FAILURE);
+		}
+
+		reader->data_len = Min(st.st_size, reader->segsize);
+		if (reader->data_len == 0)
+			return;
+
+		reader->data = mmap(NULL, reader->data_len, PROT_READ, MAP_PRIVATE,
+							reader->fd, 0);
+		if (reader->data == MAP_FAILED)
+		{
+			reader->data = NULL;
+			fprintf(stderr, "could not map file \"%s\": %m\n", path);
+			exit(EXIT_FAILURE);
+		}
+		(void) madvise(reader->data, reader->data_len, MADV_SEQUENTIAL);
+
+		/* The mapping is enough, and the reads go through it */
+		close(reader->fd);
+		reader->fd = -1;
+		reader->bytes_read += reader->data_len;
+	}
+#endif
+}
+
+/*
+ * Read the chunk of the segment open including the given offset.
+ */
+static void
+segment_reader_fill(SegmentReader *reader, uint32 offset)
+{
+	uint32		chunk_size = Min(READ_CHUNK_SIZE, reader->segsize);
+	uint32		start = offset - (offset % chunk_size);
+	uint32		len = 0;
+
+	if (reader->data == NULL)
+		reader->data = pg_malloc(chunk_size);
+
+	while (len < chunk_size)
+	{
+		ssize_t		rc;
+
+		rc = pg_pread(reader->fd, reader->data + len, chunk_size - len,
+					  start + len);
+		if (rc < 0)
+		{
+			char		fname[MAXFNAMELEN];
+
+			XLogFileName(fname, reader->tli, reader->segno, reader->segsize);
+			fprintf(stderr, "could not read from file %s, offset %u: %m\n",
+					fname, start + len);
+			exit(EXIT_FAILURE);
+		}
+		if (rc == 0)
+			break;
+		len += rc;
+	}
+
+	reader->data_start = start;
+	reader->data_len = len;
+	reader->bytes_read += len;
+}
+
+/*
+ * Check if segment segno is compressed, opening it if not open yet.
+ */
+bool
+segment_reader_compressed(SegmentReader *reader, XLogSegNo segno)
+{
+	if (!reader->is_open || reader->segno != segno)
+		segment_reader_open(reader, segno);
+
+	return segment_reader_is_compressed(reader);
+}
+
+/*
+ * Copy len bytes at offset of segment segno to buf, from memory.
+ */
+void
+segment_reader_read(SegmentReader *reader, XLogSegNo segno, uint32 offset,
+					char *buf, int len)
+{
+	if (!reader->is_open || reader->segno != segno)
+		segment_reader_open(reader, segno);
+
+	Assert(reader->mode != READ_MODE_PAGE ||
+		   segment_reader_is_compressed(reader));
+
+	if (segment_reader_is_compressed(reader))
+	{
+		SegmentInflater *inflater = reader->inflater;
+
+		segment_reader_inflate(reader, offset + len);
+		if (offset + len > inflater->out_len)
+		{
+			fprintf(stderr, "could not read from file \"%s\", offset %u: read %d of %d\n",
+					inflater->path, offset,
+					(int) Max((int64) inflater->out_len - offset, 0), len);
+			exit(EXIT_FAILURE);
+		}
+
+		memcpy(buf, inflater->out_buf + offset, len);
+		return;
+	}
+
+	if (reader->mode == READ_MODE_CHUNK &&
+		(offset < reader->data_start ||
+		 offset + len > reader->data_start + reader->data_len))
+		segment_reader_fill(reader, offset);
+
+	if (offset < reader->data_start ||
+		offset + len > reader->data_start + reader->data_len)
+	{
+		char		fname[MAXFNAMELEN];
+
+		XLogFileName(fname, reader->tli, segno, reader->segsize);
+		fprintf(stderr, "could not read from file %s, offset %u: read %d of %d\n",
+				fname, offset,
+				(int) Max((int64) reader->data_start + reader->data_len - offset, 0),
+				len);
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(buf, reader->data + (offset - reader->data_start), len);
+}
+
+/*
+ * Release all the resources of a reader.
+ */
+void
+segment_reader_free(SegmentReader *reader)
+{
+	segment_reader_close(reader);
+	if (reader->mode == READ_MODE_CHUNK && reader->data != NULL)
+	{
+		pg_free(reader->data);
+		reader->data = NULL;
+	}
+
+	if (reader->inflater != NULL)
+	{
+		SegmentInflater *inflater = reader->inflater;
+
+#ifdef HAVE_LIBZ
+		if (inflater->zs_init)
+			inflateEnd(&inflater->zs);
+#endif
+#ifdef USE_LZ4
+		if (inflater->lz4_dctx != NULL)
+			LZ4F_freeDecompressionContext(inflater->lz4_dctx);
+#endif
+#ifdef USE_ZSTD
+		if (inflater->zstd_dctx != NULL)
+			ZSTD_freeDCtx(inflater->zstd_dctx);
+#endif
+		pg_free(inflater->in_buf);
+		pg_free(inflater->out_buf);
+		pg_free(inflater);
+		reader->inflater = NULL;
+	}
+}
@@ -0,0 +1,283 @@
+/*-------------------------------------------------------------------------
+ *
+ * stats.c
+ *		Full-page image statistics per relation fork
+ *
+ * For each relation fork, the records and block references are counted
+ * with the full-page images they include, whose size is tracked as stored
+ * in the records, compressed or not, and once restored without the hole
+ * of the page.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pg_wal_blocks/stats.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include "common/hashfn.h"
+#include "common/relpath.h"
+
+#include "pg_wal_blocks.h"
+
+/* Relation fork whose statistics are tracked */
+typedef struct FpiStatsKey
+{
+	RelFileLocator rlocator;
+	ForkNumber	forknum;
+} FpiStatsKey;
+
+typedef struct FpiStatsEntry
+{
+	FpiStatsKey key;
+	char		status;			/* for simplehash */
+	uint64		records;		/* records referencing the fork */
+	uint64		blocks;			/* block references */
+	uint64		fpis;			/* full-page images */
+	uint64		fpis_applied;	/* images applied at redo */
+	uint64		fpi_len;		/* bytes of images, as stored */
+	uint64		fpi_raw_len;	/* bytes of images, uncompressed */
+	uint64		hole_len;		/* bytes of holes, not stored */
+} FpiStatsEntry;
+
+#define SH_PREFIX				fpistats
+#define SH_ELEMENT_TYPE			FpiStatsEntry
+#define SH_KEY_TYPE				FpiStatsKey
+#define SH_KEY					key
+#define SH_HASH_KEY(tb, key) \
+	hash_bytes((const unsigned char *) &(key), sizeof(FpiStatsKey))
+#define SH_EQUAL(tb, a, b)		(memcmp(&(a), &(b), sizeof(FpiStatsKey)) == 0)
+#define SH_SCOPE				static inline
+#define SH_RAW_ALLOCATOR		pg_malloc0
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+struct FpiStats
+{
+	fpistats_hash *hash;
+};
+
+FpiStats *
+fpi_stats_create(void)
+{
+	FpiStats   *stats = pg_malloc(sizeof(FpiStats));
+
+	stats->hash = fpistats_create(1024, NULL);
+	return stats;
+}
+
+void
+fpi_stats_free(FpiStats *stats)
+{
+	fpistats_destroy(stats->hash);
+	pg_free(stats);
+}
+
+static FpiStatsEntry *
+fpi_stats_lookup(FpiStats *stats, const RelFileLocator *rlocator,
+				 ForkNumber forknum)
+{
+	FpiStatsKey key;
+	FpiStatsEntry *entry;
+	bool		found;
+
+	/* Zero the key, as it is hashed and compared as bytes */
+	memset(&key, 0, sizeof(FpiStatsKey));
+	key.rlocator = *rlocator;
+	key.forknum = forknum;
+
+	entry = fpistats_insert(stats->hash, key, &found);
+	if (!found)
+	{
+		entry->records = 0;
+		entry->blocks = 0;
+		entry->fpis = 0;
+		entry->fpis_applied = 0;
+		entry->fpi_len = 0;
+		entry->fpi_raw_len = 0;
+		entry->hole_len = 0;
+	}
+
+	return entry;
+}
+
+/*
+ * Add the block references of a record to the statistics.
+ */
+void
+fpi_stats_add_record(FpiStats *stats, XLogReaderState *record)
+{
+	for (int block_id = 0; block_id <= XLogRecMaxBlockId(record); block_id++)
+	{
+		RelFileLocator rlocator;
+		ForkNumber	forknum;
+		BlockNumber blkno;
+		FpiStatsEntry *entry;
+		bool		first = true;
+
+		if (!XLogRecGetBlockTagExtended(record, block_id, &rlocator,
+										&forknum, &blkno, NULL))
+			continue;
+
+		entry = fpi_stats_lookup(stats, &rlocator, forknum);
+		entry->blocks++;
+
+		/* Count the record once for each relation fork it references */
+		for (int prev_id = 0; prev_id < block_id; prev_id++)
+		{
+			RelFileLocator prev_rlocator;
+			ForkNumber	prev_forknum;
+
+			if (XLogRecGetBlockTagExtended(record, prev_id, &prev_rlocator,
+										   &prev_forknum, NULL, NULL) &&
+				prev_forknum == forknum &&
+				RelFileLocatorEquals(prev_rlocator, rlocator))
+			{
+				first = false;
+				break;
+			}
+		}
+		if (first)
+			entry->records++;
+
+		if (XLogRecHasBlockImage(record, block_id))
+		{
+			DecodedBkpBlock *blk = XLogRecGetBlock(record, block_id);
+
+			entry->fpis++;
+			if (XLogRecBlockImageApply(record, block_id))
+				entry->fpis_applied++;
+			entry->fpi_len += blk->bimg_len;
+			entry->fpi_raw_len += BLCKSZ - blk->hole_length;
+			entry->hole_len += blk->hole_length;
+		}
+	}
+}
+
+/*
+ * Add the statistics of src to the ones of dst.
+ */
+void
+fpi_stats_merge(FpiStats *dst, FpiStats *src)
+{
+	fpistats_iterator iter;
+	FpiStatsEntry *src_entry;
+
+	fpistats_start_iterate(src->hash, &iter);
+	while ((src_entry = fpistats_iterate(src->hash, &iter)) != NULL)
+	{
+		FpiStatsEntry *entry;
+
+		entry = fpi_stats_lookup(dst, &src_entry->key.rlocator,
+								 src_entry->key.forknum);
+		entry->records += src_entry->records;
+		entry->blocks += src_entry->blocks;
+		entry->fpis += src_entry->fpis;
+		entry->fpis_applied += src_entry->fpis_applied;
+		entry->fpi_len += src_entry->fpi_len;
+		entry->fpi_raw_len += src_entry->fpi_raw_len;
+		entry->hole_len += src_entry->hole_len;
+	}
+}
+
+/* Sort by bytes of images stored, the highest first */
+static int
+fpi_stats_cmp(const void *a, const void *b)
+{
+	const FpiStatsEntry *ea = *(FpiStatsEntry *const *) a;
+	const FpiStatsEntry *eb = *(FpiStatsEntry *const *) b;
+
+	if (ea->fpi_len != eb->fpi_len)
+		return ea->fpi_len > eb->fpi_len ? -1 : 1;
+	if (ea->blocks != eb->blocks)
+		return ea->blocks > eb->blocks ? -1 : 1;
+	return memcmp(&ea->key, &eb->key, sizeof(FpiStatsKey));
+}
+
+/*
+ * Print the statistics to stdout, as a table or as CSV, sorted by bytes
+ * of full-page images.
+ */
+void
+fpi_stats_report(FpiStats *stats, bool csv)
+{
+	fpistats_iterator iter;
+	FpiStatsEntry *entry;
+	FpiStatsEntry **entries;
+	FpiStatsEntry total;
+	int			nentries = 0;
+
+	entries = pg_malloc(sizeof(FpiStatsEntry *) * Max(stats->hash->members, 1));
+	memset(&total, 0, sizeof(FpiStatsEntry));
+
+	fpistats_start_iterate(stats->hash, &iter);
+	while ((entry = fpistats_iterate(stats->hash, &iter)) != NULL)
+	{
+		entries[nentries++] = entry;
+		total.records += entry->records;
+		total.blocks += entry->blocks;
+		total.fpis += entry->fpis;
+		total.fpis_applied += entry->fpis_applied;
+		total.fpi_len += entry->fpi_len;
+		total.fpi_raw_len += entry->fpi_raw_len;
+		total.hole_len += entry->hole_len;
+	}
+
+	qsort(entries, nentries, sizeof(FpiStatsEntry *), fpi_stats_cmp);
+
+	if (csv)
+		printf("tablespace,database,relfilenode,fork,records,block_refs,"
+			   "fpis,fpis_applied,fpi_bytes,fpi_raw_bytes,hole_bytes\n");
+	else
+		printf("%-32s %-4s %10s %10s %10s %10s %14s %7s %14s %14s\n",
+			   "relation", "fork", "records", "block_refs", "fpis",
+			   "applied", "fpi_bytes", "(%)", "fpi_raw_bytes", "hole_bytes");
+
+	for (int i = 0; i < nentries; i++)
+	{
+		char		relation[64];
+
+		entry = entries[i];
+
+		if (csv)
+		{
+			printf("%u,%u,%u,%s," UINT64_FORMAT "," UINT64_FORMAT ","
+				   UINT64_FORMAT "," UINT64_FORMAT "," UINT64_FORMAT ","
+				   UINT64_FORMAT "," UINT64_FORMAT "\n",
+				   entry->key.rlocator.spcOid, entry->key.rlocator.dbOid,
+				   entry->key.rlocator.relNumber,
+				   forkNames[entry->key.forknum],
+				   entry->records, entry->blocks, entry->fpis,
+				   entry->fpis_applied, entry->fpi_len, entry->fpi_raw_len,
+				   entry->hole_len);
+			continue;
+		}
+
+		snprintf(relation, sizeof(relation), "%u/%u/%u",
+				 entry->key.rlocator.spcOid, entry->key.rlocator.dbOid,
+				 entry->key.rlocator.relNumber);
+		printf("%-32s %-4s %10" INT64_MODIFIER "u %10" INT64_MODIFIER "u %10"
+			   INT64_MODIFIER "u %10" INT64_MODIFIER "u %14" INT64_MODIFIER
+			   "u %6.2f%% %14" INT64_MODIFIER "u %14" INT64_MODIFIER "u\n",
+			   relation, forkNames[entry->key.forknum],
+			   entry->records, entry->blocks, entry->fpis,
+			   entry->fpis_applied, entry->fpi_len,
+			   total.fpi_len > 0 ? 100.0 * entry->fpi_len / total.fpi_len : 0.0,
+			   entry->fpi_raw_len, entry->hole_len);
+	}
+
+	if (!csv)
+		printf("%-32s %-4s %10" INT64_MODIFIER "u %10" INT64_MODIFIER "u %10"
+			   INT64_MODIFIER "u %10" INT64_MODIFIER "u %14" INT64_MODIFIER
+			   "u %6.2f%% %14" INT64_MODIFIER "u %14" INT64_MODIFIER "u\n",
+			   "total", "", total.records, total.blocks, total.fpis,
+			   total.fpis_applied, total.fpi_len,
+			   total.fpi_len > 0 ? 100.0 : 0.0,
+			   total.fpi_raw_len, total.hole_len);
+
+	pg_free(entries);
+}
@@ -0,0 +1,259 @@
+/*-------------------------------------------------------------------------
+ *
+ * summary.c
+ *		Block reference summaries of ranges of WAL records
+ *
+ * The blocks touched by WAL records are gathered in a BlockRefTable, whose
+ * serialized format is the one of the WAL summaries used by incremental
+ * backups, preceded by a header with the range of LSNs covered.  The
+ * summaries of consecutive ranges can be merged into one.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pg_wal_blocks/summary.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common/file_perm.h"
+
+#include "pg_wal_blocks.h"
+
+/* Number of blocks read at once from a summary */
+#define SUMMARY_BLOCK_BUFFER_SIZE	256
+
+/* Summary file being read or written */
+typedef struct SummaryFile
+{
+	const char *path;
+	int			fd;
+} SummaryFile;
+
+/*
+ * Update a block reference table with block references, in the order
+ * they have been found in the records.
+ */
+void
+summary_add_refs(BlockRefTable *brtab, BlockRef *refs, int nrefs)
+{
+	for (int i = 0; i < nrefs; i++)
+	{
+		BlockRef   *ref = &refs[i];
+
+		if (ref->limit)
+			BlockRefTableSetLimitBlock(brtab, &ref->rlocator, ref->forknum,
+									   ref->blkno);
+		else
+			BlockRefTableMarkBlockModified(brtab, &ref->rlocator,
+										   ref->forknum, ref->blkno);
+	}
+}
+
+/* Callbacks of the BlockRefTable reader and writer */
+static int
+summary_read_callback(void *callback_arg, void *data, int length)
+{
+	SummaryFile *file = (SummaryFile *) callback_arg;
+	int			rc;
+
+	rc = read(file->fd, data, length);
+	if (rc < 0)
+	{
+		fprintf(stderr, "could not read file \"%s\": %m\n", file->path);
+		exit(EXIT_FAILURE);
+	}
+
+	return rc;
+}
+
+static int
+summary_write_callback(void *callback_arg, void *data, int length)
+{
+	SummaryFile *file = (SummaryFile *) callback_arg;
+	int			rc;
+
+	errno = 0;
+	rc = write(file->fd, data, length);
+	if (rc != length)
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		fprintf(stderr, "could not write file \"%s\": %m\n", file->path);
+		exit(EXIT_FAILURE);
+	}
+
+	return rc;
+}
+
+static void
+summary_error_callback(void *callback_arg, char *fmt,...)
+{
+	va_list		ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Write a summary file for the range of records between start_lsn and
+ * end_lsn of a timeline, with the block references of brtab.
+ */
+void
+summary_write(const char *path, BlockRefTable *brtab, TimeLineID tli,
+			  XLogRecPtr start_lsn, XLogRecPtr end_lsn)
+{
+	SummaryFile file;
+	BlockSummaryHeader header;
+
+	file.path = path;
+	file.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY,
+				   pg_file_create_mode);
+	if (file.fd < 0)
+	{
+		fprintf(stderr, "could not create file \"%s\": %m\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = BLOCK_SUMMARY_MAGIC;
+	header.version = BLOCK_SUMMARY_VERSION;
+	header.start_lsn = start_lsn;
+	header.end_lsn = end_lsn;
+	header.tli = tli;
+	summary_write_callback(&file, &header, sizeof(header));
+
+	WriteBlockRefTable(brtab, summary_write_callback, &file);
+
+	if (fsync(file.fd) != 0)
+	{
+		fprintf(stderr, "could not fsync file \"%s\": %m\n", path);
+		exit(EXIT_FAILURE);
+	}
+	if (close(file.fd) != 0)
+	{
+		fprintf(stderr, "could not close file \"%s\": %m\n", path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Read a summary file, applying its contents on top of brtab.
+ */
+static void
+summary_read(const char *path, BlockSummaryHeader *header,
+			 BlockRefTable *brtab)
+{
+	SummaryFile file;
+	BlockRefTableReader *reader;
+	RelFileLocator rlocator;
+	ForkNumber	forknum;
+	BlockNumber limit_block;
+	BlockNumber blocks[SUMMARY_BLOCK_BUFFER_SIZE];
+	int			rc;
+
+	file.path = path;
+	file.fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (file.fd < 0)
+	{
+		fprintf(stderr, "could not open file \"%s\": %m\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	rc = read(file.fd, header, sizeof(BlockSummaryHeader));
+	if (rc < 0)
+	{
+		fprintf(stderr, "could not read file \"%s\": %m\n", path);
+		exit(EXIT_FAILURE);
+	}
+	if (rc != sizeof(BlockSummaryHeader) ||
+		header->magic != BLOCK_SUMMARY_MAGIC)
+	{
+		fprintf(stderr, "file \"%s\" is not a block summary\n", path);
+		exit(EXIT_FAILURE);
+	}
+	if (header->version != BLOCK_SUMMARY_VERSION)
+	{
+		fprintf(stderr, "block summary \"%s\" has unsupported version %u\n",
+				path, header->version);
+		exit(EXIT_FAILURE);
+	}
+
+	reader = CreateBlockRefTableReader(summary_read_callback, &file,
+									   (char *) path,
+									   summary_error_callback, NULL);
+
+	/*
+	 * The limit block goes first, discarding the blocks past it modified in
+	 * the previous ranges.
+	 */
+	while (BlockRefTableReaderNextRelation(reader, &rlocator, &forknum,
+										   &limit_block))
+	{
+		unsigned	nblocks;
+
+		BlockRefTableSetLimitBlock(brtab, &rlocator, forknum, limit_block);
+
+		while ((nblocks = BlockRefTableReaderGetBlocks(reader, blocks,
+													   SUMMARY_BLOCK_BUFFER_SIZE)) > 0)
+		{
+			for (unsigned i = 0; i < nblocks; i++)
+				BlockRefTableMarkBlockModified(brtab, &rlocator, forknum,
+											   blocks[i]);
+		}
+	}
+
+	DestroyBlockRefTableReader(reader);
+	close(file.fd);
+}
+
+/*
+ * Merge the summaries of consecutive ranges of records into one summary
+ * file covering all of them.  The summaries need to be given in LSN order.
+ */
+void
+summary_merge(const char *path, char **inputs, int ninputs)
+{
+	BlockRefTable *brtab = CreateEmptyBlockRefTable();
+	BlockSummaryHeader first;
+	BlockSummaryHeader header;
+
+	Assert(ninputs > 0);
+
+	summary_read(inputs[0], &first, brtab);
+	header = first;
+
+	for (int i = 1; i < ninputs; i++)
+	{
+		XLogRecPtr	prev_end_lsn = header.end_lsn;
+
+		summary_read(inputs[i], &header, brtab);
+
+		if (header.tli != first.tli)
+		{
+			fprintf(stderr, "block summary \"%s\" is on timeline %u, expected %u\n",
+					inputs[i], header.tli, first.tli);
+			exit(EXIT_FAILURE);
+		}
+		if (header.start_lsn != prev_end_lsn)
+		{
+			fprintf(stderr, "block summary \"%s\" starts at %X/%X, expected %X/%X\n",
+					inputs[i],
+					(uint32) (header.start_lsn >> 32), (uint32) header.start_lsn,
+					(uint32) (prev_end_lsn >> 32), (uint32) prev_end_lsn);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	summary_write(path, brtab, first.tli, first.start_lsn, header.end_lsn);
+}
@@ -0,0 +1,106 @@
+# Copyright (c) 2023-2026, PostgreSQL Global Development Group
+
+# Check the limit blocks of the block summaries, for relations truncated
+# or dropped and for databases created or dropped.  The contents of the
+# summaries are printed with pg_walsummary, once their header removed.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init;
+$node->start;
+
+plan skip_all => 'pg_walsummary requires PostgreSQL 17 or newer'
+  if $node->pg_version < 17;
+
+my $tempdir = PostgreSQL::Test::Utils::tempdir;
+my $dboid = $node->safe_psql('postgres',
+	"SELECT oid FROM pg_database WHERE datname = 'postgres'");
+
+# Tables created before the range, so as their limit blocks are the ones
+# of their truncation or drop rather than the ones of their creation.
+$node->safe_psql('postgres',
+	'CREATE TABLE tab_truncated AS SELECT generate_series(1, 100000) AS a');
+my $truncated = $node->safe_psql('postgres',
+	"SELECT pg_relation_filenode('tab_truncated')");
+$node->safe_psql('postgres',
+	'CREATE TABLE tab_dropped AS SELECT generate_series(1, 1000) AS a');
+$node->safe_psql('postgres', 'VACUUM tab_dropped');
+my $dropped = $node->safe_psql('postgres',
+	"SELECT pg_relation_filenode('tab_dropped')");
+my $start_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+
+# A table dropped, and one created in an aborted transaction
+$node->safe_psql('postgres', 'DROP TABLE tab_dropped');
+my $aborted = $node->safe_psql(
+	'postgres', q{
+BEGIN;
+CREATE TABLE tab_aborted (a int);
+SELECT pg_relation_filenode('tab_aborted');
+ROLLBACK;
+});
+
+# The table truncated by VACUUM, keeping its relation file
+$node->safe_psql('postgres', 'DELETE FROM tab_truncated WHERE a > 10');
+$node->safe_psql('postgres', 'VACUUM tab_truncated');
+
+# Databases created with both strategies, one of them dropped
+$node->safe_psql('postgres',
+	'CREATE DATABASE db_wal_log STRATEGY wal_log');
+$node->safe_psql('postgres',
+	'CREATE DATABASE db_file_copy STRATEGY file_copy');
+my $db_wal_log = $node->safe_psql('postgres',
+	"SELECT oid FROM pg_database WHERE datname = 'db_wal_log'");
+my $db_file_copy = $node->safe_psql('postgres',
+	"SELECT oid FROM pg_database WHERE datname = 'db_file_copy'");
+$node->safe_psql('postgres', 'DROP DATABASE db_file_copy');
+
+my $end_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+$node->safe_psql('postgres', 'SELECT pg_switch_wal()');
+
+command_ok(
+	[
+		'pg_wal_blocks', '--path', $node->data_dir . '/pg_wal',
+		'--timeline', '1', '--start', $start_lsn,
+		'--end', $end_lsn, '--summary', "$tempdir/summary"
+	],
+	'block summary written');
+
+# Remove the BlockSummaryHeader, leaving the contents of the BlockRefTable
+my $summary = slurp_file("$tempdir/summary");
+is(unpack('V', $summary), 0x53424750, 'block summary header');
+append_to_file("$tempdir/brtab", substr($summary, 32));
+
+my ($stdout, $stderr) =
+  run_command([ 'pg_walsummary', '--individual', "$tempdir/brtab" ]);
+is($stderr, '', 'block summary read by pg_walsummary');
+
+# The relations dropped get a limit block on all their forks except the
+# free space map, as for the WAL summarizer.
+like($stdout, qr/^TS 1663, DB $dboid, REL $dropped, FORK main: limit 0$/m,
+	'limit block for a relation dropped at commit');
+like($stdout, qr/^TS 1663, DB $dboid, REL $aborted, FORK main: limit 0$/m,
+	'limit block for a relation dropped at abort');
+like($stdout, qr/^TS 1663, DB $dboid, REL $dropped, FORK vm: limit 0$/m,
+	'limit block for the visibility map of a dropped relation');
+unlike($stdout, qr/^TS 1663, DB $dboid, REL $dropped, FORK fsm: limit/m,
+	'no limit block for the free space map of a dropped relation');
+like($stdout,
+	qr/^TS 1663, DB $dboid, REL $truncated, FORK main: limit [1-9][0-9]*$/m,
+	'limit block for a relation truncated');
+
+# The databases get a limit block with a relation number of 0
+like($stdout, qr/^TS 1663, DB $db_wal_log, REL 0, FORK main: limit 0$/m,
+	'limit block for a database created with wal_log');
+like($stdout, qr/^TS 1663, DB $db_file_copy, REL 0, FORK main: limit 0$/m,
+	'limit block for a database created with file_copy then dropped');
+
+$node->stop;
+done_testing();
@@ -0,0 +1,545 @@
+/*-------------------------------------------------------------------------
+ *
+ * workset.c
+ *		Estimation of the write working set with HyperLogLog sketches
+ *
+ * The number of distinct blocks modified is estimated for each window of
+ * WAL of a fixed size, cumulated over the windows, and for each relation
+ * fork over the whole range parsed.  Each estimation uses a HyperLogLog
+ * sketch, so as the memory used does not depend on the number of blocks.
+ * The sketch of a window is freed once all the records beginning in it
+ * have been added, only its estimations being kept for the report, so as
+ * the memory used does not depend on the amount of WAL parsed either.
+ *
+ * The implementation of HyperLogLog follows the one of the backend in
+ * src/backend/lib/hyperloglog.c, which is not available in frontend code.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pg_wal_blocks/workset.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include <math.h>
+#include <time.h>
+
+#include "access/rmgr.h"
+#include "access/xact.h"
+#include "common/hashfn.h"
+#include "common/int.h"
+#include "common/relpath.h"
+#include "datatype/timestamp.h"
+#include "port/pg_bitutils.h"
+
+#include "pg_wal_blocks.h"
+
+/*
+ * Number of bits of the hashes used for the register index, for the
+ * sketches of windows and of relation forks.  This gives a standard error
+ * of about 0.8% and 3.2%, with registers of 16kB and 1kB.
+ */
+#define WORKSET_WINDOW_BWIDTH		14
+#define WORKSET_RELATION_BWIDTH		10
+
+typedef struct HyperLogLog
+{
+	uint8		bwidth;			/* bits of the hashes for the index */
+	uint32		nregs;			/* number of registers, 2^bwidth */
+	double		alpha_mm;		/* alpha * nregs * nregs */
+	uint8	   *regs;			/* registers */
+} HyperLogLog;
+
+/* Window of WAL */
+typedef struct WorksetWindow
+{
+	uint64		key;			/* start of the window / window size */
+	char		status;			/* for simplehash */
+	TimestampTz last_commit;	/* last commit in the window, or 0 */
+	HyperLogLog sketch;
+} WorksetWindow;
+
+/* Relation fork */
+typedef struct WorksetRelKey
+{
+	RelFileLocator rlocator;
+	ForkNumber	forknum;
+} WorksetRelKey;
+
+typedef struct WorksetRelation
+{
+	WorksetRelKey key;
+	char		status;			/* for simplehash */
+	double		estimate;		/* estimated blocks, for the report */
+	HyperLogLog sketch;
+} WorksetRelation;
+
+#define SH_PREFIX				wswindow
+#define SH_ELEMENT_TYPE			WorksetWindow
+#define SH_KEY_TYPE				uint64
+#define SH_KEY					key
+#define SH_HASH_KEY(tb, key)	hash_bytes_uint32((uint32) ((key) ^ ((key) >> 32)))
+#define SH_EQUAL(tb, a, b)		((a) == (b))
+#define SH_SCOPE				static inline
+#define SH_RAW_ALLOCATOR		pg_malloc0
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+#define SH_PREFIX				wsrelation
+#define SH_ELEMENT_TYPE			WorksetRelation
+#define SH_KEY_TYPE				WorksetRelKey
+#define SH_KEY					key
+#define SH_HASH_KEY(tb, key) \
+	hash_bytes((const unsigned char *) &(key), sizeof(WorksetRelKey))
+#define SH_EQUAL(tb, a, b)		(memcmp(&(a), &(b), sizeof(WorksetRelKey)) == 0)
+#define SH_SCOPE				static inline
+#define SH_RAW_ALLOCATOR		pg_malloc0
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
+/* Estimations of a window complete */
+typedef struct WorksetRow
+{
+	uint64		key;			/* start of the window / window size */
+	TimestampTz last_commit;	/* last commit in the window, or 0 */
+	double		blocks;			/* blocks in the window */
+	double		cumul_blocks;	/* blocks up to the end of the window */
+} WorksetRow;
+
+struct WorkingSet
+{
+	uint64		window_size;	/* bytes of WAL per window */
+	wswindow_hash *windows;		/* windows not complete yet */
+	wsrelation_hash *relations;
+	HyperLogLog cumulated;		/* all the windows complete, regs NULL if
+								 * none */
+	WorksetRow *rows;			/* windows complete, in LSN order */
+	int			nrows;
+	int			maxrows;
+};
+
+static void
+hll_init(HyperLogLog *hll, uint8 bwidth)
+{
+	double		alpha;
+
+	hll->bwidth = bwidth;
+	hll->nregs = UINT64CONST(1) << bwidth;
+	hll->regs = pg_malloc0(hll->nregs);
+
+	switch (hll->nregs)
+	{
+		case 16:
+			alpha = 0.673;
+			break;
+		case 32:
+			alpha = 0.697;
+			break;
+		case 64:
+			alpha = 0.709;
+			break;
+		default:
+			alpha = 0.7213 / (1.0 + 1.079 / hll->nregs);
+	}
+	hll->alpha_mm = alpha * hll->nregs * hll->nregs;
+}
+
+/*
+ * Position of the leftmost one bit of x, counting from 1, limited to b + 1
+ * if the b bits looked at are all zeros.
+ */
+static inline uint8
+hll_rho(uint32 x, uint8 b)
+{
+	uint8		j;
+
+	if (x == 0)
+		return b + 1;
+
+	j = 32 - pg_leftmost_one_pos32(x);
+	return Min(j, b + 1);
+}
+
+static inline void
+hll_add(HyperLogLog *hll, uint32 hash)
+{
+	uint32		index = hash >> (32 - hll->bwidth);
+	uint8		count = hll_rho(hash << hll->bwidth, 32 - hll->bwidth);
+
+	hll->regs[index] = Max(hll->regs[index], count);
+}
+
+static void
+hll_merge(HyperLogLog *dst, const HyperLogLog *src)
+{
+	Assert(dst->bwidth == src->bwidth);
+
+	for (uint32 i = 0; i < dst->nregs; i++)
+		dst->regs[i] = Max(dst->regs[i], src->regs[i]);
+}
+
+static double
+hll_estimate(const HyperLogLog *hll)
+{
+	double		result;
+	double		sum = 0.0;
+
+	for (uint32 i = 0; i < hll->nregs; i++)
+		sum += 1.0 / pow(2.0, hll->regs[i]);
+
+	result = hll->alpha_mm / sum;
+
+	if (result <= (5.0 / 2.0) * hll->nregs)
+	{
+		/* Small range correction */
+		int			zero_count = 0;
+
+		for (uint32 i = 0; i < hll->nregs; i++)
+		{
+			if (hll->regs[i] == 0)
+				zero_count++;
+		}
+
+		if (zero_count != 0)
+			result = hll->nregs * log((double) hll->nregs / zero_count);
+	}
+	else if (result > (1.0 / 30.0) * 4294967296.0)
+	{
+		/* Large range correction */
+		result = -4294967296.0 * log(1.0 - (result / 4294967296.0));
+	}
+
+	return result;
+}
+
+WorkingSet *
+workset_create(uint64 window_size)
+{
+	WorkingSet *workset = pg_malloc(sizeof(WorkingSet));
+
+	workset->window_size = window_size;
+	workset->windows = wswindow_create(64, NULL);
+	workset->relations = wsrelation_create(1024, NULL);
+	workset->cumulated.regs = NULL;
+	workset->rows = NULL;
+	workset->nrows = 0;
+	workset->maxrows = 0;
+	return workset;
+}
+
+void
+workset_free(WorkingSet *workset)
+{
+	wswindow_iterator witer;
+	wsrelation_iterator riter;
+	WorksetWindow *window;
+	WorksetRelation *relation;
+
+	wswindow_start_iterate(workset->windows, &witer);
+	while ((window = wswindow_iterate(workset->windows, &witer)) != NULL)
+		pg_free(window->sketch.regs);
+	wsrelation_start_iterate(workset->relations, &riter);
+	while ((relation = wsrelation_iterate(workset->relations, &riter)) != NULL)
+		pg_free(relation->sketch.regs);
+
+	wswindow_destroy(workset->windows);
+	wsrelation_destroy(workset->relations);
+	if (workset->cumulated.regs != NULL)
+		pg_free(workset->cumulated.regs);
+	if (workset->rows != NULL)
+		pg_free(workset->rows);
+	pg_free(workset);
+}
+
+static WorksetWindow *
+workset_get_window(WorkingSet *workset, uint64 key)
+{
+	WorksetWindow *window;
+	bool		found;
+
+	window = wswindow_insert(workset->windows, key, &found);
+	if (!found)
+	{
+		window->last_commit = 0;
+		hll_init(&window->sketch, WORKSET_WINDOW_BWIDTH);
+	}
+	return window;
+}
+
+static WorksetRelation *
+workset_get_relation(WorkingSet *workset, const RelFileLocator *rlocator,
+					 ForkNumber forknum)
+{
+	WorksetRelKey key;
+	WorksetRelation *relation;
+	bool		found;
+
+	/* Zero the key, as it is hashed and compared as bytes */
+	memset(&key, 0, sizeof(WorksetRelKey));
+	key.rlocator = *rlocator;
+	key.forknum = forknum;
+
+	relation = wsrelation_insert(workset->relations, key, &found);
+	if (!found)
+		hll_init(&relation->sketch, WORKSET_RELATION_BWIDTH);
+	return relation;
+}
+
+/*
+ * Add the blocks referenced by a record to the sketches of its window and
+ * of the relation forks referenced.  The commit timestamps are tracked to
+ * give an idea of the time covered by each window.
+ */
+void
+workset_add_record(WorkingSet *workset, XLogReaderState *record)
+{
+	WorksetWindow *window;
+
+	window = workset_get_window(workset,
+								record->ReadRecPtr / workset->window_size);
+
+	if (XLogRecGetRmid(record) == RM_XACT_ID)
+	{
+		uint8		info = XLogRecGetInfo(record) & XLOG_XACT_OPMASK;
+
+		if (info == XLOG_XACT_COMMIT || info == XLOG_XACT_COMMIT_PREPARED)
+		{
+			xl_xact_commit *xlrec = (xl_xact_commit *) XLogRecGetData(record);
+
+			window->last_commit = Max(window->last_commit, xlrec->xact_time);
+		}
+	}
+
+	for (int block_id = 0; block_id <= XLogRecMaxBlockId(record); block_id++)
+	{
+		struct
+		{
+			RelFileLocator rlocator;
+			ForkNumber	forknum;
+			BlockNumber blkno;
+		}			block;
+		uint32		hash;
+
+		memset(&block, 0, sizeof(block));
+		if (!XLogRecGetBlockTagExtended(record, block_id, &block.rlocator,
+										&block.forknum, &block.blkno, NULL))
+			continue;
+
+		hash = hash_bytes((const unsigned char *) &block, sizeof(block));
+		hll_add(&window->sketch, hash);
+		hll_add(&workset_get_relation(workset, &block.rlocator,
+									  block.forknum)->sketch, hash);
+	}
+}
+
+/*
+ * Merge the sketches of src into the ones of dst.
+ */
+void
+workset_merge(WorkingSet *dst, WorkingSet *src)
+{
+	wswindow_iterator witer;
+	wsrelation_iterator riter;
+	WorksetWindow *src_window;
+	WorksetRelation *src_relation;
+
+	wswindow_start_iterate(src->windows, &witer);
+	while ((src_window = wswindow_iterate(src->windows, &witer)) != NULL)
+	{
+		WorksetWindow *window = workset_get_window(dst, src_window->key);
+
+		window->last_commit = Max(window->last_commit,
+								  src_window->last_commit);
+		hll_merge(&window->sketch, &src_window->sketch);
+	}
+
+	wsrelation_start_iterate(src->relations, &riter);
+	while ((src_relation = wsrelation_iterate(src->relations, &riter)) != NULL)
+	{
+		WorksetRelation *relation;
+
+		relation = workset_get_relation(dst, &src_relation->key.rlocator,
+										src_relation->key.forknum);
+		hll_merge(&relation->sketch, &src_relation->sketch);
+	}
+}
+
+/* Sort window keys, in LSN order */
+static int
+workset_key_cmp(const void *a, const void *b)
+{
+	return pg_cmp_u64(*(const uint64 *) a, *(const uint64 *) b);
+}
+
+/*
+ * Complete the windows whose key is lower than "limit", computing their
+ * estimations and freeing their sketches.  This needs to be called with
+ * an increasing limit, for the windows to be cumulated in order.
+ */
+static void
+workset_complete_windows(WorkingSet *workset, uint64 limit)
+{
+	wswindow_iterator witer;
+	WorksetWindow *window;
+	uint64	   *keys;
+	int			nkeys = 0;
+
+	if (workset->windows->members == 0)
+		return;
+
+	keys = pg_malloc(sizeof(uint64) * workset->windows->members);
+	wswindow_start_iterate(workset->windows, &witer);
+	while ((window = wswindow_iterate(workset->windows, &witer)) != NULL)
+	{
+		if (window->key < limit)
+			keys[nkeys++] = window->key;
+	}
+	qsort(keys, nkeys, sizeof(uint64), workset_key_cmp);
+
+	if (nkeys > 0 && workset->cumulated.regs == NULL)
+		hll_init(&workset->cumulated, WORKSET_WINDOW_BWIDTH);
+
+	for (int i = 0; i < nkeys; i++)
+	{
+		WorksetRow *row;
+
+		/* Deletions move entries, so look each window up again */
+		window = wswindow_lookup(workset->windows, keys[i]);
+
+		if (workset->nrows >= workset->maxrows)
+		{
+			workset->maxrows = Max(workset->maxrows * 2, 64);
+			workset->rows = pg_realloc(workset->rows,
+									   sizeof(WorksetRow) * workset->maxrows);
+		}
+		row = &workset->rows[workset->nrows++];
+
+		hll_merge(&workset->cumulated, &window->sketch);
+		row->key = window->key;
+		row->last_commit = window->last_commit;
+		row->blocks = hll_estimate(&window->sketch);
+		row->cumul_blocks = hll_estimate(&workset->cumulated);
+
+		pg_free(window->sketch.regs);
+		wswindow_delete_item(workset->windows, window);
+	}
+
+	pg_free(keys);
+}
+
+/*
+ * Complete the windows ending at or before lsn, all the records beginning
+ * before it having been added.
+ */
+void
+workset_complete(WorkingSet *workset, XLogRecPtr lsn)
+{
+	workset_complete_windows(workset, lsn / workset->window_size);
+}
+
+/* Sort relation forks by estimated number of blocks, the highest first */
+static int
+workset_relation_cmp(const void *a, const void *b)
+{
+	const WorksetRelation *ra = *(WorksetRelation *const *) a;
+	const WorksetRelation *rb = *(WorksetRelation *const *) b;
+
+	if (ra->estimate != rb->estimate)
+		return ra->estimate > rb->estimate ? -1 : 1;
+	return memcmp(&ra->key, &rb->key, sizeof(WorksetRelKey));
+}
+
+/*
+ * Format a timestamp in UTC, or an empty string if zero.
+ */
+static void
+workset_format_time(TimestampTz ts, char *buf, size_t len)
+{
+	time_t		t;
+	struct tm  *tm;
+
+	buf[0] = '\0';
+	if (ts == 0)
+		return;
+
+	t = (time_t) (ts / USECS_PER_SEC +
+				  ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY));
+	tm = gmtime(&t);
+	if (tm != NULL)
+		strftime(buf, len, "%Y-%m-%d %H:%M:%S UTC", tm);
+}
+
+/*
+ * Print to stdout the estimated working set of each window, cumulated
+ * over the windows, then the one of each relation fork.
+ */
+void
+workset_report(WorkingSet *workset)
+{
+	wsrelation_iterator riter;
+	WorksetRelation *relation;
+	WorksetRelation **relations;
+	int			nrelations = 0;
+	double		mb_per_block = (double) BLCKSZ / (1024 * 1024);
+
+	/* All the records have been added */
+	workset_complete_windows(workset, PG_UINT64_MAX);
+
+	printf("%-17s %-17s %-23s %12s %10s %12s %10s\n",
+		   "window_start", "window_end", "last_commit",
+		   "blocks", "size_mb", "cumul_blocks", "cumul_mb");
+	for (int i = 0; i < workset->nrows; i++)
+	{
+		WorksetRow *row = &workset->rows[i];
+		XLogRecPtr	start = row->key * workset->window_size;
+		XLogRecPtr	end = start + workset->window_size;
+		char		start_str[32];
+		char		end_str[32];
+		char		commit_str[64];
+
+		snprintf(start_str, sizeof(start_str), "%X/%X",
+				 (uint32) (start >> 32), (uint32) start);
+		snprintf(end_str, sizeof(end_str), "%X/%X",
+				 (uint32) (end >> 32), (uint32) end);
+		workset_format_time(row->last_commit, commit_str,
+							sizeof(commit_str));
+
+		printf("%-17s %-17s %-23s %12.0f %10.1f %12.0f %10.1f\n",
+			   start_str, end_str, commit_str,
+			   row->blocks, row->blocks * mb_per_block,
+			   row->cumul_blocks, row->cumul_blocks * mb_per_block);
+	}
+
+	relations = pg_malloc(sizeof(WorksetRelation *) *
+						  Max(workset->relations->members, 1));
+	wsrelation_start_iterate(workset->relations, &riter);
+	while ((relation = wsrelation_iterate(workset->relations, &riter)) != NULL)
+	{
+		relation->estimate = hll_estimate(&relation->sketch);
+		relations[nrelations++] = relation;
+	}
+	qsort(relations, nrelations, sizeof(WorksetRelation *),
+		  workset_relation_cmp);
+
+	printf("\n%-32s %-4s %12s %10s\n", "relation", "fork", "blocks", "size_mb");
+	for (int i = 0; i < nrelations; i++)
+	{
+		char		name[64];
+		double		blocks = relations[i]->estimate;
+
+		snprintf(name, sizeof(name), "%u/%u/%u",
+				 relations[i]->key.rlocator.spcOid,
+				 relations[i]->key.rlocator.dbOid,
+				 relations[i]->key.rlocator.relNumber);
+		printf("%-32s %-4s %12.0f %10.1f\n", name,
+			   forkNames[relations[i]->key.forknum],
+			   blocks, blocks * mb_per_block);
+	}
+
+	pg_free(relations);
+}
@@ -0,0 +1,60 @@
+/* receiver_raw/receiver_raw--1.0.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION receiver_raw" to load this file. \quit
+
+-- Subscriptions whose changes are received and applied by the workers
+-- started by the launcher, when receiver_raw.max_subscriptions is set.
+-- Each subscription uses its own replication slot on its own server.
+CREATE TABLE receiver_raw_subscriptions (
+	name text PRIMARY KEY CHECK (name ~ '^[a-z0-9_]{1,63}$'),
+	slot_name text NOT NULL CHECK (length(slot_name) < 64),
+	conn_string text NOT NULL CHECK (length(conn_string) < 1024),
+	enabled bool NOT NULL DEFAULT true);
+SELECT pg_catalog.pg_extension_config_dump('receiver_raw_subscriptions', '');
+REVOKE ALL ON receiver_raw_subscriptions FROM PUBLIC;
+
+-- Wake up the launcher so as it scans the subscriptions, returning false
+-- if the launcher is not running.
+CREATE FUNCTION receiver_raw_reload()
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+REVOKE ALL ON FUNCTION receiver_raw_reload() FROM PUBLIC;
+
+-- Statistics about the changes received and applied, for each
+-- subscription. The subscription is NULL for the receiver started with
+-- receiver_raw.slot_name and receiver_raw.conn_string. The latency
+-- histograms have 8 buckets, the first one counting latencies under
+-- 10us, each following one covering ten times the previous one, and
+-- the last one counting latencies of 10s and more.
+CREATE FUNCTION receiver_raw_stats(
+	OUT subscription text,
+	OUT slot_name text,
+	OUT status text,
+	OUT receiver_pid int,
+	OUT apply_pid int,
+	OUT messages bigint,
+	OUT bytes bigint,
+	OUT keepalives bigint,
+	OUT inserts bigint,
+	OUT updates bigint,
+	OUT deletes bigint,
+	OUT missing bigint,
+	OUT others bigint,
+	OUT batches bigint,
+	OUT apply_latency bigint[],
+	OUT commit_latency bigint[],
+	OUT received_lsn pg_lsn,
+	OUT applied_lsn pg_lsn,
+	OUT lag_bytes bigint,
+	OUT apply_lag interval)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE VIEW receiver_raw_stats AS
+	SELECT * FROM receiver_raw_stats();
+
+REVOKE ALL ON FUNCTION receiver_raw_stats() FROM PUBLIC;
+REVOKE ALL ON receiver_raw_stats FROM PUBLIC;
@@ -19,46 +19,126 @@
 #include <sys/time.h>
 
 #include "fmgr.h"
+#include "funcapi.h"
 #include "libpq-fe.h"
 #include "pqexpbuffer.h"
+#include "access/htup_details.h"
 #include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/pg_replication_origin.h"
+#include "catalog/pg_type.h"
+#include "lib/ilist.h"
 #include "lib/stringinfo.h"
+#include "miscadmin.h"
 #include "pgstat.h"
 #include "executor/spi.h"
+#include "portability/instr_time.h"
 #include "postmaster/bgworker.h"
+#include "replication/origin.h"
+#include "storage/fd.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
+#include "storage/lmgr.h"
 #include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
 #include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/pg_lsn.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
 #include "utils/wait_event.h"
 
+#include "receiver_raw.h"
+
 /* Allow load of this module in shared libs */
 PG_MODULE_MAGIC;
 
 /* Entry point of library loading */
 void		_PG_init(void);
 pg_noreturn PGDLLEXPORT void receiver_raw_main(Datum main_arg);
+pg_noreturn PGDLLEXPORT void receiver_raw_apply_main(Datum main_arg);
+
+PG_FUNCTION_INFO_V1(receiver_raw_stats);
 
 /* Signal handling */
 static volatile sig_atomic_t got_sigterm = false;
 static volatile sig_atomic_t got_sighup = false;
 
 /* GUC variables */
-static char *receiver_database = "postgres";
+char	   *receiver_database = "postgres";
 static char *receiver_slot = "slot";
 static char *receiver_conn_string = "replication=database dbname=postgres application_name=receiver_raw";
 static int	receiver_idle_time = 100;
 static bool receiver_sync_mode = true;
+static int	receiver_change_format = RECEIVER_CHANGE_FORMAT_SQL;
+char	   *receiver_spool_directory = "";
+int			receiver_max_subscriptions = 0;
+
+static const struct config_enum_entry change_format_options[] = {
+	{"sql", RECEIVER_CHANGE_FORMAT_SQL, false},
+	{"tuple", RECEIVER_CHANGE_FORMAT_TUPLE, false},
+	{NULL, 0, false}
+};
 
-/* Worker name */
+/* Worker names */
 static char *worker_name = "receiver_raw";
+static char *apply_worker_name = "receiver_raw apply";
+
+/* Replication origin tracking the spool position applied */
+static char *spool_origin_name = "receiver_raw_spool";
+
+/*
+ * Number of spooled changes after which a batch applied in a single
+ * transaction ends, at the next end of a remote transaction.
+ */
+#define SPOOL_APPLY_BATCH	10000
+
+/* Is the spool enabled? */
+#define spool_enabled	(receiver_spool_directory[0] != '\0')
+
+/* Shared state, and slot of the worker running */
+ReceiverRawShared *receiver_shared = NULL;
+static ReceiverRawWorker *MyReceiverWorker = NULL;
 
-/* Lastly written positions */
+/* Saved hook values in case of unload */
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/*
+ * Lastly written positions. The written position is the latest one received
+ * from the server, the applied position is the latest one whose changes have
+ * been committed locally, and the flushed position is the latest one whose
+ * local commit record is known as flushed to disk.
+ */
 static XLogRecPtr output_written_lsn = InvalidXLogRecPtr;
 static XLogRecPtr output_fsync_lsn = InvalidXLogRecPtr;
 static XLogRecPtr output_applied_lsn = InvalidXLogRecPtr;
 
+/* Flushed and applied positions lastly sent to the server */
+static XLogRecPtr last_sent_fsync_lsn = InvalidXLogRecPtr;
+static XLogRecPtr last_sent_applied_lsn = InvalidXLogRecPtr;
+
+/*
+ * Changes are applied with synchronous_commit = off, so the flush position
+ * reported to the server cannot be the applied position. Each local commit
+ * is tracked with the end of its commit record and the remote position it
+ * covers, and entries are discarded once the local WAL flush position has
+ * passed them.
+ */
+typedef struct FlushPosition
+{
+	dlist_node	node;
+	XLogRecPtr	local_end;		/* end of local commit record */
+	XLogRecPtr	remote_end;		/* remote position covered by commit */
+} FlushPosition;
+
+static dlist_head lsn_mapping = DLIST_STATIC_INIT(lsn_mapping);
+
+/* Spool position after the last record ending a remote transaction */
+static SpoolPtr spool_commit_pos = 0;
+
 /* Stream functions */
 static void fe_sendint64(int64 i, char *buf);
 static int64 fe_recvint64(char *buf);
@@ -85,6 +165,56 @@ receiver_raw_sighup(SIGNAL_ARGS)
 	errno = save_errno;
 }
 
+/*
+ * Track a local commit, ending at local_end, covering changes up to the
+ * given remote position.  local_end is invalid if nothing was written.
+ */
+static void
+store_flush_position(XLogRecPtr remote_lsn, XLogRecPtr local_end)
+{
+	FlushPosition *flushpos;
+
+	/* Nothing written locally, the remote position is flushed already */
+	if (XLogRecPtrIsInvalid(local_end))
+	{
+		output_fsync_lsn = Max(remote_lsn, output_fsync_lsn);
+		return;
+	}
+
+	flushpos = (FlushPosition *) MemoryContextAlloc(TopMemoryContext,
+													 sizeof(FlushPosition));
+	flushpos->local_end = local_end;
+	flushpos->remote_end = remote_lsn;
+	dlist_push_tail(&lsn_mapping, &flushpos->node);
+}
+
+/*
+ * Update the flushed position, based on the local commits whose records
+ * have been flushed to disk. Returns true if there are still local commits
+ * waiting for a flush.
+ */
+static bool
+update_flush_position(void)
+{
+	dlist_mutable_iter iter;
+	XLogRecPtr	local_flush = GetFlushRecPtr(NULL);
+
+	dlist_foreach_modify(iter, &lsn_mapping)
+	{
+		FlushPosition *pos = dlist_container(FlushPosition, node, iter.cur);
+
+		/* Entries are ordered by local commit position */
+		if (pos->local_end > local_flush)
+			return true;
+
+		output_fsync_lsn = Max(pos->remote_end, output_fsync_lsn);
+		dlist_delete(iter.cur);
+		pfree(pos);
+	}
+
+	return false;
+}
+
 /*
  * Send a Standby Status Update message to server.
  */
@@ -94,7 +224,7 @@ sendFeedback(PGconn *conn, int64 now)
 	char		replybuf[1 + 8 + 8 + 8 + 8 + 1];
 	int			len = 0;
 
-	ereport(LOG, (errmsg("%s: confirming write up to %X/%X, "
+	ereport(DEBUG1, (errmsg("%s: confirming write up to %X/%X, "
 						 "flush to %X/%X (slot custom_slot), "
 						 "applied to %X/%X",
 						 worker_name,
@@ -127,6 +257,8 @@ sendFeedback(PGconn *conn, int64 now)
 		return false;
 	}
 
+	last_sent_fsync_lsn = output_fsync_lsn;
+	last_sent_applied_lsn = output_applied_lsn;
 	return true;
 }
 
@@ -205,6 +337,321 @@ feTimestampDifference(int64 start_time, int64 stop_time,
 	}
 }
 
+/*
+ * Check if a change received is the COMMIT of a remote transaction, these
+ * being only requested when streaming into a spool.
+ */
+static bool
+is_commit_change(const char *data, int len)
+{
+	if (receiver_change_format == RECEIVER_CHANGE_FORMAT_TUPLE)
+		return len == 1 && data[0] == 'C';
+	return len == 7 && memcmp(data, "COMMIT;", 7) == 0;
+}
+
+/*
+ * Parse the streaming header of a data message received from the server.
+ * Returns the length of the header, the change data following it.
+ */
+static int
+parse_stream_header(char *copybuf, int len, XLogRecPtr *walStart,
+					XLogRecPtr *walEnd, TimestampTz *sendTime)
+{
+	int			hdr_len;
+
+	hdr_len = 1;				/* msgtype 'w' */
+	*walStart = fe_recvint64(&copybuf[hdr_len]);
+	hdr_len += 8;				/* dataStart */
+	*walEnd = fe_recvint64(&copybuf[hdr_len]);
+	hdr_len += 8;				/* WALEnd */
+	*sendTime = fe_recvint64(&copybuf[hdr_len]);
+	hdr_len += 8;				/* sendTime */
+	if (len < hdr_len + 1)
+	{
+		ereport(LOG, (errmsg("%s: Streaming header too small",
+							 worker_name)));
+		proc_exit(1);
+	}
+
+	/* Log some useful information */
+	ereport(DEBUG1, (errmsg("%s: received from server, walStart %X/%X, "
+						 "and walEnd %X/%X",
+						 worker_name,
+						 (uint32) (*walStart >> 32),
+						 (uint32) *walStart,
+						 (uint32) (*walEnd >> 32),
+						 (uint32) *walEnd)));
+
+	return hdr_len;
+}
+
+/*
+ * Count a latency, measured since the given start time, in a histogram.
+ */
+static void
+count_latency(pg_atomic_uint64 *histogram, instr_time start)
+{
+	instr_time	duration;
+	uint64		usecs;
+	int			bucket = 0;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	usecs = INSTR_TIME_GET_MICROSEC(duration);
+
+	while (usecs >= 10 && bucket < RECEIVER_LATENCY_BUCKETS - 1)
+	{
+		usecs /= 10;
+		bucket++;
+	}
+
+	pg_atomic_fetch_add_u64(&histogram[bucket], 1);
+}
+
+/*
+ * Count the commit of a batch of changes, started at the given time, and
+ * covering changes up to the given remote position sent by the server at
+ * the given time.
+ */
+static void
+count_commit(instr_time start, XLogRecPtr applied_lsn, TimestampTz send_time)
+{
+	count_latency(MyReceiverWorker->commit_latency, start);
+	pg_atomic_fetch_add_u64(&MyReceiverWorker->batches, 1);
+
+	if (!XLogRecPtrIsInvalid(applied_lsn))
+		pg_atomic_write_u64(&MyReceiverWorker->applied_lsn, applied_lsn);
+	if (send_time != 0)
+		pg_atomic_write_u64(&MyReceiverWorker->apply_lag,
+							Max(GetCurrentTimestamp() - send_time, 0));
+}
+
+/*
+ * Apply a change to the database, within the transaction of the batch in
+ * progress.
+ */
+static void
+apply_change(char *data, int len)
+{
+	int			rc;
+	instr_time	start;
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	/* Apply change directly if in tuple format */
+	if (receiver_change_format == RECEIVER_CHANGE_FORMAT_TUPLE)
+	{
+		bool		found;
+
+		pgstat_report_activity(STATE_RUNNING, NULL);
+		SetCurrentStatementStartTimestamp();
+		found = receiver_raw_apply_tuple(data, len);
+		count_latency(MyReceiverWorker->apply_latency, start);
+
+		switch (data[0])
+		{
+			case 'I':
+				pg_atomic_fetch_add_u64(&MyReceiverWorker->inserts, 1);
+				break;
+			case 'U':
+				if (found)
+					pg_atomic_fetch_add_u64(&MyReceiverWorker->updates, 1);
+				else
+					pg_atomic_fetch_add_u64(&MyReceiverWorker->missing, 1);
+				break;
+			case 'D':
+				if (found)
+					pg_atomic_fetch_add_u64(&MyReceiverWorker->deletes, 1);
+				else
+					pg_atomic_fetch_add_u64(&MyReceiverWorker->missing, 1);
+				break;
+			case 'B':
+			case 'C':
+				break;
+			default:
+				pg_atomic_fetch_add_u64(&MyReceiverWorker->others, 1);
+				break;
+		}
+		return;
+	}
+
+	/*
+	 * Transaction boundaries are received with a spool, changes are applied
+	 * in batches so ignore them.
+	 */
+	if (strcmp(data, "BEGIN;") == 0 || strcmp(data, "COMMIT;") == 0)
+		return;
+
+	pgstat_report_activity(STATE_RUNNING, data);
+	SetCurrentStatementStartTimestamp();
+
+	/* Execute query */
+	rc = SPI_execute(data, false, 0);
+	count_latency(MyReceiverWorker->apply_latency, start);
+
+	if (rc == SPI_OK_INSERT)
+	{
+		pg_atomic_fetch_add_u64(&MyReceiverWorker->inserts, SPI_processed);
+		ereport(DEBUG1, (errmsg("%s: INSERT received correctly: %s",
+								worker_name, data)));
+	}
+	else if (rc == SPI_OK_UPDATE)
+	{
+		if (SPI_processed == 0)
+			pg_atomic_fetch_add_u64(&MyReceiverWorker->missing, 1);
+		pg_atomic_fetch_add_u64(&MyReceiverWorker->updates, SPI_processed);
+		ereport(DEBUG1, (errmsg("%s: UPDATE received correctly: %s",
+								worker_name, data)));
+	}
+	else if (rc == SPI_OK_DELETE)
+	{
+		if (SPI_processed == 0)
+			pg_atomic_fetch_add_u64(&MyReceiverWorker->missing, 1);
+		pg_atomic_fetch_add_u64(&MyReceiverWorker->deletes, SPI_processed);
+		ereport(DEBUG1, (errmsg("%s: DELETE received correctly: %s",
+								worker_name, data)));
+	}
+	else if (rc >= 0)
+	{
+		pg_atomic_fetch_add_u64(&MyReceiverWorker->others, 1);
+		ereport(DEBUG1, (errmsg("%s: change received correctly: %s",
+								worker_name, data)));
+	}
+	else
+		ereport(LOG, (errmsg("%s: Error when applying change: %s",
+							 worker_name, data)));
+}
+
+/*
+ * Wake up the apply worker, if any.
+ */
+static void
+wakeup_apply_worker(void)
+{
+	Latch	   *latch;
+
+	SpinLockAcquire(&MyReceiverWorker->mutex);
+	latch = MyReceiverWorker->apply_latch;
+	SpinLockRelease(&MyReceiverWorker->mutex);
+
+	if (latch != NULL)
+		SetLatch(latch);
+}
+
+/*
+ * Flush the spool and update the positions reported to the server. All
+ * the changes received are durable once the spool is flushed, and they
+ * are all applied once the apply worker has caught up with the spool.
+ * The apply worker is only let go up to the end of the last transaction
+ * spooled, so as it never applies a transaction partially.
+ */
+static void
+update_spool_positions(void)
+{
+	(void) spool_flush();
+
+	pg_atomic_write_u64(&MyReceiverWorker->spool_flush_pos, spool_commit_pos);
+	wakeup_apply_worker();
+
+	output_fsync_lsn = output_written_lsn;
+	if (pg_atomic_read_u64(&MyReceiverWorker->applied_pos) >= spool_commit_pos)
+		output_applied_lsn = output_written_lsn;
+	else
+		output_applied_lsn =
+			Max(pg_atomic_read_u64(&MyReceiverWorker->applied_lsn),
+				output_applied_lsn);
+}
+
+/*
+ * Unregister the worker from its slot at exit.
+ */
+static void
+receiver_raw_detach(int code, Datum arg)
+{
+	bool		is_apply = DatumGetBool(arg);
+
+	SpinLockAcquire(&MyReceiverWorker->mutex);
+	if (is_apply)
+	{
+		MyReceiverWorker->apply_pid = 0;
+		MyReceiverWorker->apply_latch = NULL;
+	}
+	else
+		MyReceiverWorker->receiver_pid = 0;
+	SpinLockRelease(&MyReceiverWorker->mutex);
+}
+
+/*
+ * Attach the worker to the slot given as argument of the background worker.
+ * For a worker started by the launcher, this loads the settings of its
+ * subscription, and leaves if the subscription has been removed in-between.
+ */
+static void
+receiver_raw_attach(Datum main_arg, bool is_apply)
+{
+	int			slotno = DatumGetInt32(main_arg);
+	uint32		generation;
+	bool		valid;
+	char		name[NAMEDATALEN];
+	char		slot_name[NAMEDATALEN];
+	char		conn_string[RECEIVER_CONNINFO_LEN];
+
+	if (slotno < 0 || slotno >= receiver_shared->num_workers)
+		elog(ERROR, "invalid receiver_raw worker slot %d", slotno);
+	MyReceiverWorker = &receiver_shared->workers[slotno];
+	memcpy(&generation, MyBgworkerEntry->bgw_extra, sizeof(uint32));
+
+	SpinLockAcquire(&MyReceiverWorker->mutex);
+	valid = MyReceiverWorker->in_use &&
+		!MyReceiverWorker->stop_requested &&
+		MyReceiverWorker->generation == generation;
+	if (valid)
+	{
+		if (is_apply)
+			MyReceiverWorker->apply_pid = MyProcPid;
+		else
+			MyReceiverWorker->receiver_pid = MyProcPid;
+		strlcpy(name, MyReceiverWorker->name, NAMEDATALEN);
+		strlcpy(slot_name, MyReceiverWorker->slot_name, NAMEDATALEN);
+		strlcpy(conn_string, MyReceiverWorker->conn_string,
+				RECEIVER_CONNINFO_LEN);
+	}
+	SpinLockRelease(&MyReceiverWorker->mutex);
+
+	if (!valid)
+	{
+		ereport(LOG, (errmsg("%s: subscription of worker slot %d removed, leaving",
+							 is_apply ? apply_worker_name : worker_name,
+							 slotno)));
+		proc_exit(0);
+	}
+
+	on_shmem_exit(receiver_raw_detach, BoolGetDatum(is_apply));
+
+	/* Static worker, settings come from the GUCs */
+	if (name[0] == '\0')
+		return;
+
+	receiver_slot = pstrdup(slot_name);
+	receiver_conn_string = pstrdup(conn_string);
+	worker_name = psprintf("receiver_raw %s", name);
+	apply_worker_name = psprintf("receiver_raw apply %s", name);
+	spool_origin_name = psprintf("receiver_raw_spool_%s", name);
+
+	/* Each subscription has its own spool */
+	if (spool_enabled)
+	{
+		if (!is_apply &&
+			MakePGDirectory(receiver_spool_directory) < 0 && errno != EEXIST)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not create directory \"%s\": %m",
+							receiver_spool_directory)));
+		receiver_spool_directory = psprintf("%s/%s",
+											receiver_spool_directory, name);
+	}
+}
+
 void
 receiver_raw_main(Datum main_arg)
 {
@@ -212,6 +659,7 @@ receiver_raw_main(Datum main_arg)
 	PQExpBuffer query;
 	PGconn	   *conn;
 	PGresult   *res;
+	XLogRecPtr	start_lsn = InvalidXLogRecPtr;
 
 	/* Register functions for SIGTERM/SIGHUP management */
 	pqsignal(SIGHUP, receiver_raw_sighup);
@@ -220,9 +668,20 @@ receiver_raw_main(Datum main_arg)
 	/* We're now ready to receive signals */
 	BackgroundWorkerUnblockSignals();
 
+	/* Attach to the worker slot of this subscription */
+	receiver_raw_attach(main_arg, false);
+
 	/* Connect to a database */
 	BackgroundWorkerInitializeConnection(receiver_database, NULL, 0);
 
+	/*
+	 * Changes are applied with asynchronous commits. This is safe as the
+	 * flush position reported to the server is the one of the local commit
+	 * records flushed to disk, so the slot does not advance past changes
+	 * that could be lost locally.
+	 */
+	SetConfigOption("synchronous_commit", "off", PGC_SUSET, PGC_S_OVERRIDE);
+
 	/* Establish connection to remote server */
 	conn = PQconnectdb(receiver_conn_string);
 	if (PQstatus(conn) != CONNECTION_OK)
@@ -233,14 +692,49 @@ receiver_raw_main(Datum main_arg)
 		proc_exit(1);
 	}
 
+	/*
+	 * With a spool, streaming resumes after the COMMIT of the last
+	 * transaction stored entirely in it.  The server sends again all the
+	 * transactions committed after this point from their beginning, so the
+	 * changes spooled after it are discarded, not to be spooled twice.
+	 */
+	if (spool_enabled)
+	{
+		StringInfoData last_commit;
+
+		initStringInfo(&last_commit);
+		spool_commit_pos = spool_open_write(&last_commit);
+		if (last_commit.len > 0)
+		{
+			XLogRecPtr	walStart;
+			TimestampTz sendTime;
+
+			parse_stream_header(last_commit.data, last_commit.len,
+								&walStart, &start_lsn, &sendTime);
+		}
+		pfree(last_commit.data);
+
+		pg_atomic_write_u64(&MyReceiverWorker->spool_flush_pos,
+							spool_commit_pos);
+		wakeup_apply_worker();
+	}
+
 	/* Query buffer for remote connection */
 	query = createPQExpBuffer();
 
-	/* Start logical replication at specified position */
+	/*
+	 * Start logical replication at specified position.  Transaction
+	 * boundaries are only needed to track the transactions spooled.
+	 */
 	appendPQExpBuffer(query,
-					  "START_REPLICATION SLOT \"%s\" LOGICAL 0/0 "
-					  "(\"include_transaction\" 'off')",
-					  receiver_slot);
+					  "START_REPLICATION SLOT \"%s\" LOGICAL %X/%X "
+					  "(\"include_transaction\" '%s'%s)",
+					  receiver_slot,
+					  (uint32) (start_lsn >> 32),
+					  (uint32) start_lsn,
+					  spool_enabled ? "on" : "off",
+					  receiver_change_format == RECEIVER_CHANGE_FORMAT_TUPLE ?
+					  ", \"change_format\" 'tuple'" : "");
 	res = PQexec(conn, query->data);
 	if (PQresultStatus(res) != PGRES_COPY_BOTH)
 	{
@@ -258,6 +752,11 @@ receiver_raw_main(Datum main_arg)
 					hdr_len;
 		static uint32 wait_event_info = 0;
 
+		/* Remote position covered by the changes of the current batch */
+		XLogRecPtr	batch_lsn = InvalidXLogRecPtr;
+		TimestampTz batch_send_time = 0;
+		instr_time	commit_start;
+
 		/* Buffer for COPY data */
 		char	   *copybuf = NULL;
 
@@ -296,12 +795,16 @@ receiver_raw_main(Datum main_arg)
 
 		/*
 		 * Begin a transaction before applying any changes. All the changes of
-		 * the same batch are applied within the same transaction.
+		 * the same batch are applied within the same transaction. With a
+		 * spool, changes are only stored and there is nothing to apply.
 		 */
-		SetCurrentStatementStartTimestamp();
-		StartTransactionCommand();
-		SPI_connect();
-		PushActiveSnapshot(GetTransactionSnapshot());
+		if (!spool_enabled)
+		{
+			SetCurrentStatementStartTimestamp();
+			StartTransactionCommand();
+			SPI_connect();
+			PushActiveSnapshot(GetTransactionSnapshot());
+		}
 
 		/*
 		 * Receive data.
@@ -310,6 +813,7 @@ receiver_raw_main(Datum main_arg)
 		{
 			XLogRecPtr	walEnd,
 						walStart;
+			TimestampTz sendTime;
 
 			rc = PQgetCopyData(conn, &copybuf, 1);
 			if (rc <= 0)
@@ -336,7 +840,7 @@ receiver_raw_main(Datum main_arg)
 				 * considered as sent to this receiver.
 				 */
 				walEnd = fe_recvint64(&copybuf[pos]);
-				ereport(LOG, (errmsg("%s: keepalive message from server, "
+				ereport(DEBUG1, (errmsg("%s: keepalive message from server, "
 									 "walEnd %X/%X, ",
 									 worker_name,
 									 (uint32) (walEnd >> 32),
@@ -353,8 +857,23 @@ receiver_raw_main(Datum main_arg)
 
 				/* Update written position */
 				output_written_lsn = Max(walEnd, output_written_lsn);
-				output_fsync_lsn = output_written_lsn;
-				output_applied_lsn = output_written_lsn;
+				pg_atomic_fetch_add_u64(&MyReceiverWorker->keepalives, 1);
+				pg_atomic_write_u64(&MyReceiverWorker->received_lsn,
+									output_written_lsn);
+
+				/*
+				 * If there are no changes in flight, either in the batch in
+				 * progress or waiting for a local flush, everything the
+				 * server has sent so far is applied and flushed.
+				 */
+				if (spool_enabled)
+					update_spool_positions();
+				else if (!update_flush_position() &&
+						 XLogRecPtrIsInvalid(batch_lsn))
+				{
+					output_fsync_lsn = output_written_lsn;
+					output_applied_lsn = output_written_lsn;
+				}
 
 				/*
 				 * If the server requested an immediate reply, send one. If
@@ -379,59 +898,63 @@ receiver_raw_main(Datum main_arg)
 			}
 
 			/* Now fetch the data */
-			hdr_len = 1;		/* msgtype 'w' */
-			walStart = fe_recvint64(&copybuf[hdr_len]);
-			hdr_len += 8;		/* dataStart */
-			walEnd = fe_recvint64(&copybuf[hdr_len]);
-			hdr_len += 8;		/* WALEnd */
-			hdr_len += 8;		/* sendTime */
-			if (rc < hdr_len + 1)
+			hdr_len = parse_stream_header(copybuf, rc, &walStart, &walEnd,
+										  &sendTime);
+			output_written_lsn = Max(walEnd, output_written_lsn);
+			pg_atomic_fetch_add_u64(&MyReceiverWorker->messages, 1);
+			pg_atomic_fetch_add_u64(&MyReceiverWorker->bytes, rc - hdr_len);
+			pg_atomic_write_u64(&MyReceiverWorker->received_lsn,
+								output_written_lsn);
+
+			/*
+			 * With a spool, just store the message received. It is applied
+			 * later by the apply worker.
+			 */
+			if (spool_enabled)
 			{
-				ereport(LOG, (errmsg("%s: Streaming header too small",
-									 worker_name)));
-				proc_exit(1);
-			}
+				bool		commit = is_commit_change(copybuf + hdr_len,
+													  rc - hdr_len);
+				SpoolPtr	pos = spool_write(copybuf, rc, commit);
 
-			/* Log some useful information */
-			ereport(LOG, (errmsg("%s: received from server, walStart %X/%X, "
-								 "and walEnd %X/%X",
-								 worker_name,
-								 (uint32) (walStart >> 32),
-								 (uint32) walStart,
-								 (uint32) (walEnd >> 32),
-								 (uint32) walEnd)));
-
-			/* Apply change to database */
-			pgstat_report_activity(STATE_RUNNING, copybuf + hdr_len);
-			SetCurrentStatementStartTimestamp();
+				if (commit)
+					spool_commit_pos = pos;
+				continue;
+			}
 
-			/* Execute query */
-			rc = SPI_execute(copybuf + hdr_len, false, 0);
-
-			if (rc == SPI_OK_INSERT)
-				ereport(LOG, (errmsg("%s: INSERT received correctly: %s",
-									 worker_name, copybuf + hdr_len)));
-			else if (rc == SPI_OK_UPDATE)
-				ereport(LOG, (errmsg("%s: UPDATE received correctly: %s",
-									 worker_name, copybuf + hdr_len)));
-			else if (rc == SPI_OK_DELETE)
-				ereport(LOG, (errmsg("%s: DELETE received correctly: %s",
-									 worker_name, copybuf + hdr_len)));
-			else
-				ereport(LOG, (errmsg("%s: Error when applying change: %s",
-									 worker_name, copybuf + hdr_len)));
+			apply_change(copybuf + hdr_len, rc - hdr_len);
 
-			/* Update written position */
-			output_written_lsn = Max(walEnd, output_written_lsn);
-			output_fsync_lsn = output_written_lsn;
-			output_applied_lsn = output_written_lsn;
+			/* The change is applied only once the batch is committed */
+			batch_lsn = Max(walEnd, batch_lsn);
+			batch_send_time = Max(sendTime, batch_send_time);
 		}
 
 		/* Finish process */
-		SPI_finish();
-		PopActiveSnapshot();
-		CommitTransactionCommand();
-		pgstat_report_activity(STATE_IDLE, NULL);
+		if (spool_enabled)
+		{
+			/* Flush in one batch all the changes spooled */
+			update_spool_positions();
+		}
+		else
+		{
+			INSTR_TIME_SET_CURRENT(commit_start);
+			if (receiver_change_format == RECEIVER_CHANGE_FORMAT_TUPLE)
+				receiver_raw_apply_flush();
+			SPI_finish();
+			PopActiveSnapshot();
+
+			/* Set only if the commit writes a record */
+			XactLastCommitEnd = InvalidXLogRecPtr;
+			CommitTransactionCommand();
+			pgstat_report_activity(STATE_IDLE, NULL);
+
+			/* Track the local commit of this batch, if it applied anything */
+			if (!XLogRecPtrIsInvalid(batch_lsn))
+			{
+				count_commit(commit_start, batch_lsn, batch_send_time);
+				output_applied_lsn = Max(batch_lsn, output_applied_lsn);
+				store_flush_position(batch_lsn, XactLastCommitEnd);
+			}
+		}
 
 		/* No data, move to next loop */
 		if (rc == 0)
@@ -452,6 +975,20 @@ receiver_raw_main(Datum main_arg)
 			int			usecs;
 			int64		now;
 
+			/*
+			 * Let the server know about the local commits flushed and the
+			 * changes applied since the last feedback, so as the slot can
+			 * advance.
+			 */
+			if (spool_enabled)
+				update_spool_positions();
+			else
+				update_flush_position();
+			if ((output_fsync_lsn > last_sent_fsync_lsn ||
+				 output_applied_lsn > last_sent_applied_lsn) &&
+				!sendFeedback(conn, feGetCurrentTimestamp()))
+				proc_exit(1);
+
 			FD_ZERO(&input_mask);
 			FD_SET(PQsocket(conn), &input_mask);
 
@@ -520,6 +1057,402 @@ receiver_raw_main(Datum main_arg)
 	proc_exit(0);
 }
 
+/*
+ * Main entry point of the apply worker, applying the changes stored in the
+ * spool by the receiver.
+ */
+void
+receiver_raw_apply_main(Datum main_arg)
+{
+	RepOriginId originid;
+	SpoolPtr	pos;
+	StringInfoData buf;
+
+	/* Register functions for SIGTERM/SIGHUP management */
+	pqsignal(SIGHUP, receiver_raw_sighup);
+	pqsignal(SIGTERM, receiver_raw_sigterm);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	/* Attach to the worker slot of this subscription */
+	receiver_raw_attach(main_arg, true);
+
+	/* Connect to a database */
+	BackgroundWorkerInitializeConnection(receiver_database, NULL, 0);
+
+	/*
+	 * Changes are applied with asynchronous commits, the spool is only
+	 * cleaned up once the local commit records are flushed to disk.
+	 */
+	SetConfigOption("synchronous_commit", "off", PGC_SUSET, PGC_S_OVERRIDE);
+
+	/*
+	 * The spool position applied is tracked with a replication origin, so
+	 * as it is consistent with the changes committed, even after a crash.
+	 */
+	StartTransactionCommand();
+	originid = replorigin_by_name(spool_origin_name, true);
+	if (originid == InvalidRepOriginId)
+		originid = replorigin_create(spool_origin_name);
+	CommitTransactionCommand();
+
+	replorigin_session_setup(originid, 0);
+	replorigin_session_origin = originid;
+	pos = replorigin_session_get_progress(false);
+
+	/* Let the receiver know where to wake up this worker */
+	SpinLockAcquire(&MyReceiverWorker->mutex);
+	MyReceiverWorker->apply_latch = MyLatch;
+	SpinLockRelease(&MyReceiverWorker->mutex);
+
+	initStringInfo(&buf);
+
+	while (!got_sigterm)
+	{
+		static uint32 wait_event_info = 0;
+		SpoolPtr	limit;
+		XLogRecPtr	applied_lsn = InvalidXLogRecPtr;
+		XLogRecPtr	local_end;
+		TimestampTz send_time = 0;
+		instr_time	commit_start;
+		int			count = 0;
+
+		if (wait_event_info == 0)
+			wait_event_info = WaitEventExtensionNew("receiver_raw_apply_main");
+
+		/* Wait for new changes to be spooled */
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 receiver_idle_time * 1L,
+						 wait_event_info);
+		ResetLatch(MyLatch);
+
+		/* Process signals */
+		if (got_sighup)
+		{
+			ProcessConfigFile(PGC_SIGHUP);
+			got_sighup = false;
+			ereport(LOG, (errmsg("%s: processed SIGHUP", apply_worker_name)));
+		}
+
+		if (got_sigterm)
+		{
+			ereport(LOG, (errmsg("%s: processed SIGTERM", apply_worker_name)));
+			proc_exit(0);
+		}
+
+		/*
+		 * Clean up the spool if some local commits have been flushed, never
+		 * past the position recorded by the origin, from where the apply
+		 * resumes after a restart.
+		 */
+		update_flush_position();
+		if (!XLogRecPtrIsInvalid(output_fsync_lsn))
+			spool_remove(Min(output_fsync_lsn,
+							 replorigin_session_get_progress(false)));
+
+		limit = pg_atomic_read_u64(&MyReceiverWorker->spool_flush_pos);
+		if (pos >= limit)
+			continue;
+
+		/* Apply a batch of spooled changes within the same transaction */
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		SPI_connect();
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		while (spool_read(&pos, limit, &buf))
+		{
+			XLogRecPtr	walStart,
+						walEnd;
+			TimestampTz sendTime;
+			int			hdr_len;
+
+			hdr_len = parse_stream_header(buf.data, buf.len,
+										  &walStart, &walEnd, &sendTime);
+			apply_change(buf.data + hdr_len, buf.len - hdr_len);
+			applied_lsn = Max(walEnd, applied_lsn);
+			send_time = Max(sendTime, send_time);
+			count++;
+
+			/* End the batch only with a remote transaction */
+			if (count >= SPOOL_APPLY_BATCH &&
+				is_commit_change(buf.data + hdr_len, buf.len - hdr_len))
+				break;
+		}
+
+		INSTR_TIME_SET_CURRENT(commit_start);
+		if (receiver_change_format == RECEIVER_CHANGE_FORMAT_TUPLE)
+			receiver_raw_apply_flush();
+		SPI_finish();
+		PopActiveSnapshot();
+
+		/* Track the spool position applied with the commit of this batch */
+		replorigin_session_origin_lsn = pos;
+		replorigin_session_origin_timestamp = GetCurrentTimestamp();
+		XactLastCommitEnd = InvalidXLogRecPtr;
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		/*
+		 * A batch that wrote nothing has no commit record to move the
+		 * origin, so move it explicitly.  The origin has to be released
+		 * from this session for that.
+		 */
+		local_end = XactLastCommitEnd;
+		if (XLogRecPtrIsInvalid(local_end))
+		{
+			StartTransactionCommand();
+			LockRelationOid(ReplicationOriginRelationId, RowExclusiveLock);
+			replorigin_session_reset();
+			replorigin_advance(originid, pos, InvalidXLogRecPtr, false, true);
+			replorigin_session_setup(originid, 0);
+			replorigin_session_origin = originid;
+			local_end = GetXLogInsertRecPtr();
+			CommitTransactionCommand();
+		}
+
+		count_commit(commit_start, applied_lsn, send_time);
+		pg_atomic_write_u64(&MyReceiverWorker->applied_pos, pos);
+		store_flush_position(pos, local_end);
+
+		/* More changes are waiting, come back immediately */
+		if (pos < limit)
+			SetLatch(MyLatch);
+	}
+
+	proc_exit(0);
+}
+
+/*
+ * Size of the shared memory state.
+ */
+static Size
+receiver_raw_shmem_size(void)
+{
+	return add_size(offsetof(ReceiverRawShared, workers),
+					mul_size(Max(receiver_max_subscriptions, 1),
+							 sizeof(ReceiverRawWorker)));
+}
+
+/*
+ * Request shared memory space for the state shared across workers.
+ */
+static void
+receiver_raw_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(receiver_raw_shmem_size());
+}
+
+/*
+ * Reset the statistics and positions of a worker slot, before assigning it
+ * to a subscription.  No workers can be running on this slot.
+ */
+void
+receiver_raw_reset_worker(ReceiverRawWorker *worker)
+{
+	worker->receiver_pid = 0;
+	worker->apply_pid = 0;
+	worker->apply_latch = NULL;
+	pg_atomic_init_u64(&worker->spool_flush_pos, 0);
+	pg_atomic_init_u64(&worker->applied_lsn, 0);
+	pg_atomic_init_u64(&worker->applied_pos, 0);
+	pg_atomic_init_u64(&worker->received_lsn, 0);
+	pg_atomic_init_u64(&worker->messages, 0);
+	pg_atomic_init_u64(&worker->bytes, 0);
+	pg_atomic_init_u64(&worker->keepalives, 0);
+	pg_atomic_init_u64(&worker->inserts, 0);
+	pg_atomic_init_u64(&worker->updates, 0);
+	pg_atomic_init_u64(&worker->deletes, 0);
+	pg_atomic_init_u64(&worker->missing, 0);
+	pg_atomic_init_u64(&worker->others, 0);
+	pg_atomic_init_u64(&worker->batches, 0);
+	for (int i = 0; i < RECEIVER_LATENCY_BUCKETS; i++)
+	{
+		pg_atomic_init_u64(&worker->apply_latency[i], 0);
+		pg_atomic_init_u64(&worker->commit_latency[i], 0);
+	}
+	pg_atomic_init_u64(&worker->apply_lag, 0);
+}
+
+/*
+ * Initialize the state shared across workers.
+ */
+static void
+receiver_raw_shmem_startup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	receiver_shared = ShmemInitStruct("receiver_raw",
+									  receiver_raw_shmem_size(),
+									  &found);
+	if (!found)
+	{
+		SpinLockInit(&receiver_shared->mutex);
+		receiver_shared->launcher_latch = NULL;
+		receiver_shared->num_workers = Max(receiver_max_subscriptions, 1);
+		for (int i = 0; i < receiver_shared->num_workers; i++)
+		{
+			ReceiverRawWorker *worker = &receiver_shared->workers[i];
+
+			SpinLockInit(&worker->mutex);
+			worker->in_use = false;
+			worker->stop_requested = false;
+			worker->generation = 0;
+			worker->name[0] = '\0';
+			worker->slot_name[0] = '\0';
+			worker->conn_string[0] = '\0';
+			receiver_raw_reset_worker(worker);
+		}
+
+		/* Without launcher, the first slot is used by the static worker */
+		if (receiver_max_subscriptions == 0)
+		{
+			receiver_shared->workers[0].in_use = true;
+			strlcpy(receiver_shared->workers[0].slot_name, receiver_slot,
+					NAMEDATALEN);
+			strlcpy(receiver_shared->workers[0].conn_string,
+					receiver_conn_string, RECEIVER_CONNINFO_LEN);
+		}
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * receiver_raw_stats
+ *
+ * Report statistics about the changes received and applied, for each
+ * subscription.
+ */
+Datum
+receiver_raw_stats(PG_FUNCTION_ARGS)
+{
+#define RECEIVER_RAW_STATS_COLS	20
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+	if (receiver_shared == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("receiver_raw must be loaded via \"shared_preload_libraries\"")));
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	for (int w = 0; w < receiver_shared->num_workers; w++)
+	{
+		ReceiverRawWorker *worker = &receiver_shared->workers[w];
+		Datum		values[RECEIVER_RAW_STATS_COLS] = {0};
+		bool		nulls[RECEIVER_RAW_STATS_COLS] = {0};
+		Datum		apply_latency[RECEIVER_LATENCY_BUCKETS];
+		Datum		commit_latency[RECEIVER_LATENCY_BUCKETS];
+		char		name[NAMEDATALEN];
+		char		slot_name[NAMEDATALEN];
+		bool		in_use;
+		bool		stop_requested;
+		pid_t		receiver_pid;
+		pid_t		apply_pid;
+		XLogRecPtr	received_lsn;
+		XLogRecPtr	applied_lsn;
+		Interval   *apply_lag;
+		int			i = 0;
+
+		SpinLockAcquire(&worker->mutex);
+		in_use = worker->in_use;
+		stop_requested = worker->stop_requested;
+		receiver_pid = worker->receiver_pid;
+		apply_pid = worker->apply_pid;
+		strlcpy(name, worker->name, NAMEDATALEN);
+		strlcpy(slot_name, worker->slot_name, NAMEDATALEN);
+		SpinLockRelease(&worker->mutex);
+
+		if (!in_use)
+			continue;
+
+		/* Subscription, NULL for the static worker */
+		if (name[0] == '\0')
+			nulls[i++] = true;
+		else
+			values[i++] = CStringGetTextDatum(name);
+		values[i++] = CStringGetTextDatum(slot_name);
+		if (stop_requested)
+			values[i++] = CStringGetTextDatum("stopping");
+		else if (receiver_pid != 0)
+			values[i++] = CStringGetTextDatum("running");
+		else
+			values[i++] = CStringGetTextDatum("stopped");
+		if (receiver_pid == 0)
+			nulls[i++] = true;
+		else
+			values[i++] = Int32GetDatum(receiver_pid);
+		if (apply_pid == 0)
+			nulls[i++] = true;
+		else
+			values[i++] = Int32GetDatum(apply_pid);
+
+		for (int b = 0; b < RECEIVER_LATENCY_BUCKETS; b++)
+		{
+			apply_latency[b] =
+				Int64GetDatum(pg_atomic_read_u64(&worker->apply_latency[b]));
+			commit_latency[b] =
+				Int64GetDatum(pg_atomic_read_u64(&worker->commit_latency[b]));
+		}
+
+		received_lsn = pg_atomic_read_u64(&worker->received_lsn);
+		applied_lsn = pg_atomic_read_u64(&worker->applied_lsn);
+
+		apply_lag = (Interval *) palloc0(sizeof(Interval));
+		apply_lag->time = pg_atomic_read_u64(&worker->apply_lag);
+
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->messages));
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->bytes));
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->keepalives));
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->inserts));
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->updates));
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->deletes));
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->missing));
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->others));
+		values[i++] = Int64GetDatum(pg_atomic_read_u64(&worker->batches));
+		values[i++] = PointerGetDatum(construct_array_builtin(apply_latency,
+															  RECEIVER_LATENCY_BUCKETS,
+															  INT8OID));
+		values[i++] = PointerGetDatum(construct_array_builtin(commit_latency,
+															  RECEIVER_LATENCY_BUCKETS,
+															  INT8OID));
+		values[i++] = LSNGetDatum(received_lsn);
+		if (XLogRecPtrIsInvalid(received_lsn))
+			nulls[i - 1] = true;
+
+		/* Lag is unknown until something has been applied */
+		if (XLogRecPtrIsInvalid(applied_lsn))
+		{
+			nulls[i++] = true;
+			nulls[i++] = true;
+			nulls[i++] = true;
+		}
+		else
+		{
+			values[i++] = LSNGetDatum(applied_lsn);
+			values[i++] = Int64GetDatum(received_lsn > applied_lsn ?
+										received_lsn - applied_lsn : 0);
+			values[i++] = IntervalPGetDatum(apply_lag);
+		}
+
+		Assert(i == RECEIVER_RAW_STATS_COLS);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+							 values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
 /*
  * Entry point to load parameters
  */
@@ -577,6 +1510,44 @@ receiver_raw_load_params(void)
 							 PGC_SIGHUP,
 							 0, NULL, NULL, NULL);
 
+	/* Format of the changes received */
+	DefineCustomEnumVariable("receiver_raw.change_format",
+							 "Format of the changes received from decoder_raw.",
+							 NULL,
+							 &receiver_change_format,
+							 RECEIVER_CHANGE_FORMAT_SQL,
+							 change_format_options,
+							 PGC_POSTMASTER,
+							 0, NULL, NULL, NULL);
+
+	/* Local spool of changes received */
+	DefineCustomStringVariable("receiver_raw.spool_directory",
+							   "Directory where changes received are spooled before being applied.",
+							   "Changes are applied directly if empty.",
+							   &receiver_spool_directory,
+							   "",
+							   PGC_POSTMASTER,
+							   0, NULL, NULL, NULL);
+
+	/* Subscriptions started by the launcher */
+	DefineCustomIntVariable("receiver_raw.max_subscriptions",
+							"Maximum number of subscriptions started by the launcher.",
+							"If 0, a single receiver is started using the settings of receiver_raw.slot_name and receiver_raw.conn_string.",
+							&receiver_max_subscriptions,
+							0, 0, 1024,
+							PGC_POSTMASTER,
+							0, NULL, NULL, NULL);
+
+	/* Nap time of the launcher between two scans of the subscriptions */
+	DefineCustomIntVariable("receiver_raw.launcher_naptime",
+							"Nap time between two scans of the subscriptions by the launcher.",
+							NULL,
+							&receiver_launcher_naptime,
+							10, 1, INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
 	MarkGUCPrefixReserved("receiver_raw");
 }
 
@@ -588,8 +1559,17 @@ _PG_init(void)
 {
 	BackgroundWorker worker;
 
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
 	receiver_raw_load_params();
 
+	/* Shared state across workers */
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = receiver_raw_shmem_request;
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = receiver_raw_shmem_startup;
+
 	/* Worker parameter and registration */
 	MemSet(&worker, 0, sizeof(BackgroundWorker));
 	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
@@ -602,5 +1582,27 @@ _PG_init(void)
 	worker.bgw_restart_time = 10;
 	worker.bgw_main_arg = (Datum) 0;
 	worker.bgw_notify_pid = 0;
+
+	/*
+	 * With subscriptions, the launcher starts the workers of each of them.
+	 */
+	if (receiver_max_subscriptions > 0)
+	{
+		snprintf(worker.bgw_function_name, BGW_MAXLEN,
+				 "receiver_raw_launcher_main");
+		snprintf(worker.bgw_name, BGW_MAXLEN, "receiver_raw launcher");
+		RegisterBackgroundWorker(&worker);
+		return;
+	}
+
 	RegisterBackgroundWorker(&worker);
+
+	/* Apply worker, consuming the spool filled by the receiver */
+	if (spool_enabled)
+	{
+		snprintf(worker.bgw_function_name, BGW_MAXLEN,
+				 "receiver_raw_apply_main");
+		snprintf(worker.bgw_name, BGW_MAXLEN, "%s", apply_worker_name);
+		RegisterBackgroundWorker(&worker);
+	}
 }
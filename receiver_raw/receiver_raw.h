@@ -0,0 +1,128 @@
+/*-------------------------------------------------------------------------
+ *
+ * receiver_raw.h
+ *		Definitions shared across the files of receiver_raw.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		receiver_raw/receiver_raw.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef RECEIVER_RAW_H
+#define RECEIVER_RAW_H
+
+#include "access/xlogdefs.h"
+#include "lib/stringinfo.h"
+#include "port/atomics.h"
+#include "storage/latch.h"
+#include "storage/spin.h"
+
+/*
+ * Format of the changes received from decoder_raw, matching its option
+ * "change_format".
+ */
+typedef enum ReceiverChangeFormat
+{
+	RECEIVER_CHANGE_FORMAT_SQL,		/* raw queries */
+	RECEIVER_CHANGE_FORMAT_TUPLE,	/* binary tuples */
+} ReceiverChangeFormat;
+
+/* Apply of changes in tuple format, in receiver_raw_apply.c */
+extern bool receiver_raw_apply_tuple(char *data, int len);
+extern void receiver_raw_apply_flush(void);
+
+/*
+ * Position in the local spool of changes, made of a segment number and an
+ * offset in this segment.
+ */
+typedef uint64 SpoolPtr;
+
+#define RECEIVER_SPOOL_SEG_SIZE		(16 * 1024 * 1024)
+
+/*
+ * Number of buckets of the latency histograms.  Bucket 0 counts latencies
+ * under 10us, and each following bucket covers ten times the previous one,
+ * the last one counting everything above.
+ */
+#define RECEIVER_LATENCY_BUCKETS	8
+
+/* Maximum length of the connection string of a subscription */
+#define RECEIVER_CONNINFO_LEN		1024
+
+/*
+ * State of a receiver, shared between the receiver, its apply worker when a
+ * spool is used, the launcher and the backends reporting statistics.
+ */
+typedef struct ReceiverRawWorker
+{
+	slock_t		mutex;			/* protects all the fields up to apply_latch */
+
+	/* Subscription assigned to the worker, set by the launcher */
+	bool		in_use;			/* slot assigned to a subscription? */
+	bool		stop_requested; /* launcher asked workers to stop? */
+	uint32		generation;		/* bumped each time the slot is assigned */
+	char		name[NAMEDATALEN];	/* subscription name, empty if static */
+	char		slot_name[NAMEDATALEN];
+	char		conn_string[RECEIVER_CONNINFO_LEN];
+
+	pid_t		receiver_pid;	/* PID of receiver, 0 if not running */
+	pid_t		apply_pid;		/* PID of apply worker, 0 if not running */
+	Latch	   *apply_latch;	/* latch of the apply worker, if running */
+
+	pg_atomic_uint64 spool_flush_pos;	/* spool position flushed */
+	pg_atomic_uint64 applied_lsn;	/* remote LSN applied */
+	pg_atomic_uint64 applied_pos;	/* spool position applied */
+
+	/* Statistics */
+	pg_atomic_uint64 received_lsn;	/* remote LSN received */
+	pg_atomic_uint64 messages;	/* changes received */
+	pg_atomic_uint64 bytes;		/* bytes of changes received */
+	pg_atomic_uint64 keepalives;	/* keepalive messages received */
+	pg_atomic_uint64 inserts;	/* rows inserted */
+	pg_atomic_uint64 updates;	/* rows updated */
+	pg_atomic_uint64 deletes;	/* rows deleted */
+	pg_atomic_uint64 missing;	/* UPDATEs and DELETEs with no local row */
+	pg_atomic_uint64 others;	/* other changes applied */
+	pg_atomic_uint64 batches;	/* transactions committed */
+	pg_atomic_uint64 apply_latency[RECEIVER_LATENCY_BUCKETS];
+	pg_atomic_uint64 commit_latency[RECEIVER_LATENCY_BUCKETS];
+	pg_atomic_uint64 apply_lag; /* lag of the last commit, in usecs */
+} ReceiverRawWorker;
+
+/*
+ * Shared memory state of receiver_raw.  There is one worker slot for each
+ * subscription when the launcher is used, and a single one for the static
+ * receiver otherwise.
+ */
+typedef struct ReceiverRawShared
+{
+	slock_t		mutex;			/* protects launcher_latch */
+	Latch	   *launcher_latch; /* latch of the launcher, if running */
+	int			num_workers;	/* number of worker slots */
+	ReceiverRawWorker workers[FLEXIBLE_ARRAY_MEMBER];
+} ReceiverRawShared;
+
+/* In receiver_raw.c */
+extern PGDLLIMPORT ReceiverRawShared *receiver_shared;
+extern PGDLLIMPORT char *receiver_database;
+extern PGDLLIMPORT char *receiver_spool_directory;
+extern PGDLLIMPORT int receiver_max_subscriptions;
+
+extern void receiver_raw_reset_worker(ReceiverRawWorker *worker);
+
+/* Launcher of the receivers of each subscription, in receiver_raw_launcher.c */
+extern PGDLLIMPORT int receiver_launcher_naptime;
+
+pg_noreturn extern PGDLLEXPORT void receiver_raw_launcher_main(Datum main_arg);
+
+/* Local spool of changes, in receiver_raw_spool.c */
+extern SpoolPtr spool_open_write(StringInfo last_commit);
+extern SpoolPtr spool_write(const char *data, int len, bool commit);
+extern SpoolPtr spool_flush(void);
+extern bool spool_read(SpoolPtr *pos, SpoolPtr limit, StringInfo buf);
+extern void spool_remove(SpoolPtr pos);
+
+#endif							/* RECEIVER_RAW_H */
@@ -0,0 +1,658 @@
+/*-------------------------------------------------------------------------
+ *
+ * receiver_raw_apply.c
+ *		Apply changes received in the tuple format of decoder_raw directly
+ *		with the executor, without going through SQL.
+ *
+ * Changes are made of a relation name and column values generated by the
+ * send function of each column type, so there is no need to parse and plan
+ * a query for each one of them.  The state of a relation is kept across
+ * consecutive changes on it, and series of INSERTs are buffered to be
+ * applied with a multi-insert when the relation allows it.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		receiver_raw/receiver_raw_apply.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/heapam.h"
+#include "access/table.h"
+#include "access/tableam.h"
+#include "access/transam.h"
+#include "access/xact.h"
+#include "catalog/namespace.h"
+#include "commands/trigger.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "libpq/pqformat.h"
+#include "nodes/makefuncs.h"
+#include "parser/parse_relation.h"
+#include "replication/logicalrelation.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#include "receiver_raw.h"
+
+/* Maximum number of INSERTs buffered for a multi-insert */
+#define MAX_BUFFERED_TUPLES		1000
+
+/*
+ * State of the relation changes are applied to.
+ */
+typedef struct ApplyRelState
+{
+	char	   *nspname;
+	char	   *relname;
+	Relation	rel;
+	EState	   *estate;
+	ResultRelInfo *resultRelInfo;
+
+	/* Index used to find tuples for UPDATE and DELETE, if any */
+	Oid			idxoid;
+	Bitmapset  *keyattrs;
+
+	/* Column types sent with the last change, once checked */
+	char	   *remote_types;
+	int			remote_types_len;
+
+	/* Receive functions of the columns */
+	FmgrInfo   *recv_finfo;
+	Oid		   *recv_ioparam;
+	StringInfoData colbuf;
+
+	/* Slots for received values, and local tuple found */
+	TupleTableSlot *remoteslot;
+	TupleTableSlot *newslot;
+	TupleTableSlot *localslot;
+	bool	   *unchanged;		/* 'u' values in the last tuple read */
+
+	/* Buffered INSERTs, for a multi-insert */
+	bool		use_multi_insert;
+	BulkInsertState bistate;
+	TupleTableSlot *slots[MAX_BUFFERED_TUPLES];
+	int			nslots;			/* number of slots created */
+	int			nused;			/* number of slots filled */
+} ApplyRelState;
+
+static ApplyRelState *apply_state = NULL;
+
+/* Memory context for the data of a single change */
+static MemoryContext ApplyMessageContext = NULL;
+
+/*
+ * Move to the next command, so as the next changes can see the effects of
+ * the previous ones.
+ */
+static void
+apply_next_command(ApplyRelState *state)
+{
+	CommandCounterIncrement();
+	state->estate->es_output_cid = GetCurrentCommandId(true);
+}
+
+/*
+ * Apply the INSERTs buffered for a relation.
+ */
+static void
+apply_flush_inserts(ApplyRelState *state)
+{
+	int			i;
+
+	if (state->nused == 0)
+		return;
+
+	if (state->bistate == NULL)
+		state->bistate = GetBulkInsertState();
+
+	table_multi_insert(state->rel, state->slots, state->nused,
+					   state->estate->es_output_cid, 0, state->bistate);
+
+	for (i = 0; i < state->nused; i++)
+	{
+		TupleTableSlot *slot = state->slots[i];
+
+		if (state->resultRelInfo->ri_NumIndices > 0)
+		{
+			List	   *recheckIndexes;
+
+			recheckIndexes = ExecInsertIndexTuples(state->resultRelInfo,
+												   slot, state->estate,
+												   false, false, NULL,
+												   NIL, false);
+			list_free(recheckIndexes);
+		}
+
+		ResetPerTupleExprContext(state->estate);
+		ExecClearTuple(slot);
+	}
+
+	state->nused = 0;
+	apply_next_command(state);
+}
+
+/*
+ * Open a relation for the application of changes, with all the executor
+ * state needed.
+ */
+static void
+apply_rel_open(const char *nspname, const char *relname)
+{
+	ApplyRelState *state;
+	MemoryContext oldcxt;
+	Relation	rel;
+	TupleDesc	tupdesc;
+	RangeTblEntry *rte;
+	List	   *perminfos = NIL;
+	TriggerDesc *trigdesc;
+	int			i;
+
+	oldcxt = MemoryContextSwitchTo(TopTransactionContext);
+
+	rel = table_openrv(makeRangeVar(pstrdup(nspname), pstrdup(relname), -1),
+					   RowExclusiveLock);
+
+	if (rel->rd_rel->relkind != RELKIND_RELATION)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("cannot apply changes in tuple format to relation \"%s.%s\"",
+						nspname, relname),
+				 errdetail_relkind_not_supported(rel->rd_rel->relkind)));
+
+	state = palloc0(sizeof(ApplyRelState));
+	state->nspname = pstrdup(nspname);
+	state->relname = pstrdup(relname);
+	state->rel = rel;
+	tupdesc = RelationGetDescr(rel);
+
+	/* Executor state, as done for logical replication */
+	state->estate = CreateExecutorState();
+	rte = makeNode(RangeTblEntry);
+	rte->rtekind = RTE_RELATION;
+	rte->relid = RelationGetRelid(rel);
+	rte->relkind = rel->rd_rel->relkind;
+	rte->rellockmode = AccessShareLock;
+	addRTEPermissionInfo(&perminfos, rte);
+	ExecInitRangeTable(state->estate, list_make1(rte), perminfos,
+					   bms_make_singleton(1));
+	state->estate->es_output_cid = GetCurrentCommandId(true);
+
+	state->resultRelInfo = makeNode(ResultRelInfo);
+	InitResultRelInfo(state->resultRelInfo, rel, 1, NULL, 0);
+	ExecOpenIndices(state->resultRelInfo, false);
+	AfterTriggerBeginQuery();
+
+	state->idxoid = GetRelationIdentityOrPK(rel);
+	if (OidIsValid(state->idxoid))
+		state->keyattrs = RelationGetIdentityKeyBitmap(rel);
+
+	/* Look up the receive functions only once */
+	state->recv_finfo = palloc0(sizeof(FmgrInfo) * tupdesc->natts);
+	state->recv_ioparam = palloc0(sizeof(Oid) * tupdesc->natts);
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+		Oid			typreceive;
+
+		if (attr->attisdropped)
+			continue;
+
+		getTypeBinaryInputInfo(attr->atttypid, &typreceive,
+							   &state->recv_ioparam[i]);
+		fmgr_info(typreceive, &state->recv_finfo[i]);
+	}
+	initStringInfo(&state->colbuf);
+
+	/* Slots are created in the memory context of the executor */
+	MemoryContextSwitchTo(state->estate->es_query_cxt);
+	state->remoteslot = table_slot_create(rel, &state->estate->es_tupleTable);
+	state->newslot = table_slot_create(rel, &state->estate->es_tupleTable);
+	state->localslot = table_slot_create(rel, &state->estate->es_tupleTable);
+	state->unchanged = palloc0(sizeof(bool) * tupdesc->natts);
+
+	/*
+	 * A multi-insert bypasses row triggers and generated columns, so use it
+	 * only if the relation has none of them.
+	 */
+	trigdesc = rel->trigdesc;
+	state->use_multi_insert =
+		(trigdesc == NULL ||
+		 (!trigdesc->trig_insert_before_row &&
+		  !trigdesc->trig_insert_after_row &&
+		  !trigdesc->trig_insert_instead_row)) &&
+		(tupdesc->constr == NULL || !tupdesc->constr->has_generated_stored);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	apply_state = state;
+}
+
+/*
+ * Close the relation changes are applied to, applying first any INSERTs
+ * still buffered.
+ */
+static void
+apply_rel_close(void)
+{
+	ApplyRelState *state = apply_state;
+
+	if (state == NULL)
+		return;
+
+	apply_flush_inserts(state);
+
+	/* Handle any queued AFTER triggers */
+	AfterTriggerEndQuery(state->estate);
+
+	if (state->bistate != NULL)
+		FreeBulkInsertState(state->bistate);
+	ExecCloseIndices(state->resultRelInfo);
+	ExecResetTupleTable(state->estate->es_tupleTable, false);
+	FreeExecutorState(state->estate);
+	table_close(state->rel, NoLock);
+
+	pfree(state->colbuf.data);
+	if (state->remote_types)
+		pfree(state->remote_types);
+	pfree(state->recv_finfo);
+	pfree(state->recv_ioparam);
+	pfree(state->nspname);
+	pfree(state->relname);
+	pfree(state);
+	apply_state = NULL;
+}
+
+/*
+ * Check that the column types sent with a change match the ones of the
+ * relation, as the values of a column are read with the receive function
+ * of its local type.  Types not built in the server are sent as InvalidOid,
+ * their OIDs differing across clusters.  The types are the same for all
+ * the changes of a relation until its schema changes, so the last ones
+ * checked are kept to skip the check.
+ */
+static void
+apply_check_types(StringInfo s, ApplyRelState *state)
+{
+	TupleDesc	tupdesc = RelationGetDescr(state->rel);
+	int			ntypes = pq_getmsgint(s, 2);
+	int			len = ntypes * sizeof(uint32);
+	const char *types = pq_getmsgbytes(s, len);
+	StringInfoData typebuf;
+	int			nlive = 0;
+	int			i;
+
+	if (state->remote_types != NULL && state->remote_types_len == len &&
+		memcmp(state->remote_types, types, len) == 0)
+		return;
+
+	initReadOnlyStringInfo(&typebuf, (char *) types, len);
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+		Oid			remote_type;
+		Oid			local_type;
+
+		if (attr->attisdropped)
+			continue;
+
+		/* Count all the live columns, for the error below */
+		if (nlive++ >= ntypes)
+			continue;
+
+		remote_type = pq_getmsgint(&typebuf, 4);
+		local_type = attr->atttypid < FirstNormalObjectId ?
+			attr->atttypid : InvalidOid;
+
+		if (remote_type != local_type)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("column \"%s\" of relation \"%s.%s\" has type %s, but change has type %s",
+							NameStr(attr->attname),
+							state->nspname, state->relname,
+							format_type_be(attr->atttypid),
+							OidIsValid(remote_type) ?
+							format_type_be(remote_type) : "not built in")));
+	}
+
+	if (nlive != ntypes)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("change for relation \"%s.%s\" has %d columns, expected %d",
+						state->nspname, state->relname, ntypes, nlive)));
+
+	if (state->remote_types != NULL)
+		pfree(state->remote_types);
+	state->remote_types = MemoryContextAlloc(TopTransactionContext, len);
+	memcpy(state->remote_types, types, len);
+	state->remote_types_len = len;
+}
+
+/*
+ * Read a tuple from a change and store its values into the given slot.
+ * Values marked as unchanged are set as NULL, and tracked in the state's
+ * "unchanged" array.  The caller is in charge of storing the slot.
+ */
+static void
+apply_read_tuple(StringInfo s, ApplyRelState *state, TupleTableSlot *slot)
+{
+	TupleDesc	tupdesc = RelationGetDescr(state->rel);
+	int			natts = pq_getmsgint(s, 2);
+	int			nlive = 0;
+	int			i;
+
+	ExecClearTuple(slot);
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+		char		kind;
+
+		slot->tts_values[i] = (Datum) 0;
+		slot->tts_isnull[i] = true;
+		state->unchanged[i] = false;
+
+		if (attr->attisdropped)
+			continue;
+
+		if (nlive++ >= natts)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROTOCOL_VIOLATION),
+					 errmsg("change for relation \"%s.%s\" has %d columns, expected more",
+							state->nspname, state->relname, natts)));
+
+		kind = pq_getmsgbyte(s);
+		switch (kind)
+		{
+			case 'n':
+				break;
+			case 'u':
+				state->unchanged[i] = true;
+				break;
+			case 'b':
+				{
+					int			len = pq_getmsgint(s, 4);
+
+					resetStringInfo(&state->colbuf);
+					appendBinaryStringInfo(&state->colbuf,
+										   pq_getmsgbytes(s, len), len);
+					slot->tts_values[i] =
+						ReceiveFunctionCall(&state->recv_finfo[i],
+											&state->colbuf,
+											state->recv_ioparam[i],
+											attr->atttypmod);
+					slot->tts_isnull[i] = false;
+				}
+				break;
+			default:
+				ereport(ERROR,
+						(errcode(ERRCODE_PROTOCOL_VIOLATION),
+						 errmsg("unrecognized column value kind \"%c\"", kind)));
+		}
+	}
+
+	if (nlive != natts)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("change for relation \"%s.%s\" has %d columns, expected %d",
+						state->nspname, state->relname, natts, nlive)));
+}
+
+/*
+ * Find the local tuple matching the key values of the given slot, storing
+ * it in the local slot of the state.
+ */
+static bool
+apply_find_tuple(ApplyRelState *state, TupleTableSlot *keyslot)
+{
+	TupleDesc	tupdesc = RelationGetDescr(state->rel);
+	int			i;
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		if (!state->unchanged[i])
+			continue;
+
+		/*
+		 * A lookup with an index only needs its columns, otherwise all the
+		 * values are needed.
+		 */
+		if (OidIsValid(state->idxoid) &&
+			!bms_is_member(i + 1 - FirstLowInvalidHeapAttributeNumber,
+						   state->keyattrs))
+			continue;
+
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("key values of change missing to find tuple in relation \"%s.%s\"",
+						state->nspname, state->relname),
+				 errhint("Check that the REPLICA IDENTITY of both relations is consistent.")));
+	}
+
+	if (OidIsValid(state->idxoid))
+		return RelationFindReplTupleByIndex(state->rel, state->idxoid,
+											LockTupleExclusive,
+											keyslot, state->localslot);
+
+	return RelationFindReplTupleSeq(state->rel, LockTupleExclusive,
+									keyslot, state->localslot);
+}
+
+/*
+ * Apply an INSERT.
+ */
+static void
+apply_handle_insert(StringInfo s, ApplyRelState *state)
+{
+	TupleTableSlot *slot;
+
+	if (!state->use_multi_insert)
+	{
+		apply_read_tuple(s, state, state->remoteslot);
+		ExecStoreVirtualTuple(state->remoteslot);
+		ExecSimpleRelationInsert(state->resultRelInfo, state->estate,
+								 state->remoteslot);
+		apply_next_command(state);
+		return;
+	}
+
+	/* Buffer the tuple, creating a new slot if necessary */
+	if (state->nused == state->nslots)
+	{
+		MemoryContext oldcxt;
+
+		oldcxt = MemoryContextSwitchTo(state->estate->es_query_cxt);
+		state->slots[state->nslots++] =
+			table_slot_create(state->rel, &state->estate->es_tupleTable);
+		MemoryContextSwitchTo(oldcxt);
+	}
+	slot = state->slots[state->nused];
+
+	apply_read_tuple(s, state, slot);
+	ExecStoreVirtualTuple(slot);
+
+	if (state->rel->rd_att->constr)
+		ExecConstraints(state->resultRelInfo, slot, state->estate);
+
+	/* Values are allocated for this change only, so copy them */
+	ExecMaterializeSlot(slot);
+	state->nused++;
+
+	if (state->nused == MAX_BUFFERED_TUPLES)
+		apply_flush_inserts(state);
+}
+
+/*
+ * Apply an UPDATE.  Nothing is done if no tuple matches the key, as the
+ * equivalent query would do.  Returns false in this case.
+ */
+static bool
+apply_handle_update(StringInfo s, ApplyRelState *state)
+{
+	TupleDesc	tupdesc = RelationGetDescr(state->rel);
+	EPQState	epqstate;
+	int			i;
+
+	/* The tuple may be one of the INSERTs buffered */
+	apply_flush_inserts(state);
+
+	apply_read_tuple(s, state, state->remoteslot);
+	ExecStoreVirtualTuple(state->remoteslot);
+
+	if (!apply_find_tuple(state, state->remoteslot))
+		return false;
+
+	/* Build the new tuple, keeping the local values unchanged */
+	apply_read_tuple(s, state, state->newslot);
+	slot_getallattrs(state->localslot);
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		if (!state->unchanged[i])
+			continue;
+		state->newslot->tts_values[i] = state->localslot->tts_values[i];
+		state->newslot->tts_isnull[i] = state->localslot->tts_isnull[i];
+	}
+	ExecStoreVirtualTuple(state->newslot);
+
+	EvalPlanQualInit(&epqstate, state->estate, NULL, NIL, -1, NIL);
+	ExecSimpleRelationUpdate(state->resultRelInfo, state->estate, &epqstate,
+							 state->localslot, state->newslot);
+	EvalPlanQualEnd(&epqstate);
+
+	apply_next_command(state);
+	return true;
+}
+
+/*
+ * Apply a DELETE.  Nothing is done if no tuple matches the key, as the
+ * equivalent query would do.  Returns false in this case.
+ */
+static bool
+apply_handle_delete(StringInfo s, ApplyRelState *state)
+{
+	EPQState	epqstate;
+
+	/* The tuple may be one of the INSERTs buffered */
+	apply_flush_inserts(state);
+
+	apply_read_tuple(s, state, state->remoteslot);
+	ExecStoreVirtualTuple(state->remoteslot);
+
+	if (!apply_find_tuple(state, state->remoteslot))
+		return false;
+
+	EvalPlanQualInit(&epqstate, state->estate, NULL, NIL, -1, NIL);
+	ExecSimpleRelationDelete(state->resultRelInfo, state->estate, &epqstate,
+							 state->localslot);
+	EvalPlanQualEnd(&epqstate);
+
+	apply_next_command(state);
+	return true;
+}
+
+/*
+ * receiver_raw_apply_tuple
+ *
+ * Apply a change received in tuple format.  This needs to be called within
+ * a transaction with SPI connected, with receiver_raw_apply_flush() called
+ * before committing.  Returns false if an UPDATE or a DELETE found no tuple
+ * matching its key.
+ */
+bool
+receiver_raw_apply_tuple(char *data, int len)
+{
+	StringInfoData s;
+	MemoryContext oldcxt;
+	char		action;
+	const char *nspname;
+	const char *relname;
+	bool		found = true;
+
+	if (ApplyMessageContext == NULL)
+		ApplyMessageContext = AllocSetContextCreate(TopMemoryContext,
+													"receiver_raw apply",
+													ALLOCSET_DEFAULT_SIZES);
+
+	initReadOnlyStringInfo(&s, data, len);
+	action = pq_getmsgbyte(&s);
+
+	switch (action)
+	{
+		case 'B':
+		case 'C':
+			/* Changes are applied in batches, so ignore transactions */
+			return true;
+		case 'Q':
+			{
+				const char *query = pq_getmsgstring(&s);
+
+				apply_rel_close();
+				if (SPI_execute(query, false, 0) < 0)
+					ereport(LOG,
+							(errmsg("receiver_raw: Error when applying change: %s",
+									query)));
+				return true;
+			}
+		case 'I':
+		case 'U':
+		case 'D':
+			break;
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_PROTOCOL_VIOLATION),
+					 errmsg("unrecognized change action \"%c\"", action)));
+	}
+
+	oldcxt = MemoryContextSwitchTo(ApplyMessageContext);
+
+	nspname = pq_getmsgstring(&s);
+	relname = pq_getmsgstring(&s);
+
+	/* Switch to the relation of this change, if necessary */
+	if (apply_state == NULL ||
+		strcmp(apply_state->relname, relname) != 0 ||
+		strcmp(apply_state->nspname, nspname) != 0)
+	{
+		apply_rel_close();
+		apply_rel_open(nspname, relname);
+	}
+
+	apply_check_types(&s, apply_state);
+
+	if (action == 'I')
+		apply_handle_insert(&s, apply_state);
+	else if (action == 'U')
+		found = apply_handle_update(&s, apply_state);
+	else
+		found = apply_handle_delete(&s, apply_state);
+
+	pq_getmsgend(&s);
+
+	/*
+	 * Release what the executor allocated for this row, like the values of
+	 * index expressions.  Buffered INSERTs have been materialized already.
+	 */
+	ResetPerTupleExprContext(apply_state->estate);
+
+	MemoryContextSwitchTo(oldcxt);
+	MemoryContextReset(ApplyMessageContext);
+
+	return found;
+}
+
+/*
+ * receiver_raw_apply_flush
+ *
+ * Apply all the changes still buffered and release the executor state.
+ */
+void
+receiver_raw_apply_flush(void)
+{
+	apply_rel_close();
+}
@@ -0,0 +1,697 @@
+/*-------------------------------------------------------------------------
+ *
+ * receiver_raw_launcher.c
+ *		Launcher of the receivers of the subscriptions listed in the table
+ *		receiver_raw_subscriptions.
+ *
+ * When receiver_raw.max_subscriptions is set, the launcher scans the
+ * subscriptions enabled in the table receiver_raw_subscriptions of the
+ * extension receiver_raw, and starts for each one of them a receiver, and
+ * an apply worker if a spool is used, as dynamic background workers.  Each
+ * subscription is assigned a worker slot in shared memory, where its
+ * settings and statistics are stored.  The workers of the subscriptions
+ * removed, disabled or whose settings have changed are stopped, and the
+ * workers that have exited are started again.
+ *
+ * The spool and the replication origin of a subscription are named after
+ * it, so they are dropped once the subscription is removed and its workers
+ * are gone.  The slot and connection string a spool was created for are
+ * stored in it, and it is dropped with the origin if they have changed when
+ * the workers are started, as its positions do not apply to another
+ * upstream.
+ *
+ * The subscriptions are scanned every receiver_raw.launcher_naptime, when a
+ * worker started by the launcher starts or stops, or when
+ * receiver_raw_reload() is called.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		receiver_raw/receiver_raw_launcher.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "access/xact.h"
+#include "commands/extension.h"
+#include "executor/spi.h"
+#include "nodes/pg_list.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "replication/origin.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/wait_event.h"
+
+#include "receiver_raw.h"
+
+PG_FUNCTION_INFO_V1(receiver_raw_reload);
+
+/* GUC variables */
+int			receiver_launcher_naptime = 10;
+
+/* Subscription, as listed in receiver_raw_subscriptions */
+typedef struct LauncherSubscription
+{
+	char	   *name;
+	char	   *slot_name;
+	char	   *conn_string;
+	bool		enabled;
+} LauncherSubscription;
+
+/* Handles of the workers started by the launcher, for each worker slot */
+typedef struct LauncherWorker
+{
+	BackgroundWorkerHandle *receiver;
+	BackgroundWorkerHandle *apply;
+} LauncherWorker;
+
+static LauncherWorker *launcher_workers = NULL;
+
+/*
+ * Scan the subscriptions, allocated in the given memory context.  Nothing
+ * is returned until the extension is installed.
+ */
+static List *
+launcher_load_subscriptions(MemoryContext cxt)
+{
+	Oid			extoid;
+	List	   *subs = NIL;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "scanning subscriptions");
+
+	extoid = get_extension_oid("receiver_raw", true);
+	if (OidIsValid(extoid))
+	{
+		char	   *nspname;
+		StringInfoData query;
+		int			ret;
+
+		nspname = get_namespace_name(get_extension_schema(extoid));
+		initStringInfo(&query);
+		appendStringInfo(&query,
+						 "SELECT name, slot_name, conn_string, enabled "
+						 "FROM %s.receiver_raw_subscriptions "
+						 "ORDER BY name",
+						 quote_identifier(nspname));
+
+		ret = SPI_execute(query.data, true, 0);
+		if (ret != SPI_OK_SELECT)
+			elog(ERROR, "could not scan subscriptions: error code %d", ret);
+
+		for (uint64 i = 0; i < SPI_processed; i++)
+		{
+			HeapTuple	tuple = SPI_tuptable->vals[i];
+			TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+			LauncherSubscription *sub;
+			MemoryContext oldcxt;
+
+			oldcxt = MemoryContextSwitchTo(cxt);
+			sub = palloc(sizeof(LauncherSubscription));
+			sub->name = SPI_getvalue(tuple, tupdesc, 1);
+			sub->slot_name = SPI_getvalue(tuple, tupdesc, 2);
+			sub->conn_string = SPI_getvalue(tuple, tupdesc, 3);
+			sub->enabled = strcmp(SPI_getvalue(tuple, tupdesc, 4), "t") == 0;
+			subs = lappend(subs, sub);
+			MemoryContextSwitchTo(oldcxt);
+		}
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return subs;
+}
+
+/*
+ * Find the slot assigned to a subscription, or -1 if there is none.
+ */
+static int
+launcher_find_slot(const char *name)
+{
+	for (int i = 0; i < receiver_shared->num_workers; i++)
+	{
+		ReceiverRawWorker *worker = &receiver_shared->workers[i];
+		bool		found;
+
+		SpinLockAcquire(&worker->mutex);
+		found = worker->in_use && strcmp(worker->name, name) == 0;
+		SpinLockRelease(&worker->mutex);
+
+		if (found)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Register a worker of a slot, returning its handle or NULL on failure.
+ */
+static BackgroundWorkerHandle *
+launcher_register_worker(int slotno, uint32 generation, const char *name,
+						 bool is_apply)
+{
+	BackgroundWorker worker;
+	BackgroundWorkerHandle *handle;
+
+	MemSet(&worker, 0, sizeof(BackgroundWorker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+		BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "receiver_raw");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN,
+			 is_apply ? "receiver_raw_apply_main" : "receiver_raw_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN,
+			 is_apply ? "receiver_raw apply %s" : "receiver_raw %s", name);
+	/* Wait 10 seconds for restart before crash */
+	worker.bgw_restart_time = 10;
+	worker.bgw_main_arg = Int32GetDatum(slotno);
+	memcpy(worker.bgw_extra, &generation, sizeof(uint32));
+	worker.bgw_notify_pid = MyProcPid;
+
+	if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+	{
+		ereport(WARNING,
+				(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+				 errmsg("could not start worker for subscription \"%s\"",
+						name),
+				 errhint("You might need to increase \"%s\".",
+						 "max_worker_processes")));
+		return NULL;
+	}
+
+	return handle;
+}
+
+/*
+ * Ask the workers of a slot to stop.
+ */
+static void
+launcher_stop_workers(int slotno)
+{
+	ReceiverRawWorker *worker = &receiver_shared->workers[slotno];
+	LauncherWorker *lw = &launcher_workers[slotno];
+	pid_t		receiver_pid;
+	pid_t		apply_pid;
+
+	SpinLockAcquire(&worker->mutex);
+	worker->stop_requested = true;
+	receiver_pid = worker->receiver_pid;
+	apply_pid = worker->apply_pid;
+	SpinLockRelease(&worker->mutex);
+
+	/*
+	 * Workers not started by this launcher have no handle, so signal them
+	 * directly.  They leave on SIGTERM, or when they attach to their slot
+	 * if not running yet.
+	 */
+	if (lw->receiver != NULL)
+		TerminateBackgroundWorker(lw->receiver);
+	else if (receiver_pid != 0)
+		kill(receiver_pid, SIGTERM);
+
+	if (lw->apply != NULL)
+		TerminateBackgroundWorker(lw->apply);
+	else if (apply_pid != 0)
+		kill(apply_pid, SIGTERM);
+}
+
+/*
+ * Check if a worker started by the launcher has stopped.
+ */
+static bool
+launcher_worker_stopped(BackgroundWorkerHandle *handle)
+{
+	pid_t		pid;
+
+	return handle == NULL ||
+		GetBackgroundWorkerPid(handle, &pid) == BGWH_STOPPED;
+}
+
+/*
+ * Drop the spool and the replication origin of a subscription, whose
+ * workers are gone.
+ */
+static void
+launcher_reset_subscription(const char *name)
+{
+	char		origin_name[NAMEDATALEN];
+
+	ereport(LOG,
+			(errmsg("receiver_raw launcher: dropping spool and origin of subscription \"%s\"",
+					name)));
+
+	if (receiver_spool_directory[0] != '\0')
+	{
+		char		path[MAXPGPATH];
+		struct stat st;
+
+		snprintf(path, MAXPGPATH, "%s/%s", receiver_spool_directory, name);
+		if (stat(path, &st) == 0 && !rmtree(path, true))
+			ereport(WARNING,
+					(errmsg("could not remove spool directory \"%s\"",
+							path)));
+	}
+
+	snprintf(origin_name, NAMEDATALEN, "receiver_raw_spool_%s", name);
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	replorigin_drop_by_name(origin_name, true, false);
+	CommitTransactionCommand();
+}
+
+/*
+ * Drop the spool and the origin of the subscriptions removed, once their
+ * workers are gone.  These are the sub-directories of the spool directory
+ * not matching any subscription, including disabled ones.
+ */
+static void
+launcher_drop_orphans(List *subs)
+{
+	DIR		   *dir;
+	struct dirent *de;
+
+	if (receiver_spool_directory[0] == '\0')
+		return;
+
+	dir = AllocateDir(receiver_spool_directory);
+	while ((de = ReadDirExtended(dir, receiver_spool_directory, DEBUG1)) != NULL)
+	{
+		char		path[MAXPGPATH];
+		struct stat st;
+		ListCell   *lc;
+		bool		found = false;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		/* Skip the segments of the spool of a static receiver */
+		snprintf(path, MAXPGPATH, "%s/%s", receiver_spool_directory,
+				 de->d_name);
+		if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+			continue;
+
+		foreach(lc, subs)
+		{
+			LauncherSubscription *sub = (LauncherSubscription *) lfirst(lc);
+
+			if (strcmp(sub->name, de->d_name) == 0)
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (!found && launcher_find_slot(de->d_name) < 0)
+			launcher_reset_subscription(de->d_name);
+	}
+	FreeDir(dir);
+}
+
+/*
+ * Release a slot whose workers have been asked to stop, if they are gone.
+ */
+static void
+launcher_release_slot(int slotno)
+{
+	ReceiverRawWorker *worker = &receiver_shared->workers[slotno];
+	LauncherWorker *lw = &launcher_workers[slotno];
+	bool		running;
+
+	SpinLockAcquire(&worker->mutex);
+	running = worker->receiver_pid != 0 || worker->apply_pid != 0;
+	SpinLockRelease(&worker->mutex);
+
+	if (running ||
+		!launcher_worker_stopped(lw->receiver) ||
+		!launcher_worker_stopped(lw->apply))
+		return;
+
+	SpinLockAcquire(&worker->mutex);
+	worker->in_use = false;
+	worker->stop_requested = false;
+	SpinLockRelease(&worker->mutex);
+
+	if (lw->receiver != NULL)
+		pfree(lw->receiver);
+	if (lw->apply != NULL)
+		pfree(lw->apply);
+	lw->receiver = NULL;
+	lw->apply = NULL;
+}
+
+/*
+ * Check the upstream a subscription's spool was created for, dropping the
+ * spool and the origin if the subscription now uses another slot or
+ * connection string.  The upstream is then stored in the spool.
+ */
+static void
+launcher_check_upstream(LauncherSubscription *sub)
+{
+	char		dirpath[MAXPGPATH];
+	char		path[MAXPGPATH];
+	char		tmppath[MAXPGPATH];
+	StringInfoData upstream;
+	FILE	   *file;
+
+	if (receiver_spool_directory[0] == '\0')
+		return;
+
+	snprintf(dirpath, MAXPGPATH, "%s/%s", receiver_spool_directory, sub->name);
+	snprintf(path, MAXPGPATH, "%s/upstream", dirpath);
+	snprintf(tmppath, MAXPGPATH, "%s/upstream.tmp", dirpath);
+
+	initStringInfo(&upstream);
+	appendStringInfo(&upstream, "%s\n%s\n", sub->slot_name, sub->conn_string);
+
+	file = AllocateFile(path, PG_BINARY_R);
+	if (file != NULL)
+	{
+		char	   *buf = palloc(upstream.len + 1);
+		size_t		nread = fread(buf, 1, upstream.len + 1, file);
+		bool		same = nread == upstream.len &&
+			memcmp(buf, upstream.data, upstream.len) == 0;
+
+		FreeFile(file);
+		pfree(buf);
+		if (same)
+		{
+			pfree(upstream.data);
+			return;
+		}
+
+		ereport(LOG,
+				(errmsg("receiver_raw launcher: upstream of subscription \"%s\" has changed",
+						sub->name)));
+		launcher_reset_subscription(sub->name);
+	}
+	else if (errno != ENOENT)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+
+	if (MakePGDirectory(receiver_spool_directory) < 0 && errno != EEXIST)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m",
+						receiver_spool_directory)));
+	if (MakePGDirectory(dirpath) < 0 && errno != EEXIST)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m", dirpath)));
+
+	file = AllocateFile(tmppath, PG_BINARY_W);
+	if (file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", tmppath)));
+	if (fwrite(upstream.data, 1, upstream.len, file) != upstream.len ||
+		pg_fsync(fileno(file)) != 0 ||
+		FreeFile(file) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", tmppath)));
+	durable_rename(tmppath, path, ERROR);
+
+	pfree(upstream.data);
+}
+
+/*
+ * Assign a free slot to a subscription and start its workers.
+ */
+static void
+launcher_start_workers(LauncherSubscription *sub)
+{
+	ReceiverRawWorker *worker = NULL;
+	LauncherWorker *lw;
+	uint32		generation;
+	int			slotno;
+
+	for (slotno = 0; slotno < receiver_shared->num_workers; slotno++)
+	{
+		bool		in_use;
+
+		worker = &receiver_shared->workers[slotno];
+		SpinLockAcquire(&worker->mutex);
+		in_use = worker->in_use;
+		SpinLockRelease(&worker->mutex);
+
+		if (!in_use)
+			break;
+	}
+
+	if (slotno >= receiver_shared->num_workers)
+	{
+		ereport(WARNING,
+				(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+				 errmsg("out of worker slots for subscription \"%s\"",
+						sub->name),
+				 errhint("You might need to increase \"%s\".",
+						 "receiver_raw.max_subscriptions")));
+		return;
+	}
+
+	/* Drop the spool and the origin if the upstream has changed */
+	launcher_check_upstream(sub);
+
+	/* No workers are attached to this slot, so reset it first */
+	receiver_raw_reset_worker(worker);
+
+	SpinLockAcquire(&worker->mutex);
+	worker->in_use = true;
+	worker->stop_requested = false;
+	generation = ++worker->generation;
+	strlcpy(worker->name, sub->name, NAMEDATALEN);
+	strlcpy(worker->slot_name, sub->slot_name, NAMEDATALEN);
+	strlcpy(worker->conn_string, sub->conn_string, RECEIVER_CONNINFO_LEN);
+	SpinLockRelease(&worker->mutex);
+
+	ereport(LOG,
+			(errmsg("receiver_raw launcher: starting workers for subscription \"%s\"",
+					sub->name)));
+
+	lw = &launcher_workers[slotno];
+	lw->receiver = launcher_register_worker(slotno, generation, sub->name,
+											false);
+	if (lw->receiver != NULL && receiver_spool_directory[0] != '\0')
+		lw->apply = launcher_register_worker(slotno, generation, sub->name,
+											 true);
+
+	/* Retry on the next scan if a worker could not be registered */
+	if (lw->receiver == NULL ||
+		(receiver_spool_directory[0] != '\0' && lw->apply == NULL))
+		launcher_stop_workers(slotno);
+}
+
+/*
+ * Synchronize the workers running with the subscriptions enabled.
+ */
+static void
+launcher_sync(MemoryContext cxt)
+{
+	List	   *subs = launcher_load_subscriptions(cxt);
+	ListCell   *lc;
+
+	/*
+	 * Stop the workers of the subscriptions removed, disabled or changed,
+	 * and of the subscriptions whose receiver has exited.  These are started
+	 * again once their slot is released.
+	 */
+	for (int i = 0; i < receiver_shared->num_workers; i++)
+	{
+		ReceiverRawWorker *worker = &receiver_shared->workers[i];
+		LauncherSubscription *sub = NULL;
+		char		name[NAMEDATALEN];
+		char		slot_name[NAMEDATALEN];
+		char		conn_string[RECEIVER_CONNINFO_LEN];
+		bool		active;
+
+		SpinLockAcquire(&worker->mutex);
+		active = worker->in_use && !worker->stop_requested;
+		strlcpy(name, worker->name, NAMEDATALEN);
+		strlcpy(slot_name, worker->slot_name, NAMEDATALEN);
+		strlcpy(conn_string, worker->conn_string, RECEIVER_CONNINFO_LEN);
+		SpinLockRelease(&worker->mutex);
+
+		if (!active)
+			continue;
+
+		foreach(lc, subs)
+		{
+			LauncherSubscription *s = (LauncherSubscription *) lfirst(lc);
+
+			if (strcmp(s->name, name) == 0)
+			{
+				sub = s;
+				break;
+			}
+		}
+
+		if (sub == NULL || !sub->enabled ||
+			strcmp(sub->slot_name, slot_name) != 0 ||
+			strcmp(sub->conn_string, conn_string) != 0 ||
+			launcher_worker_stopped(launcher_workers[i].receiver))
+		{
+			ereport(LOG,
+					(errmsg("receiver_raw launcher: stopping workers for subscription \"%s\"",
+							name)));
+			launcher_stop_workers(i);
+		}
+	}
+
+	/* Release the slots whose workers are gone */
+	for (int i = 0; i < receiver_shared->num_workers; i++)
+	{
+		ReceiverRawWorker *worker = &receiver_shared->workers[i];
+		bool		stopping;
+
+		SpinLockAcquire(&worker->mutex);
+		stopping = worker->in_use && worker->stop_requested;
+		SpinLockRelease(&worker->mutex);
+
+		if (stopping)
+			launcher_release_slot(i);
+	}
+
+	launcher_drop_orphans(subs);
+
+	/* Start the workers of the new subscriptions */
+	foreach(lc, subs)
+	{
+		LauncherSubscription *sub = (LauncherSubscription *) lfirst(lc);
+
+		if (sub->enabled && launcher_find_slot(sub->name) < 0)
+			launcher_start_workers(sub);
+	}
+}
+
+/*
+ * Unregister the latch of the launcher at exit.
+ */
+static void
+launcher_shmem_exit(int code, Datum arg)
+{
+	SpinLockAcquire(&receiver_shared->mutex);
+	receiver_shared->launcher_latch = NULL;
+	SpinLockRelease(&receiver_shared->mutex);
+}
+
+/*
+ * Main entry point of the launcher.
+ */
+void
+receiver_raw_launcher_main(Datum main_arg)
+{
+	MemoryContext cxt;
+
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnection(receiver_database, NULL, 0);
+
+	launcher_workers = MemoryContextAllocZero(TopMemoryContext,
+											  sizeof(LauncherWorker) *
+											  receiver_shared->num_workers);
+	cxt = AllocSetContextCreate(TopMemoryContext,
+								"receiver_raw launcher",
+								ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * The workers started by a previous launcher cannot be tracked with
+	 * handles, so stop them.  They are started again once gone.
+	 */
+	for (int i = 0; i < receiver_shared->num_workers; i++)
+	{
+		ReceiverRawWorker *worker = &receiver_shared->workers[i];
+		bool		in_use;
+
+		SpinLockAcquire(&worker->mutex);
+		in_use = worker->in_use;
+		SpinLockRelease(&worker->mutex);
+
+		if (in_use)
+			launcher_stop_workers(i);
+	}
+
+	/* Let receiver_raw_reload() know where to wake up the launcher */
+	on_shmem_exit(launcher_shmem_exit, (Datum) 0);
+	SpinLockAcquire(&receiver_shared->mutex);
+	receiver_shared->launcher_latch = MyLatch;
+	SpinLockRelease(&receiver_shared->mutex);
+
+	ereport(LOG, (errmsg("receiver_raw launcher started")));
+
+	for (;;)
+	{
+		static uint32 wait_event_info = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		MemoryContextReset(cxt);
+		launcher_sync(cxt);
+
+		if (wait_event_info == 0)
+			wait_event_info = WaitEventExtensionNew("receiver_raw_launcher_main");
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 receiver_launcher_naptime * 1000L,
+						 wait_event_info);
+		ResetLatch(MyLatch);
+	}
+}
+
+/*
+ * receiver_raw_reload
+ *
+ * Wake up the launcher, so as it scans the subscriptions.  Returns false if
+ * the launcher is not running.
+ */
+Datum
+receiver_raw_reload(PG_FUNCTION_ARGS)
+{
+	Latch	   *latch;
+
+	if (receiver_shared == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("receiver_raw must be loaded via \"shared_preload_libraries\"")));
+
+	SpinLockAcquire(&receiver_shared->mutex);
+	latch = receiver_shared->launcher_latch;
+	SpinLockRelease(&receiver_shared->mutex);
+
+	if (latch != NULL)
+		SetLatch(latch);
+
+	PG_RETURN_BOOL(latch != NULL);
+}
@@ -0,0 +1,518 @@
+/*-------------------------------------------------------------------------
+ *
+ * receiver_raw_spool.c
+ *		Local spool of the changes received from the server.
+ *
+ * The spool is a set of segment files in receiver_raw.spool_directory,
+ * named after their segment number.  Each record of a segment is made of a
+ * header with its length, flags and CRC, followed by the CopyData payload
+ * received from the server as-is.  A record with a length of zero marks the
+ * end of a segment, records never crossing segment boundaries.  A change
+ * larger than a segment is split into several records, all of them except
+ * the last one being flagged as continued in the next record.  A position
+ * in the spool is a SpoolPtr, combining a segment number and an offset.
+ *
+ * The receiver appends records to the spool, buffering them and flushing
+ * them to disk in batches.  The records ending a remote transaction are
+ * flagged, and the apply worker reads the records up to the last one of
+ * them flushed, published in shared memory, so as it only applies complete
+ * transactions.  It removes the segments it does not need anymore.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		receiver_raw/receiver_raw_spool.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "port/pg_crc32c.h"
+#include "storage/fd.h"
+#include "utils/memutils.h"
+
+#include "receiver_raw.h"
+
+/* Data is written to disk once the write buffer reaches this size */
+#define SPOOL_WRITE_BUFFER_SIZE		(1024 * 1024)
+
+/* Header of a spool record */
+typedef struct SpoolRecordHeader
+{
+	uint32		len;			/* length of payload, 0 for end of segment */
+	uint32		flags;			/* SPOOL_RECORD_* flags */
+	pg_crc32c	crc;			/* CRC of flags and payload */
+} SpoolRecordHeader;
+
+/* Record ending a remote transaction */
+#define SPOOL_RECORD_COMMIT			0x01
+/* Payload continued in the next record */
+#define SPOOL_RECORD_CONTINUED		0x02
+
+/* Maximum payload of a record, leaving room for the end of segment */
+#define SPOOL_MAX_RECORD_LEN \
+	(RECEIVER_SPOOL_SEG_SIZE - 2 * sizeof(SpoolRecordHeader))
+
+#define SpoolPtrGetSegNo(ptr)	((ptr) / RECEIVER_SPOOL_SEG_SIZE)
+#define SpoolPtrGetOffset(ptr)	((ptr) % RECEIVER_SPOOL_SEG_SIZE)
+#define SpoolSegNoGetPtr(segno)	((SpoolPtr) (segno) * RECEIVER_SPOOL_SEG_SIZE)
+
+/* Write state, used by the receiver */
+static int	write_fd = -1;
+static uint64 write_segno = 0;
+static uint32 write_file_offset = 0;	/* data written in the file */
+static StringInfo write_buffer = NULL;	/* data not written yet */
+static bool write_file_dirty = false;	/* written since the last fsync? */
+static bool write_dir_dirty = false;
+
+/* Read state, used by the apply worker */
+static int	read_fd = -1;
+static uint64 read_segno = 0;
+
+/*
+ * Build the path of a spool segment.
+ */
+static void
+spool_segment_path(char *path, uint64 segno)
+{
+	snprintf(path, MAXPGPATH, "%s/%016llX", receiver_spool_directory,
+			 (unsigned long long) segno);
+}
+
+/*
+ * Open a spool segment.
+ */
+static int
+spool_segment_open(uint64 segno, int flags)
+{
+	char		path[MAXPGPATH];
+	int			fd;
+
+	spool_segment_path(path, segno);
+	fd = BasicOpenFile(path, flags | PG_BINARY);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+	return fd;
+}
+
+/*
+ * Read from a spool segment the record at the given offset, appending its
+ * payload to "buf".  Returns false if there is no complete and valid record
+ * at this location.
+ */
+static bool
+spool_segment_read(int fd, uint32 offset, SpoolRecordHeader *hdr,
+				   StringInfo buf)
+{
+	pg_crc32c	crc;
+	char	   *data;
+
+	if (pg_pread(fd, hdr, sizeof(SpoolRecordHeader), offset) !=
+		sizeof(SpoolRecordHeader))
+		return false;
+
+	if (hdr->len == 0)
+		return true;
+
+	if (hdr->len > SPOOL_MAX_RECORD_LEN)
+		return false;
+
+	enlargeStringInfo(buf, hdr->len);
+	data = buf->data + buf->len;
+	if (pg_pread(fd, data, hdr->len,
+				 offset + sizeof(SpoolRecordHeader)) != hdr->len)
+		return false;
+	buf->len += hdr->len;
+	buf->data[buf->len] = '\0';
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, &hdr->flags, sizeof(hdr->flags));
+	COMP_CRC32C(crc, data, hdr->len);
+	FIN_CRC32C(crc);
+
+	return EQ_CRC32C(crc, hdr->crc);
+}
+
+/*
+ * Write to disk the data buffered.
+ */
+static void
+spool_write_buffer(void)
+{
+	if (write_buffer->len == 0)
+		return;
+
+	errno = 0;
+	if (pg_pwrite(write_fd, write_buffer->data, write_buffer->len,
+				  write_file_offset) != write_buffer->len)
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to spool segment %016llX: %m",
+						(unsigned long long) write_segno)));
+	}
+
+	write_file_offset += write_buffer->len;
+	resetStringInfo(write_buffer);
+	write_file_dirty = true;
+}
+
+/*
+ * Finish the segment being written and begin the next one.
+ */
+static void
+spool_switch_segment(void)
+{
+	SpoolRecordHeader hdr;
+
+	hdr.len = 0;
+	hdr.flags = 0;
+	INIT_CRC32C(hdr.crc);
+	appendBinaryStringInfo(write_buffer, &hdr, sizeof(hdr));
+	spool_write_buffer();
+
+	if (pg_fsync(write_fd) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync spool segment %016llX: %m",
+						(unsigned long long) write_segno)));
+	close(write_fd);
+	write_file_dirty = false;
+
+	write_segno++;
+	write_file_offset = 0;
+	write_fd = spool_segment_open(write_segno, O_RDWR | O_CREAT);
+	write_dir_dirty = true;
+}
+
+/*
+ * spool_open_write
+ *
+ * Prepare the spool for writes, continuing after the last record ending a
+ * remote transaction.  The records after it belong to a transaction not
+ * spooled entirely, that the server sends again from its beginning once
+ * streaming resumes, so they are discarded, as well as the segments holding
+ * only such records.  Returns the spool position where the next record will
+ * be written, and sets "last_commit" to the payload of the last record
+ * ending a transaction if there is one, so as the caller knows from where
+ * to resume streaming.
+ */
+SpoolPtr
+spool_open_write(StringInfo last_commit)
+{
+	DIR		   *dir;
+	struct dirent *de;
+	bool		found = false;
+	uint64		oldest_segno = 0;
+	uint64		latest_segno = 0;
+	uint64		segno;
+	StringInfoData buf;
+	SpoolRecordHeader hdr;
+	MemoryContext oldcxt;
+
+	if (MakePGDirectory(receiver_spool_directory) < 0 && errno != EEXIST)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m",
+						receiver_spool_directory)));
+
+	/* Find the oldest and the latest segments */
+	dir = AllocateDir(receiver_spool_directory);
+	while ((de = ReadDir(dir, receiver_spool_directory)) != NULL)
+	{
+		if (strlen(de->d_name) != 16 ||
+			strspn(de->d_name, "0123456789ABCDEF") != 16)
+			continue;
+
+		segno = strtou64(de->d_name, NULL, 16);
+		if (!found || segno < oldest_segno)
+			oldest_segno = segno;
+		if (!found || segno > latest_segno)
+			latest_segno = segno;
+		found = true;
+	}
+	FreeDir(dir);
+
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	write_buffer = makeStringInfo();
+	MemoryContextSwitchTo(oldcxt);
+	write_file_offset = 0;
+	resetStringInfo(last_commit);
+
+	if (!found)
+	{
+		write_segno = 0;
+		write_fd = spool_segment_open(write_segno, O_RDWR | O_CREAT);
+		write_dir_dirty = true;
+		return SpoolSegNoGetPtr(write_segno);
+	}
+
+	/*
+	 * Look for the last record ending a transaction, from the latest segment
+	 * back to the oldest one.  The apply worker never goes past such a
+	 * record, so it is always in a segment still around if it has applied
+	 * anything.  If there is none, the spool restarts from the beginning of
+	 * the oldest segment.  Such records are small enough to never be split.
+	 */
+	initStringInfo(&buf);
+	for (segno = latest_segno;; segno--)
+	{
+		uint32		offset = 0;
+
+		write_segno = segno;
+		write_fd = spool_segment_open(segno, O_RDWR);
+		for (;;)
+		{
+			resetStringInfo(&buf);
+			if (!spool_segment_read(write_fd, offset, &hdr, &buf) ||
+				hdr.len == 0)
+				break;
+
+			offset += sizeof(SpoolRecordHeader) + hdr.len;
+			if ((hdr.flags & SPOOL_RECORD_COMMIT) != 0)
+			{
+				write_file_offset = offset;
+				resetStringInfo(last_commit);
+				appendBinaryStringInfo(last_commit, buf.data, buf.len);
+			}
+		}
+
+		if (last_commit->len > 0 || segno == oldest_segno)
+			break;
+		close(write_fd);
+	}
+	pfree(buf.data);
+
+	/* Discard everything after this record */
+	if (ftruncate(write_fd, write_file_offset) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not truncate spool segment %016llX: %m",
+						(unsigned long long) write_segno)));
+	if (pg_fsync(write_fd) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync spool segment %016llX: %m",
+						(unsigned long long) write_segno)));
+
+	for (segno = write_segno + 1; segno <= latest_segno; segno++)
+	{
+		char		path[MAXPGPATH];
+
+		spool_segment_path(path, segno);
+		if (unlink(path) < 0 && errno != ENOENT)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", path)));
+		write_dir_dirty = true;
+	}
+
+	return SpoolSegNoGetPtr(write_segno) + write_file_offset;
+}
+
+/*
+ * spool_write
+ *
+ * Append a change to the spool, "commit" telling if it ends a remote
+ * transaction.  A change is written to a new segment if it does not fit in
+ * the current one, except if it is larger than a segment, in which case it
+ * is split into records filling as many segments as needed.  Returns the
+ * spool position after the change.  The change is not flushed to disk yet.
+ */
+SpoolPtr
+spool_write(const char *data, int len, bool commit)
+{
+	for (;;)
+	{
+		SpoolRecordHeader hdr;
+		uint32		offset = write_file_offset + write_buffer->len;
+		uint32		avail = 0;
+
+		if (offset + 2 * sizeof(SpoolRecordHeader) < RECEIVER_SPOOL_SEG_SIZE)
+			avail = RECEIVER_SPOOL_SEG_SIZE - offset -
+				2 * sizeof(SpoolRecordHeader);
+
+		/* Switch to a new segment if the change does not fit in this one */
+		if (len > avail && (len <= SPOOL_MAX_RECORD_LEN || avail == 0))
+		{
+			spool_switch_segment();
+			continue;
+		}
+
+		if (len > avail)
+		{
+			hdr.len = avail;
+			hdr.flags = SPOOL_RECORD_CONTINUED;
+		}
+		else
+		{
+			hdr.len = len;
+			hdr.flags = commit ? SPOOL_RECORD_COMMIT : 0;
+		}
+		INIT_CRC32C(hdr.crc);
+		COMP_CRC32C(hdr.crc, &hdr.flags, sizeof(hdr.flags));
+		COMP_CRC32C(hdr.crc, data, hdr.len);
+		FIN_CRC32C(hdr.crc);
+		appendBinaryStringInfo(write_buffer, &hdr, sizeof(hdr));
+		appendBinaryStringInfo(write_buffer, data, hdr.len);
+
+		if (write_buffer->len >= SPOOL_WRITE_BUFFER_SIZE)
+			spool_write_buffer();
+
+		if ((hdr.flags & SPOOL_RECORD_CONTINUED) == 0)
+			break;
+		data += hdr.len;
+		len -= hdr.len;
+	}
+
+	return SpoolSegNoGetPtr(write_segno) + write_file_offset +
+		write_buffer->len;
+}
+
+/*
+ * spool_flush
+ *
+ * Write and flush to disk all the records appended to the spool, if any
+ * have been written since the last flush.  Returns the spool position
+ * flushed.
+ */
+SpoolPtr
+spool_flush(void)
+{
+	spool_write_buffer();
+
+	if (write_file_dirty)
+	{
+		if (pg_fsync(write_fd) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not fsync spool segment %016llX: %m",
+							(unsigned long long) write_segno)));
+		write_file_dirty = false;
+	}
+
+	/* Make new segments durable */
+	if (write_dir_dirty)
+	{
+		fsync_fname(receiver_spool_directory, true);
+		write_dir_dirty = false;
+	}
+
+	return SpoolSegNoGetPtr(write_segno) + write_file_offset;
+}
+
+/*
+ * spool_read
+ *
+ * Read the change of the spool at position "pos", up to the position
+ * "limit", storing its payload in "buf" and moving "pos" after it.  The
+ * records of a change split are put back together.  Returns false if there
+ * is no change to read.
+ */
+bool
+spool_read(SpoolPtr *pos, SpoolPtr limit, StringInfo buf)
+{
+	SpoolRecordHeader hdr;
+	SpoolPtr	read_pos = *pos;
+
+	resetStringInfo(buf);
+	while (read_pos < limit)
+	{
+		uint64		segno = SpoolPtrGetSegNo(read_pos);
+
+		if (read_fd < 0 || read_segno != segno)
+		{
+			if (read_fd >= 0)
+				close(read_fd);
+			read_fd = spool_segment_open(segno, O_RDONLY);
+			read_segno = segno;
+		}
+
+		if (!spool_segment_read(read_fd, SpoolPtrGetOffset(read_pos), &hdr,
+								buf))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid record in spool segment %016llX at offset %u",
+							(unsigned long long) segno,
+							(uint32) SpoolPtrGetOffset(read_pos))));
+
+		/* End of segment, move to the next one */
+		if (hdr.len == 0)
+		{
+			read_pos = SpoolSegNoGetPtr(segno + 1);
+			if (buf->len == 0)
+				*pos = read_pos;
+			continue;
+		}
+
+		read_pos += sizeof(SpoolRecordHeader) + hdr.len;
+		if ((hdr.flags & SPOOL_RECORD_CONTINUED) != 0)
+			continue;
+
+		*pos = read_pos;
+		return true;
+	}
+
+	/* The limit is always after a complete change */
+	if (buf->len > 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("incomplete change in spool segment %016llX",
+						(unsigned long long) SpoolPtrGetSegNo(read_pos))));
+
+	return false;
+}
+
+/*
+ * spool_remove
+ *
+ * Remove all the spool segments before the one of the given position.
+ */
+void
+spool_remove(SpoolPtr pos)
+{
+	static bool first_call = true;
+	static uint64 oldest_segno = 0;
+	uint64		segno = SpoolPtrGetSegNo(pos);
+
+	/* Look for the oldest segment on first call */
+	if (first_call)
+	{
+		DIR		   *dir;
+		struct dirent *de;
+
+		oldest_segno = segno;
+		dir = AllocateDir(receiver_spool_directory);
+		while ((de = ReadDir(dir, receiver_spool_directory)) != NULL)
+		{
+			if (strlen(de->d_name) != 16 ||
+				strspn(de->d_name, "0123456789ABCDEF") != 16)
+				continue;
+			oldest_segno = Min(oldest_segno,
+							   strtou64(de->d_name, NULL, 16));
+		}
+		FreeDir(dir);
+		first_call = false;
+	}
+
+	for (; oldest_segno < segno; oldest_segno++)
+	{
+		char		path[MAXPGPATH];
+
+		spool_segment_path(path, oldest_segno);
+		if (unlink(path) < 0 && errno != ENOENT)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", path)));
+	}
+}
@@ -0,0 +1,84 @@
+# Copyright (c) 2023-2026, PostgreSQL Global Development Group
+
+# Check the changes received through a spool, including a change larger
+# than a spool segment.  decoder_raw needs to be installed.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $publisher = PostgreSQL::Test::Cluster->new('publisher');
+$publisher->init(allows_streaming => 'logical');
+$publisher->start;
+
+$publisher->safe_psql('postgres',
+	"SELECT pg_create_logical_replication_slot('slot', 'decoder_raw')");
+
+my $publisher_connstr = $publisher->connstr('postgres');
+my $spool_directory = PostgreSQL::Test::Utils::tempdir;
+
+my $subscriber = PostgreSQL::Test::Cluster->new('subscriber');
+$subscriber->init;
+$subscriber->append_conf(
+	'postgresql.conf', qq{
+shared_preload_libraries = 'receiver_raw'
+receiver_raw.conn_string = '$publisher_connstr replication=database application_name=receiver_raw'
+receiver_raw.spool_directory = '$spool_directory'
+});
+$subscriber->start;
+
+foreach my $node ($publisher, $subscriber)
+{
+	$node->safe_psql('postgres',
+		'CREATE TABLE tab (a int PRIMARY KEY, b text)');
+}
+
+# 20MB change, larger than a spool segment of 16MB
+$publisher->safe_psql('postgres',
+	"INSERT INTO tab VALUES (1, repeat('x', 20 * 1024 * 1024))");
+$publisher->safe_psql('postgres', "INSERT INTO tab VALUES (2, 'small')");
+
+$subscriber->poll_query_until('postgres',
+	'SELECT count(*) = 2 FROM tab')
+  or die "timed out waiting for the changes to be applied";
+
+my $result = $subscriber->safe_psql('postgres',
+	'SELECT a, length(b) FROM tab ORDER BY a');
+is($result, qq(1|20971520
+2|5), 'change larger than a spool segment applied');
+
+# Changes received after a restart are applied once
+$subscriber->restart;
+$publisher->safe_psql('postgres', "INSERT INTO tab VALUES (3, 'after')");
+
+$subscriber->poll_query_until('postgres',
+	'SELECT count(*) = 3 FROM tab')
+  or die "timed out waiting for the changes to be applied";
+
+$result = $subscriber->safe_psql('postgres',
+	'SELECT a, b FROM tab WHERE a > 1 ORDER BY a');
+is($result, qq(2|small
+3|after), 'changes applied after restart');
+
+# DELETE with no local row, counted as missing
+$subscriber->safe_psql('postgres', 'DELETE FROM tab WHERE a = 3');
+$publisher->safe_psql('postgres', 'DELETE FROM tab WHERE a IN (2, 3)');
+
+$subscriber->poll_query_until('postgres',
+	'SELECT count(*) = 1 FROM tab')
+  or die "timed out waiting for the changes to be applied";
+
+$subscriber->safe_psql('postgres', 'CREATE EXTENSION receiver_raw');
+$subscriber->poll_query_until('postgres',
+	'SELECT missing = 1 FROM receiver_raw_stats')
+  or die "timed out waiting for the statistics to be updated";
+$result = $subscriber->safe_psql('postgres',
+	'SELECT deletes, missing FROM receiver_raw_stats');
+is($result, '1|1', 'DELETE with no local row counted as missing');
+
+$subscriber->stop;
+$publisher->stop;
+done_testing();
@@ -1,3 +1,8 @@
 -- Sanity check for archive_get_size
 SELECT archive_get_size('../no_parent'); -- error
 SELECT archive_get_size('/no_absolute'); -- error
+-- Sanity checks for archive_get_data_chunks
+SELECT * FROM archive_get_data_chunks('../no_parent'); -- error
+SELECT * FROM archive_get_data_chunks('/no_absolute'); -- error
+SELECT * FROM archive_get_data_chunks('file', 0); -- error
+SELECT * FROM archive_get_data_chunks('file', 1024, -1); -- error
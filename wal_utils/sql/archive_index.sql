@@ -0,0 +1,4 @@
+-- Sanity checks for the archive index, not enabled here
+SELECT * FROM archive_index_status(); -- error
+SELECT * FROM archive_index_timelines(); -- error
+SELECT * FROM archive_index_segments(1, '0/0', '0/1000000'); -- error
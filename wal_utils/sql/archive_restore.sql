@@ -0,0 +1,6 @@
+-- Sanity checks for archive_restore_segments
+SELECT * FROM archive_restore_segments('{}', '.');
+SELECT * FROM archive_restore_segments('{000000010000000000000001}', '.', -1); -- error
+SELECT * FROM archive_restore_segments('{000000010000000000000001,NULL}', '.'); -- error
+SELECT * FROM archive_restore_segments('{00000001000000000000000Z}', '.'); -- error
+SELECT * FROM archive_restore_segments('{}', 'PG_VERSION'); -- error
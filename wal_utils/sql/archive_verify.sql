@@ -0,0 +1,5 @@
+-- Sanity checks for archive_verify_segments
+SELECT * FROM archive_verify_segments('{}');
+SELECT * FROM archive_verify_segments('{000000010000000000000001}', -1); -- error
+SELECT * FROM archive_verify_segments('{000000010000000000000001,NULL}'); -- error
+SELECT * FROM archive_verify_segments('{00000001000000000000000Z}'); -- error
@@ -0,0 +1,6 @@
+-- Sanity checks for archive_wal_stats
+SELECT * FROM archive_wal_stats(NULL, '0/0', 1, '0/0'); -- error
+SELECT * FROM archive_wal_stats(1, '0/0', 1, '0/0', NULL, NULL); -- error
+SELECT * FROM archive_wal_stats(1, '0/0', 1, '0/0', NULL, false, -1); -- error
+SELECT * FROM archive_wal_stats(1, '0/2000000', 1, '0/1000000'); -- error
+SELECT * FROM archive_wal_stats(1, '0/1000000', 2, '0/2000000'); -- error
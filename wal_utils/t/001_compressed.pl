@@ -0,0 +1,85 @@
+# Copyright (c) 2023-2026, PostgreSQL Global Development Group
+
+# Check the reads of WAL segments compressed with gzip, lz4 and zstd, made
+# of one or several members or frames.
+
+use strict;
+use warnings;
+
+use Digest::MD5 qw(md5_hex);
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $archive = PostgreSQL::Test::Utils::tempdir;
+
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init;
+
+# The archive path is given to the server through its environment
+$ENV{PGARCHIVE} = $archive;
+$node->start;
+$node->safe_psql('postgres', 'CREATE EXTENSION wal_utils');
+
+# Fill a segment, and take it once complete
+$node->safe_psql('postgres',
+	'CREATE TABLE tab AS SELECT generate_series(1, 100000) AS a');
+my $segname = $node->safe_psql('postgres',
+	'SELECT pg_walfile_name(pg_current_wal_lsn())');
+$node->safe_psql('postgres', 'SELECT pg_switch_wal()');
+
+my $segment = slurp_file($node->data_dir . "/pg_wal/$segname");
+my $size = length($segment);
+my $md5 = md5_hex($segment);
+
+# The segment, and its halves compressed separately then concatenated
+my $half = int($size / 2);
+append_to_file("$archive/segment", $segment);
+append_to_file("$archive/half1", substr($segment, 0, $half));
+append_to_file("$archive/half2", substr($segment, $half));
+
+# Files are compressed from paths rather than from stdin, so as lz4 and zstd
+# store the content size in their frame headers.
+my @methods = (
+	[ 'gzip', '.gz', '#define HAVE_LIBZ 1', 'gzip -c' ],
+	[ 'lz4', '.lz4', '#define USE_LZ4 1', 'lz4 -q -c --content-size' ],
+	[ 'zstd', '.zst', '#define USE_ZSTD 1', 'zstd -q -c' ]);
+
+foreach my $method (@methods)
+{
+	my ($name, $suffix, $config, $command) = @$method;
+
+  SKIP:
+	{
+		my ($program) = split(/ /, $command);
+
+		skip "$name not supported by this build", 4
+		  unless check_pg_config($config);
+		skip "$program not found", 4
+		  if system("$program --version >/dev/null 2>&1") != 0;
+
+		system("$command $archive/segment > $archive/${name}_single$suffix") == 0
+		  or die "could not compress segment with $name";
+		system("$command $archive/half1 > $archive/${name}_multi$suffix") == 0
+		  and system("$command $archive/half2 >> $archive/${name}_multi$suffix") == 0
+		  or die "could not compress segment with $name";
+
+		foreach my $kind ('single', 'multi')
+		{
+			my $file = "${name}_$kind";
+
+			is( $node->safe_psql(
+					'postgres', "SELECT archive_get_size('$file')"),
+				$size,
+				"size of segment compressed with $name, $kind");
+			is( $node->safe_psql(
+					'postgres',
+					"SELECT md5(archive_get_data('$file', 0, $size))"),
+				$md5,
+				"data of segment compressed with $name, $kind");
+		}
+	}
+}
+
+$node->stop;
+done_testing();
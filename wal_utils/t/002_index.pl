@@ -0,0 +1,126 @@
+# Copyright (c) 2023-2026, PostgreSQL Global Development Group
+
+# Check the archive index, with the segments and the history files of a
+# real archive, as files are added to it and removed from it.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+# Small segments, so as a few of them are archived quickly
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init(has_archiving => 1, extra => ['--wal-segsize=1']);
+$node->append_conf(
+	'postgresql.conf', q{
+shared_preload_libraries = 'wal_utils'
+wal_utils.index_max_files = 1000
+wal_utils.index_rescan_interval = 1s
+});
+
+# The archive path is given to the server through its environment
+my $archive = $node->archive_dir;
+$ENV{PGARCHIVE} = $archive;
+$node->start;
+$node->safe_psql('postgres', 'CREATE EXTENSION wal_utils');
+
+# Fill a few segments, and wait for all of them to be archived
+my $start_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+$node->safe_psql('postgres',
+	'CREATE TABLE tab AS SELECT generate_series(1, 100000) AS a');
+my $end_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+my $last_segment = $node->safe_psql('postgres',
+	"SELECT pg_walfile_name('$end_lsn')");
+$node->safe_psql('postgres', 'SELECT pg_switch_wal()');
+$node->poll_query_until('postgres',
+	"SELECT coalesce(last_archived_wal >= '$last_segment', false) FROM pg_stat_archiver"
+) or die "timed out while waiting for the segments to be archived";
+
+my $segments = $node->safe_psql('postgres',
+	"SELECT string_agg(s, ',') FROM archive_build_segment_list(1, '$start_lsn', 1, '$end_lsn', NULL) s"
+);
+my @segments = split(/,/, $segments);
+my $nsegments = scalar(@segments);
+cmp_ok($nsegments, '>=', 4, 'segments archived');
+
+# The index is ready once its first full scan is done
+$node->poll_query_until('postgres',
+	'SELECT ready AND NOT overflow FROM archive_index_status()')
+  or die "timed out while waiting for the archive index";
+is( $node->safe_psql(
+		'postgres',
+		'SELECT pid IS NOT NULL, max_files, last_scan IS NOT NULL FROM archive_index_status()'
+	),
+	't|1000|t',
+	'state of the archive index');
+
+# The segments are found with their size, as they are archived
+$node->poll_query_until('postgres',
+	"SELECT count(*) = $nsegments FROM archive_index_segments(1, '$start_lsn', '$end_lsn')"
+) or die "timed out while waiting for the segments in the archive index";
+is( $node->safe_psql(
+		'postgres',
+		"SELECT string_agg(segment, ',' ORDER BY segment) FROM archive_index_segments(1, '$start_lsn', '$end_lsn')"
+	),
+	$segments,
+	'segments found in the archive index');
+is( $node->safe_psql(
+		'postgres',
+		"SELECT count(*) FROM archive_index_segments(1, '$start_lsn', '$end_lsn')
+		   WHERE size = 1024 * 1024 AND compression = 'none'
+		     AND pg_walfile_name(segment_lsn + 1) = segment"
+	),
+	$nsegments,
+	'sizes, compression and LSNs of the segments in the archive index');
+is( $node->safe_psql(
+		'postgres',
+		"SELECT timeline, history_size IS NULL, segments >= $nsegments FROM archive_index_timelines()"
+	),
+	'1|t|t',
+	'initial timeline in the archive index, without history file');
+
+# Add a history file and a compressed segment on a second timeline.  The
+# index only looks at the names and the sizes of the files, so the
+# segment does not need to be really compressed.
+my $history = "1\t0/3000000\tno recovery target specified\n";
+append_to_file("$archive/00000002.history", $history);
+my $tli2_segment = '00000002' . substr($segments[0], 8);
+append_to_file("$archive/$tli2_segment.zst", 'x' x 1000);
+
+$node->poll_query_until('postgres',
+	"SELECT count(*) = 1 FROM archive_index_timelines() WHERE timeline = 2 AND history_size IS NOT NULL AND total_size = 1000"
+) or die "timed out while waiting for the second timeline";
+is( $node->safe_psql(
+		'postgres',
+		'SELECT history_size, total_size FROM archive_index_timelines() WHERE timeline = 2'
+	),
+	length($history) . '|1000',
+	'history file and segment of the second timeline in the archive index');
+is( $node->safe_psql(
+		'postgres',
+		"SELECT segment, size, compression FROM archive_index_segments(2, '0/0', '$end_lsn')"
+	),
+	"$tli2_segment|1000|zstd",
+	'compressed segment in the archive index');
+
+# Files removed from the archives go away from the index
+unlink("$archive/00000002.history")
+  or die "could not remove history file: $!";
+unlink("$archive/$tli2_segment.zst")
+  or die "could not remove segment: $!";
+$node->poll_query_until('postgres',
+	'SELECT count(*) = 0 FROM archive_index_timelines() WHERE timeline = 2')
+  or die "timed out while waiting for the second timeline to go away";
+is( $node->safe_psql(
+		'postgres',
+		"SELECT count(*) FROM archive_index_segments(1, '$start_lsn', '$end_lsn')"
+	),
+	$nsegments,
+	'segments of the initial timeline still in the archive index');
+
+$node->stop;
+done_testing();
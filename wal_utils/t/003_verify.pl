@@ -0,0 +1,95 @@
+# Copyright (c) 2023-2026, PostgreSQL Global Development Group
+
+# Check the verification of the segments of a real archive, some of them
+# valid, one corrupted and one missing.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+# Small segments, so as a few of them are archived quickly
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init(has_archiving => 1, extra => ['--wal-segsize=1']);
+
+# The archive path is given to the server through its environment
+my $archive = $node->archive_dir;
+$ENV{PGARCHIVE} = $archive;
+$node->start;
+$node->safe_psql('postgres', 'CREATE EXTENSION wal_utils');
+
+# Fill a few segments, and wait for all of them to be archived
+my $start_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+$node->safe_psql('postgres',
+	'CREATE TABLE tab AS SELECT generate_series(1, 100000) AS a');
+my $end_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+my $last_segment = $node->safe_psql('postgres',
+	"SELECT pg_walfile_name('$end_lsn')");
+$node->safe_psql('postgres', 'SELECT pg_switch_wal()');
+$node->poll_query_until('postgres',
+	"SELECT coalesce(last_archived_wal >= '$last_segment', false) FROM pg_stat_archiver"
+) or die "timed out while waiting for the segments to be archived";
+
+my @segments = split(
+	/\n/,
+	$node->safe_psql(
+		'postgres',
+		"SELECT archive_build_segment_list(1, '$start_lsn', 1, '$end_lsn', NULL)"
+	));
+cmp_ok(scalar(@segments), '>=', 4, 'segments archived');
+
+# Corrupt the middle of the second segment, full of records, leaving its
+# first page read with the records of the first segment continuing in it.
+# The records before the corruption are still counted.
+my $corrupted = $segments[1];
+open(my $fh, '+<', "$archive/$corrupted")
+  or die "could not open $corrupted: $!";
+binmode($fh);
+seek($fh, 512 * 1024 + 100, 0) or die "could not seek in $corrupted: $!";
+read($fh, my $data, 16) == 16 or die "could not read $corrupted: $!";
+seek($fh, 512 * 1024 + 100, 0) or die "could not seek in $corrupted: $!";
+print $fh ($data ^ ("\xff" x 16)) or die "could not write $corrupted: $!";
+close($fh);
+
+# A segment never archived
+my $missing = $node->safe_psql('postgres',
+	"SELECT pg_walfile_name('$end_lsn'::pg_lsn + 100 * 1024 * 1024)");
+
+my $list = join(',', @segments, $missing);
+my %expected;
+$expected{$_} = 'valid' foreach (@segments);
+$expected{$corrupted} = 'invalid';
+$expected{$missing} = 'missing';
+
+foreach my $workers (0, 1, 4)
+{
+	my $result = $node->safe_psql(
+		'postgres', qq{
+SELECT segment, status,
+       CASE status
+         WHEN 'valid' THEN records > 0 AND bytes > 0
+           AND end_lsn IS NOT NULL AND duration >= 0 AND error IS NULL
+         WHEN 'invalid' THEN records > 0 AND error <> ''
+         WHEN 'missing' THEN records IS NULL AND end_lsn IS NULL
+       END
+  FROM archive_verify_segments('{$list}', $workers)
+  ORDER BY segment});
+
+	my %statuses;
+	foreach my $row (split(/\n/, $result))
+	{
+		my ($segment, $status, $check) = split(/\|/, $row);
+
+		$statuses{$segment} = $status;
+		is($check, 't', "contents of $status segment $segment, $workers workers");
+	}
+	is_deeply(\%statuses, \%expected,
+		"status of the segments verified, $workers workers");
+}
+
+$node->stop;
+done_testing();
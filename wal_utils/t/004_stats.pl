@@ -0,0 +1,83 @@
+# Copyright (c) 2023-2026, PostgreSQL Global Development Group
+
+# Check the statistics of the records of a real archive, comparing them
+# with the ones of pg_walinspect for the same range of records.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+# Small segments, so as a few of them are archived quickly
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init(has_archiving => 1, extra => ['--wal-segsize=1']);
+
+# The archive path is given to the server through its environment
+my $archive = $node->archive_dir;
+$ENV{PGARCHIVE} = $archive;
+$node->start;
+$node->safe_psql('postgres', 'CREATE EXTENSION wal_utils');
+$node->safe_psql('postgres', 'CREATE EXTENSION pg_walinspect');
+$node->safe_psql('postgres', 'CREATE TABLE tab (a int)');
+
+# Fill a few segments with a mix of records, and wait for all of them to
+# be archived.  The start and end LSNs are the ones of record boundaries.
+my $start_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+$node->safe_psql('postgres',
+	'INSERT INTO tab SELECT generate_series(1, 50000)');
+$node->safe_psql('postgres', 'UPDATE tab SET a = a + 1 WHERE a % 10 = 0');
+$node->safe_psql('postgres', 'DELETE FROM tab WHERE a % 20 = 0');
+$node->safe_psql('postgres', 'VACUUM tab');
+my $end_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+my $last_segment = $node->safe_psql('postgres',
+	"SELECT pg_walfile_name('$end_lsn')");
+$node->safe_psql('postgres', 'SELECT pg_switch_wal()');
+$node->poll_query_until('postgres',
+	"SELECT coalesce(last_archived_wal >= '$last_segment', false) FROM pg_stat_archiver"
+) or die "timed out while waiting for the segments to be archived";
+
+cmp_ok(
+	$node->safe_psql(
+		'postgres',
+		"SELECT count(*) FROM archive_build_segment_list(1, '$start_lsn', 1, '$end_lsn', NULL)"
+	),
+	'>=', 4,
+	'segments archived');
+
+foreach my $per_record ('false', 'true')
+{
+	my $expected = $node->safe_psql(
+		'postgres', qq{
+SELECT * FROM pg_get_wal_stats('$start_lsn', '$end_lsn', $per_record)
+  ORDER BY 1});
+	like($expected, qr/^Heap/m, "records gathered, per_record = $per_record");
+
+	foreach my $workers (0, 4)
+	{
+		is( $node->safe_psql(
+				'postgres', qq{
+SELECT * FROM archive_wal_stats(1, '$start_lsn', 1, '$end_lsn', NULL,
+                                $per_record, $workers)
+  ORDER BY 1}),
+			$expected,
+			"statistics of the archives, per_record = $per_record, $workers workers"
+		);
+	}
+}
+
+# The statistics are not computed for segments missing in the archives
+my ($ret, $stdout, $stderr) = $node->psql('postgres',
+	"SELECT * FROM archive_wal_stats(1, '$start_lsn', 1, '$end_lsn'::pg_lsn + 100 * 1024 * 1024)"
+);
+isnt($ret, 0, 'statistics over segments missing in the archives');
+like(
+	$stderr,
+	qr/segment "[0-9A-F]{24}" not found in the archives/,
+	'error for segments missing in the archives');
+
+$node->stop;
+done_testing();
@@ -0,0 +1,177 @@
+# Copyright (c) 2023-2026, PostgreSQL Global Development Group
+
+# Check the restore of the segments and history files of a real archive,
+# comparing the restored files with the archived ones for each way of
+# copying them.
+
+use strict;
+use warnings;
+
+use Digest::MD5 qw(md5_hex);
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+# Small segments, so as a few of them are archived quickly
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init(has_archiving => 1, extra => ['--wal-segsize=1']);
+
+# The archive path is given to the server through its environment
+my $archive = $node->archive_dir;
+$ENV{PGARCHIVE} = $archive;
+$node->start;
+$node->safe_psql('postgres', 'CREATE EXTENSION wal_utils');
+
+# Fill a few segments, and wait for all of them to be archived
+my $start_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+$node->safe_psql('postgres',
+	'CREATE TABLE tab AS SELECT generate_series(1, 100000) AS a');
+my $end_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_wal_insert_lsn()');
+my $last_segment = $node->safe_psql('postgres',
+	"SELECT pg_walfile_name('$end_lsn')");
+$node->safe_psql('postgres', 'SELECT pg_switch_wal()');
+$node->poll_query_until('postgres',
+	"SELECT coalesce(last_archived_wal >= '$last_segment', false) FROM pg_stat_archiver"
+) or die "timed out while waiting for the segments to be archived";
+
+my @segments = split(
+	/\n/,
+	$node->safe_psql(
+		'postgres',
+		"SELECT archive_build_segment_list(1, '$start_lsn', 1, '$end_lsn', NULL)"
+	));
+cmp_ok(scalar(@segments), '>=', 4, 'segments archived');
+
+# Restore files into a target, returning a hash of their status, size
+# and method.
+sub restore
+{
+	my ($files, $target, $overwrite) = @_;
+	my %result;
+
+	my $list = join(',', @$files);
+	my $rows = $node->safe_psql(
+		'postgres', qq{
+SELECT file, status, size, method, error
+  FROM archive_restore_segments('{$list}', '$target', 4, $overwrite)});
+	foreach my $row (split(/\n/, $rows))
+	{
+		my ($file, $status, $size, $method, $error) = split(/\|/, $row);
+
+		$result{$file} = {
+			status => $status,
+			size => $size,
+			method => $method,
+			error => $error
+		};
+	}
+	return \%result;
+}
+
+# Check that a restored file matches byte for byte its original
+sub check_restored
+{
+	my ($result, $file, $target, $original, $method, $test) = @_;
+
+	is($result->{$file}->{status}, 'restored', "$test: status");
+	is($result->{$file}->{error}, '', "$test: no error");
+	like($result->{$file}->{method}, $method, "$test: method");
+	is($result->{$file}->{size}, length($original), "$test: size");
+	ok(-f "$target/$file"
+		  && md5_hex(slurp_file("$target/$file")) eq md5_hex($original),
+		"$test: contents");
+}
+
+# Uncompressed files are cloned, copied with copy_file_range() or with
+# a plain copy, depending on what the filesystem supports.
+my $copy_methods = qr/^(clone|copy_file_range|copy)$/;
+
+# Segments of the initial timeline, which has no history file
+my $target = PostgreSQL::Test::Utils::tempdir;
+my $result = restore(\@segments, $target, 'false');
+is_deeply([ sort keys %$result ], \@segments, 'files restored');
+foreach my $segment (@segments)
+{
+	check_restored($result, $segment, $target,
+		slurp_file("$archive/$segment"),
+		$copy_methods, "segment $segment");
+}
+
+opendir(my $dh, $target) or die "could not open $target: $!";
+my @tmpfiles = grep { /\.tmp$/ } readdir($dh);
+closedir($dh);
+is_deeply(\@tmpfiles, [], 'no temporary files left in the target');
+
+# Files already present are skipped, except when overwriting them
+$result = restore(\@segments, $target, 'false');
+is_deeply(
+	[ map { $result->{$_}->{status} } @segments ],
+	[ map { 'skipped' } @segments ],
+	'files present in the target skipped');
+$result = restore(\@segments, $target, 'true');
+is_deeply(
+	[ map { $result->{$_}->{status} } @segments ],
+	[ map { 'restored' } @segments ],
+	'files present in the target overwritten');
+
+# A second timeline, with its history file and segments archived
+# uncompressed and compressed with each method supported, the segments
+# being copies of the ones of the initial timeline.
+my $history = "1\t0/3000000\tno recovery target specified\n";
+append_to_file("$archive/00000002.history", $history);
+
+my @methods = (
+	[ 'none', '', undef, undef ],
+	[ 'gzip', '.gz', '#define HAVE_LIBZ 1', 'gzip -c' ],
+	[ 'lz4', '.lz4', '#define USE_LZ4 1', 'lz4 -q -c' ],
+	[ 'zstd', '.zst', '#define USE_ZSTD 1', 'zstd -q -c' ]);
+my @tli2_files;
+my %originals = ('00000002.history' => $history);
+my %expected_methods = ('00000002.history' => $copy_methods);
+
+for (my $i = 0; $i < scalar(@methods); $i++)
+{
+	my ($name, $suffix, $config, $command) = @{ $methods[$i] };
+	my $segment = $segments[$i];
+	my $tli2_segment = '00000002' . substr($segment, 8);
+
+	if (defined($config))
+	{
+		my ($program) = split(/ /, $command);
+
+		next unless check_pg_config($config);
+		next if system("$program --version >/dev/null 2>&1") != 0;
+
+		system("$command $archive/$segment > $archive/$tli2_segment$suffix")
+		  == 0
+		  or die "could not compress segment with $name";
+		$expected_methods{$tli2_segment} = qr/^decompress$/;
+	}
+	else
+	{
+		append_to_file("$archive/$tli2_segment",
+			slurp_file("$archive/$segment"));
+		$expected_methods{$tli2_segment} = $copy_methods;
+	}
+
+	push @tli2_files, $tli2_segment;
+	$originals{$tli2_segment} = slurp_file("$archive/$segment");
+}
+
+# A segment never archived, far past the ones generated
+my $missing = '0000000200000000000000FF';
+
+my $target2 = PostgreSQL::Test::Utils::tempdir;
+$result = restore([ @tli2_files, $missing ], $target2, 'false');
+foreach my $file (sort keys %originals)
+{
+	check_restored($result, $file, $target2, $originals{$file},
+		$expected_methods{$file}, "file $file of the second timeline");
+}
+is($result->{$missing}->{status}, 'missing', 'segment missing in the archives');
+ok(!-e "$target2/$missing", 'segment missing not restored');
+
+$node->stop;
+done_testing();
@@ -36,7 +36,9 @@ LANGUAGE C;
 -- by Postgres. Note that there is no restriction on the file name that
 -- caller can use here, a segment file could be compressed, and the
 -- archive could be used as well to store some custom metadata. The path
--- defined cannot be absolute as well.
+-- defined cannot be absolute as well. If the file does not exist, a variant
+-- compressed with gzip, zstd or lz4 (suffix .gz, .zst or .lz4) is looked
+-- for and decompressed on the fly.
 CREATE FUNCTION archive_get_data(
 	IN filename text,
 	IN begin_t bigint,
@@ -45,10 +47,134 @@ CREATE FUNCTION archive_get_data(
 RETURNS bytea
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT;
--- Get the size of a file in archives.
+-- Get data from the archive path as a set of chunks of at most chunk_size
+-- bytes, returned one at a time with the offset where each one begins.
+-- This bounds the memory used when fetching large files, like WAL
+-- segments.
+CREATE FUNCTION archive_get_data_chunks(
+	IN filename text,
+	IN chunk_size int DEFAULT 1048576,
+	IN begin_t bigint DEFAULT 0,
+	IN offset_t bigint DEFAULT -1,
+	OUT chunk_offset bigint,
+	OUT data bytea)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+-- Get the size of a file in archives, once decompressed if compressed.
 CREATE FUNCTION archive_get_size(
 	IN filename text,
 	OUT size bigint)
 RETURNS bigint
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT;
+
+-- Verify a list of segments in the archives, as generated by
+-- archive_build_segment_list(), reading all their records to check their
+-- page headers, continuation records and CRCs. The segments are spread
+-- across up to max_workers dynamic background workers. duration is in
+-- milliseconds, throughput in MB of WAL read per second.
+CREATE FUNCTION archive_verify_segments(
+	IN segments text[],
+	IN max_workers int DEFAULT 4,
+	OUT segment text,
+	OUT status text,
+	OUT records bigint,
+	OUT bytes bigint,
+	OUT end_lsn pg_lsn,
+	OUT duration float8,
+	OUT throughput float8,
+	OUT error text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+-- Get statistics about the WAL records of the archives between an origin
+-- and a target, resolved with the same rules as archive_build_segment_list(),
+-- per resource manager or per record type if per_record is true, like
+-- pg_waldump --stats. The segments are spread across up to max_workers
+-- dynamic background workers.
+CREATE FUNCTION archive_wal_stats(
+	IN origin_tli int,
+	IN origin_lsn pg_lsn,
+	IN target_tli int,
+	IN target_lsn pg_lsn,
+	IN history_data text DEFAULT NULL,
+	IN per_record bool DEFAULT false,
+	IN max_workers int DEFAULT 4,
+	OUT "resource_manager/record_type" text,
+	OUT count int8,
+	OUT count_percentage float8,
+	OUT record_size int8,
+	OUT record_size_percentage float8,
+	OUT fpi_size int8,
+	OUT fpi_size_percentage float8,
+	OUT combined_size int8,
+	OUT combined_size_percentage float8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+-- Restore a list of segments from the archives, as generated by
+-- archive_build_segment_list(), into the directory target_dir, with the
+-- history files of their timelines. Compressed files are decompressed.
+-- Files already present in target_dir are skipped, except if overwrite is
+-- true. The files are spread across up to max_workers dynamic background
+-- workers, each file being written under a temporary name and renamed once
+-- flushed to disk. method is the way a file has been copied: "clone",
+-- "copy_file_range", "copy" or "decompress". duration is in milliseconds.
+CREATE FUNCTION archive_restore_segments(
+	IN segments text[],
+	IN target_dir text,
+	IN max_workers int DEFAULT 4,
+	IN overwrite bool DEFAULT false,
+	OUT file text,
+	OUT status text,
+	OUT size bigint,
+	OUT method text,
+	OUT duration float8,
+	OUT error text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+-- Set of routines querying the index of the archives kept in shared
+-- memory, available when the module is loaded with shared_preload_libraries
+-- and wal_utils.index_max_files is set. Sizes are the ones of the files on
+-- disk, compressed or not.
+-- Get the segments of a timeline present in the archives and covering the
+-- range of LSNs given.
+CREATE FUNCTION archive_index_segments(
+	IN timeline int,
+	IN start_lsn pg_lsn,
+	IN end_lsn pg_lsn,
+	OUT segment text,
+	OUT segment_lsn pg_lsn,
+	OUT size bigint,
+	OUT compression text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+-- Get a summary of each timeline present in the archives, history_size
+-- being NULL if its history file is missing.
+CREATE FUNCTION archive_index_timelines(
+	OUT timeline int,
+	OUT history_size bigint,
+	OUT segments bigint,
+	OUT total_size bigint,
+	OUT begin_lsn pg_lsn,
+	OUT end_lsn pg_lsn)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+-- Get the state of the index.
+CREATE FUNCTION archive_index_status(
+	OUT pid int,
+	OUT ready bool,
+	OUT overflow bool,
+	OUT files bigint,
+	OUT max_files int,
+	OUT last_scan timestamptz)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
@@ -14,12 +14,16 @@
 #include "postgres.h"
 #include "fmgr.h"
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include "access/htup_details.h"
 #include "access/timeline.h"
 #include "access/xlog.h"
 #include "access/xlog_internal.h"
 #include "catalog/pg_type.h"
+#include "executor/executor.h"
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "storage/fd.h"
@@ -29,8 +33,12 @@
 #include "utils/tuplestore.h"
 #include "varatt.h"
 
+#include "wal_utils.h"
+
 PG_MODULE_MAGIC;
 
+void		_PG_init(void);
+
 static List *parseTimeLineHistory(char *buffer);
 
 /*
@@ -40,6 +48,20 @@ PG_FUNCTION_INFO_V1(archive_parse_history);
 PG_FUNCTION_INFO_V1(archive_build_segment_list);
 PG_FUNCTION_INFO_V1(archive_get_size);
 PG_FUNCTION_INFO_V1(archive_get_data);
+PG_FUNCTION_INFO_V1(archive_get_data_chunks);
+
+/*
+ * State of archive_get_data_chunks() across calls.
+ */
+typedef struct ArchiveChunkState
+{
+	char	   *filepath;		/* file read */
+	ArchiveFile *file;			/* file opened, NULL if closed */
+	int64		offset;			/* offset of next chunk */
+	int64		end;			/* offset where to stop reading */
+	int32		chunk_size;		/* size of each chunk */
+	ExprContext *econtext;		/* context where cleanup is registered */
+} ArchiveChunkState;
 
 /*
  * parseTimeLineHistory
@@ -208,37 +230,18 @@ archive_parse_history(PG_FUNCTION_ARGS)
 }
 
 /*
- * archive_build_segment_list
- *
- * Taking in input an origin timeline and LSN, as well as a target timeline
- * and LSN, build a list of WAL segments able to allow a standby pointing to
- * the origin timeline to reach the target timeline.
- *
- * Note that the origin and the target timelines need to be direct parents,
- * and user needs to provide in input a buffer corresponding to a history
- * file in text format, on which is performed a set of tests, checking for
- * timeline jumps to build the correct list of segments to join the origin
- * and the target.
+ * archive_segment_list
  *
- * The target timeline needs normally to match the history file name given
- * in input, but this is let up to the user to combine both correctly for
- * flexibility, still this routine checks if the target LSN is newer than
- * the last entry in the history file, as well as it checks if the last
- * timeline entry is higher than the target.
+ * Build the list of WAL segment names able to allow a standby pointing to
+ * the origin timeline and LSN to reach the target timeline and LSN.  See
+ * archive_build_segment_list() for details.
  */
-Datum
-archive_build_segment_list(PG_FUNCTION_ARGS)
+List *
+archive_segment_list(TimeLineID origin_tli, XLogRecPtr origin_lsn,
+					 TimeLineID target_tli, XLogRecPtr target_lsn,
+					 char *history_buf)
 {
-	TimeLineID	origin_tli;
-	XLogRecPtr	origin_lsn;
-	TimeLineID	target_tli;
-	XLogRecPtr	target_lsn;
-	char	   *history_buf;
-	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
-	MemoryContext per_query_ctx;
-	MemoryContext oldcontext;
-	TupleDesc	tupdesc;
-	Tuplestorestate *tupstore;
+	List	   *result = NIL;
 	List	   *entries = NIL;
 	ListCell   *entry;
 	TimeLineHistoryEntry *history;
@@ -246,48 +249,8 @@ archive_build_segment_list(PG_FUNCTION_ARGS)
 	XLogRecPtr	current_seg_lsn;
 	TimeLineID	current_tli;
 	char		xlogfname[MAXFNAMELEN];
-	Datum		values[1];
-	bool		nulls[1];
 	XLogSegNo	logSegNo;
 
-	/* Sanity checks for arguments */
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) ||
-		PG_ARGISNULL(2) || PG_ARGISNULL(3))
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("origin or target data cannot be NULL")));
-
-	origin_tli = PG_GETARG_INT32(0);
-	origin_lsn = PG_GETARG_LSN(1);
-	target_tli = PG_GETARG_INT32(2);
-	target_lsn = PG_GETARG_LSN(3);
-	history_buf = PG_ARGISNULL(4) ? NULL :
-		TextDatumGetCString(PG_GETARG_DATUM(4));
-
-	/* check to see if caller supports us returning a tuplestore */
-	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
-		ereport(ERROR,
-				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-				 errmsg("set-valued function called in context that cannot accept a set")));
-	if (!(rsinfo->allowedModes & SFRM_Materialize))
-		ereport(ERROR,
-				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-				 errmsg("materialize mode required, but it is not "
-						"allowed in this context")));
-
-	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-	oldcontext = MemoryContextSwitchTo(per_query_ctx);
-	tupdesc = CreateTemplateTupleDesc(1);
-
-	TupleDescInitEntry(tupdesc, (AttrNumber) 1, "wal_segs", TEXTOID, -1, 0);
-
-	tupstore = tuplestore_begin_heap(true, false, work_mem);
-	rsinfo->returnMode = SFRM_Materialize;
-	rsinfo->setResult = tupstore;
-	rsinfo->setDesc = tupdesc;
-
-	MemoryContextSwitchTo(oldcontext);
-
 	/* First do sanity checks on target and origin data */
 	if (origin_lsn > target_lsn)
 		ereport(ERROR,
@@ -412,9 +375,7 @@ archive_build_segment_list(PG_FUNCTION_ARGS)
 		{
 			XLByteToPrevSeg(current_seg_lsn, logSegNo, wal_segment_size);
 			XLogFileName(xlogfname, current_tli, logSegNo, wal_segment_size);
-			nulls[0] = false;
-			values[0] = CStringGetTextDatum(xlogfname);
-			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			result = lappend(result, pstrdup(xlogfname));
 
 			/*
 			 * Add equivalent of one segment, and just track the beginning of
@@ -431,9 +392,96 @@ archive_build_segment_list(PG_FUNCTION_ARGS)
 	 */
 	XLByteToPrevSeg(target_lsn, logSegNo, wal_segment_size);
 	XLogFileName(xlogfname, target_tli, logSegNo, wal_segment_size);
-	nulls[0] = false;
-	values[0] = CStringGetTextDatum(xlogfname);
-	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	result = lappend(result, pstrdup(xlogfname));
+
+	return result;
+}
+
+/*
+ * archive_build_segment_list
+ *
+ * Taking in input an origin timeline and LSN, as well as a target timeline
+ * and LSN, build a list of WAL segments able to allow a standby pointing to
+ * the origin timeline to reach the target timeline.
+ *
+ * Note that the origin and the target timelines need to be direct parents,
+ * and user needs to provide in input a buffer corresponding to a history
+ * file in text format, on which is performed a set of tests, checking for
+ * timeline jumps to build the correct list of segments to join the origin
+ * and the target.
+ *
+ * The target timeline needs normally to match the history file name given
+ * in input, but this is let up to the user to combine both correctly for
+ * flexibility, still this routine checks if the target LSN is newer than
+ * the last entry in the history file, as well as it checks if the last
+ * timeline entry is higher than the target.
+ */
+Datum
+archive_build_segment_list(PG_FUNCTION_ARGS)
+{
+	TimeLineID	origin_tli;
+	XLogRecPtr	origin_lsn;
+	TimeLineID	target_tli;
+	XLogRecPtr	target_lsn;
+	char	   *history_buf;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	List	   *segments;
+	ListCell   *lc;
+	Datum		values[1];
+	bool		nulls[1];
+
+	/* Sanity checks for arguments */
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) ||
+		PG_ARGISNULL(2) || PG_ARGISNULL(3))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("origin or target data cannot be NULL")));
+
+	origin_tli = PG_GETARG_INT32(0);
+	origin_lsn = PG_GETARG_LSN(1);
+	target_tli = PG_GETARG_INT32(2);
+	target_lsn = PG_GETARG_LSN(3);
+	history_buf = PG_ARGISNULL(4) ? NULL :
+		TextDatumGetCString(PG_GETARG_DATUM(4));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+	tupdesc = CreateTemplateTupleDesc(1);
+
+	TupleDescInitEntry(tupdesc, (AttrNumber) 1, "wal_segs", TEXTOID, -1, 0);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	segments = archive_segment_list(origin_tli, origin_lsn,
+									target_tli, target_lsn,
+									history_buf);
+
+	foreach(lc, segments)
+	{
+		nulls[0] = false;
+		values[0] = CStringGetTextDatum((char *) lfirst(lc));
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
 
 	return (Datum) 0;
 }
@@ -444,7 +492,7 @@ archive_build_segment_list(PG_FUNCTION_ARGS)
  * a full path name using the path defined for the archives which is
  * enforced by the environment where Postgres is running.
  */
-static char *
+char *
 check_and_build_filepath(char *filename)
 {
 	char	   *filepath;
@@ -482,14 +530,16 @@ check_and_build_filepath(char *filename)
  * Look at a file in the archives whose path is defined by the environment
  * variable PGARCHIVE and get its size. This is useful when combined with
  * archive_get_data to evaluate a set of chunks to be used during any
- * data transfer from the archives.
+ * data transfer from the archives. For a file stored compressed, this is
+ * the size of its data once decompressed.
  */
 Datum
 archive_get_size(PG_FUNCTION_ARGS)
 {
 	char	   *filename = text_to_cstring(PG_GETARG_TEXT_PP(0));
 	char	   *filepath;
-	struct stat fst;
+	ArchiveFile *file;
+	int64		size;
 
 	if (!superuser())
 		ereport(ERROR,
@@ -500,12 +550,11 @@ archive_get_size(PG_FUNCTION_ARGS)
 	pfree(filename);
 
 	/* get needed information about the file */
-	if (stat(filepath, &fst) < 0)
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not stat file \"%s\": %m", filepath)));
+	file = archive_file_open(filepath);
+	size = archive_file_size(file);
+	archive_file_close(file);
 
-	PG_RETURN_INT64((int64) fst.st_size);
+	PG_RETURN_INT64(size);
 }
 
 /*
@@ -513,7 +562,8 @@ archive_get_size(PG_FUNCTION_ARGS)
  *
  * Read a portion of data in an archive folder defined by PGARCHIVE, and
  * return it as bytea. If bytes_to_read is negative or higher than the
- * file's size, read the whole file.
+ * file's size, read the whole file. A file stored compressed is
+ * decompressed on the fly.
  *
  * Even if data is returned in binary format, it is always possible to
  * convert it to text using encode(data, 'escape'), which is recommended
@@ -528,8 +578,8 @@ archive_get_data(PG_FUNCTION_ARGS)
 	int64		seek_offset = 0;
 	int64		bytes_to_read = -1;
 	bytea	   *result;
-	size_t		nbytes;
-	FILE	   *file;
+	size_t		nbytes = 0;
+	ArchiveFile *file;
 
 	if (!superuser())
 		ereport(ERROR,
@@ -547,56 +597,209 @@ archive_get_data(PG_FUNCTION_ARGS)
 	filepath = check_and_build_filepath(filename);
 	pfree(filename);
 
-	/*
-	 * Read the file, the whole file is read if bytes_to_read is negative.
-	 */
-	if (bytes_to_read < 0)
-	{
-		if (seek_offset < 0)
-			bytes_to_read = -seek_offset;
-		else
-		{
-			struct stat fst;
-
-			if (stat(filepath, &fst) < 0)
-				ereport(ERROR,
-						(errcode_for_file_access(),
-						 errmsg("could not stat file \"%s\": %m", filepath)));
-
-			bytes_to_read = fst.st_size - seek_offset;
-		}
-	}
-
 	/* not sure why anyone thought that int64 length was a good idea */
 	if (bytes_to_read > (MaxAllocSize - VARHDRSZ))
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("requested length too large")));
 
-	if ((file = AllocateFile(filepath, PG_BINARY_R)) == NULL)
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not open file \"%s\" for reading: %m",
-						filepath)));
+	file = archive_file_open(filepath);
 
-	if (fseeko(file, (off_t) seek_offset,
-			   (seek_offset >= 0) ? SEEK_SET : SEEK_END) != 0)
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not seek in file \"%s\": %m", filepath)));
+	/* A negative offset is counted from the end of the file */
+	if (seek_offset < 0)
+		seek_offset = Max(archive_file_size(file) + seek_offset, 0);
 
 	result = (bytea *) palloc((Size) bytes_to_read + VARHDRSZ);
 
-	nbytes = fread(VARDATA(result), 1, (size_t) bytes_to_read, file);
-
-	if (ferror(file))
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not read file \"%s\": %m", filepath)));
+	while (nbytes < bytes_to_read)
+	{
+		ssize_t		rc;
+
+		rc = archive_file_pread(file, VARDATA(result) + nbytes,
+								(size_t) bytes_to_read - nbytes,
+								seek_offset + nbytes);
+		if (rc == 0)
+			break;
+		nbytes += rc;
+	}
 
 	SET_VARSIZE(result, nbytes + VARHDRSZ);
 
-	FreeFile(file);
+	archive_file_close(file);
 
 	PG_RETURN_BYTEA_P(result);
 }
+
+/*
+ * Release the resources of archive_get_data_chunks(), either at the end of
+ * the scan or when the query stops early.
+ */
+static void
+archive_chunk_cleanup(Datum arg)
+{
+	ArchiveChunkState *state = (ArchiveChunkState *) DatumGetPointer(arg);
+
+	if (state->file != NULL)
+	{
+		archive_file_close(state->file);
+		state->file = NULL;
+	}
+}
+
+/*
+ * Release the resources of archive_get_data_chunks() at the end of the scan.
+ * The state is freed with the multi-call context of the function, so the
+ * cleanup callback needs to go away as well.
+ */
+static void
+archive_chunk_done(ArchiveChunkState *state)
+{
+	archive_chunk_cleanup(PointerGetDatum(state));
+	if (state->econtext != NULL)
+		UnregisterExprContextCallback(state->econtext,
+									  archive_chunk_cleanup,
+									  PointerGetDatum(state));
+}
+
+/*
+ * archive_get_data_chunks
+ *
+ * Read a portion of data in an archive folder defined by PGARCHIVE, and
+ * return it as a set of (offset, data) rows, each chunk being at most of
+ * chunk_size bytes.  If bytes_to_read is negative, read up to the end of the
+ * file.
+ *
+ * Contrary to archive_get_data, the data is returned one chunk per call, so
+ * as memory usage is bounded by the chunk size when the function is called
+ * in the target list of a query, letting clients pipeline large transfers.
+ * Chunks are read with pread(), files stored compressed being decompressed
+ * on the fly.  The file is not mapped, as reading a mapping of a file
+ * truncated or rewritten in the archives would raise SIGBUS, making the
+ * server restart, while a read only returns less data.
+ */
+Datum
+archive_get_data_chunks(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	ArchiveChunkState *state;
+	int64		nbytes;
+	ssize_t		rc;
+	bytea	   *chunk;
+	Datum		values[2];
+	bool		nulls[2] = {0};
+	HeapTuple	tuple;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc	tupdesc;
+		ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+		char	   *filename = text_to_cstring(PG_GETARG_TEXT_PP(0));
+		int32		chunk_size = PG_GETARG_INT32(1);
+		int64		seek_offset = PG_GETARG_INT64(2);
+		int64		bytes_to_read = PG_GETARG_INT64(3);
+		int64		size;
+		bool		compressed;
+
+		if (!superuser())
+			ereport(ERROR,
+					(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+					 (errmsg("must be superuser to read files"))));
+
+		if (chunk_size <= 0 || chunk_size > MaxAllocSize - VARHDRSZ)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("chunk size must be between 1 and %d",
+							(int) (MaxAllocSize - VARHDRSZ))));
+		if (seek_offset < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("requested offset cannot be negative")));
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		state = (ArchiveChunkState *) palloc0(sizeof(ArchiveChunkState));
+		state->filepath = check_and_build_filepath(filename);
+		state->chunk_size = chunk_size;
+		funcctx->user_fctx = state;
+
+		MemoryContextSwitchTo(oldcontext);
+
+		state->file = archive_file_open(state->filepath);
+		compressed =
+			archive_file_compression(state->file) != ARCHIVE_COMPRESSION_NONE;
+
+		/* Make sure that the file is closed if the scan stops early */
+		if (rsinfo != NULL && IsA(rsinfo, ReturnSetInfo))
+		{
+			state->econtext = rsinfo->econtext;
+			RegisterExprContextCallback(state->econtext,
+										archive_chunk_cleanup,
+										PointerGetDatum(state));
+		}
+
+		size = archive_file_size(state->file);
+		state->offset = Min(seek_offset, size);
+		if (bytes_to_read < 0 || bytes_to_read > size - state->offset)
+			state->end = size;
+		else
+			state->end = state->offset + bytes_to_read;
+
+#if defined(USE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+		if (compressed)
+			(void) posix_fadvise(archive_file_fd(state->file), 0, 0,
+								 POSIX_FADV_SEQUENTIAL);
+		else
+			(void) posix_fadvise(archive_file_fd(state->file),
+								 (off_t) state->offset,
+								 (off_t) (state->end - state->offset),
+								 POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	state = (ArchiveChunkState *) funcctx->user_fctx;
+
+	if (state->offset >= state->end)
+	{
+		archive_chunk_done(state);
+		SRF_RETURN_DONE(funcctx);
+	}
+
+	nbytes = Min(state->end - state->offset, (int64) state->chunk_size);
+	chunk = (bytea *) palloc((Size) nbytes + VARHDRSZ);
+
+	rc = archive_file_pread(state->file, VARDATA(chunk), (size_t) nbytes,
+							state->offset);
+
+	/* File truncated while reading, stop here */
+	if (rc == 0)
+	{
+		archive_chunk_done(state);
+		SRF_RETURN_DONE(funcctx);
+	}
+	nbytes = rc;
+
+	SET_VARSIZE(chunk, nbytes + VARHDRSZ);
+
+	values[0] = Int64GetDatum(state->offset);
+	values[1] = PointerGetDatum(chunk);
+	state->offset += nbytes;
+
+	tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	archive_index_init();
+}
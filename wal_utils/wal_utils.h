@@ -0,0 +1,107 @@
+/*-------------------------------------------------------------------------
+ *
+ * wal_utils.h
+ *		Definitions shared across the files of wal_utils.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  wal_utils/wal_utils.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef WAL_UTILS_H
+#define WAL_UTILS_H
+
+#include "access/xlog_internal.h"
+#include "access/xlogstats.h"
+#include "nodes/pg_list.h"
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "utils/array.h"
+
+/*
+ * Compression methods of the files in the archives, detected from their
+ * suffix.
+ */
+typedef enum ArchiveCompression
+{
+	ARCHIVE_COMPRESSION_NONE,
+	ARCHIVE_COMPRESSION_GZIP,	/* .gz */
+	ARCHIVE_COMPRESSION_ZSTD,	/* .zst */
+	ARCHIVE_COMPRESSION_LZ4,	/* .lz4 */
+} ArchiveCompression;
+
+#define ARCHIVE_COMPRESSION_MAX	ARCHIVE_COMPRESSION_LZ4
+
+/* File of the archives, possibly compressed, opened for reads */
+typedef struct ArchiveFile ArchiveFile;
+
+/* In wal_utils.c */
+extern char *check_and_build_filepath(char *filename);
+extern List *archive_segment_list(TimeLineID origin_tli, XLogRecPtr origin_lsn,
+								  TimeLineID target_tli, XLogRecPtr target_lsn,
+								  char *history_buf);
+
+/* Reads of archived files, in wal_utils_archive.c */
+extern const char *archive_compression_suffix(ArchiveCompression compression);
+extern const char *archive_compression_name(ArchiveCompression compression);
+extern bool archive_file_exists(const char *filepath);
+extern ArchiveFile *archive_file_open(const char *filepath);
+extern const char *archive_file_path(ArchiveFile *file);
+extern ArchiveCompression archive_file_compression(ArchiveFile *file);
+extern int	archive_file_fd(ArchiveFile *file);
+extern int64 archive_file_size(ArchiveFile *file);
+extern ssize_t archive_file_pread(ArchiveFile *file, char *buf, size_t len,
+								  int64 offset);
+extern void archive_file_close(ArchiveFile *file);
+
+/* Index of the archives in shared memory, in wal_utils_index.c */
+extern void archive_index_init(void);
+pg_noreturn extern PGDLLEXPORT void archive_index_main(Datum main_arg);
+
+/*
+ * Scans of archived WAL segments, reading all their records, spread across
+ * dynamic background workers, in wal_utils_scan.c.
+ */
+#define ARCHIVE_SCAN_ERROR_LEN	256
+
+typedef enum ArchiveScanStatus
+{
+	ARCHIVE_SCAN_PENDING,		/* not scanned */
+	ARCHIVE_SCAN_VALID,			/* all the records could be read */
+	ARCHIVE_SCAN_INVALID,		/* failure while reading records */
+	ARCHIVE_SCAN_MISSING,		/* segment not found in the archives */
+} ArchiveScanStatus;
+
+/* Result of the scan of one segment */
+typedef struct ArchiveScanSegment
+{
+	char		name[MAXFNAMELEN];	/* name of the segment */
+	char		next_name[MAXFNAMELEN]; /* segment following it */
+	ArchiveScanStatus status;
+	int64		records;		/* number of records beginning in segment */
+	int64		bytes;			/* total size of these records */
+	XLogRecPtr	end_lsn;		/* end of the last record read */
+	int64		read_bytes;		/* WAL read, including the next segment */
+	double		elapsed;		/* time spent on the segment, in ms */
+	char		error[ARCHIVE_SCAN_ERROR_LEN];	/* error if invalid */
+} ArchiveScanSegment;
+
+extern int	archive_workers_launch(dsm_segment *seg, const char *function_name,
+								   const char *type, int nworkers,
+								   BackgroundWorkerHandle **handles);
+extern void archive_workers_wait(BackgroundWorkerHandle **handles,
+								 int nworkers);
+extern List *archive_scan_segment_list(ArrayType *segments);
+extern ArchiveScanSegment *archive_scan_run(List *segments, int max_workers,
+											XLogRecPtr start_lsn,
+											XLogRecPtr end_lsn,
+											XLogStats *stats);
+pg_noreturn extern PGDLLEXPORT void archive_scan_main(Datum main_arg);
+
+/* Bulk restore of archived files, in wal_utils_restore.c */
+pg_noreturn extern PGDLLEXPORT void archive_restore_main(Datum main_arg);
+
+#endif							/* WAL_UTILS_H */
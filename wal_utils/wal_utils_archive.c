@@ -0,0 +1,971 @@
+/*-------------------------------------------------------------------------
+ *
+ * wal_utils_archive.c
+ *		Reads of files in the archives, possibly compressed.
+ *
+ * A file requested is read as-is if it exists.  Otherwise, a compressed
+ * variant of it is looked for, with the suffix ".gz", ".zst" or ".lz4",
+ * and is decompressed on the fly, giving the illusion that the file is
+ * stored uncompressed.
+ *
+ * Reads of compressed files are efficient when sequential.  Reading at an
+ * offset before the current position of the decompressed stream restarts
+ * decompression from the beginning of the file, except for files in the
+ * zstd seekable format, whose seek table is used to restart from the frame
+ * including the offset requested.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  wal_utils/wal_utils_archive.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "storage/fd.h"
+
+#include "wal_utils.h"
+
+/* Size of the buffers used for compressed data and skipped data */
+#define ARCHIVE_BUFFER_SIZE		(128 * 1024)
+
+/* Footer of the zstd seekable format */
+#define ZSTD_SEEKABLE_MAGIC			0x8F92EAB1
+#define ZSTD_SEEKABLE_FOOTER_SIZE	9
+#define ZSTD_SKIPPABLE_MAGIC		0x184D2A5E
+#define ZSTD_SKIPPABLE_HEADER_SIZE	8
+
+/* Maximum size of a zstd frame header, not in the stable API of zstd.h */
+#define ZSTD_FRAME_HEADER_SIZE_MAX	18
+
+/* Skippable frames of zstd and LZ4 use the magic numbers 0x184D2A5[0-F] */
+#define SKIPPABLE_MAGIC_MASK		0xFFFFFFF0
+#define SKIPPABLE_MAGIC_BASE		0x184D2A50
+
+struct ArchiveFile
+{
+	char	   *path;			/* path of the file opened */
+	ArchiveCompression compression;
+	int			fd;
+	off_t		raw_size;		/* size of the file on disk */
+	int64		size;			/* size of the data, -1 if unknown yet */
+
+	/* Decompression state */
+	char	   *in_buf;			/* compressed data read */
+	size_t		in_len;			/* bytes in in_buf */
+	size_t		in_pos;			/* bytes of in_buf consumed */
+	off_t		in_offset;		/* offset of the next read of the file */
+	char	   *skip_buf;		/* decompressed data skipped */
+	int64		pos;			/* position in the decompressed data */
+	bool		frame_done;		/* at the end of a frame? */
+	bool		eof;			/* end of decompressed data reached? */
+
+#ifdef HAVE_LIBZ
+	z_stream	zs;
+	bool		zs_init;
+#endif
+#ifdef USE_ZSTD
+	ZSTD_DCtx  *zstd_dctx;
+
+	/*
+	 * Seek table of the zstd seekable format, with nframes + 1 entries for
+	 * the offsets where each frame begins, in the file and in the data.
+	 */
+	int			nframes;
+	off_t	   *frame_raw_offsets;
+	int64	   *frame_offsets;
+#endif
+#ifdef USE_LZ4
+	LZ4F_dctx  *lz4_dctx;
+#endif
+};
+
+static const struct
+{
+	const char *suffix;
+	ArchiveCompression compression;
+}			archive_suffixes[] =
+{
+	{".gz", ARCHIVE_COMPRESSION_GZIP},
+	{".zst", ARCHIVE_COMPRESSION_ZSTD},
+	{".lz4", ARCHIVE_COMPRESSION_LZ4},
+};
+
+/*
+ * archive_compression_suffix
+ *
+ * Suffix of the files compressed with the given method, "" if none.
+ */
+const char *
+archive_compression_suffix(ArchiveCompression compression)
+{
+	for (int i = 0; i < lengthof(archive_suffixes); i++)
+	{
+		if (archive_suffixes[i].compression == compression)
+			return archive_suffixes[i].suffix;
+	}
+	return "";
+}
+
+/*
+ * archive_compression_name
+ *
+ * Name of a compression method, as reported to users.
+ */
+const char *
+archive_compression_name(ArchiveCompression compression)
+{
+	switch (compression)
+	{
+		case ARCHIVE_COMPRESSION_NONE:
+			return "none";
+		case ARCHIVE_COMPRESSION_GZIP:
+			return "gzip";
+		case ARCHIVE_COMPRESSION_ZSTD:
+			return "zstd";
+		case ARCHIVE_COMPRESSION_LZ4:
+			return "lz4";
+	}
+	return "unknown";			/* keep compiler quiet */
+}
+
+/*
+ * Read exactly len bytes of a file at offset, failing otherwise.
+ */
+static void
+archive_file_read_raw(ArchiveFile *file, char *buf, size_t len, off_t offset)
+{
+	ssize_t		rc = pg_pread(file->fd, buf, len, offset);
+
+	if (rc < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", file->path)));
+	if (rc != len)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("could not read file \"%s\": read %zd of %zu",
+						file->path, rc, len)));
+}
+
+static uint32
+archive_read_le32(const unsigned char *p)
+{
+	return (uint32) p[0] | ((uint32) p[1] << 8) |
+		((uint32) p[2] << 16) | ((uint32) p[3] << 24);
+}
+
+#ifdef USE_ZSTD
+/*
+ * Load the seek table of a file in the zstd seekable format, if any.  This
+ * is stored in a skippable frame at the end of the file.
+ */
+static void
+archive_zstd_load_seek_table(ArchiveFile *file)
+{
+	unsigned char footer[ZSTD_SEEKABLE_FOOTER_SIZE];
+	unsigned char header[ZSTD_SKIPPABLE_HEADER_SIZE];
+	unsigned char *table;
+	uint32		nframes;
+	int			entry_size;
+	off_t		table_size;
+	off_t		raw_offset = 0;
+	int64		offset = 0;
+
+	if (file->raw_size < ZSTD_SKIPPABLE_HEADER_SIZE + ZSTD_SEEKABLE_FOOTER_SIZE)
+		return;
+
+	archive_file_read_raw(file, (char *) footer, ZSTD_SEEKABLE_FOOTER_SIZE,
+						  file->raw_size - ZSTD_SEEKABLE_FOOTER_SIZE);
+	if (archive_read_le32(footer + 5) != ZSTD_SEEKABLE_MAGIC)
+		return;
+
+	nframes = archive_read_le32(footer);
+	entry_size = (footer[4] & 0x80) ? 12 : 8;	/* with checksums? */
+	table_size = (off_t) nframes * entry_size + ZSTD_SEEKABLE_FOOTER_SIZE;
+	if (table_size + ZSTD_SKIPPABLE_HEADER_SIZE > file->raw_size)
+		return;
+
+	archive_file_read_raw(file, (char *) header, ZSTD_SKIPPABLE_HEADER_SIZE,
+						  file->raw_size - table_size - ZSTD_SKIPPABLE_HEADER_SIZE);
+	if (archive_read_le32(header) != ZSTD_SKIPPABLE_MAGIC ||
+		archive_read_le32(header + 4) != table_size)
+		return;
+
+	table = palloc(table_size);
+	archive_file_read_raw(file, (char *) table, table_size,
+						  file->raw_size - table_size);
+
+	file->frame_raw_offsets = palloc((nframes + 1) * sizeof(off_t));
+	file->frame_offsets = palloc((nframes + 1) * sizeof(int64));
+	for (uint32 i = 0; i < nframes; i++)
+	{
+		file->frame_raw_offsets[i] = raw_offset;
+		file->frame_offsets[i] = offset;
+		raw_offset += archive_read_le32(table + i * entry_size);
+		offset += archive_read_le32(table + i * entry_size + 4);
+	}
+	file->frame_raw_offsets[nframes] = raw_offset;
+	file->frame_offsets[nframes] = offset;
+	pfree(table);
+
+	/* Ignore a seek table not matching the file */
+	if (raw_offset != file->raw_size - table_size - ZSTD_SKIPPABLE_HEADER_SIZE)
+	{
+		pfree(file->frame_raw_offsets);
+		pfree(file->frame_offsets);
+		file->frame_raw_offsets = NULL;
+		file->frame_offsets = NULL;
+		return;
+	}
+
+	file->nframes = nframes;
+}
+
+/*
+ * Find the frame including the given offset of the data, using the seek
+ * table.  Returns -1 if there is no seek table.
+ */
+static int
+archive_zstd_find_frame(ArchiveFile *file, int64 offset)
+{
+	int			low = 0;
+	int			high;
+
+	if (file->nframes == 0)
+		return -1;
+
+	/* Find the last frame beginning at or before the offset */
+	high = file->nframes - 1;
+	while (low < high)
+	{
+		int			mid = (low + high + 1) / 2;
+
+		if (file->frame_offsets[mid] <= offset)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return low;
+}
+
+/*
+ * Size of the data of a zstd file, as the sum of the content sizes stored
+ * in the headers of its frames.  The blocks of each frame are walked to
+ * find where the next frame begins.  Returns -1 if a frame has no content
+ * size, or if the file is not made only of complete frames.
+ */
+static int64
+archive_zstd_content_size(ArchiveFile *file)
+{
+	static const int did_sizes[4] = {0, 1, 2, 4};
+	static const int fcs_sizes[4] = {0, 2, 4, 8};
+	off_t		offset = 0;
+	int64		size = 0;
+
+	while (offset < file->raw_size)
+	{
+		unsigned char header[ZSTD_FRAME_HEADER_SIZE_MAX];
+		size_t		len = Min(file->raw_size - offset, ZSTD_FRAME_HEADER_SIZE_MAX);
+		unsigned long long content_size;
+		unsigned char descriptor;
+		bool		last = false;
+
+		if (len < ZSTD_SKIPPABLE_HEADER_SIZE)
+			return -1;
+		archive_file_read_raw(file, (char *) header, len, offset);
+
+		if ((archive_read_le32(header) & SKIPPABLE_MAGIC_MASK) ==
+			SKIPPABLE_MAGIC_BASE)
+		{
+			offset += ZSTD_SKIPPABLE_HEADER_SIZE + archive_read_le32(header + 4);
+			continue;
+		}
+
+		content_size = ZSTD_getFrameContentSize(header, len);
+		if (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+			content_size == ZSTD_CONTENTSIZE_ERROR)
+			return -1;
+		size += (int64) content_size;
+
+		/*
+		 * The frame header is made of the magic number, the descriptor, the
+		 * window size unless in single segment mode, the dictionary ID and
+		 * the content size, whose fields sizes are given by the descriptor.
+		 */
+		descriptor = header[4];
+		offset += 5 + ((descriptor & 0x20) ? 0 : 1) +
+			did_sizes[descriptor & 0x03] +
+			((descriptor >> 6) == 0 && (descriptor & 0x20) ? 1 :
+			 fcs_sizes[descriptor >> 6]);
+
+		/* Each block has a header of 3 bytes, RLE blocks storing 1 byte */
+		while (!last)
+		{
+			unsigned char block_header[3];
+			uint32		block;
+
+			if (offset + 3 > file->raw_size)
+				return -1;
+			archive_file_read_raw(file, (char *) block_header, 3, offset);
+			block = (uint32) block_header[0] | ((uint32) block_header[1] << 8) |
+				((uint32) block_header[2] << 16);
+			last = (block & 0x01) != 0;
+			if (((block >> 1) & 0x03) == 3)
+				return -1;
+			offset += 3 + (((block >> 1) & 0x03) == 1 ? 1 : block >> 3);
+		}
+
+		/* Content checksum */
+		if ((descriptor & 0x04) != 0)
+			offset += 4;
+	}
+
+	return offset == file->raw_size ? size : -1;
+}
+#endif							/* USE_ZSTD */
+
+#ifdef USE_LZ4
+/*
+ * Size of the data of an LZ4 file, as the sum of the content sizes stored
+ * in the headers of its frames.  The blocks of each frame are walked to
+ * find where the next frame begins.  Returns -1 if a frame has no content
+ * size, or if the file is not made only of complete frames.
+ */
+static int64
+archive_lz4_content_size(ArchiveFile *file)
+{
+	LZ4F_dctx  *dctx;
+	off_t		offset = 0;
+	int64		size = 0;
+
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+		return -1;
+
+	while (size >= 0 && offset < file->raw_size)
+	{
+		char		header[LZ4F_HEADER_SIZE_MAX];
+		size_t		len = Min(file->raw_size - offset, LZ4F_HEADER_SIZE_MAX);
+		LZ4F_frameInfo_t info;
+
+		if (len < 8)
+		{
+			size = -1;
+			break;
+		}
+		archive_file_read_raw(file, header, len, offset);
+
+		if ((archive_read_le32((unsigned char *) header) & SKIPPABLE_MAGIC_MASK) ==
+			SKIPPABLE_MAGIC_BASE)
+		{
+			offset += 8 + archive_read_le32((unsigned char *) header + 4);
+			continue;
+		}
+
+		/* The length of the frame header is returned in len */
+		LZ4F_resetDecompressionContext(dctx);
+		if (LZ4F_isError(LZ4F_getFrameInfo(dctx, &info, header, &len)) ||
+			info.contentSize == 0)
+		{
+			size = -1;
+			break;
+		}
+		size += (int64) info.contentSize;
+		offset += len;
+
+		/*
+		 * Each block has a 4-byte size, followed by its data and its
+		 * checksum if enabled, until a size of zero ending the frame.
+		 */
+		for (;;)
+		{
+			unsigned char block_header[4];
+			uint32		block_size;
+
+			if (offset + 4 > file->raw_size)
+			{
+				size = -1;
+				break;
+			}
+			archive_file_read_raw(file, (char *) block_header, 4, offset);
+			block_size = archive_read_le32(block_header) & 0x7FFFFFFF;
+			offset += 4;
+			if (block_size == 0)
+				break;
+			offset += block_size + (info.blockChecksumFlag ? 4 : 0);
+		}
+
+		/* Content checksum */
+		if (info.contentChecksumFlag)
+			offset += 4;
+	}
+
+	LZ4F_freeDecompressionContext(dctx);
+
+	return offset == file->raw_size ? size : -1;
+}
+#endif							/* USE_LZ4 */
+
+/*
+ * Reset the decompression state to the beginning of the file.
+ */
+static void
+archive_file_reset(ArchiveFile *file)
+{
+	file->in_len = 0;
+	file->in_pos = 0;
+	file->in_offset = 0;
+	file->pos = 0;
+	file->frame_done = false;
+	file->eof = false;
+
+	switch (file->compression)
+	{
+		case ARCHIVE_COMPRESSION_NONE:
+			break;
+		case ARCHIVE_COMPRESSION_GZIP:
+#ifdef HAVE_LIBZ
+			if (file->zs_init)
+				inflateEnd(&file->zs);
+			file->zs_init = false;
+			memset(&file->zs, 0, sizeof(z_stream));
+			/* Detect gzip or zlib headers */
+			if (inflateInit2(&file->zs, 15 + 32) != Z_OK)
+				ereport(ERROR,
+						(errcode(ERRCODE_OUT_OF_MEMORY),
+						 errmsg("could not initialize decompression of file \"%s\"",
+								file->path)));
+			file->zs_init = true;
+#endif
+			break;
+		case ARCHIVE_COMPRESSION_ZSTD:
+#ifdef USE_ZSTD
+			if (file->zstd_dctx == NULL)
+			{
+				file->zstd_dctx = ZSTD_createDCtx();
+				if (file->zstd_dctx == NULL)
+					ereport(ERROR,
+							(errcode(ERRCODE_OUT_OF_MEMORY),
+							 errmsg("could not initialize decompression of file \"%s\"",
+									file->path)));
+			}
+			else
+				ZSTD_DCtx_reset(file->zstd_dctx, ZSTD_reset_session_only);
+#endif
+			break;
+		case ARCHIVE_COMPRESSION_LZ4:
+#ifdef USE_LZ4
+			if (file->lz4_dctx == NULL)
+			{
+				if (LZ4F_isError(LZ4F_createDecompressionContext(&file->lz4_dctx,
+																 LZ4F_VERSION)))
+					ereport(ERROR,
+							(errcode(ERRCODE_OUT_OF_MEMORY),
+							 errmsg("could not initialize decompression of file \"%s\"",
+									file->path)));
+			}
+			else
+				LZ4F_resetDecompressionContext(file->lz4_dctx);
+#endif
+			break;
+	}
+}
+
+/*
+ * Move the decompression state to the given offset of the data, or before
+ * it.  With a zstd seek table, decompression restarts at the frame including
+ * the offset, and from the beginning of the file otherwise.
+ */
+static void
+archive_file_seek(ArchiveFile *file, int64 offset)
+{
+	archive_file_reset(file);
+
+#ifdef USE_ZSTD
+	if (file->compression == ARCHIVE_COMPRESSION_ZSTD)
+	{
+		int			frame = archive_zstd_find_frame(file, offset);
+
+		if (frame >= 0)
+		{
+			file->in_offset = file->frame_raw_offsets[frame];
+			file->pos = file->frame_offsets[frame];
+		}
+	}
+#endif
+}
+
+/*
+ * Make sure that some compressed data is available in the input buffer.
+ * Returns false at the end of the file.
+ */
+static bool
+archive_file_fill(ArchiveFile *file)
+{
+	ssize_t		rc;
+
+	if (file->in_pos < file->in_len)
+		return true;
+
+	rc = pg_pread(file->fd, file->in_buf, ARCHIVE_BUFFER_SIZE,
+				  file->in_offset);
+	if (rc < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", file->path)));
+
+	file->in_len = rc;
+	file->in_pos = 0;
+	file->in_offset += rc;
+
+	return rc > 0;
+}
+
+/*
+ * Decompress up to len bytes of data at the current position.  Returns the
+ * number of bytes decompressed, less than len only at the end of the data.
+ */
+static size_t
+archive_file_decompress(ArchiveFile *file, char *buf, size_t len)
+{
+	size_t		produced = 0;
+
+	while (produced < len && !file->eof)
+	{
+		bool		input_end = !archive_file_fill(file);
+		size_t		before = produced;
+
+		switch (file->compression)
+		{
+			case ARCHIVE_COMPRESSION_NONE:
+				Assert(false);
+				break;
+			case ARCHIVE_COMPRESSION_GZIP:
+#ifdef HAVE_LIBZ
+				{
+					int			ret;
+					size_t		avail_in = file->in_len - file->in_pos;
+
+					file->zs.next_in = (Bytef *) file->in_buf + file->in_pos;
+					file->zs.avail_in = avail_in;
+					file->zs.next_out = (Bytef *) buf + produced;
+					file->zs.avail_out = len - produced;
+
+					ret = inflate(&file->zs, Z_NO_FLUSH);
+					if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+						ereport(ERROR,
+								(errcode(ERRCODE_DATA_CORRUPTED),
+								 errmsg("could not decompress file \"%s\": %s",
+										file->path,
+										file->zs.msg ? file->zs.msg : "unknown error")));
+
+					file->in_pos += avail_in - file->zs.avail_in;
+					produced = len - file->zs.avail_out;
+
+					/* Members of a gzip file can be concatenated */
+					if (ret == Z_STREAM_END)
+					{
+						file->frame_done = true;
+						inflateReset(&file->zs);
+					}
+					else if (avail_in != file->zs.avail_in)
+						file->frame_done = false;
+				}
+#endif
+				break;
+			case ARCHIVE_COMPRESSION_ZSTD:
+#ifdef USE_ZSTD
+				{
+					ZSTD_inBuffer in = {file->in_buf, file->in_len, file->in_pos};
+					ZSTD_outBuffer out = {buf, len, produced};
+					size_t		ret;
+
+					ret = ZSTD_decompressStream(file->zstd_dctx, &out, &in);
+					if (ZSTD_isError(ret))
+						ereport(ERROR,
+								(errcode(ERRCODE_DATA_CORRUPTED),
+								 errmsg("could not decompress file \"%s\": %s",
+										file->path, ZSTD_getErrorName(ret))));
+
+					file->in_pos = in.pos;
+					produced = out.pos;
+					file->frame_done = (ret == 0);
+				}
+#endif
+				break;
+			case ARCHIVE_COMPRESSION_LZ4:
+#ifdef USE_LZ4
+				{
+					size_t		dst_size = len - produced;
+					size_t		src_size = file->in_len - file->in_pos;
+					size_t		ret;
+
+					ret = LZ4F_decompress(file->lz4_dctx, buf + produced,
+										  &dst_size,
+										  file->in_buf + file->in_pos,
+										  &src_size, NULL);
+					if (LZ4F_isError(ret))
+						ereport(ERROR,
+								(errcode(ERRCODE_DATA_CORRUPTED),
+								 errmsg("could not decompress file \"%s\": %s",
+										file->path, LZ4F_getErrorName(ret))));
+
+					file->in_pos += src_size;
+					produced += dst_size;
+					file->frame_done = (ret == 0);
+				}
+#endif
+				break;
+		}
+
+		/* All the input is consumed, and nothing more is produced */
+		if (input_end && produced == before)
+		{
+			if (!file->frame_done)
+				ereport(ERROR,
+						(errcode(ERRCODE_DATA_CORRUPTED),
+						 errmsg("could not decompress file \"%s\": unexpected end of file",
+								file->path)));
+			file->eof = true;
+		}
+	}
+
+	file->pos += produced;
+	return produced;
+}
+
+/*
+ * archive_file_exists
+ *
+ * Check if a file of the archives exists, uncompressed or compressed.
+ */
+bool
+archive_file_exists(const char *filepath)
+{
+	struct stat fst;
+
+	if (stat(filepath, &fst) == 0)
+		return true;
+
+	for (int i = 0; i < lengthof(archive_suffixes); i++)
+	{
+		char		path[MAXPGPATH];
+
+		snprintf(path, MAXPGPATH, "%s%s", filepath, archive_suffixes[i].suffix);
+		if (stat(path, &fst) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * archive_file_open
+ *
+ * Open a file of the archives for reads.  If the file does not exist, its
+ * compressed variants are looked for.
+ */
+ArchiveFile *
+archive_file_open(const char *filepath)
+{
+	ArchiveFile *file;
+	struct stat fst;
+
+	file = (ArchiveFile *) palloc0(sizeof(ArchiveFile));
+	file->path = pstrdup(filepath);
+	file->compression = ARCHIVE_COMPRESSION_NONE;
+	file->fd = -1;
+	file->size = -1;
+
+	if (stat(filepath, &fst) < 0)
+	{
+		bool		found = false;
+
+		if (errno != ENOENT)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not stat file \"%s\": %m", filepath)));
+
+		for (int i = 0; i < lengthof(archive_suffixes); i++)
+		{
+			char	   *path = psprintf("%s%s", filepath,
+										archive_suffixes[i].suffix);
+
+			if (stat(path, &fst) == 0)
+			{
+				pfree(file->path);
+				file->path = path;
+				file->compression = archive_suffixes[i].compression;
+				found = true;
+				break;
+			}
+			if (errno != ENOENT)
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not stat file \"%s\": %m", path)));
+			pfree(path);
+		}
+
+		if (!found)
+		{
+			errno = ENOENT;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not stat file \"%s\": %m", filepath)));
+		}
+	}
+
+	switch (file->compression)
+	{
+		case ARCHIVE_COMPRESSION_NONE:
+			break;
+		case ARCHIVE_COMPRESSION_GZIP:
+#ifndef HAVE_LIBZ
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("could not read file \"%s\": compression method %s not supported by this build",
+							file->path, "gzip")));
+#endif
+			break;
+		case ARCHIVE_COMPRESSION_ZSTD:
+#ifndef USE_ZSTD
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("could not read file \"%s\": compression method %s not supported by this build",
+							file->path, "zstd")));
+#endif
+			break;
+		case ARCHIVE_COMPRESSION_LZ4:
+#ifndef USE_LZ4
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("could not read file \"%s\": compression method %s not supported by this build",
+							file->path, "lz4")));
+#endif
+			break;
+	}
+
+	file->fd = OpenTransientFile(file->path, O_RDONLY | PG_BINARY);
+	if (file->fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for reading: %m",
+						file->path)));
+	file->raw_size = fst.st_size;
+
+	if (file->compression == ARCHIVE_COMPRESSION_NONE)
+	{
+		file->size = fst.st_size;
+		return file;
+	}
+
+	file->in_buf = palloc(ARCHIVE_BUFFER_SIZE);
+	archive_file_reset(file);
+
+#ifdef USE_ZSTD
+	if (file->compression == ARCHIVE_COMPRESSION_ZSTD)
+		archive_zstd_load_seek_table(file);
+#endif
+
+	return file;
+}
+
+/*
+ * archive_file_path
+ *
+ * Path of the file opened, including its compression suffix.
+ */
+const char *
+archive_file_path(ArchiveFile *file)
+{
+	return file->path;
+}
+
+/*
+ * archive_file_compression
+ *
+ * Compression method of the file opened.
+ */
+ArchiveCompression
+archive_file_compression(ArchiveFile *file)
+{
+	return file->compression;
+}
+
+/*
+ * archive_file_fd
+ *
+ * File descriptor of the file opened, whose data is compressed if the file
+ * is compressed.
+ */
+int
+archive_file_fd(ArchiveFile *file)
+{
+	return file->fd;
+}
+
+/*
+ * archive_file_size
+ *
+ * Size of the data of a file, decompressed.  This is retrieved from the
+ * metadata of the compressed file where possible: the seek table for the
+ * zstd seekable format, or the frame headers for zstd and LZ4 if all the
+ * frames of the file store their content size.  The whole file is
+ * decompressed otherwise, as well as for gzip, whose trailer only has the
+ * size of the last member, modulo 4GB.
+ */
+int64
+archive_file_size(ArchiveFile *file)
+{
+	int64		size = -1;
+
+	if (file->size >= 0)
+		return file->size;
+
+	switch (file->compression)
+	{
+		case ARCHIVE_COMPRESSION_NONE:
+			Assert(false);
+			break;
+		case ARCHIVE_COMPRESSION_GZIP:
+			break;
+		case ARCHIVE_COMPRESSION_ZSTD:
+#ifdef USE_ZSTD
+			if (file->nframes > 0)
+				size = file->frame_offsets[file->nframes];
+			else
+				size = archive_zstd_content_size(file);
+#endif
+			break;
+		case ARCHIVE_COMPRESSION_LZ4:
+#ifdef USE_LZ4
+			size = archive_lz4_content_size(file);
+#endif
+			break;
+	}
+
+	/* No metadata, so decompress the whole file */
+	if (size < 0)
+	{
+		if (file->skip_buf == NULL)
+			file->skip_buf = palloc(ARCHIVE_BUFFER_SIZE);
+
+		archive_file_reset(file);
+		while (archive_file_decompress(file, file->skip_buf,
+									   ARCHIVE_BUFFER_SIZE) > 0)
+			;
+		size = file->pos;
+		archive_file_reset(file);
+	}
+
+	file->size = size;
+	return size;
+}
+
+/*
+ * archive_file_pread
+ *
+ * Read up to len bytes of the data of a file at the given offset.  Returns
+ * the number of bytes read, 0 at the end of the data.
+ */
+ssize_t
+archive_file_pread(ArchiveFile *file, char *buf, size_t len, int64 offset)
+{
+	bool		seek = false;
+
+	if (file->compression == ARCHIVE_COMPRESSION_NONE)
+	{
+		ssize_t		rc = pg_pread(file->fd, buf, len, (off_t) offset);
+
+		if (rc < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m", file->path)));
+		return rc;
+	}
+
+	/* Going backwards, decompression needs to restart */
+	if (offset < file->pos)
+		seek = true;
+
+#ifdef USE_ZSTD
+	/* Jump forward with the seek table rather than decompressing */
+	if (file->compression == ARCHIVE_COMPRESSION_ZSTD)
+	{
+		int			frame = archive_zstd_find_frame(file, offset);
+
+		if (frame >= 0 && file->frame_offsets[frame] > file->pos)
+			seek = true;
+	}
+#endif
+
+	if (seek)
+		archive_file_seek(file, offset);
+
+	/* Skip the data up to the offset requested */
+	while (file->pos < offset && !file->eof)
+	{
+		if (file->skip_buf == NULL)
+			file->skip_buf = palloc(ARCHIVE_BUFFER_SIZE);
+
+		archive_file_decompress(file, file->skip_buf,
+								Min(offset - file->pos, ARCHIVE_BUFFER_SIZE));
+	}
+
+	if (file->pos < offset)
+		return 0;
+
+	return archive_file_decompress(file, buf, len);
+}
+
+/*
+ * archive_file_close
+ *
+ * Close a file, and release its decompression state.
+ */
+void
+archive_file_close(ArchiveFile *file)
+{
+#ifdef HAVE_LIBZ
+	if (file->zs_init)
+		inflateEnd(&file->zs);
+#endif
+#ifdef USE_ZSTD
+	if (file->zstd_dctx != NULL)
+		ZSTD_freeDCtx(file->zstd_dctx);
+	if (file->frame_raw_offsets != NULL)
+		pfree(file->frame_raw_offsets);
+	if (file->frame_offsets != NULL)
+		pfree(file->frame_offsets);
+#endif
+#ifdef USE_LZ4
+	if (file->lz4_dctx != NULL)
+		LZ4F_freeDecompressionContext(file->lz4_dctx);
+#endif
+
+	if (file->fd >= 0)
+		CloseTransientFile(file->fd);
+	if (file->in_buf != NULL)
+		pfree(file->in_buf);
+	if (file->skip_buf != NULL)
+		pfree(file->skip_buf);
+	pfree(file->path);
+	pfree(file);
+}
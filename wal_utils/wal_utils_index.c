@@ -0,0 +1,938 @@
+/*-------------------------------------------------------------------------
+ *
+ * wal_utils_index.c
+ *		Index of the files in the archives, kept in shared memory.
+ *
+ * A background worker scans the archive directory defined by PGARCHIVE
+ * and registers in a shared hash table the WAL segments and history files
+ * present, with their size and compression method.  The index is kept up
+ * to date with inotify where available, and with full scans done at a
+ * fixed interval, so as SQL functions can answer questions about the
+ * contents of the archives without looking at the filesystem.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  wal_utils/wal_utils_index.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#define HAVE_ARCHIVE_INOTIFY 1
+#endif
+
+#include "access/htup_details.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "common/int.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/pg_lsn.h"
+#include "utils/timestamp.h"
+#include "utils/wait_event.h"
+
+#include "wal_utils.h"
+
+/* Segment number used in the keys of history files */
+#define ARCHIVE_INDEX_HISTORY	PG_UINT64_MAX
+
+/* Size of the buffer used to read inotify events */
+#define ARCHIVE_INDEX_EVENT_BUFFER	8192
+
+/*
+ * Key of the index, one per segment or history file.  Compressed variants
+ * of the same file share the same key, the file that archive_file_open()
+ * would read being the one registered.  The key is hashed as a blob, so
+ * it needs to be zeroed before being filled to clean up its padding.
+ */
+typedef struct ArchiveIndexKey
+{
+	TimeLineID	tli;
+	XLogSegNo	segno;			/* ARCHIVE_INDEX_HISTORY for history file */
+} ArchiveIndexKey;
+
+typedef struct ArchiveIndexEntry
+{
+	ArchiveIndexKey key;		/* hash key, must be first */
+	int64		size;			/* size of the file on disk */
+	ArchiveCompression compression;
+	uint32		generation;		/* last scan or event seeing the file */
+} ArchiveIndexEntry;
+
+typedef struct ArchiveIndexShared
+{
+	LWLock	   *lock;			/* protects all the fields and the hash */
+	pid_t		pid;			/* PID of the worker, 0 if not running */
+	bool		ready;			/* first full scan done? */
+	bool		overflow;		/* some files could not be indexed? */
+	uint32		generation;		/* current full scan */
+	TimestampTz last_scan;		/* end time of the last full scan */
+} ArchiveIndexShared;
+
+/* GUC parameters */
+static int	archive_index_max_files = 0;
+static int	archive_index_rescan_interval = 300;
+
+/* Shared state */
+static ArchiveIndexShared *archive_index = NULL;
+static HTAB *archive_index_hash = NULL;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* Directory of the archives, in the worker */
+static char *archive_index_path = NULL;
+
+PG_FUNCTION_INFO_V1(archive_index_segments);
+PG_FUNCTION_INFO_V1(archive_index_timelines);
+PG_FUNCTION_INFO_V1(archive_index_status);
+
+/*
+ * Size of the shared memory state.
+ */
+static Size
+archive_index_shmem_size(void)
+{
+	return add_size(MAXALIGN(sizeof(ArchiveIndexShared)),
+					hash_estimate_size(archive_index_max_files,
+									   sizeof(ArchiveIndexEntry)));
+}
+
+/*
+ * Request shared memory space for the index.
+ */
+static void
+archive_index_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(archive_index_shmem_size());
+	RequestNamedLWLockTranche("wal_utils", 1);
+}
+
+/*
+ * Initialize the shared state of the index, or attach to it.
+ */
+static void
+archive_index_shmem_startup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	archive_index = ShmemInitStruct("wal_utils archive index",
+									sizeof(ArchiveIndexShared),
+									&found);
+	if (!found)
+	{
+		archive_index->lock = &(GetNamedLWLockTranche("wal_utils"))->lock;
+		archive_index->pid = 0;
+		archive_index->ready = false;
+		archive_index->overflow = false;
+		archive_index->generation = 0;
+		archive_index->last_scan = 0;
+	}
+
+	info.keysize = sizeof(ArchiveIndexKey);
+	info.entrysize = sizeof(ArchiveIndexEntry);
+	archive_index_hash = ShmemInitHash("wal_utils archive index hash",
+									   archive_index_max_files,
+									   archive_index_max_files,
+									   &info,
+									   HASH_ELEM | HASH_BLOBS);
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Parse the name of a file of the archives, filling in the key of the
+ * index it maps to.  Returns false if the file is not a segment or a
+ * history file, possibly compressed.
+ */
+static bool
+archive_index_parse_name(const char *name, ArchiveIndexKey *key)
+{
+	char		base[MAXFNAMELEN];
+	size_t		len = strlen(name);
+
+	memset(key, 0, sizeof(ArchiveIndexKey));
+
+	for (int i = ARCHIVE_COMPRESSION_NONE + 1; i <= ARCHIVE_COMPRESSION_MAX; i++)
+	{
+		const char *suffix = archive_compression_suffix((ArchiveCompression) i);
+		size_t		suffix_len = strlen(suffix);
+
+		if (len > suffix_len && strcmp(name + len - suffix_len, suffix) == 0)
+		{
+			len -= suffix_len;
+			break;
+		}
+	}
+
+	if (len >= MAXFNAMELEN)
+		return false;
+	memcpy(base, name, len);
+	base[len] = '\0';
+
+	if (IsXLogFileName(base))
+	{
+		XLogFromFileName(base, &key->tli, &key->segno, wal_segment_size);
+		return true;
+	}
+	if (IsTLHistoryFileName(base))
+	{
+		sscanf(base, "%08X.history", &key->tli);
+		key->segno = ARCHIVE_INDEX_HISTORY;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Refresh the entry of the index for a key, looking at the files present
+ * in the archives for it.  The file read is the first one found among the
+ * uncompressed file and its compressed variants, like archive_file_open().
+ */
+static void
+archive_index_refresh(const ArchiveIndexKey *key)
+{
+	char		base[MAXFNAMELEN];
+	char		path[MAXPGPATH];
+	struct stat fst;
+	int			compression;
+	bool		found = false;
+	ArchiveIndexEntry *entry;
+
+	if (key->segno == ARCHIVE_INDEX_HISTORY)
+		TLHistoryFileName(base, key->tli);
+	else
+		XLogFileName(base, key->tli, key->segno, wal_segment_size);
+
+	for (compression = ARCHIVE_COMPRESSION_NONE;
+		 compression <= ARCHIVE_COMPRESSION_MAX;
+		 compression++)
+	{
+		snprintf(path, MAXPGPATH, "%s/%s%s", archive_index_path, base,
+				 archive_compression_suffix((ArchiveCompression) compression));
+
+		if (stat(path, &fst) < 0)
+		{
+			if (errno != ENOENT)
+				ereport(LOG,
+						(errcode_for_file_access(),
+						 errmsg("could not stat file \"%s\": %m", path)));
+			continue;
+		}
+
+		if (S_ISREG(fst.st_mode))
+		{
+			found = true;
+			break;
+		}
+	}
+
+	LWLockAcquire(archive_index->lock, LW_EXCLUSIVE);
+
+	if (!found)
+	{
+		hash_search(archive_index_hash, key, HASH_REMOVE, NULL);
+		LWLockRelease(archive_index->lock);
+		return;
+	}
+
+	entry = (ArchiveIndexEntry *) hash_search(archive_index_hash, key,
+											  HASH_FIND, NULL);
+	if (entry == NULL &&
+		hash_get_num_entries(archive_index_hash) < archive_index_max_files)
+		entry = (ArchiveIndexEntry *) hash_search(archive_index_hash, key,
+												  HASH_ENTER_NULL, NULL);
+
+	if (entry == NULL)
+	{
+		if (!archive_index->overflow)
+			ereport(LOG,
+					(errmsg("archive index is full, some files are not indexed"),
+					 errhint("Consider increasing \"%s\".",
+							 "wal_utils.index_max_files")));
+		archive_index->overflow = true;
+	}
+	else
+	{
+		entry->size = (int64) fst.st_size;
+		entry->compression = (ArchiveCompression) compression;
+		entry->generation = archive_index->generation;
+	}
+
+	LWLockRelease(archive_index->lock);
+}
+
+/*
+ * Scan the whole archive directory, registering all the files found and
+ * removing from the index the ones that have gone away.  Returns true if
+ * another scan is needed to index files that did not fit.
+ */
+static bool
+archive_index_scan(void)
+{
+	DIR		   *dir;
+	struct dirent *de;
+	HASH_SEQ_STATUS status;
+	ArchiveIndexEntry *entry;
+	uint32		generation;
+	long		removed = 0;
+	bool		overflow;
+
+	dir = AllocateDir(archive_index_path);
+	if (dir == NULL)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not open directory \"%s\": %m",
+						archive_index_path)));
+		return false;
+	}
+
+	LWLockAcquire(archive_index->lock, LW_EXCLUSIVE);
+	generation = ++archive_index->generation;
+	archive_index->overflow = false;
+	LWLockRelease(archive_index->lock);
+
+	while ((de = ReadDirExtended(dir, archive_index_path, LOG)) != NULL)
+	{
+		ArchiveIndexKey key;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (archive_index_parse_name(de->d_name, &key))
+			archive_index_refresh(&key);
+	}
+	FreeDir(dir);
+
+	/* Remove the files not seen */
+	LWLockAcquire(archive_index->lock, LW_EXCLUSIVE);
+	hash_seq_init(&status, archive_index_hash);
+	while ((entry = (ArchiveIndexEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (entry->generation != generation)
+		{
+			hash_search(archive_index_hash, &entry->key, HASH_REMOVE, NULL);
+			removed++;
+		}
+	}
+	overflow = archive_index->overflow;
+	archive_index->ready = true;
+	archive_index->last_scan = GetCurrentTimestamp();
+	LWLockRelease(archive_index->lock);
+
+	elog(DEBUG1, "archive index scan done, %ld files removed", removed);
+
+	/* Files removed may have freed space for the ones not indexed */
+	return overflow && removed > 0;
+}
+
+#ifdef HAVE_ARCHIVE_INOTIFY
+/*
+ * Set up a watch on the archive directory, returning the inotify file
+ * descriptor, or -1 on failure.
+ */
+static int
+archive_index_watch(void)
+{
+	int			fd;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+	{
+		ereport(LOG,
+				(errmsg("could not initialize inotify: %m")));
+		return -1;
+	}
+
+	if (inotify_add_watch(fd, archive_index_path,
+						  IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO |
+						  IN_MOVED_FROM | IN_DELETE |
+						  IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+	{
+		ereport(LOG,
+				(errmsg("could not watch directory \"%s\": %m",
+						archive_index_path)));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Process the inotify events available, refreshing the index for each
+ * file created or removed.  Returns true if a full scan is needed, the
+ * events having been lost or the watch having gone away.  In the latter
+ * case, *fd is closed and reset to -1.
+ */
+static bool
+archive_index_read_events(int *fd)
+{
+	union
+	{
+		struct inotify_event event;
+		char		data[ARCHIVE_INDEX_EVENT_BUFFER];
+	}			buf;
+	bool		need_scan = false;
+
+	for (;;)
+	{
+		ssize_t		len;
+		char	   *ptr;
+
+		len = read(*fd, buf.data, sizeof(buf.data));
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			ereport(LOG,
+					(errmsg("could not read inotify events: %m")));
+			close(*fd);
+			*fd = -1;
+			return true;
+		}
+		if (len == 0)
+			break;
+
+		for (ptr = buf.data; ptr < buf.data + len;)
+		{
+			const struct inotify_event *event;
+			ArchiveIndexKey key;
+
+			event = (const struct inotify_event *) ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW)
+				need_scan = true;
+			else if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+			{
+				/* The directory is gone, watch it again */
+				close(*fd);
+				*fd = -1;
+				return true;
+			}
+			else if (event->len > 0 &&
+					 archive_index_parse_name(event->name, &key))
+				archive_index_refresh(&key);
+		}
+	}
+
+	return need_scan;
+}
+#endif							/* HAVE_ARCHIVE_INOTIFY */
+
+/*
+ * Reset the shared state when the worker exits.
+ */
+static void
+archive_index_shutdown(int code, Datum arg)
+{
+	LWLockAcquire(archive_index->lock, LW_EXCLUSIVE);
+	archive_index->pid = 0;
+	archive_index->ready = false;
+	LWLockRelease(archive_index->lock);
+}
+
+/*
+ * archive_index_main
+ *
+ * Main loop of the worker maintaining the index.
+ */
+void
+archive_index_main(Datum main_arg)
+{
+	char	   *path;
+	int			inotify_fd = -1;
+	bool		need_scan = true;
+	TimestampTz last_scan = 0;
+	uint32		wait_event_info;
+
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	path = getenv("PGARCHIVE");
+	if (path == NULL)
+	{
+		ereport(LOG,
+				(errmsg("archive path is not defined, archive index disabled"),
+				 errhint("Check value of environment variable %s",
+						 "PGARCHIVE")));
+		/* No restarts */
+		proc_exit(0);
+	}
+	archive_index_path = pstrdup(path);
+	canonicalize_path(archive_index_path);
+
+	LWLockAcquire(archive_index->lock, LW_EXCLUSIVE);
+	archive_index->pid = MyProcPid;
+	archive_index->ready = false;
+	LWLockRelease(archive_index->lock);
+	before_shmem_exit(archive_index_shutdown, (Datum) 0);
+
+	wait_event_info = WaitEventExtensionNew("wal_utils_archive_index");
+
+	for (;;)
+	{
+		int			events = WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH;
+		long		timeout;
+		int			rc;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+#ifdef HAVE_ARCHIVE_INOTIFY
+		/* The watch needs to be in place before scanning */
+		if (inotify_fd < 0)
+		{
+			inotify_fd = archive_index_watch();
+			need_scan = true;
+		}
+#endif
+
+		if (!need_scan &&
+			TimestampDifferenceExceeds(last_scan, GetCurrentTimestamp(),
+									   archive_index_rescan_interval * 1000))
+			need_scan = true;
+
+		if (need_scan)
+		{
+			need_scan = archive_index_scan();
+			last_scan = GetCurrentTimestamp();
+			if (need_scan)
+				continue;
+		}
+
+		timeout = TimestampDifferenceMilliseconds(GetCurrentTimestamp(),
+												  TimestampTzPlusMilliseconds(last_scan,
+																			  archive_index_rescan_interval * 1000L));
+		if (inotify_fd >= 0)
+			events |= WL_SOCKET_READABLE;
+
+		rc = WaitLatchOrSocket(MyLatch, events, inotify_fd, timeout,
+							   wait_event_info);
+
+		if (rc & WL_LATCH_SET)
+			ResetLatch(MyLatch);
+
+#ifdef HAVE_ARCHIVE_INOTIFY
+		if (rc & WL_SOCKET_READABLE)
+			need_scan = archive_index_read_events(&inotify_fd);
+#endif
+	}
+}
+
+/*
+ * Check that the index can be queried, complaining otherwise.
+ */
+static void
+archive_index_check(bool need_ready)
+{
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to query the archive index"))));
+
+	if (archive_index == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("archive index is not enabled"),
+				 errhint("Load \"%s\" with \"%s\" and set \"%s\".",
+						 "wal_utils", "shared_preload_libraries",
+						 "wal_utils.index_max_files")));
+
+	if (!need_ready)
+		return;
+
+	/* No lock needed, this is only a hint */
+	if (!archive_index->ready)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("archive index is not ready")));
+	if (archive_index->overflow)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("archive index is incomplete"),
+				 errhint("Consider increasing \"%s\".",
+						 "wal_utils.index_max_files")));
+}
+
+static int
+archive_index_entry_cmp(const void *a, const void *b)
+{
+	const ArchiveIndexEntry *ea = (const ArchiveIndexEntry *) a;
+	const ArchiveIndexEntry *eb = (const ArchiveIndexEntry *) b;
+
+	if (ea->key.tli != eb->key.tli)
+		return ea->key.tli < eb->key.tli ? -1 : 1;
+	if (ea->key.segno != eb->key.segno)
+		return ea->key.segno < eb->key.segno ? -1 : 1;
+	return 0;
+}
+
+/*
+ * archive_index_segments
+ *
+ * Return the segments of a timeline present in the archives covering the
+ * range of LSNs given, with their size on disk and their compression.
+ */
+Datum
+archive_index_segments(PG_FUNCTION_ARGS)
+{
+	TimeLineID	tli = PG_GETARG_INT32(0);
+	XLogRecPtr	start_lsn = PG_GETARG_LSN(1);
+	XLogRecPtr	end_lsn = PG_GETARG_LSN(2);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	XLogSegNo	start_segno;
+	XLogSegNo	end_segno;
+	ArchiveIndexEntry *entries;
+	long		nentries = 0;
+	long		maxentries;
+
+	archive_index_check(true);
+
+	if (start_lsn > end_lsn)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("start LSN %X/%X newer than end LSN %X/%X",
+						(uint32) (start_lsn >> 32),
+						(uint32) start_lsn,
+						(uint32) (end_lsn >> 32),
+						(uint32) end_lsn)));
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	XLByteToSeg(start_lsn, start_segno, wal_segment_size);
+	XLByteToSeg(end_lsn, end_segno, wal_segment_size);
+
+	LWLockAcquire(archive_index->lock, LW_SHARED);
+
+	maxentries = hash_get_num_entries(archive_index_hash);
+	if (end_segno - start_segno < (XLogSegNo) maxentries)
+		maxentries = (long) (end_segno - start_segno + 1);
+	entries = (ArchiveIndexEntry *)
+		palloc(sizeof(ArchiveIndexEntry) * Max(maxentries, 1));
+
+	if (end_segno - start_segno < (XLogSegNo) maxentries)
+	{
+		/* Short range, look up each segment */
+		for (XLogSegNo segno = start_segno; segno <= end_segno; segno++)
+		{
+			ArchiveIndexKey key;
+			ArchiveIndexEntry *entry;
+
+			memset(&key, 0, sizeof(ArchiveIndexKey));
+			key.tli = tli;
+			key.segno = segno;
+			entry = (ArchiveIndexEntry *) hash_search(archive_index_hash,
+													  &key, HASH_FIND, NULL);
+			if (entry != NULL)
+				entries[nentries++] = *entry;
+		}
+	}
+	else
+	{
+		HASH_SEQ_STATUS status;
+		ArchiveIndexEntry *entry;
+
+		/* Range wider than the index, scan all of it */
+		hash_seq_init(&status, archive_index_hash);
+		while ((entry = (ArchiveIndexEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (entry->key.tli == tli &&
+				entry->key.segno >= start_segno &&
+				entry->key.segno <= end_segno)
+				entries[nentries++] = *entry;
+		}
+	}
+
+	LWLockRelease(archive_index->lock);
+
+	qsort(entries, nentries, sizeof(ArchiveIndexEntry),
+		  archive_index_entry_cmp);
+
+	for (long i = 0; i < nentries; i++)
+	{
+		ArchiveIndexEntry *entry = &entries[i];
+		char		xlogfname[MAXFNAMELEN];
+		XLogRecPtr	segment_lsn;
+		Datum		values[4];
+		bool		nulls[4] = {0};
+
+		XLogFileName(xlogfname, entry->key.tli, entry->key.segno,
+					 wal_segment_size);
+		XLogSegNoOffsetToRecPtr(entry->key.segno, 0, wal_segment_size,
+								segment_lsn);
+
+		values[0] = CStringGetTextDatum(xlogfname);
+		values[1] = LSNGetDatum(segment_lsn);
+		values[2] = Int64GetDatum(entry->size);
+		values[3] = CStringGetTextDatum(archive_compression_name(entry->compression));
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+							 values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * Summary of a timeline, for archive_index_timelines().
+ */
+typedef struct ArchiveIndexTimeline
+{
+	TimeLineID	tli;			/* hash key, must be first */
+	bool		has_history;
+	int64		history_size;
+	int64		segments;
+	int64		total_size;
+	XLogSegNo	min_segno;
+	XLogSegNo	max_segno;
+} ArchiveIndexTimeline;
+
+static int
+archive_index_timeline_cmp(const void *a, const void *b)
+{
+	const ArchiveIndexTimeline *ta = *(ArchiveIndexTimeline *const *) a;
+	const ArchiveIndexTimeline *tb = *(ArchiveIndexTimeline *const *) b;
+
+	return pg_cmp_u32(ta->tli, tb->tli);
+}
+
+/*
+ * archive_index_timelines
+ *
+ * Return a summary of each timeline present in the archives: its history
+ * file, the number of segments, their total size on disk and the range of
+ * LSNs they cover.
+ */
+Datum
+archive_index_timelines(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASHCTL		info;
+	HTAB	   *timelines;
+	HASH_SEQ_STATUS status;
+	ArchiveIndexEntry *entry;
+	ArchiveIndexTimeline *timeline;
+	ArchiveIndexTimeline **sorted;
+	long		ntimelines = 0;
+
+	archive_index_check(true);
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	info.keysize = sizeof(TimeLineID);
+	info.entrysize = sizeof(ArchiveIndexTimeline);
+	info.hcxt = CurrentMemoryContext;
+	timelines = hash_create("wal_utils archive timelines", 32, &info,
+							HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	LWLockAcquire(archive_index->lock, LW_SHARED);
+	hash_seq_init(&status, archive_index_hash);
+	while ((entry = (ArchiveIndexEntry *) hash_seq_search(&status)) != NULL)
+	{
+		bool		found;
+
+		timeline = (ArchiveIndexTimeline *) hash_search(timelines,
+														&entry->key.tli,
+														HASH_ENTER, &found);
+		if (!found)
+		{
+			timeline->has_history = false;
+			timeline->history_size = 0;
+			timeline->segments = 0;
+			timeline->total_size = 0;
+			timeline->min_segno = PG_UINT64_MAX;
+			timeline->max_segno = 0;
+		}
+
+		if (entry->key.segno == ARCHIVE_INDEX_HISTORY)
+		{
+			timeline->has_history = true;
+			timeline->history_size = entry->size;
+			continue;
+		}
+
+		timeline->segments++;
+		timeline->total_size += entry->size;
+		timeline->min_segno = Min(timeline->min_segno, entry->key.segno);
+		timeline->max_segno = Max(timeline->max_segno, entry->key.segno);
+	}
+	LWLockRelease(archive_index->lock);
+
+	sorted = (ArchiveIndexTimeline **)
+		palloc(sizeof(ArchiveIndexTimeline *) *
+			   Max(hash_get_num_entries(timelines), 1));
+	hash_seq_init(&status, timelines);
+	while ((timeline = (ArchiveIndexTimeline *) hash_seq_search(&status)) != NULL)
+		sorted[ntimelines++] = timeline;
+	qsort(sorted, ntimelines, sizeof(ArchiveIndexTimeline *),
+		  archive_index_timeline_cmp);
+
+	for (long i = 0; i < ntimelines; i++)
+	{
+		Datum		values[6];
+		bool		nulls[6] = {0};
+
+		timeline = sorted[i];
+
+		values[0] = Int32GetDatum(timeline->tli);
+		if (timeline->has_history)
+			values[1] = Int64GetDatum(timeline->history_size);
+		else
+			nulls[1] = true;
+		values[2] = Int64GetDatum(timeline->segments);
+		values[3] = Int64GetDatum(timeline->total_size);
+		if (timeline->segments > 0)
+		{
+			XLogRecPtr	begin_lsn;
+			XLogRecPtr	end_lsn;
+
+			XLogSegNoOffsetToRecPtr(timeline->min_segno, 0,
+									wal_segment_size, begin_lsn);
+			XLogSegNoOffsetToRecPtr(timeline->max_segno + 1, 0,
+									wal_segment_size, end_lsn);
+			values[4] = LSNGetDatum(begin_lsn);
+			values[5] = LSNGetDatum(end_lsn);
+		}
+		else
+		{
+			nulls[4] = true;
+			nulls[5] = true;
+		}
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+							 values, nulls);
+	}
+
+	hash_destroy(timelines);
+
+	return (Datum) 0;
+}
+
+/*
+ * archive_index_status
+ *
+ * Report the state of the index and of its worker.
+ */
+Datum
+archive_index_status(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[6];
+	bool		nulls[6] = {0};
+	pid_t		pid;
+	TimestampTz last_scan;
+
+	archive_index_check(false);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	LWLockAcquire(archive_index->lock, LW_SHARED);
+	pid = archive_index->pid;
+	last_scan = archive_index->last_scan;
+	values[1] = BoolGetDatum(archive_index->ready);
+	values[2] = BoolGetDatum(archive_index->overflow);
+	values[3] = Int64GetDatum(hash_get_num_entries(archive_index_hash));
+	LWLockRelease(archive_index->lock);
+
+	if (pid != 0)
+		values[0] = Int32GetDatum(pid);
+	else
+		nulls[0] = true;
+	values[4] = Int32GetDatum(archive_index_max_files);
+	if (last_scan != 0)
+		values[5] = TimestampTzGetDatum(last_scan);
+	else
+		nulls[5] = true;
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/*
+ * archive_index_init
+ *
+ * Define the parameters of the index, and set up its shared state and
+ * its worker when loaded with shared_preload_libraries.
+ */
+void
+archive_index_init(void)
+{
+	BackgroundWorker worker;
+
+	DefineCustomIntVariable("wal_utils.index_max_files",
+							"Maximum number of files tracked by the archive index.",
+							"The archive index is disabled if 0.",
+							&archive_index_max_files,
+							0, 0, INT_MAX / 2,
+							PGC_POSTMASTER,
+							0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("wal_utils.index_rescan_interval",
+							"Interval between two full scans of the archives by the archive index.",
+							NULL,
+							&archive_index_rescan_interval,
+							300, 1, INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+	MarkGUCPrefixReserved("wal_utils");
+
+	if (!process_shared_preload_libraries_in_progress ||
+		archive_index_max_files == 0)
+		return;
+
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = archive_index_shmem_request;
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = archive_index_shmem_startup;
+
+	MemSet(&worker, 0, sizeof(BackgroundWorker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "wal_utils");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "archive_index_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "wal_utils archive index");
+	snprintf(worker.bgw_type, BGW_MAXLEN, "wal_utils archive index");
+	worker.bgw_restart_time = 10;
+	worker.bgw_main_arg = (Datum) 0;
+	worker.bgw_notify_pid = 0;
+	RegisterBackgroundWorker(&worker);
+}
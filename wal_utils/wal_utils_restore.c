@@ -0,0 +1,859 @@
+/*-------------------------------------------------------------------------
+ *
+ * wal_utils_restore.c
+ *		Bulk restore of files from the archives into a target directory.
+ *
+ * The files to restore are distributed across a set of dynamic background
+ * workers and the backend requesting the restore, like for scans.  Each
+ * file is first copied under a temporary name, using a clone of the file
+ * where the filesystem supports it, copy_file_range() or a plain copy,
+ * compressed files being decompressed on the fly.  The copies are flushed
+ * to disk in batches, each batch being renamed to the final names once
+ * its files are durable, with one flush of the target directory.  The
+ * temporary names include the PID of the process copying the file, so as
+ * concurrent restores into the same target do not write the same files.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  wal_utils/wal_utils_restore.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "portability/instr_time.h"
+#include "storage/fd.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+
+#include "wal_utils.h"
+
+/* Number of files flushed to disk at once */
+#define ARCHIVE_RESTORE_BATCH	16
+
+/* Size of the buffer used for plain copies */
+#define ARCHIVE_RESTORE_BUFFER_SIZE	(128 * 1024)
+
+typedef enum ArchiveRestoreStatus
+{
+	ARCHIVE_RESTORE_PENDING,	/* not copied yet */
+	ARCHIVE_RESTORE_COPIED,		/* copied, not durable yet */
+	ARCHIVE_RESTORE_RENAMED,	/* durable, renamed or being renamed */
+	ARCHIVE_RESTORE_RESTORED,	/* copied and durable */
+	ARCHIVE_RESTORE_SKIPPED,	/* already present in the target */
+	ARCHIVE_RESTORE_MISSING,	/* not found in the archives */
+	ARCHIVE_RESTORE_FAILED,		/* failure while restoring */
+} ArchiveRestoreStatus;
+
+typedef enum ArchiveRestoreMethod
+{
+	ARCHIVE_RESTORE_NONE,
+	ARCHIVE_RESTORE_CLONE,		/* clone of the file */
+	ARCHIVE_RESTORE_COPY_FILE_RANGE,	/* copy_file_range() */
+	ARCHIVE_RESTORE_COPY,		/* read() and write() */
+	ARCHIVE_RESTORE_DECOMPRESS, /* decompression of a compressed file */
+} ArchiveRestoreMethod;
+
+/* File to restore */
+typedef struct ArchiveRestoreFile
+{
+	char		name[MAXFNAMELEN];
+	ArchiveRestoreStatus status;
+	ArchiveRestoreMethod method;
+	pid_t		copier;			/* process copying it, 0 if none yet */
+	int64		size;			/* bytes written */
+	double		elapsed;		/* time spent, in ms */
+	char		error[ARCHIVE_SCAN_ERROR_LEN];
+} ArchiveRestoreFile;
+
+/*
+ * State shared across the processes working on a restore.
+ */
+typedef struct ArchiveRestoreShared
+{
+	char		target[MAXPGPATH];	/* target directory */
+	bool		overwrite;		/* overwrite files in the target? */
+	int			nfiles;			/* number of files to restore */
+	pg_atomic_uint32 next_file; /* next file to restore */
+	ArchiveRestoreFile files[FLEXIBLE_ARRAY_MEMBER];
+} ArchiveRestoreShared;
+
+/*
+ * Resources used while restoring a file, released on failure.
+ */
+typedef struct ArchiveRestoreState
+{
+	ArchiveFile *src;			/* file read, NULL if closed */
+	int			dst_fd;			/* file written, -1 if closed */
+	char		tmp_path[MAXPGPATH];	/* temporary file, "" if none */
+} ArchiveRestoreState;
+
+PG_FUNCTION_INFO_V1(archive_restore_segments);
+
+/*
+ * Build the path of a file in the target directory, temporary or not.  The
+ * temporary path is the one of the process copying the file.
+ */
+static void
+archive_restore_path(ArchiveRestoreShared *shared, ArchiveRestoreFile *file,
+					 bool temporary, char *path)
+{
+	if (temporary)
+		snprintf(path, MAXPGPATH, "%s/%s.%d.tmp", shared->target, file->name,
+				 (int) file->copier);
+	else
+		snprintf(path, MAXPGPATH, "%s/%s", shared->target, file->name);
+}
+
+/*
+ * Write all the data of a buffer.
+ */
+static void
+archive_restore_write(ArchiveRestoreState *state, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t		rc = write(state->dst_fd, buf, len);
+
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write file \"%s\": %m",
+							state->tmp_path)));
+		}
+		buf += rc;
+		len -= rc;
+	}
+}
+
+/*
+ * Copy an uncompressed file, trying first the methods able to share
+ * storage or to avoid copies through user space.
+ */
+static ArchiveRestoreMethod
+archive_restore_copy(ArchiveRestoreState *state, int64 *size)
+{
+	int			src_fd = archive_file_fd(state->src);
+	int64		src_size = archive_file_size(state->src);
+	char	   *buf;
+	int64		offset = 0;
+
+#if defined(__linux__) && defined(FICLONE)
+	if (ioctl(state->dst_fd, FICLONE, src_fd) == 0)
+	{
+		*size = src_size;
+		return ARCHIVE_RESTORE_CLONE;
+	}
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+	{
+		bool		supported = true;
+
+		while (offset < src_size)
+		{
+			ssize_t		rc;
+
+			rc = copy_file_range(src_fd, NULL, state->dst_fd, NULL,
+								 Min(src_size - offset, 1024 * 1024 * 1024),
+								 0);
+			if (rc < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				/* Not supported across these files, switch to a copy */
+				if (offset == 0 &&
+					(errno == EXDEV || errno == ENOSYS ||
+					 errno == EOPNOTSUPP || errno == EINVAL))
+				{
+					supported = false;
+					break;
+				}
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not copy file \"%s\" to \"%s\": %m",
+								archive_file_path(state->src),
+								state->tmp_path)));
+			}
+			if (rc == 0)
+				break;
+			offset += rc;
+		}
+
+		if (supported)
+		{
+			*size = offset;
+			return ARCHIVE_RESTORE_COPY_FILE_RANGE;
+		}
+	}
+#endif
+
+	buf = palloc(ARCHIVE_RESTORE_BUFFER_SIZE);
+	offset = 0;
+	for (;;)
+	{
+		ssize_t		rc;
+
+		rc = archive_file_pread(state->src, buf, ARCHIVE_RESTORE_BUFFER_SIZE,
+								offset);
+		if (rc == 0)
+			break;
+		archive_restore_write(state, buf, rc);
+		offset += rc;
+	}
+	pfree(buf);
+
+	*size = offset;
+	return ARCHIVE_RESTORE_COPY;
+}
+
+/*
+ * Copy a file from the archives under its temporary name in the target.
+ */
+static void
+archive_restore_file(ArchiveRestoreShared *shared, ArchiveRestoreFile *file,
+					 ArchiveRestoreState *state)
+{
+	char	   *src_path = check_and_build_filepath(file->name);
+	char		dst_path[MAXPGPATH];
+	struct stat fst;
+
+	/* Remove the copy left by a worker that exited before renaming it */
+	if (file->copier != 0 && file->copier != MyProcPid)
+	{
+		archive_restore_path(shared, file, true, dst_path);
+		if (unlink(dst_path) < 0 && errno != ENOENT)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", dst_path)));
+	}
+	file->copier = MyProcPid;
+
+	archive_restore_path(shared, file, false, dst_path);
+
+	if (!shared->overwrite && stat(dst_path, &fst) == 0)
+	{
+		file->status = ARCHIVE_RESTORE_SKIPPED;
+		return;
+	}
+
+	if (!archive_file_exists(src_path))
+	{
+		file->status = ARCHIVE_RESTORE_MISSING;
+		return;
+	}
+
+	state->src = archive_file_open(src_path);
+
+	archive_restore_path(shared, file, true, state->tmp_path);
+	state->dst_fd = OpenTransientFile(state->tmp_path,
+									  O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+	if (state->dst_fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", state->tmp_path)));
+
+	if (archive_file_compression(state->src) == ARCHIVE_COMPRESSION_NONE)
+		file->method = archive_restore_copy(state, &file->size);
+	else
+	{
+		char	   *buf = palloc(ARCHIVE_RESTORE_BUFFER_SIZE);
+		int64		offset = 0;
+
+		for (;;)
+		{
+			ssize_t		rc;
+
+			rc = archive_file_pread(state->src, buf,
+									ARCHIVE_RESTORE_BUFFER_SIZE, offset);
+			if (rc == 0)
+				break;
+			archive_restore_write(state, buf, rc);
+			offset += rc;
+		}
+		pfree(buf);
+
+		file->method = ARCHIVE_RESTORE_DECOMPRESS;
+		file->size = offset;
+	}
+
+	/* Start writeback now, the batch flush has less to wait for */
+	pg_flush_data(state->dst_fd, 0, 0);
+
+	if (CloseTransientFile(state->dst_fd) != 0)
+	{
+		state->dst_fd = -1;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m", state->tmp_path)));
+	}
+	state->dst_fd = -1;
+
+	file->status = ARCHIVE_RESTORE_COPIED;
+}
+
+/*
+ * Release the resources used to restore a file.  On failure, the temporary
+ * file is removed as well.
+ */
+static void
+archive_restore_release(ArchiveRestoreState *state, bool failed)
+{
+	if (state->dst_fd >= 0)
+		CloseTransientFile(state->dst_fd);
+	state->dst_fd = -1;
+	if (failed && state->tmp_path[0] != '\0')
+		(void) unlink(state->tmp_path);
+	if (state->src != NULL)
+		archive_file_close(state->src);
+	state->src = NULL;
+}
+
+/*
+ * Copy one file, saving its result.
+ *
+ * In the backend, errors are reported in the result of the file rather
+ * than failing the whole restore, except for query cancellations, trapping
+ * them in a subtransaction so as the resources acquired are released.  The
+ * workers have no transaction, so an error makes them exit instead, leaving
+ * the file pending, to be restored again by the backend.
+ */
+static void
+archive_restore_one(ArchiveRestoreShared *shared, ArchiveRestoreFile *file,
+					MemoryContext restore_context)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(restore_context);
+	ArchiveRestoreState state;
+	instr_time	start;
+	instr_time	duration;
+
+	state.src = NULL;
+	state.dst_fd = -1;
+	state.tmp_path[0] = '\0';
+	INSTR_TIME_SET_CURRENT(start);
+
+	if (!IsTransactionState())
+	{
+		PG_TRY();
+		{
+			archive_restore_file(shared, file, &state);
+		}
+		PG_CATCH();
+		{
+			archive_restore_release(&state, true);
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+
+		archive_restore_release(&state, false);
+	}
+	else
+	{
+		ResourceOwner oldowner = CurrentResourceOwner;
+
+		BeginInternalSubTransaction(NULL);
+		MemoryContextSwitchTo(restore_context);
+
+		PG_TRY();
+		{
+			archive_restore_file(shared, file, &state);
+			archive_restore_release(&state, false);
+
+			ReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(restore_context);
+			CurrentResourceOwner = oldowner;
+		}
+		PG_CATCH();
+		{
+			ErrorData  *edata;
+
+			MemoryContextSwitchTo(restore_context);
+			edata = CopyErrorData();
+			archive_restore_release(&state, true);
+			if (edata->sqlerrcode == ERRCODE_QUERY_CANCELED)
+				PG_RE_THROW();
+			FlushErrorState();
+
+			RollbackAndReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(restore_context);
+			CurrentResourceOwner = oldowner;
+
+			file->status = ARCHIVE_RESTORE_FAILED;
+			strlcpy(file->error, edata->message, ARCHIVE_SCAN_ERROR_LEN);
+		}
+		PG_END_TRY();
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	file->elapsed = INSTR_TIME_GET_MILLISEC(duration);
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(restore_context);
+}
+
+/*
+ * Flush a file or a directory to disk.  Contrary to fsync_fname(), a
+ * failure is never a PANIC, the target directory being outside the data
+ * folder.
+ */
+static void
+archive_restore_fsync(const char *path, bool isdir)
+{
+	int			fd;
+
+	fd = OpenTransientFile(path, (isdir ? O_RDONLY : O_RDWR) | PG_BINARY);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+
+	/* Some platforms do not allow to flush directories */
+	if (pg_fsync(fd) != 0 && !(isdir && (errno == EBADF || errno == EINVAL)))
+	{
+		int			save_errno = errno;
+
+		CloseTransientFile(fd);
+		errno = save_errno;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync file \"%s\": %m", path)));
+	}
+
+	CloseTransientFile(fd);
+}
+
+/*
+ * Make a batch of copied files durable, and give them their final name.
+ */
+static void
+archive_restore_sync_batch(ArchiveRestoreShared *shared, uint32 *batch,
+						   int nbatch)
+{
+	char		tmp_path[MAXPGPATH];
+	char		path[MAXPGPATH];
+
+	for (int i = 0; i < nbatch; i++)
+	{
+		ArchiveRestoreFile *file = &shared->files[batch[i]];
+
+		if (file->status == ARCHIVE_RESTORE_RENAMED)
+			continue;
+		archive_restore_path(shared, file, true, tmp_path);
+		archive_restore_fsync(tmp_path, false);
+	}
+
+	/*
+	 * Files are marked before their rename, so as a file renamed by a worker
+	 * that exits before the end of the batch is known to be restored by
+	 * this call, and not skipped when the backend retries it.
+	 */
+	for (int i = 0; i < nbatch; i++)
+	{
+		ArchiveRestoreFile *file = &shared->files[batch[i]];
+
+		if (file->status == ARCHIVE_RESTORE_RENAMED)
+			continue;
+		file->status = ARCHIVE_RESTORE_RENAMED;
+		archive_restore_path(shared, file, true, tmp_path);
+		archive_restore_path(shared, file, false, path);
+		if (rename(tmp_path, path) < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not rename file \"%s\" to \"%s\": %m",
+							tmp_path, path)));
+	}
+
+	archive_restore_fsync(shared->target, true);
+
+	for (int i = 0; i < nbatch; i++)
+		shared->files[batch[i]].status = ARCHIVE_RESTORE_RESTORED;
+}
+
+/*
+ * Make a batch of copied files durable, with the same handling of errors
+ * as archive_restore_one(), the temporary files of a batch that failed
+ * being removed.
+ */
+static void
+archive_restore_sync(ArchiveRestoreShared *shared, uint32 *batch, int nbatch)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	ResourceOwner oldowner = CurrentResourceOwner;
+	ErrorData  *volatile edata = NULL;
+
+	if (!IsTransactionState())
+	{
+		archive_restore_sync_batch(shared, batch, nbatch);
+		return;
+	}
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		archive_restore_sync_batch(shared, batch, nbatch);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		if (edata->sqlerrcode == ERRCODE_QUERY_CANCELED)
+			PG_RE_THROW();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_END_TRY();
+
+	if (edata == NULL)
+		return;
+
+	for (int i = 0; i < nbatch; i++)
+	{
+		ArchiveRestoreFile *file = &shared->files[batch[i]];
+		char		tmp_path[MAXPGPATH];
+
+		if (file->status == ARCHIVE_RESTORE_RESTORED)
+			continue;
+		file->status = ARCHIVE_RESTORE_FAILED;
+		strlcpy(file->error, edata->message, ARCHIVE_SCAN_ERROR_LEN);
+
+		archive_restore_path(shared, file, true, tmp_path);
+		(void) unlink(tmp_path);
+	}
+	FreeErrorData(edata);
+}
+
+/*
+ * Restore files until there are none left to grab, flushing them in
+ * batches.  Files already restored are skipped.
+ */
+static void
+archive_restore_work(ArchiveRestoreShared *shared)
+{
+	MemoryContext restore_context;
+	uint32		batch[ARCHIVE_RESTORE_BATCH];
+	int			nbatch = 0;
+
+	restore_context = AllocSetContextCreate(CurrentMemoryContext,
+											"wal_utils archive restore",
+											ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		uint32		i = pg_atomic_fetch_add_u32(&shared->next_file, 1);
+		ArchiveRestoreFile *file;
+
+		if (i >= shared->nfiles)
+			break;
+
+		file = &shared->files[i];
+
+		/*
+		 * A file being renamed by a worker that exited is restored if its
+		 * temporary copy is gone, only its directory needing a flush.
+		 * Otherwise, files copied by a worker that exited need to be copied
+		 * again.
+		 */
+		if (file->status == ARCHIVE_RESTORE_RENAMED)
+		{
+			char		tmp_path[MAXPGPATH];
+			struct stat st;
+
+			archive_restore_path(shared, file, true, tmp_path);
+			if (stat(tmp_path, &st) == 0)
+				file->status = ARCHIVE_RESTORE_COPIED;
+		}
+		else if (file->status == ARCHIVE_RESTORE_PENDING ||
+				 file->status == ARCHIVE_RESTORE_COPIED)
+		{
+			file->status = ARCHIVE_RESTORE_PENDING;
+			archive_restore_one(shared, file, restore_context);
+		}
+		else
+			continue;
+
+		if (file->status != ARCHIVE_RESTORE_COPIED &&
+			file->status != ARCHIVE_RESTORE_RENAMED)
+			continue;
+
+		batch[nbatch++] = i;
+		if (nbatch == ARCHIVE_RESTORE_BATCH)
+		{
+			archive_restore_sync(shared, batch, nbatch);
+			nbatch = 0;
+		}
+	}
+
+	if (nbatch > 0)
+		archive_restore_sync(shared, batch, nbatch);
+
+	MemoryContextDelete(restore_context);
+}
+
+/*
+ * Stop the workers from grabbing new files when the backend requesting
+ * the restore goes away.
+ */
+static void
+archive_restore_detach(dsm_segment *seg, Datum arg)
+{
+	ArchiveRestoreShared *shared = (ArchiveRestoreShared *) DatumGetPointer(arg);
+
+	pg_atomic_write_u32(&shared->next_file, shared->nfiles);
+}
+
+/*
+ * archive_restore_main
+ *
+ * Entry point of the dynamic background workers restoring files.
+ */
+void
+archive_restore_main(Datum main_arg)
+{
+	dsm_segment *seg;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "wal_utils archive restore");
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+
+	archive_restore_work((ArchiveRestoreShared *) dsm_segment_address(seg));
+
+	dsm_detach(seg);
+	proc_exit(0);
+}
+
+/*
+ * Status and method of a file, as reported to users.
+ */
+static const char *
+archive_restore_status(ArchiveRestoreStatus status)
+{
+	switch (status)
+	{
+		case ARCHIVE_RESTORE_PENDING:
+		case ARCHIVE_RESTORE_COPIED:
+		case ARCHIVE_RESTORE_RENAMED:
+			return "not restored";
+		case ARCHIVE_RESTORE_RESTORED:
+			return "restored";
+		case ARCHIVE_RESTORE_SKIPPED:
+			return "skipped";
+		case ARCHIVE_RESTORE_MISSING:
+			return "missing";
+		case ARCHIVE_RESTORE_FAILED:
+			return "failed";
+	}
+	return "unknown";			/* keep compiler quiet */
+}
+
+static const char *
+archive_restore_method(ArchiveRestoreMethod method)
+{
+	switch (method)
+	{
+		case ARCHIVE_RESTORE_NONE:
+			return NULL;
+		case ARCHIVE_RESTORE_CLONE:
+			return "clone";
+		case ARCHIVE_RESTORE_COPY_FILE_RANGE:
+			return "copy_file_range";
+		case ARCHIVE_RESTORE_COPY:
+			return "copy";
+		case ARCHIVE_RESTORE_DECOMPRESS:
+			return "decompress";
+	}
+	return NULL;				/* keep compiler quiet */
+}
+
+/*
+ * archive_restore_segments
+ *
+ * Copy a list of segments from the archives, as generated by
+ * archive_build_segment_list(), into a target directory, with the history
+ * files of their timelines.  The files are spread across up to max_workers
+ * background workers.  Returns the status of each file.
+ */
+Datum
+archive_restore_segments(PG_FUNCTION_ARGS)
+{
+	ArrayType  *array = PG_GETARG_ARRAYTYPE_P(0);
+	char	   *target = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	int			max_workers = PG_GETARG_INT32(2);
+	bool		overwrite = PG_GETARG_BOOL(3);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	List	   *segments;
+	List	   *files = NIL;
+	List	   *timelines = NIL;
+	ListCell   *lc;
+	struct stat fst;
+	Size		size;
+	dsm_segment *seg;
+	ArchiveRestoreShared *shared;
+	BackgroundWorkerHandle **handles;
+	int			nworkers;
+	int			nlaunched;
+	int			i = 0;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to read files"))));
+
+	if (max_workers < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of workers cannot be negative")));
+
+	segments = archive_scan_segment_list(array);
+
+	canonicalize_path(target);
+	/* Room for the temporary names, with a PID */
+	if (strlen(target) + MAXFNAMELEN + 16 >= MAXPGPATH)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("target directory path is too long")));
+	if (stat(target, &fst) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not stat directory \"%s\": %m", target)));
+	if (!S_ISDIR(fst.st_mode))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("\"%s\" is not a directory", target)));
+
+	/*
+	 * History files come first, one for each timeline of the segments
+	 * except the initial timeline, which has none.
+	 */
+	foreach(lc, segments)
+	{
+		TimeLineID	tli;
+		XLogSegNo	segno;
+
+		XLogFromFileName((char *) lfirst(lc), &tli, &segno, wal_segment_size);
+		if (tli > 1 && !list_member_oid(timelines, (Oid) tli))
+		{
+			char		histfname[MAXFNAMELEN];
+
+			timelines = lappend_oid(timelines, (Oid) tli);
+			TLHistoryFileName(histfname, tli);
+			files = lappend(files, pstrdup(histfname));
+		}
+	}
+	files = list_concat(files, segments);
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	size = add_size(offsetof(ArchiveRestoreShared, files),
+					mul_size(list_length(files), sizeof(ArchiveRestoreFile)));
+	seg = dsm_create(size, 0);
+	shared = (ArchiveRestoreShared *) dsm_segment_address(seg);
+	memset(shared, 0, size);
+	strlcpy(shared->target, target, MAXPGPATH);
+	shared->overwrite = overwrite;
+	shared->nfiles = list_length(files);
+	pg_atomic_init_u32(&shared->next_file, 0);
+	foreach(lc, files)
+	{
+		ArchiveRestoreFile *file = &shared->files[i++];
+
+		strlcpy(file->name, (char *) lfirst(lc), MAXFNAMELEN);
+		file->status = ARCHIVE_RESTORE_PENDING;
+		file->method = ARCHIVE_RESTORE_NONE;
+	}
+
+	on_dsm_detach(seg, archive_restore_detach, PointerGetDatum(shared));
+
+	/* This backend takes care of one file as well */
+	nworkers = Max(Min(max_workers, shared->nfiles - 1), 0);
+	handles = (BackgroundWorkerHandle **)
+		palloc0(sizeof(BackgroundWorkerHandle *) * Max(nworkers, 1));
+	nlaunched = archive_workers_launch(seg, "archive_restore_main",
+									   "wal_utils archive restore worker",
+									   nworkers, handles);
+
+	elog(DEBUG1, "archive restore of %d files launched %d workers out of %d",
+		 shared->nfiles, nlaunched, nworkers);
+
+	archive_restore_work(shared);
+	archive_workers_wait(handles, nlaunched);
+
+	/* Restore the files left behind by workers terminated early */
+	pg_atomic_write_u32(&shared->next_file, 0);
+	archive_restore_work(shared);
+
+	for (i = 0; i < shared->nfiles; i++)
+	{
+		ArchiveRestoreFile *file = &shared->files[i];
+		const char *method = archive_restore_method(file->method);
+		Datum		values[6];
+		bool		nulls[6] = {0};
+
+		values[0] = CStringGetTextDatum(file->name);
+		values[1] = CStringGetTextDatum(archive_restore_status(file->status));
+		if (file->status == ARCHIVE_RESTORE_RESTORED)
+		{
+			values[2] = Int64GetDatum(file->size);
+			values[4] = Float8GetDatum(file->elapsed);
+		}
+		else
+		{
+			nulls[2] = true;
+			nulls[4] = true;
+		}
+		if (method != NULL && file->status == ARCHIVE_RESTORE_RESTORED)
+			values[3] = CStringGetTextDatum(method);
+		else
+			nulls[3] = true;
+		if (file->error[0] != '\0')
+			values[5] = CStringGetTextDatum(file->error);
+		else
+			nulls[5] = true;
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+							 values, nulls);
+	}
+
+	dsm_detach(seg);
+	pfree(handles);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,696 @@
+/*-------------------------------------------------------------------------
+ *
+ * wal_utils_scan.c
+ *		Scans of archived WAL segments, across dynamic background workers.
+ *
+ * Each segment of a list is scanned independently, reading with an
+ * xlogreader all the records beginning in it, which checks the page
+ * headers, the continuation records and the CRC of each record.  A
+ * record crossing the end of a segment is read from the next segment if
+ * present in the archives.
+ *
+ * The segments are distributed across a set of dynamic background
+ * workers and the backend requesting the scan, which grab the next
+ * segment to scan from a counter in a dynamic shared memory segment where
+ * the result of each segment is stored.
+ *
+ * A scan can also aggregate statistics about the records of a range of
+ * LSNs.  Each process accumulates them in its own area of the shared
+ * memory segment, merged by the backend once all the segments have been
+ * scanned.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  wal_utils/wal_utils_scan.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "access/xlogreader.h"
+#include "access/xlogstats.h"
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "portability/instr_time.h"
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+
+#include "wal_utils.h"
+
+/*
+ * State shared across the processes working on a scan.
+ */
+typedef struct ArchiveScanShared
+{
+	int			nsegments;		/* number of segments to scan */
+	pg_atomic_uint32 next_segment;	/* next segment to scan */
+
+	/* Statistics of records, if collect_stats */
+	bool		collect_stats;
+	XLogRecPtr	start_lsn;		/* records before are not counted */
+	XLogRecPtr	end_lsn;		/* scan stops there, if valid */
+	int			nparticipants;	/* number of statistics areas */
+	pg_atomic_uint32 next_participant;	/* next area to assign */
+	Size		stats_offset;	/* offset of the areas in this segment */
+
+	ArchiveScanSegment segments[FLEXIBLE_ARRAY_MEMBER];
+} ArchiveScanShared;
+
+#define ArchiveScanGetStats(shared, participant) \
+	(((XLogStats *) ((char *) (shared) + (shared)->stats_offset)) + (participant))
+
+/*
+ * Private state of the xlogreader scanning a segment.
+ */
+typedef struct ArchiveScanReader
+{
+	XLogReaderState *reader;	/* NULL if not allocated */
+	XLogRecPtr	segment_start;	/* beginning of the segment scanned */
+	const char *names[2];		/* segment scanned and the next one */
+	ArchiveFile *files[2];		/* files opened, NULL if not yet */
+	bool		end_of_data;	/* reads went past the data available */
+	int64		read_bytes;		/* end of the data read, from segment_start */
+	char	   *error;			/* read failure, NULL if none */
+} ArchiveScanReader;
+
+/*
+ * archive_scan_segment_list
+ *
+ * Build a list of segment names from an array of text, as generated by
+ * archive_build_segment_list(), checking that each name is valid and can
+ * be looked up in the archives.
+ */
+List *
+archive_scan_segment_list(ArrayType *segments)
+{
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	List	   *result = NIL;
+
+	deconstruct_array_builtin(segments, TEXTOID, &elems, &nulls, &nelems);
+
+	for (int i = 0; i < nelems; i++)
+	{
+		char	   *name;
+
+		if (nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("segment list cannot contain NULL values")));
+
+		name = TextDatumGetCString(elems[i]);
+		if (!IsXLogFileName(name))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid WAL segment name \"%s\"", name)));
+
+		result = lappend(result, name);
+	}
+
+	/* Complain early if the archives cannot be accessed */
+	if (result != NIL)
+		pfree(check_and_build_filepath((char *) linitial(result)));
+
+	return result;
+}
+
+/* XLogReader callback, to read a WAL page of the segment or the next one */
+static int
+archive_scan_page_read(XLogReaderState *state, XLogRecPtr targetPagePtr,
+					   int reqLen, XLogRecPtr targetRecPtr, char *readBuf)
+{
+	ArchiveScanReader *private = (ArchiveScanReader *) state->private_data;
+	int			which;
+	int64		offset;
+	size_t		nread = 0;
+
+	if (targetPagePtr < private->segment_start ||
+		targetPagePtr - private->segment_start >= 2 * (uint64) wal_segment_size)
+	{
+		private->end_of_data = true;
+		return -1;
+	}
+
+	which = (targetPagePtr - private->segment_start) / wal_segment_size;
+	offset = (targetPagePtr - private->segment_start) % wal_segment_size;
+
+	if (private->files[which] == NULL)
+	{
+		char	   *filepath;
+
+		filepath = check_and_build_filepath((char *) private->names[which]);
+
+		/* The next segment may not be there, in which case stop */
+		if (which == 1 && !archive_file_exists(filepath))
+		{
+			private->end_of_data = true;
+			return -1;
+		}
+		private->files[which] = archive_file_open(filepath);
+	}
+
+	while (nread < XLOG_BLCKSZ)
+	{
+		ssize_t		rc;
+
+		rc = archive_file_pread(private->files[which], readBuf + nread,
+								XLOG_BLCKSZ - nread, offset + nread);
+		if (rc == 0)
+			break;
+		nread += rc;
+	}
+
+	private->read_bytes = Max(private->read_bytes,
+							  (int64) (targetPagePtr - private->segment_start) + nread);
+
+	if (nread < reqLen)
+	{
+		private->error = psprintf("could not read file \"%s\", offset %lld: read %zu of %d",
+								  private->names[which], (long long) offset,
+								  nread, reqLen);
+		return -1;
+	}
+
+	return (int) nread;
+}
+
+/*
+ * Mark a segment as invalid, with the error reported by the xlogreader or
+ * the failure of the page read callback.
+ */
+static void
+archive_scan_invalid(ArchiveScanSegment *segment, ArchiveScanReader *private,
+					 XLogRecPtr lsn, const char *errormsg)
+{
+	segment->status = ARCHIVE_SCAN_INVALID;
+
+	if (private->error != NULL)
+		strlcpy(segment->error, private->error, ARCHIVE_SCAN_ERROR_LEN);
+	else if (errormsg != NULL)
+		strlcpy(segment->error, errormsg, ARCHIVE_SCAN_ERROR_LEN);
+	else
+		snprintf(segment->error, ARCHIVE_SCAN_ERROR_LEN,
+				 "could not read WAL record at %X/%X",
+				 (uint32) (lsn >> 32), (uint32) lsn);
+}
+
+/*
+ * Add the statistics of src to dst.
+ */
+static void
+archive_scan_merge_stats(XLogStats *dst, XLogStats *src)
+{
+	dst->count += src->count;
+	for (int ri = 0; ri <= RM_MAX_ID; ri++)
+	{
+		dst->rmgr_stats[ri].count += src->rmgr_stats[ri].count;
+		dst->rmgr_stats[ri].rec_len += src->rmgr_stats[ri].rec_len;
+		dst->rmgr_stats[ri].fpi_len += src->rmgr_stats[ri].fpi_len;
+
+		for (int rj = 0; rj < MAX_XLINFO_TYPES; rj++)
+		{
+			dst->record_stats[ri][rj].count += src->record_stats[ri][rj].count;
+			dst->record_stats[ri][rj].rec_len += src->record_stats[ri][rj].rec_len;
+			dst->record_stats[ri][rj].fpi_len += src->record_stats[ri][rj].fpi_len;
+		}
+	}
+}
+
+/*
+ * Read all the records beginning in a segment.  If stats is not NULL, the
+ * statistics of the records in the range of LSNs of the scan are added to
+ * it once the segment has been read completely.  The counters of the
+ * segment are reset first, as a segment left behind by a worker that
+ * exited is scanned again from its beginning.
+ */
+static void
+archive_scan_records(ArchiveScanShared *shared, ArchiveScanSegment *segment,
+					 ArchiveScanReader *private, XLogStats *stats)
+{
+	TimeLineID	tli;
+	XLogSegNo	segno;
+	XLogRecPtr	segment_end;
+	XLogRecPtr	first_record;
+	char	   *errormsg;
+	XLogStats  *segment_stats = NULL;
+
+	segment->records = 0;
+	segment->bytes = 0;
+	segment->end_lsn = InvalidXLogRecPtr;
+	segment->read_bytes = 0;
+	segment->error[0] = '\0';
+
+	if (!archive_file_exists(check_and_build_filepath(segment->name)))
+	{
+		segment->status = ARCHIVE_SCAN_MISSING;
+		return;
+	}
+
+	XLogFromFileName(segment->name, &tli, &segno, wal_segment_size);
+	XLogSegNoOffsetToRecPtr(segno, 0, wal_segment_size,
+							private->segment_start);
+	segment_end = private->segment_start + wal_segment_size;
+	private->names[0] = segment->name;
+	private->names[1] = segment->next_name;
+
+	private->reader = XLogReaderAllocate(wal_segment_size, NULL,
+										 XL_ROUTINE(.page_read = &archive_scan_page_read,
+													.segment_open = NULL,
+													.segment_close = NULL),
+										 private);
+	if (private->reader == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory"),
+				 errdetail("Failed while allocating a WAL reading processor.")));
+
+	/* Skip the continuation of a record from the previous segment */
+	first_record = XLogFindNextRecord(private->reader, private->segment_start,
+									  &errormsg);
+	if (XLogRecPtrIsInvalid(first_record))
+	{
+		/* No record begins in this segment */
+		if (private->end_of_data && private->error == NULL)
+		{
+			segment->status = ARCHIVE_SCAN_VALID;
+			return;
+		}
+
+		archive_scan_invalid(segment, private, private->segment_start,
+							 errormsg);
+		return;
+	}
+
+	XLogBeginRead(private->reader, first_record);
+
+	if (stats != NULL)
+		segment_stats = (XLogStats *) palloc0(sizeof(XLogStats));
+
+	for (;;)
+	{
+		XLogRecord *record;
+
+		CHECK_FOR_INTERRUPTS();
+
+		record = XLogReadRecord(private->reader, &errormsg);
+		if (record == NULL)
+		{
+			/* Last record continuing in a segment not available */
+			if (private->end_of_data && private->error == NULL)
+				break;
+
+			archive_scan_invalid(segment, private,
+								 private->reader->EndRecPtr, errormsg);
+			return;
+		}
+
+		/* Records beginning in the next segment are scanned with it */
+		if (private->reader->ReadRecPtr >= segment_end)
+			break;
+
+		/* Nothing to do past the end of the range scanned */
+		if (!XLogRecPtrIsInvalid(shared->end_lsn) &&
+			private->reader->ReadRecPtr >= shared->end_lsn)
+			break;
+
+		segment->records++;
+		segment->bytes += XLogRecGetTotalLen(private->reader);
+		segment->end_lsn = private->reader->EndRecPtr;
+
+		if (segment_stats != NULL &&
+			private->reader->ReadRecPtr >= shared->start_lsn)
+			XLogRecStoreStats(segment_stats, private->reader);
+	}
+
+	/*
+	 * Statistics are added only for complete segments, so as a segment
+	 * scanned again after the exit of a worker is not counted twice.
+	 */
+	if (segment_stats != NULL)
+		archive_scan_merge_stats(stats, segment_stats);
+
+	segment->status = ARCHIVE_SCAN_VALID;
+}
+
+/*
+ * Release the xlogreader and the files of the scan of a segment.
+ */
+static void
+archive_scan_release(ArchiveScanReader *private)
+{
+	if (private->reader != NULL)
+		XLogReaderFree(private->reader);
+	private->reader = NULL;
+	for (int i = 0; i < lengthof(private->files); i++)
+	{
+		if (private->files[i] != NULL)
+			archive_file_close(private->files[i]);
+		private->files[i] = NULL;
+	}
+}
+
+/*
+ * Scan one segment, saving its result.
+ *
+ * In the backend, errors are reported in the result of the segment rather
+ * than failing the whole scan, except for query cancellations, trapping
+ * them in a subtransaction so as the resources acquired are released.
+ * The workers have no transaction, so an error makes them exit instead,
+ * leaving the segment pending, to be scanned again by the backend.
+ */
+static void
+archive_scan_one(ArchiveScanShared *shared, ArchiveScanSegment *segment,
+				 XLogStats *stats, MemoryContext scan_context)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(scan_context);
+	ArchiveScanReader private;
+	instr_time	start;
+	instr_time	duration;
+
+	memset(&private, 0, sizeof(ArchiveScanReader));
+	INSTR_TIME_SET_CURRENT(start);
+
+	if (!IsTransactionState())
+	{
+		archive_scan_records(shared, segment, &private, stats);
+		archive_scan_release(&private);
+	}
+	else
+	{
+		ResourceOwner oldowner = CurrentResourceOwner;
+
+		BeginInternalSubTransaction(NULL);
+		MemoryContextSwitchTo(scan_context);
+
+		PG_TRY();
+		{
+			archive_scan_records(shared, segment, &private, stats);
+			archive_scan_release(&private);
+
+			ReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(scan_context);
+			CurrentResourceOwner = oldowner;
+		}
+		PG_CATCH();
+		{
+			ErrorData  *edata;
+
+			MemoryContextSwitchTo(scan_context);
+			edata = CopyErrorData();
+			if (edata->sqlerrcode == ERRCODE_QUERY_CANCELED)
+				PG_RE_THROW();
+			FlushErrorState();
+
+			archive_scan_release(&private);
+			RollbackAndReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(scan_context);
+			CurrentResourceOwner = oldowner;
+
+			segment->status = ARCHIVE_SCAN_INVALID;
+			strlcpy(segment->error, edata->message, ARCHIVE_SCAN_ERROR_LEN);
+		}
+		PG_END_TRY();
+	}
+
+	segment->read_bytes = private.read_bytes;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	segment->elapsed = INSTR_TIME_GET_MILLISEC(duration);
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(scan_context);
+}
+
+/*
+ * Scan segments until there are none left to grab.  Segments already
+ * scanned are skipped.  participant is the statistics area of the process.
+ */
+static void
+archive_scan_work(ArchiveScanShared *shared, int participant)
+{
+	MemoryContext scan_context;
+	XLogStats  *stats = NULL;
+
+	if (shared->collect_stats)
+		stats = ArchiveScanGetStats(shared, participant);
+
+	scan_context = AllocSetContextCreate(CurrentMemoryContext,
+										 "wal_utils archive scan",
+										 ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		uint32		i = pg_atomic_fetch_add_u32(&shared->next_segment, 1);
+
+		if (i >= shared->nsegments)
+			break;
+
+		if (shared->segments[i].status == ARCHIVE_SCAN_PENDING)
+			archive_scan_one(shared, &shared->segments[i], stats,
+							 scan_context);
+	}
+
+	MemoryContextDelete(scan_context);
+}
+
+/*
+ * archive_workers_launch
+ *
+ * Launch up to nworkers dynamic background workers running function_name
+ * of this library, with the DSM segment given as argument.  Returns the
+ * number of workers launched, whose handles are stored in handles, as
+ * the caller can go on with fewer workers than requested, if any.
+ */
+int
+archive_workers_launch(dsm_segment *seg, const char *function_name,
+					   const char *type, int nworkers,
+					   BackgroundWorkerHandle **handles)
+{
+	int			nlaunched = 0;
+
+	for (int i = 0; i < nworkers; i++)
+	{
+		BackgroundWorker worker;
+
+		memset(&worker, 0, sizeof(BackgroundWorker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		snprintf(worker.bgw_library_name, BGW_MAXLEN, "wal_utils");
+		snprintf(worker.bgw_function_name, BGW_MAXLEN, "%s", function_name);
+		snprintf(worker.bgw_name, BGW_MAXLEN, "%s for PID %d",
+				 type, MyProcPid);
+		snprintf(worker.bgw_type, BGW_MAXLEN, "%s", type);
+		worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+		worker.bgw_notify_pid = MyProcPid;
+
+		if (!RegisterDynamicBackgroundWorker(&worker, &handles[nlaunched]))
+			break;
+		nlaunched++;
+	}
+
+	return nlaunched;
+}
+
+/*
+ * archive_workers_wait
+ *
+ * Wait for the exit of the workers launched with archive_workers_launch().
+ */
+void
+archive_workers_wait(BackgroundWorkerHandle **handles, int nworkers)
+{
+	for (int i = 0; i < nworkers; i++)
+	{
+		if (WaitForBackgroundWorkerShutdown(handles[i]) == BGWH_POSTMASTER_DIED)
+			ereport(ERROR,
+					(errcode(ERRCODE_ADMIN_SHUTDOWN),
+					 errmsg("postmaster exited during archive operation")));
+	}
+}
+
+/*
+ * Stop the workers from grabbing new segments when the backend requesting
+ * the scan goes away, on error for example.
+ */
+static void
+archive_scan_detach(dsm_segment *seg, Datum arg)
+{
+	ArchiveScanShared *shared = (ArchiveScanShared *) DatumGetPointer(arg);
+
+	pg_atomic_write_u32(&shared->next_segment, shared->nsegments);
+}
+
+/*
+ * archive_scan_run
+ *
+ * Scan a list of segments using up to max_workers dynamic background
+ * workers in addition to the current backend, returning an array with the
+ * result of each segment, in the order of the list.
+ *
+ * Records are read up to end_lsn if valid.  If stats is not NULL, the
+ * statistics of the records beginning between start_lsn and end_lsn are
+ * added to it.
+ */
+ArchiveScanSegment *
+archive_scan_run(List *segments, int max_workers, XLogRecPtr start_lsn,
+				 XLogRecPtr end_lsn, XLogStats *stats)
+{
+	int			nsegments = list_length(segments);
+	Size		size;
+	dsm_segment *seg;
+	ArchiveScanShared *shared;
+	BackgroundWorkerHandle **handles;
+	int			nworkers;
+	int			nlaunched = 0;
+	Size		stats_offset;
+	uint32		participant;
+	ArchiveScanSegment *result;
+	ListCell   *lc;
+	int			i = 0;
+
+	/* This backend takes care of one segment as well */
+	nworkers = Max(Min(max_workers, nsegments - 1), 0);
+
+	size = add_size(offsetof(ArchiveScanShared, segments),
+					mul_size(nsegments, sizeof(ArchiveScanSegment)));
+	size = MAXALIGN(size);
+	stats_offset = size;
+	if (stats != NULL)
+		size = add_size(size, mul_size(nworkers + 1, sizeof(XLogStats)));
+
+	seg = dsm_create(size, 0);
+	shared = (ArchiveScanShared *) dsm_segment_address(seg);
+	memset(shared, 0, size);
+	shared->nsegments = nsegments;
+	pg_atomic_init_u32(&shared->next_segment, 0);
+	shared->collect_stats = (stats != NULL);
+	shared->start_lsn = start_lsn;
+	shared->end_lsn = end_lsn;
+	shared->nparticipants = nworkers + 1;
+	pg_atomic_init_u32(&shared->next_participant, 0);
+	shared->stats_offset = stats_offset;
+
+	/* The first statistics area is the one of this backend */
+	participant = pg_atomic_fetch_add_u32(&shared->next_participant, 1);
+
+	foreach(lc, segments)
+	{
+		ArchiveScanSegment *segment = &shared->segments[i++];
+
+		strlcpy(segment->name, (char *) lfirst(lc), MAXFNAMELEN);
+		segment->status = ARCHIVE_SCAN_PENDING;
+		segment->end_lsn = InvalidXLogRecPtr;
+	}
+
+	/*
+	 * Records crossing the end of a segment continue in the next one of the
+	 * list if it follows it, like at a timeline switch, or in the next one
+	 * on the same timeline.
+	 */
+	for (i = 0; i < nsegments; i++)
+	{
+		ArchiveScanSegment *segment = &shared->segments[i];
+		TimeLineID	tli;
+		XLogSegNo	segno;
+
+		XLogFromFileName(segment->name, &tli, &segno, wal_segment_size);
+
+		if (i + 1 < nsegments)
+		{
+			TimeLineID	next_tli;
+			XLogSegNo	next_segno;
+
+			XLogFromFileName(shared->segments[i + 1].name, &next_tli,
+							 &next_segno, wal_segment_size);
+			if (next_segno == segno + 1)
+			{
+				strlcpy(segment->next_name, shared->segments[i + 1].name,
+						MAXFNAMELEN);
+				continue;
+			}
+		}
+
+		XLogFileName(segment->next_name, tli, segno + 1, wal_segment_size);
+	}
+
+	on_dsm_detach(seg, archive_scan_detach, PointerGetDatum(shared));
+
+	handles = (BackgroundWorkerHandle **)
+		palloc0(sizeof(BackgroundWorkerHandle *) * Max(nworkers, 1));
+	nlaunched = archive_workers_launch(seg, "archive_scan_main",
+									   "wal_utils archive scan worker",
+									   nworkers, handles);
+
+	elog(DEBUG1, "archive scan of %d segments launched %d workers out of %d",
+		 nsegments, nlaunched, nworkers);
+
+	archive_scan_work(shared, participant);
+
+	archive_workers_wait(handles, nlaunched);
+
+	/* Scan the segments left behind by workers terminated early */
+	pg_atomic_write_u32(&shared->next_segment, 0);
+	archive_scan_work(shared, participant);
+
+	if (stats != NULL)
+	{
+		for (i = 0; i < shared->nparticipants; i++)
+			archive_scan_merge_stats(stats, ArchiveScanGetStats(shared, i));
+	}
+
+	result = (ArchiveScanSegment *)
+		palloc(sizeof(ArchiveScanSegment) * Max(nsegments, 1));
+	memcpy(result, shared->segments, sizeof(ArchiveScanSegment) * nsegments);
+
+	dsm_detach(seg);
+	pfree(handles);
+
+	return result;
+}
+
+/*
+ * archive_scan_main
+ *
+ * Entry point of the dynamic background workers scanning segments.
+ */
+void
+archive_scan_main(Datum main_arg)
+{
+	dsm_segment *seg;
+	ArchiveScanShared *shared;
+	uint32		participant;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "wal_utils archive scan");
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+
+	shared = (ArchiveScanShared *) dsm_segment_address(seg);
+
+	/* Workers are never more than the statistics areas */
+	participant = pg_atomic_fetch_add_u32(&shared->next_participant, 1);
+	Assert(participant < shared->nparticipants);
+
+	archive_scan_work(shared, participant);
+
+	dsm_detach(seg);
+	proc_exit(0);
+}
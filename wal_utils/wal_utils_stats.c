@@ -0,0 +1,216 @@
+/*-------------------------------------------------------------------------
+ *
+ * wal_utils_stats.c
+ *		Statistics about the WAL records stored in the archives.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  wal_utils/wal_utils_stats.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "access/xlogstats.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/pg_lsn.h"
+
+#include "wal_utils.h"
+
+PG_FUNCTION_INFO_V1(archive_wal_stats);
+
+/*
+ * Fill in a row of archive_wal_stats(), with the percentages of each
+ * value compared to its total.
+ */
+static void
+archive_wal_stats_row(ReturnSetInfo *rsinfo, const char *name,
+					  uint64 n, uint64 total_count,
+					  uint64 rec_len, uint64 total_rec_len,
+					  uint64 fpi_len, uint64 total_fpi_len,
+					  uint64 tot_len, uint64 total_len)
+{
+	Datum		values[9];
+	bool		nulls[9] = {0};
+	double		n_pct = 0;
+	double		rec_len_pct = 0;
+	double		fpi_len_pct = 0;
+	double		tot_len_pct = 0;
+
+	if (total_count != 0)
+		n_pct = 100 * (double) n / total_count;
+	if (total_rec_len != 0)
+		rec_len_pct = 100 * (double) rec_len / total_rec_len;
+	if (total_fpi_len != 0)
+		fpi_len_pct = 100 * (double) fpi_len / total_fpi_len;
+	if (total_len != 0)
+		tot_len_pct = 100 * (double) tot_len / total_len;
+
+	values[0] = CStringGetTextDatum(name);
+	values[1] = Int64GetDatum(n);
+	values[2] = Float8GetDatum(n_pct);
+	values[3] = Int64GetDatum(rec_len);
+	values[4] = Float8GetDatum(rec_len_pct);
+	values[5] = Int64GetDatum(fpi_len);
+	values[6] = Float8GetDatum(fpi_len_pct);
+	values[7] = Int64GetDatum(tot_len);
+	values[8] = Float8GetDatum(tot_len_pct);
+
+	tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+}
+
+/*
+ * archive_wal_stats
+ *
+ * Taking in input the same origin and target data as
+ * archive_build_segment_list(), scan the archived segments between the
+ * origin LSN and the target LSN and return statistics about their records
+ * like pg_waldump --stats, per resource manager or per record type if
+ * per_record is true.  The segments are spread across up to max_workers
+ * background workers.
+ */
+Datum
+archive_wal_stats(PG_FUNCTION_ARGS)
+{
+	TimeLineID	origin_tli;
+	XLogRecPtr	origin_lsn;
+	TimeLineID	target_tli;
+	XLogRecPtr	target_lsn;
+	char	   *history_buf;
+	bool		per_record;
+	int			max_workers;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	List	   *segments;
+	ListCell   *lc;
+	ArchiveScanSegment *results;
+	XLogStats  *stats;
+	uint64		total_count = 0;
+	uint64		total_rec_len = 0;
+	uint64		total_fpi_len = 0;
+	uint64		total_len;
+	int			i = 0;
+
+	/* Sanity checks for arguments */
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) ||
+		PG_ARGISNULL(2) || PG_ARGISNULL(3))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("origin or target data cannot be NULL")));
+	if (PG_ARGISNULL(5) || PG_ARGISNULL(6))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("per_record and max_workers cannot be NULL")));
+
+	origin_tli = PG_GETARG_INT32(0);
+	origin_lsn = PG_GETARG_LSN(1);
+	target_tli = PG_GETARG_INT32(2);
+	target_lsn = PG_GETARG_LSN(3);
+	history_buf = PG_ARGISNULL(4) ? NULL :
+		TextDatumGetCString(PG_GETARG_DATUM(4));
+	per_record = PG_GETARG_BOOL(5);
+	max_workers = PG_GETARG_INT32(6);
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to read files"))));
+
+	if (max_workers < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of workers cannot be negative")));
+
+	segments = archive_segment_list(origin_tli, origin_lsn,
+									target_tli, target_lsn,
+									history_buf);
+
+	/* Complain early if the archives cannot be accessed */
+	pfree(check_and_build_filepath((char *) linitial(segments)));
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	stats = (XLogStats *) palloc0(sizeof(XLogStats));
+	results = archive_scan_run(segments, max_workers, origin_lsn,
+							   target_lsn, stats);
+
+	/* Statistics are only reliable if all the segments could be read */
+	foreach(lc, segments)
+	{
+		ArchiveScanSegment *segment = &results[i++];
+
+		if (segment->status == ARCHIVE_SCAN_MISSING)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FILE),
+					 errmsg("segment \"%s\" not found in the archives",
+							segment->name)));
+		if (segment->status != ARCHIVE_SCAN_VALID)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("could not read segment \"%s\": %s",
+							segment->name, segment->error)));
+	}
+
+	for (int ri = 0; ri <= RM_MAX_ID; ri++)
+	{
+		total_count += stats->rmgr_stats[ri].count;
+		total_rec_len += stats->rmgr_stats[ri].rec_len;
+		total_fpi_len += stats->rmgr_stats[ri].fpi_len;
+	}
+	total_len = total_rec_len + total_fpi_len;
+
+	for (int ri = 0; ri <= RM_MAX_ID; ri++)
+	{
+		RmgrData	desc;
+
+		if (!RmgrIdIsValid(ri) || !RmgrIdExists(ri))
+			continue;
+
+		desc = GetRmgr(ri);
+
+		if (per_record)
+		{
+			for (int rj = 0; rj < MAX_XLINFO_TYPES; rj++)
+			{
+				XLogRecStats *rstats = &stats->record_stats[ri][rj];
+				const char *id;
+
+				/* Skip undefined combinations and ones that did not occur */
+				if (rstats->count == 0)
+					continue;
+
+				/* the upper four bits in xl_info are the rmgr's */
+				id = desc.rm_identify(rj << 4);
+				if (id == NULL)
+					id = psprintf("UNKNOWN (%x)", rj << 4);
+
+				archive_wal_stats_row(rsinfo,
+									  psprintf("%s/%s", desc.rm_name, id),
+									  rstats->count, total_count,
+									  rstats->rec_len, total_rec_len,
+									  rstats->fpi_len, total_fpi_len,
+									  rstats->rec_len + rstats->fpi_len,
+									  total_len);
+			}
+		}
+		else
+		{
+			XLogRecStats *rstats = &stats->rmgr_stats[ri];
+
+			archive_wal_stats_row(rsinfo, desc.rm_name,
+								  rstats->count, total_count,
+								  rstats->rec_len, total_rec_len,
+								  rstats->fpi_len, total_fpi_len,
+								  rstats->rec_len + rstats->fpi_len,
+								  total_len);
+		}
+	}
+
+	return (Datum) 0;
+}
@@ -0,0 +1,127 @@
+/*-------------------------------------------------------------------------
+ *
+ * wal_utils_verify.c
+ *		Verification of the WAL segments stored in the archives.
+ *
+ * Copyright (c) 1996-2026, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  wal_utils/wal_utils_verify.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/xlog.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/pg_lsn.h"
+
+#include "wal_utils.h"
+
+PG_FUNCTION_INFO_V1(archive_verify_segments);
+
+/*
+ * Status of a segment, as reported to users.
+ */
+static const char *
+archive_verify_status(ArchiveScanStatus status)
+{
+	switch (status)
+	{
+		case ARCHIVE_SCAN_PENDING:
+			return "not verified";
+		case ARCHIVE_SCAN_VALID:
+			return "valid";
+		case ARCHIVE_SCAN_INVALID:
+			return "invalid";
+		case ARCHIVE_SCAN_MISSING:
+			return "missing";
+	}
+	return "unknown";			/* keep compiler quiet */
+}
+
+/*
+ * archive_verify_segments
+ *
+ * Verify a list of segments in the archives, as generated by
+ * archive_build_segment_list(), reading all their records to check their
+ * page headers, continuation records and CRCs.  The segments are spread
+ * across up to max_workers background workers.  Returns the status of
+ * each segment with the records read and the throughput of the read.
+ */
+Datum
+archive_verify_segments(PG_FUNCTION_ARGS)
+{
+	ArrayType  *array = PG_GETARG_ARRAYTYPE_P(0);
+	int			max_workers = PG_GETARG_INT32(1);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	List	   *segments;
+	int			nsegments;
+	ArchiveScanSegment *results;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to read files"))));
+
+	if (max_workers < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of workers cannot be negative")));
+
+	segments = archive_scan_segment_list(array);
+	nsegments = list_length(segments);
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	results = archive_scan_run(segments, max_workers, InvalidXLogRecPtr,
+							   InvalidXLogRecPtr, NULL);
+
+	for (int i = 0; i < nsegments; i++)
+	{
+		ArchiveScanSegment *segment = &results[i];
+		Datum		values[8];
+		bool		nulls[8] = {0};
+
+		values[0] = CStringGetTextDatum(segment->name);
+		values[1] = CStringGetTextDatum(archive_verify_status(segment->status));
+
+		if (segment->status == ARCHIVE_SCAN_VALID ||
+			segment->status == ARCHIVE_SCAN_INVALID)
+		{
+			values[2] = Int64GetDatum(segment->records);
+			values[3] = Int64GetDatum(segment->bytes);
+			if (XLogRecPtrIsInvalid(segment->end_lsn))
+				nulls[4] = true;
+			else
+				values[4] = LSNGetDatum(segment->end_lsn);
+			values[5] = Float8GetDatum(segment->elapsed);
+
+			/* Throughput in MB of WAL read per second */
+			if (segment->elapsed > 0)
+				values[6] = Float8GetDatum(((double) segment->read_bytes / (1024 * 1024)) /
+										   (segment->elapsed / 1000.0));
+			else
+				nulls[6] = true;
+		}
+		else
+		{
+			for (int j = 2; j <= 6; j++)
+				nulls[j] = true;
+		}
+
+		if (segment->error[0] != '\0')
+			values[7] = CStringGetTextDatum(segment->error);
+		else
+			nulls[7] = true;
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+							 values, nulls);
+	}
+
+	return (Datum) 0;
+}